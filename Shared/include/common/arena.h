@@ -0,0 +1,485 @@
+// arena.h: Slab arena for host tensor buffers.
+//
+
+#ifndef TENSORRT_ARENA_H
+#define TENSORRT_ARENA_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#ifdef _MSC_VER
+#include <malloc.h>
+#else
+#include <sys/mman.h>
+#endif
+
+namespace samplesCommon
+{
+
+//!
+//! \brief Alignment of every carve out of an arena, a cache line and an AVX-512 register.
+//!
+constexpr size_t kArenaAlignment = 64;
+
+inline size_t arenaAlign(size_t bytes)
+{
+    return (bytes + kArenaAlignment - 1) & ~(kArenaAlignment - 1);
+}
+
+//!
+//! \brief How the pool backs its slabs.
+//!
+enum class HugePageMode
+{
+    kNone,        //!< Regular pages.
+    kTransparent, //!< 2 MiB chunks advised with MADV_HUGEPAGE.
+    kExplicit,    //!< 2 MiB chunks mapped with MAP_HUGETLB, falls back to kTransparent if none are reserved.
+};
+
+//!
+//! \brief A contiguous 64-byte aligned block the bindings of one context are carved from.
+//!
+//! \details Carving is a pointer bump and is not thread-safe: a slab belongs to one context. Memory is only
+//!          given back when the whole slab is released to its pool.
+//!
+class ArenaSlab
+{
+public:
+    ArenaSlab(void* base, size_t capacity)
+        : mBase(static_cast<char*>(base))
+        , mCapacity(capacity)
+    {
+    }
+
+    //!
+    //! \brief Returns nullptr if the slab is exhausted.
+    //!
+    void* carve(size_t bytes)
+    {
+        const size_t aligned = arenaAlign(bytes);
+        if (aligned > mCapacity - mUsed)
+        {
+            return nullptr;
+        }
+        void* ptr = mBase + mUsed;
+        mUsed += aligned;
+        return ptr;
+    }
+
+    bool owns(const void* ptr) const
+    {
+        const char* p = static_cast<const char*>(ptr);
+        return p >= mBase && p < mBase + mCapacity;
+    }
+
+    void* base() const { return mBase; }
+
+    size_t capacity() const { return mCapacity; }
+
+    size_t used() const { return mUsed; }
+
+private:
+    friend class ArenaPool;
+
+    char* mBase;
+    size_t mCapacity;
+    size_t mUsed{0};
+    ArenaSlab* mNextFree{nullptr}; //!< Link of the pool's list of unused slab objects.
+};
+
+//!
+//! \brief Process-wide pool of arena slabs.
+//!
+//! \details Requests are rounded up to a power of two size class (at least one page). Released slabs go back
+//!          to the free list of their class, so opening and closing streams of the same model does not map
+//!          memory after the first session. With huge pages on, classes below 2 MiB are split from 2 MiB
+//!          chunks, so the bindings of many small contexts share one TLB entry. The ArenaSlab objects and the
+//!          control blocks of their shared_ptr are pooled as well, so a warm pool hands out slabs without a
+//!          heap allocation.
+//!
+class ArenaPool
+{
+public:
+    static constexpr size_t kPageBytes = 4096;
+    static constexpr size_t kHugePageBytes = 2 << 20;
+
+    struct Stats
+    {
+        size_t mappedBytes;  //!< Bytes mapped from the OS, live or pooled.
+        size_t pooledBytes;  //!< Bytes sitting in the free lists.
+        size_t acquires;     //!< Slabs handed out.
+        size_t reuses;       //!< Slabs handed out from a free list.
+    };
+
+    //!
+    //! \brief The pool lives until process exit and is never destroyed, slabs may outlive static objects.
+    //!
+    static ArenaPool& instance()
+    {
+        static ArenaPool* pool = new ArenaPool();
+        return *pool;
+    }
+
+    //!
+    //! \brief Affects slabs mapped from now on, pooled ones keep their backing.
+    //!
+    void setHugePages(HugePageMode mode)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mMode = mode;
+    }
+
+    HugePageMode hugePages() const
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        return mMode;
+    }
+
+    //!
+    //! \brief Get a slab of at least bytes. Dropping the last reference returns it to the pool.
+    //!        Returns nullptr if the OS refuses the mapping.
+    //!
+    std::shared_ptr<ArenaSlab> acquire(size_t bytes)
+    {
+        const size_t sizeClass = classOf(bytes);
+        void* base = nullptr;
+        ArenaSlab* slab = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            auto& freeList = mFree[sizeClass];
+            if (!freeList.empty())
+            {
+                base = freeList.back();
+                freeList.pop_back();
+                mStats.pooledBytes -= sizeClass;
+                ++mStats.reuses;
+            }
+            else
+            {
+                base = mapClass(sizeClass);
+            }
+            if (!base)
+            {
+                return nullptr;
+            }
+            ++mStats.acquires;
+            if (mFreeSlabs)
+            {
+                slab = mFreeSlabs;
+                mFreeSlabs = slab->mNextFree;
+                slab->mBase = static_cast<char*>(base);
+                slab->mCapacity = sizeClass;
+                slab->mUsed = 0;
+                slab->mNextFree = nullptr;
+            }
+        }
+        if (!slab)
+        {
+            slab = new ArenaSlab(base, sizeClass);
+        }
+        return std::shared_ptr<ArenaSlab>(
+            slab, [this](ArenaSlab* released) { release(released); }, BlockAllocator<ArenaSlab>(this));
+    }
+
+    //!
+    //! \brief Unmap pooled slabs that own their mapping. Slabs split from a huge page chunk stay pooled.
+    //!
+    void trim()
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        for (auto& entry : mFree)
+        {
+            auto& freeList = entry.second;
+            for (auto it = freeList.begin(); it != freeList.end();)
+            {
+                auto mapping = mMappings.find(*it);
+                if (mapping == mMappings.end())
+                {
+                    ++it;
+                    continue;
+                }
+                unmap(*it, mapping->second);
+                mStats.mappedBytes -= mapping->second;
+                mStats.pooledBytes -= entry.first;
+                mMappings.erase(mapping);
+                it = freeList.erase(it);
+            }
+        }
+    }
+
+    Stats stats() const
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        return mStats;
+    }
+
+private:
+    //!
+    //! \brief Allocates the shared_ptr control blocks of acquire() from the pool's free list of blocks.
+    //!
+    template <typename T>
+    class BlockAllocator
+    {
+    public:
+        using value_type = T;
+
+        explicit BlockAllocator(ArenaPool* pool)
+            : mPool(pool)
+        {
+        }
+
+        template <typename U>
+        BlockAllocator(const BlockAllocator<U>& other)
+            : mPool(other.mPool)
+        {
+        }
+
+        T* allocate(size_t count) { return static_cast<T*>(mPool->allocateBlock(count * sizeof(T))); }
+
+        void deallocate(T* ptr, size_t count) { mPool->freeBlock(ptr, count * sizeof(T)); }
+
+        template <typename U>
+        bool operator==(const BlockAllocator<U>& other) const
+        {
+            return mPool == other.mPool;
+        }
+
+        template <typename U>
+        bool operator!=(const BlockAllocator<U>& other) const
+        {
+            return mPool != other.mPool;
+        }
+
+    private:
+        template <typename U>
+        friend class BlockAllocator;
+
+        ArenaPool* mPool;
+    };
+
+    //!
+    //! \brief Room for a control block with a pointer-sized deleter and allocator, larger ones use the heap.
+    //!
+    static constexpr size_t kBlockBytes = 64;
+
+    struct FreeBlock
+    {
+        FreeBlock* next;
+    };
+
+    ArenaPool() = default;
+
+    void* allocateBlock(size_t bytes)
+    {
+        if (bytes > kBlockBytes)
+        {
+            return ::operator new(bytes);
+        }
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            if (mFreeBlocks)
+            {
+                FreeBlock* block = mFreeBlocks;
+                mFreeBlocks = block->next;
+                return block;
+            }
+        }
+        return ::operator new(kBlockBytes);
+    }
+
+    void freeBlock(void* ptr, size_t bytes)
+    {
+        if (bytes > kBlockBytes)
+        {
+            ::operator delete(ptr);
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mMutex);
+        mFreeBlocks = new (ptr) FreeBlock{mFreeBlocks};
+    }
+
+    static size_t classOf(size_t bytes)
+    {
+        size_t sizeClass = kPageBytes;
+        while (sizeClass < bytes)
+        {
+            sizeClass <<= 1;
+        }
+        return sizeClass;
+    }
+
+    void release(ArenaSlab* slab)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mFree[slab->capacity()].push_back(slab->base());
+        mStats.pooledBytes += slab->capacity();
+        slab->mNextFree = mFreeSlabs;
+        mFreeSlabs = slab;
+    }
+
+    // Called with the mutex held.
+    void* mapClass(size_t sizeClass)
+    {
+        if (mMode == HugePageMode::kNone || sizeClass >= kHugePageBytes)
+        {
+            const size_t bytes = mMode == HugePageMode::kNone ? sizeClass : roundUp(sizeClass, kHugePageBytes);
+            void* base = map(bytes);
+            if (base)
+            {
+                mMappings.emplace(base, bytes);
+                mStats.mappedBytes += bytes;
+            }
+            return base;
+        }
+
+        // Split a huge page chunk into slabs of this class, keep the first and pool the rest.
+        char* chunk = static_cast<char*>(map(kHugePageBytes));
+        if (!chunk)
+        {
+            return nullptr;
+        }
+        mStats.mappedBytes += kHugePageBytes;
+        auto& freeList = mFree[sizeClass];
+        for (size_t offset = sizeClass; offset < kHugePageBytes; offset += sizeClass)
+        {
+            freeList.push_back(chunk + offset);
+            mStats.pooledBytes += sizeClass;
+        }
+        return chunk;
+    }
+
+    // Called with the mutex held.
+    void* map(size_t bytes)
+    {
+#ifdef _MSC_VER
+        return _aligned_malloc(bytes, kPageBytes);
+#else
+        void* base = MAP_FAILED;
+#ifdef MAP_HUGETLB
+        if (mMode == HugePageMode::kExplicit)
+        {
+            base = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (base == MAP_FAILED)
+            {
+                std::cout << "Warning: no explicit huge pages available, using transparent huge pages." << std::endl;
+                mMode = HugePageMode::kTransparent;
+            }
+        }
+#endif
+        if (base == MAP_FAILED)
+        {
+            base = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        }
+        if (base == MAP_FAILED)
+        {
+            std::cerr << "Error: failed to map " << bytes << " bytes for the tensor arena." << std::endl;
+            return nullptr;
+        }
+#ifdef MADV_HUGEPAGE
+        if (mMode == HugePageMode::kTransparent)
+        {
+            madvise(base, bytes, MADV_HUGEPAGE);
+        }
+#endif
+        return base;
+#endif
+    }
+
+    static void unmap(void* base, size_t bytes)
+    {
+#ifdef _MSC_VER
+        _aligned_free(base);
+#else
+        munmap(base, bytes);
+#endif
+    }
+
+    static size_t roundUp(size_t bytes, size_t granularity)
+    {
+        return (bytes + granularity - 1) / granularity * granularity;
+    }
+
+    mutable std::mutex mMutex;
+    HugePageMode mMode{HugePageMode::kNone};
+    std::map<size_t, std::vector<void*>> mFree;  //!< Free slabs by size class.
+    std::map<void*, size_t> mMappings;           //!< Slabs that own their mapping, with the mapped size.
+    ArenaSlab* mFreeSlabs{nullptr};              //!< Slab objects of released slabs, for the next acquire().
+    FreeBlock* mFreeBlocks{nullptr};             //!< Released control blocks of kBlockBytes.
+    Stats mStats{};
+};
+
+//!
+//! \brief GenericBuffer allocation policy carving from a slab. Falls back to an aligned heap allocation if
+//!        the slab is missing or exhausted, e.g. when a buffer grows past its carve.
+//!
+class ArenaAllocator
+{
+public:
+    ArenaAllocator() = default;
+
+    explicit ArenaAllocator(std::shared_ptr<ArenaSlab> slab)
+        : mSlab(std::move(slab))
+    {
+    }
+
+    bool operator()(void** ptr, size_t size) const
+    {
+        *ptr = mSlab ? mSlab->carve(size) : nullptr;
+        if (!*ptr)
+        {
+#ifdef _MSC_VER
+            *ptr = _aligned_malloc(arenaAlign(size), kArenaAlignment);
+#else
+            *ptr = aligned_alloc(kArenaAlignment, arenaAlign(size));
+#endif
+        }
+        return *ptr != nullptr;
+    }
+
+    const std::shared_ptr<ArenaSlab>& slab() const { return mSlab; }
+
+private:
+    std::shared_ptr<ArenaSlab> mSlab;
+};
+
+//!
+//! \brief Counterpart of ArenaAllocator. Holds a slab reference, so the slab outlives its buffers.
+//!
+class ArenaFree
+{
+public:
+    ArenaFree() = default;
+
+    explicit ArenaFree(std::shared_ptr<ArenaSlab> slab)
+        : mSlab(std::move(slab))
+    {
+    }
+
+    void operator()(void* ptr) const
+    {
+        if (!ptr || (mSlab && mSlab->owns(ptr)))
+        {
+            return;
+        }
+#ifdef _MSC_VER
+        _aligned_free(ptr);
+#else
+        free(ptr);
+#endif
+    }
+
+private:
+    std::shared_ptr<ArenaSlab> mSlab;
+};
+
+} // namespace samplesCommon
+
+#endif // TENSORRT_ARENA_H
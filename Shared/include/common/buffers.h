@@ -51,9 +51,12 @@
 #define TENSORRT_BUFFERS_H
 
 #include "NvInfer.h"
-// #include "half.h"
+#include "arena.h"
 #include "common.h"
+#include "fp16.h"
+#include "staging.h"
 #include <cuda_runtime_api.h>
+#include <algorithm>
 #include <cassert>
 #include <iostream>
 #include <iterator>
@@ -82,6 +85,8 @@ namespace samplesCommon
 //!          The boolean indicates whether or not the memory allocation was successful.
 //!          FreeFunc must be a functor that takes in (void* ptr) and returns void.
 //!          ptr is the allocated buffer address. It must work with nullptr input.
+//!          Stateful policies, like an arena allocator, are passed as instances to the constructor
+//!          and move with the buffer.
 //!
 template <typename AllocFunc, typename FreeFunc>
 class GenericBuffer
@@ -112,11 +117,29 @@ public:
         }
     }
 
+    //!
+    //! \brief Construct a buffer with the specified allocation size in bytes, using the given allocation policy.
+    //!
+    GenericBuffer(size_t size, nvinfer1::DataType type, AllocFunc alloc, FreeFunc free)
+        : mSize(size)
+        , mCapacity(size)
+        , mType(type)
+        , allocFn(std::move(alloc))
+        , freeFn(std::move(free))
+    {
+        if (!allocFn(&mBuffer, this->nbBytes()))
+        {
+            throw std::bad_alloc();
+        }
+    }
+
     GenericBuffer(GenericBuffer&& buf)
         : mSize(buf.mSize)
         , mCapacity(buf.mCapacity)
         , mType(buf.mType)
         , mBuffer(buf.mBuffer)
+        , allocFn(std::move(buf.allocFn))
+        , freeFn(std::move(buf.freeFn))
     {
         buf.mSize = 0;
         buf.mCapacity = 0;
@@ -133,6 +156,8 @@ public:
             mCapacity = buf.mCapacity;
             mType = buf.mType;
             mBuffer = buf.mBuffer;
+            allocFn = std::move(buf.allocFn);
+            freeFn = std::move(buf.freeFn);
             // Reset buf.
             buf.mSize = 0;
             buf.mCapacity = 0;
@@ -203,7 +228,7 @@ public:
 private:
     size_t mSize{0}, mCapacity{0};
     nvinfer1::DataType mType;
-    void* mBuffer;
+    void* mBuffer{nullptr};
     AllocFunc allocFn;
     FreeFunc freeFn;
 };
@@ -238,6 +263,7 @@ public:
 
 using DeviceBuffer = GenericBuffer<DeviceAllocator, DeviceFree>;
 using HostBuffer = GenericBuffer<HostAllocator, HostFree>;
+using ArenaHostBuffer = GenericBuffer<ArenaAllocator, ArenaFree>;
 
 //!
 //! \brief  The ManagedBuffer class groups together a pair of corresponding device and host buffers.
@@ -246,7 +272,7 @@ class ManagedBuffer
 {
 public:
     DeviceBuffer deviceBuffer;
-    HostBuffer hostBuffer;
+    ArenaHostBuffer hostBuffer;
 };
 
 //!
@@ -256,11 +282,15 @@ public:
 //!          memcpy between host and device buffers to aid with inference,
 //!          and debugging dumps to validate inference. The BufferManager class is meant to be
 //!          used to simplify buffer management and any interactions between buffers and the engine.
+//!          The bindings are laid out by a StagingLayout: all inputs packed in one region and all outputs
+//!          in another, on the host and on the device, so each transfer direction is a single copy.
+//!          Both host regions are carved from one arena slab.
 //!
 class BufferManager
 {
 public:
     static const size_t kINVALID_SIZE_VALUE = ~size_t(0);
+    static const size_t kSTAGING_ALIGNMENT = 256; //!< Binding alignment in the staging regions, as cudaMalloc gives.
 
     //!
     //! \brief Create a BufferManager for handling buffer interactions with engine.
@@ -269,10 +299,15 @@ public:
         : mEngine(engine)
         , mBatchSize(batchSize)
     {
-        // Create host and device buffers
-        for (int i = 0; i < mEngine->getNbBindings(); i++)
+        // Size every binding first, then place them in the staging regions.
+        const int nbBindings = mEngine->getNbBindings();
+        std::vector<size_t> bytes(nbBindings);
+        std::vector<bool> isInput(nbBindings);
+        for (int i = 0; i < nbBindings; i++)
         {
             auto dims = context ? context->getBindingDimensions(i) : mEngine->getBindingDimensions(i);
+            // Bindings of the optimization profiles of other contexts stay unresolved and get no space.
+            const bool resolved = std::none_of(dims.d, dims.d + dims.nbDims, [](int d) { return d < 0; });
             size_t vol = context ? 1 : static_cast<size_t>(mBatchSize);
             nvinfer1::DataType type = mEngine->getBindingDataType(i);
             int vecDim = mEngine->getBindingVectorizedDim(i);
@@ -282,12 +317,24 @@ public:
                 dims.d[vecDim] = divUp(dims.d[vecDim], scalarsPerVec);
                 vol *= scalarsPerVec;
             }
-            vol *= samplesCommon::volume(dims);
-            std::unique_ptr<ManagedBuffer> manBuf{new ManagedBuffer()};
-            manBuf->deviceBuffer = DeviceBuffer(vol, type);
-            manBuf->hostBuffer = HostBuffer(vol, type);
-            mDeviceBindings.emplace_back(manBuf->deviceBuffer.data());
-            mManagedBuffers.emplace_back(std::move(manBuf));
+            vol *= resolved ? samplesCommon::volume(dims) : 0;
+            bytes[i] = vol * samplesCommon::getElementSize(type);
+            isInput[i] = mEngine->bindingIsInput(i);
+        }
+        mLayout = StagingLayout(bytes, isInput, kSTAGING_ALIGNMENT);
+
+        // Create the host and device regions, the bindings are views into them.
+        const size_t inputBytes = mLayout.inputBytes();
+        const size_t outputBytes = mLayout.outputBytes();
+        auto hostSlab = ArenaPool::instance().acquire(inputBytes + outputBytes);
+        mHostInputs = ArenaHostBuffer(inputBytes, nvinfer1::DataType::kINT8, ArenaAllocator(hostSlab), ArenaFree(hostSlab));
+        mHostOutputs = ArenaHostBuffer(outputBytes, nvinfer1::DataType::kINT8, ArenaAllocator(hostSlab), ArenaFree(hostSlab));
+        mDeviceInputs = DeviceBuffer(inputBytes, nvinfer1::DataType::kINT8);
+        mDeviceOutputs = DeviceBuffer(outputBytes, nvinfer1::DataType::kINT8);
+        for (int i = 0; i < nbBindings; i++)
+        {
+            mHostBindings.emplace_back(mLayout.resolve(i, mHostInputs.data(), mHostOutputs.data()));
+            mDeviceBindings.emplace_back(mLayout.resolve(i, mDeviceInputs.data(), mDeviceOutputs.data()));
         }
     }
 
@@ -323,9 +370,14 @@ public:
         int index = mEngine->getBindingIndex(tensorName.c_str());
         if (index == -1)
             return kINVALID_SIZE_VALUE;
-        return mManagedBuffers[index]->hostBuffer.nbBytes();
+        return mLayout.view(index).bytes;
     }
 
+    //!
+    //! \brief Returns the placement of the bindings in the staging regions.
+    //!
+    const StagingLayout& layout() const { return mLayout; }
+
     //!
     //! \brief Dump host buffer with specified tensorName to ostream.
     //!        Prints error message to std::ostream if no such tensor can be found.
@@ -338,8 +390,8 @@ public:
             os << "Invalid tensor name" << std::endl;
             return;
         }
-        void* buf = mManagedBuffers[index]->hostBuffer.data();
-        size_t bufSize = mManagedBuffers[index]->hostBuffer.nbBytes();
+        void* buf = mHostBindings[index];
+        size_t bufSize = mLayout.view(index).bytes;
         nvinfer1::Dims bufDims = mEngine->getBindingDimensions(index);
         size_t rowCount = static_cast<size_t>(bufDims.nbDims >= 1 ? bufDims.d[bufDims.nbDims - 1] : mBatchSize);
 
@@ -351,8 +403,11 @@ public:
         {
         case nvinfer1::DataType::kINT32: print<int32_t>(os, buf, bufSize, rowCount); break;
         case nvinfer1::DataType::kFLOAT: print<float>(os, buf, bufSize, rowCount); break;
-        case nvinfer1::DataType::kHALF: // print<half_float::half>(os, buf, bufSize, rowCount); break;
-        case nvinfer1::DataType::kINT8: assert(0 && "Int8 network-level input and output is not supported"); break;
+        case nvinfer1::DataType::kHALF: printConverted<uint16_t, float>(os, buf, bufSize, rowCount, halfToFloat); break;
+        case nvinfer1::DataType::kINT8:
+            printConverted<int8_t, int>(os, buf, bufSize, rowCount, [](int8_t v) { return static_cast<int>(v); });
+            break;
+        default: os << "Unsupported data type" << std::endl; break;
         }
     }
 
@@ -385,6 +440,19 @@ public:
         }
     }
 
+    //!
+    //! \brief Print a buffer of T converted element-wise to the printable type U.
+    //!
+    template <typename T, typename U, typename Convert>
+    void printConverted(std::ostream& os, void* buf, size_t bufSize, size_t rowCount, Convert convert)
+    {
+        assert(bufSize % sizeof(T) == 0);
+        const T* typedBuf = static_cast<const T*>(buf);
+        std::vector<U> converted(bufSize / sizeof(T));
+        std::transform(typedBuf, typedBuf + converted.size(), converted.begin(), convert);
+        print<U>(os, converted.data(), converted.size() * sizeof(U), rowCount);
+    }
+
     //!
     //! \brief Copy the contents of input host buffers to input device buffers synchronously.
     //!
@@ -414,32 +482,36 @@ private:
         int index = mEngine->getBindingIndex(tensorName.c_str());
         if (index == -1)
             return nullptr;
-        return (isHost ? mManagedBuffers[index]->hostBuffer.data() : mManagedBuffers[index]->deviceBuffer.data());
+        return isHost ? mHostBindings[index] : mDeviceBindings[index];
     }
 
+    //!
+    //! \brief Copies the whole input or output region in one transfer.
+    //!
     void memcpyBuffers(const bool copyInput, const bool deviceToHost, const bool async, const cudaStream_t& stream = 0)
     {
-        for (int i = 0; i < mEngine->getNbBindings(); i++)
-        {
-            void* dstPtr
-                = deviceToHost ? mManagedBuffers[i]->hostBuffer.data() : mManagedBuffers[i]->deviceBuffer.data();
-            const void* srcPtr
-                = deviceToHost ? mManagedBuffers[i]->deviceBuffer.data() : mManagedBuffers[i]->hostBuffer.data();
-            const size_t byteSize = mManagedBuffers[i]->hostBuffer.nbBytes();
-            const cudaMemcpyKind memcpyType = deviceToHost ? cudaMemcpyDeviceToHost : cudaMemcpyHostToDevice;
-            if ((copyInput && mEngine->bindingIsInput(i)) || (!copyInput && !mEngine->bindingIsInput(i)))
-            {
-                if (async)
-                    CHECK(cudaMemcpyAsync(dstPtr, srcPtr, byteSize, memcpyType, stream));
-                else
-                    CHECK(cudaMemcpy(dstPtr, srcPtr, byteSize, memcpyType));
-            }
-        }
+        ArenaHostBuffer& host = copyInput ? mHostInputs : mHostOutputs;
+        DeviceBuffer& device = copyInput ? mDeviceInputs : mDeviceOutputs;
+        const size_t byteSize = copyInput ? mLayout.inputBytes() : mLayout.outputBytes();
+        if (byteSize == 0)
+            return;
+        void* dstPtr = deviceToHost ? host.data() : device.data();
+        const void* srcPtr = deviceToHost ? device.data() : host.data();
+        const cudaMemcpyKind memcpyType = deviceToHost ? cudaMemcpyDeviceToHost : cudaMemcpyHostToDevice;
+        if (async)
+            CHECK(cudaMemcpyAsync(dstPtr, srcPtr, byteSize, memcpyType, stream));
+        else
+            CHECK(cudaMemcpy(dstPtr, srcPtr, byteSize, memcpyType));
     }
 
     std::shared_ptr<nvinfer1::ICudaEngine> mEngine;              //!< The pointer to the engine
     int mBatchSize;                                              //!< The batch size
-    std::vector<std::unique_ptr<ManagedBuffer>> mManagedBuffers; //!< The vector of pointers to managed buffers
+    StagingLayout mLayout;                                       //!< Placement of the bindings in the regions
+    ArenaHostBuffer mHostInputs;                                 //!< Host region of all input bindings
+    ArenaHostBuffer mHostOutputs;                                //!< Host region of all output bindings
+    DeviceBuffer mDeviceInputs;                                  //!< Device region of all input bindings
+    DeviceBuffer mDeviceOutputs;                                 //!< Device region of all output bindings
+    std::vector<void*> mHostBindings;                            //!< The vector of host buffers, views into the regions
     std::vector<void*> mDeviceBindings;                          //!< The vector of device buffers needed for engine execution
 };
 
@@ -0,0 +1,103 @@
+// fp16.h: Scalar IEEE half precision conversion.
+//
+
+#ifndef TENSORRT_FP16_H
+#define TENSORRT_FP16_H
+
+#include <cstdint>
+#include <cstring>
+
+namespace samplesCommon
+{
+
+//!
+//! \brief Convert a float to half precision, rounding to nearest even. Overflow gives infinity, NaN stays NaN.
+//!
+inline uint16_t floatToHalf(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    const uint32_t sign = (bits >> 16) & 0x8000;
+    const uint32_t abs = bits & 0x7fffffff;
+
+    if (abs >= 0x7f800000)
+    {
+        // Infinity, or NaN with the payload truncated and kept quiet.
+        return static_cast<uint16_t>(sign | 0x7c00 | (abs > 0x7f800000 ? 0x200 | ((abs >> 13) & 0x3ff) : 0));
+    }
+    if (abs >= 0x477ff000)
+    {
+        // Rounds to 65520 or more, past the largest half.
+        return static_cast<uint16_t>(sign | 0x7c00);
+    }
+    if (abs < 0x38800000)
+    {
+        // Below the smallest normal half, 2^-14: a subnormal in units of 2^-24.
+        if (abs < 0x33000000)
+        {
+            return static_cast<uint16_t>(sign);
+        }
+        const uint32_t shift = 126 - (abs >> 23);
+        const uint32_t mantissa = (abs & 0x7fffff) | 0x800000;
+        uint32_t half = mantissa >> shift;
+        const uint32_t rest = mantissa & ((1u << shift) - 1);
+        const uint32_t tie = 1u << (shift - 1);
+        if (rest > tie || (rest == tie && (half & 1)))
+        {
+            ++half;
+        }
+        return static_cast<uint16_t>(sign | half);
+    }
+
+    // Normal: rebias the exponent from 127 to 15, a mantissa carry correctly bumps the exponent.
+    uint32_t half = (abs >> 13) - ((127 - 15) << 10);
+    const uint32_t rest = abs & 0x1fff;
+    if (rest > 0x1000 || (rest == 0x1000 && (half & 1)))
+    {
+        ++half;
+    }
+    return static_cast<uint16_t>(sign | half);
+}
+
+//!
+//! \brief Convert a half precision value to float, exactly.
+//!
+inline float halfToFloat(uint16_t value)
+{
+    const uint32_t sign = static_cast<uint32_t>(value & 0x8000) << 16;
+    uint32_t exponent = (value >> 10) & 0x1f;
+    uint32_t mantissa = value & 0x3ff;
+
+    uint32_t bits;
+    if (exponent == 0x1f)
+    {
+        bits = sign | 0x7f800000 | (mantissa << 13);
+    }
+    else if (exponent != 0)
+    {
+        bits = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+    }
+    else if (mantissa == 0)
+    {
+        bits = sign;
+    }
+    else
+    {
+        // Subnormal, normalize the mantissa.
+        exponent = 127 - 14;
+        while (!(mantissa & 0x400))
+        {
+            mantissa <<= 1;
+            --exponent;
+        }
+        bits = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+    }
+
+    float result;
+    memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
+} // namespace samplesCommon
+
+#endif // TENSORRT_FP16_H
@@ -0,0 +1,103 @@
+// staging.h: Packed placement of the bindings of a context in one input and one output region.
+//
+
+#ifndef TENSORRT_STAGING_H
+#define TENSORRT_STAGING_H
+
+#include <cassert>
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace samplesCommon
+{
+
+//!
+//! \brief Placement of the bindings of a context: all inputs packed in one region, all outputs in another.
+//!
+//! \details Each binding gets a view, its region and byte offset in it. Offsets follow binding order and are
+//!          aligned to the given alignment, so host-device transfers are one copy per direction and the
+//!          views keep the alignment the kernels and the device expect. Pure arithmetic, no CUDA.
+//!
+class StagingLayout
+{
+public:
+    struct View
+    {
+        bool isInput;
+        size_t offset; //!< Byte offset in the region of the binding direction.
+        size_t bytes;
+    };
+
+    StagingLayout() = default;
+
+    //!
+    //! \brief Lay out bindings of the given byte sizes. alignment must be a power of two.
+    //!
+    StagingLayout(const std::vector<size_t>& bytes, const std::vector<bool>& isInput, size_t alignment)
+        : mAlignment(alignment)
+    {
+        assert(bytes.size() == isInput.size());
+        assert(alignment != 0 && (alignment & (alignment - 1)) == 0);
+        mViews.reserve(bytes.size());
+        for (size_t i = 0; i < bytes.size(); i++)
+        {
+            size_t& end = isInput[i] ? mInputBytes : mOutputBytes;
+            mViews.push_back({isInput[i], end, bytes[i]});
+            end += align(bytes[i]);
+        }
+    }
+
+    int nbBindings() const { return static_cast<int>(mViews.size()); }
+
+    const View& view(int index) const { return mViews[index]; }
+
+    //!
+    //! \brief Size of the input region, a multiple of the alignment.
+    //!
+    size_t inputBytes() const { return mInputBytes; }
+
+    //!
+    //! \brief Size of the output region, a multiple of the alignment.
+    //!
+    size_t outputBytes() const { return mOutputBytes; }
+
+    size_t alignment() const { return mAlignment; }
+
+    //!
+    //! \brief Address of a binding given the bases of the two regions.
+    //!
+    void* resolve(int index, void* inputBase, void* outputBase) const
+    {
+        const View& v = mViews[index];
+        return static_cast<char*>(v.isInput ? inputBase : outputBase) + v.offset;
+    }
+
+    //!
+    //! \brief Print the regions and the view of each binding, names indexed like the bindings.
+    //!
+    void dump(std::ostream& os, const std::vector<std::string>& names) const
+    {
+        os << "  Staging: inputs " << mInputBytes << " bytes, outputs " << mOutputBytes << " bytes, aligned to "
+           << mAlignment << std::endl;
+        for (int i = 0; i < nbBindings(); i++)
+        {
+            const View& v = mViews[i];
+            os << "    [" << i << "] " << (i < static_cast<int>(names.size()) ? names[i] : std::string())
+               << (v.isInput ? ": input +" : ": output +") << v.offset << ", " << v.bytes << " bytes" << std::endl;
+        }
+    }
+
+private:
+    size_t align(size_t bytes) const { return (bytes + mAlignment - 1) & ~(mAlignment - 1); }
+
+    std::vector<View> mViews;
+    size_t mInputBytes{0};
+    size_t mOutputBytes{0};
+    size_t mAlignment{1};
+};
+
+} // namespace samplesCommon
+
+#endif // TENSORRT_STAGING_H
@@ -0,0 +1,169 @@
+// Harness.cpp: Impl
+//
+
+#include "Harness.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+
+#include "CpuKernels.h"
+
+
+namespace {
+
+double ElapsedNs(const BenchRunner::Body &body, uint64_t iterations)
+{
+    const auto start = std::chrono::steady_clock::now();
+    body(iterations);
+    const std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+const char *Compiler()
+{
+#if defined(__clang__)
+    return "clang " __clang_version__;
+#elif defined(__GNUC__)
+    return "gcc " __VERSION__;
+#elif defined(_MSC_VER)
+    return "msvc";
+#else
+    return "unknown";
+#endif
+}
+
+}
+
+BenchRunner::BenchRunner(const BenchConfig &config) : config_(config)
+{
+}
+
+void BenchRunner::Add(const std::string &name, const std::string &params, double items, const std::string &item_unit,
+                      Body body)
+{
+    cases_.push_back({name, params, items, item_unit, std::move(body)});
+}
+
+bool BenchRunner::Matches(const Case &bench) const
+{
+    return config_.filter.empty() || (bench.name + "/" + bench.params).find(config_.filter) != std::string::npos;
+}
+
+const std::vector<BenchResult> &BenchRunner::Run()
+{
+    results_.clear();
+    for (const auto &bench : cases_) {
+        if (!Matches(bench)) {
+            continue;
+        }
+        const auto id = bench.name + "/" + bench.params;
+        if (config_.format == ReportFormat::kText) {
+            std::cerr << "Info: running " << id << std::endl;
+        }
+        results_.push_back(RunCase(bench));
+    }
+    return results_;
+}
+
+BenchResult BenchRunner::RunCase(const Case &bench) const
+{
+    // Warm up, then grow the iteration count until a run takes a tenth of the target and scale from it.
+    const auto target_ns = config_.min_time_ms * 1e6;
+    ElapsedNs(bench.body, 1);
+    uint64_t iterations = 1;
+    auto elapsed = ElapsedNs(bench.body, iterations);
+    while (elapsed < target_ns / 10 && iterations < (uint64_t(1) << 40)) {
+        iterations *= 2;
+        elapsed = ElapsedNs(bench.body, iterations);
+    }
+    iterations = std::max<uint64_t>(1, static_cast<uint64_t>(iterations * target_ns / std::max(elapsed, 1.0)));
+
+    std::vector<double> per_iteration;
+    for (int i = 0; i < std::max(1, config_.repetitions); ++i) {
+        per_iteration.push_back(ElapsedNs(bench.body, iterations) / iterations);
+    }
+    std::sort(per_iteration.begin(), per_iteration.end());
+
+    BenchResult result;
+    result.name = bench.name;
+    result.params = bench.params;
+    result.iterations = iterations;
+    result.ns_median = per_iteration[per_iteration.size() / 2];
+    result.ns_min = per_iteration.front();
+    result.ns_max = per_iteration.back();
+    result.items = bench.items;
+    result.item_unit = bench.item_unit;
+    return result;
+}
+
+void BenchRunner::Report(std::ostream &os) const
+{
+    switch (config_.format) {
+        case ReportFormat::kJson:
+            ReportJson(os);
+            break;
+        case ReportFormat::kCsv:
+            ReportCsv(os);
+            break;
+        default:
+            ReportText(os);
+            break;
+    }
+}
+
+void BenchRunner::List(std::ostream &os) const
+{
+    for (const auto &bench : cases_) {
+        if (Matches(bench)) {
+            os << bench.name << "/" << bench.params << std::endl;
+        }
+    }
+}
+
+void BenchRunner::ReportText(std::ostream &os) const
+{
+    os << "***** Benchmarks (" << kernels::InstructionSet() << ") *****" << std::endl;
+    const auto flags = os.flags();
+    const auto precision = os.precision();
+    os << std::fixed << std::setprecision(1);
+    for (const auto &result : results_) {
+        const auto rate = result.ns_median > 0 ? result.items / result.ns_median * 1e3 : 0.0;
+        os << "  " << std::left << std::setw(20) << result.name << std::setw(28) << result.params << std::right
+           << std::setw(12) << result.ns_median << " ns  [" << result.ns_min << ", " << result.ns_max << "]  "
+           << rate << " M" << result.item_unit << "/s" << std::endl;
+    }
+    os.flags(flags);
+    os.precision(precision);
+}
+
+void BenchRunner::ReportJson(std::ostream &os) const
+{
+    const auto precision = os.precision();
+    os << std::setprecision(9);
+    os << "{\n  \"context\": {\"compiler\": \"" << Compiler() << "\", \"isa\": \"" << kernels::InstructionSet()
+       << "\", \"min_time_ms\": " << config_.min_time_ms << ", \"repetitions\": " << config_.repetitions << "},\n";
+    os << "  \"benchmarks\": [";
+    for (size_t i = 0; i < results_.size(); ++i) {
+        const auto &result = results_[i];
+        os << (i ? ",\n" : "\n") << "    {\"name\": \"" << result.name << "\", \"params\": \"" << result.params
+           << "\", \"iterations\": " << result.iterations << ", \"ns_median\": " << result.ns_median
+           << ", \"ns_min\": " << result.ns_min << ", \"ns_max\": " << result.ns_max << ", \"items\": "
+           << result.items << ", \"item_unit\": \"" << result.item_unit << "\"}";
+    }
+    os << "\n  ]\n}" << std::endl;
+    os.precision(precision);
+}
+
+void BenchRunner::ReportCsv(std::ostream &os) const
+{
+    const auto precision = os.precision();
+    os << std::setprecision(9);
+    os << "name,params,iterations,ns_median,ns_min,ns_max,items,item_unit" << std::endl;
+    for (const auto &result : results_) {
+        os << result.name << ",\"" << result.params << "\"," << result.iterations << ',' << result.ns_median << ','
+           << result.ns_min << ',' << result.ns_max << ',' << result.items << ',' << result.item_unit << std::endl;
+    }
+    os.precision(precision);
+}
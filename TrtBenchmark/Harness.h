@@ -0,0 +1,102 @@
+// Harness.h: Minimal microbenchmark runner with text, JSON and CSV reports
+//
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+
+//!
+//! \brief Keep the compiler from optimizing away a value or the writes behind a pointer.
+//!
+template <typename T>
+inline void DoNotOptimize(const T &value)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : "r,m"(value) : "memory");
+#else
+    static volatile const void *sink;
+    sink = &value;
+#endif
+}
+
+enum class ReportFormat : int
+{
+    kText = 0,
+    kJson,
+    kCsv,
+};
+
+struct BenchConfig
+{
+    double min_time_ms = 100.0;     //!< Wall time of one repetition, the iteration count is calibrated to it.
+    int repetitions = 5;            //!< The report gives the median, min and max over the repetitions.
+    std::string filter;             //!< Only run cases whose "name/params" contains it.
+    ReportFormat format = ReportFormat::kText;
+};
+
+struct BenchResult
+{
+    std::string name;
+    std::string params;
+    uint64_t iterations;            //!< Per repetition.
+    double ns_median;               //!< Per iteration.
+    double ns_min;
+    double ns_max;
+    double items;                   //!< Items (samples, bins, bytes...) per iteration, for the throughput.
+    std::string item_unit;
+};
+
+//!
+//! \brief Runs registered cases. A case body gets an iteration count and loops itself, so the timed region
+//!        holds nothing but the primitive; set up its inputs outside the body.
+//!
+class BenchRunner
+{
+public:
+    using Body = std::function<void(uint64_t iterations)>;
+
+    explicit BenchRunner(const BenchConfig &config);
+
+    void Add(const std::string &name, const std::string &params, double items, const std::string &item_unit, Body body);
+
+    //!
+    //! \brief Run every case matching the filter, in registration order.
+    //!
+    const std::vector<BenchResult> &Run();
+
+    void Report(std::ostream &os) const;
+
+    //!
+    //! \brief Print the "name/params" of every case matching the filter without running it.
+    //!
+    void List(std::ostream &os) const;
+
+private:
+    struct Case
+    {
+        std::string name;
+        std::string params;
+        double items;
+        std::string item_unit;
+        Body body;
+    };
+
+    bool Matches(const Case &bench) const;
+
+    BenchResult RunCase(const Case &bench) const;
+
+    void ReportText(std::ostream &os) const;
+
+    void ReportJson(std::ostream &os) const;
+
+    void ReportCsv(std::ostream &os) const;
+
+    BenchConfig config_;
+    std::vector<Case> cases_;
+    std::vector<BenchResult> results_;
+};
@@ -0,0 +1,221 @@
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <thread>
+
+#include "StreamLoad.h"
+
+
+namespace {
+
+struct LoadGenConfig
+{
+    StreamLoadConfig load;
+    int start_streams = 1;
+    int step_streams = 1;
+    bool double_streams = false;    //!< Double the streams every step instead of adding step_streams.
+    int max_streams = 256;
+    double miss_threshold_pct = 1.0;    //!< Deadline miss rate above which a step fails.
+    std::string out_path;
+};
+
+struct LoadStep
+{
+    int streams;
+    StreamLoadResult result;
+
+    double MissRatePct() const
+    {
+        return result.frames ? 100.0 * result.deadline_misses / result.frames : 0.0;
+    }
+};
+
+LoadStep RunStep(const LoadGenConfig &config, int streams)
+{
+    auto load = config.load;
+    load.streams = streams;
+    LoadStep step{streams, RunStreamLoad(load)};
+
+    const auto cores = std::max(1u, std::thread::hardware_concurrency());
+    const auto &result = step.result;
+    std::cout << "Info: " << streams << " streams: " << result.frames << " frames, " << result.deadline_misses
+              << " deadline misses (" << step.MissRatePct() << "%), " << result.degraded_frames
+              << " degraded, latency p50 " << result.latency.p50_us / 1e3
+              << " ms, p99 " << result.latency.p99_us / 1e3 << " ms, cpu "
+              << 100.0 * result.cpu_seconds / std::max(1e-9, result.wall_seconds * cores) << "%" << std::endl;
+    return step;
+}
+
+//!
+//! \brief Ramp the stream count until the miss rate crosses the threshold, then bisect between the last
+//!        passing and the first failing count. Returns the highest passing count, 0 if even the first fails,
+//!        -1 if the streams of a step failed to run.
+//!
+int FindKnee(const LoadGenConfig &config, std::vector<LoadStep> &steps)
+{
+    auto failed = false;
+    const auto passes = [&](int streams) {
+        steps.push_back(RunStep(config, streams));
+        failed = failed || steps.back().result.failed_streams > 0;
+        return !failed && steps.back().MissRatePct() <= config.miss_threshold_pct;
+    };
+
+    auto good = 0;
+    auto bad = 0;
+    for (auto streams = std::max(1, config.start_streams); streams <= config.max_streams;) {
+        if (!passes(streams)) {
+            bad = streams;
+            break;
+        }
+        good = streams;
+        streams = config.double_streams ? streams * 2 : streams + std::max(1, config.step_streams);
+    }
+    if (!bad) {
+        std::cout << "Warning: no deadline slip up to " << good << " streams." << std::endl;
+        return good;
+    }
+    while (!failed && bad - good > 1) {
+        const auto mid = good + (bad - good) / 2;
+        if (passes(mid)) {
+            good = mid;
+        } else {
+            bad = mid;
+        }
+    }
+    if (failed) {
+        std::cerr << "Error: " << steps.back().result.failed_streams << " of " << steps.back().streams
+                  << " streams failed, no knee found." << std::endl;
+        return -1;
+    }
+    return good;
+}
+
+void WriteJson(std::ostream &os, const LoadGenConfig &config, const std::vector<LoadStep> &steps, int knee)
+{
+    const auto &load = config.load;
+    const auto precision = os.precision();
+    os.precision(9);
+    os << "{\n  \"context\": {\"model\": \"" << load.model_path << "\", \"connect\": \"" << load.connect_endpoint
+       << "\", \"inputs\": "
+       << (load.input_paths.empty() ? 0 : load.input_paths.size()) << ", \"seconds\": " << load.seconds
+       << ", \"burst_frames\": " << load.burst_frames << ", \"stagger_ms\": " << load.stagger_ms
+       << ", \"talk_s\": " << load.signal.talk_s << ", \"pause_s\": " << load.signal.pause_s
+       << ", \"deadline_ms\": " << load.deadline_ms << ", \"overload\": " << (load.overload.enabled ? "true" : "false")
+       << ", \"miss_threshold_pct\": " << config.miss_threshold_pct
+       << ", \"cores\": " << std::max(1u, std::thread::hardware_concurrency()) << "},\n";
+    os << "  \"steps\": [";
+    for (size_t i = 0; i < steps.size(); ++i) {
+        const auto &result = steps[i].result;
+        os << (i ? ",\n" : "\n") << "    {\"streams\": " << steps[i].streams << ", \"frames\": " << result.frames
+           << ", \"deadline_misses\": " << result.deadline_misses << ", \"miss_rate_pct\": " << steps[i].MissRatePct()
+           << ", \"degraded_frames\": " << result.degraded_frames
+           << ", \"latency_p50_ms\": " << result.latency.p50_us / 1e3 << ", \"latency_p99_ms\": "
+           << result.latency.p99_us / 1e3 << ", \"cpu_seconds\": " << result.cpu_seconds << ", \"wall_seconds\": "
+           << result.wall_seconds << ", \"peak_rss_mb\": " << result.peak_rss_mb << "}";
+    }
+    os << "\n  ],\n  \"knee_streams\": " << knee << "\n}" << std::endl;
+    os.precision(precision);
+}
+
+void PrintUsage(const char *prog)
+{
+    std::cout << "Usage: " << prog << " model-file [options]" << std::endl;
+    std::cout << "       " << prog << " --connect unix:path|[host:]port [options]" << std::endl;
+    std::cout << "Options:" << std::endl;
+    std::cout << "  --connect endpoint              Stream to a running --serve server instead of in-process executors." << std::endl;
+    std::cout << "  --format s16|f32                PCM format the server was started with, default s16." << std::endl;
+    std::cout << "  --input voice-file              Add a recorded input, streams take them round robin." << std::endl;
+    std::cout << "  --seconds s                     Synthetic audio per stream, default 10." << std::endl;
+    std::cout << "  --talk s --pause s              Mean talk spurt and pause of the synthetic audio." << std::endl;
+    std::cout << "  --burst frames                  Frames arrive in bursts of this many, default 1." << std::endl;
+    std::cout << "  --stagger ms                    Spread the stream starts over ms, default 1000." << std::endl;
+    std::cout << "  --deadline ms                   Frame latency counted as a miss above, default 10." << std::endl;
+    std::cout << "  --threshold pct                 Miss rate at which the node is saturated, default 1." << std::endl;
+    std::cout << "  --overload                      Let the executors shed inference past the deadline." << std::endl;
+    std::cout << "  --start n                       Streams of the first step, default 1." << std::endl;
+    std::cout << "  --step n                        Streams added per step, default 1." << std::endl;
+    std::cout << "  --double                        Double the streams every step instead." << std::endl;
+    std::cout << "  --max n                         Give up above n streams, default 256." << std::endl;
+    std::cout << "  --out json-file                 Write the steps and the knee to json-file." << std::endl;
+}
+
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2) {
+        PrintUsage(argv[0]);
+        return -1;
+    }
+
+    LoadGenConfig config;
+    auto &load = config.load;
+    load.realtime = true;
+    load.stagger_ms = 1000.0;
+    load.deadline_ms = 10.0;
+    load.report_stages = false;
+    auto first = 1;
+    if (strcmp(argv[1], "--connect") == 0 && argc > 2) {
+        load.connect_endpoint = argv[2];
+        first = 3;
+    } else {
+        load.model_path = argv[1];
+        first = 2;
+    }
+    for (int i = first; i < argc; ++i) {
+        if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+            load.connect_format = strcmp(argv[++i], "f32") == 0 ? PcmFormat::kF32 : PcmFormat::kS16;
+        } else if (strcmp(argv[i], "--input") == 0 && i + 1 < argc) {
+            load.input_paths.emplace_back(argv[++i]);
+        } else if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) {
+            load.seconds = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--talk") == 0 && i + 1 < argc) {
+            load.signal.talk_s = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--pause") == 0 && i + 1 < argc) {
+            load.signal.pause_s = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--burst") == 0 && i + 1 < argc) {
+            load.burst_frames = std::max(1, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--stagger") == 0 && i + 1 < argc) {
+            load.stagger_ms = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--deadline") == 0 && i + 1 < argc) {
+            load.deadline_ms = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--overload") == 0) {
+            load.overload.enabled = true;
+        } else if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc) {
+            config.miss_threshold_pct = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--start") == 0 && i + 1 < argc) {
+            config.start_streams = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--step") == 0 && i + 1 < argc) {
+            config.step_streams = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--double") == 0) {
+            config.double_streams = true;
+        } else if (strcmp(argv[i], "--max") == 0 && i + 1 < argc) {
+            config.max_streams = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+            config.out_path = argv[++i];
+        } else {
+            PrintUsage(argv[0]);
+            return -1;
+        }
+    }
+
+    load.overload.frame_deadline_ms = load.deadline_ms;
+
+    std::vector<LoadStep> steps;
+    const auto knee = FindKnee(config, steps);
+    if (knee < 0) {
+        return 1;
+    }
+    std::cout << "Info: knee at " << knee << " real-time streams (deadline " << load.deadline_ms << " ms, miss rate <= "
+              << config.miss_threshold_pct << "%)." << std::endl;
+    if (!config.out_path.empty()) {
+        std::ofstream out(config.out_path);
+        if (!out) {
+            std::cerr << "Error: Unable to write results: " << config.out_path << std::endl;
+            return 1;
+        }
+        WriteJson(out, config, steps, knee);
+    }
+    return 0;
+}
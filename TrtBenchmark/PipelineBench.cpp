@@ -0,0 +1,209 @@
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+#include "StreamLoad.h"
+
+
+namespace {
+
+struct PipelineBenchConfig
+{
+    std::string model_path;
+    int streams = 1;
+    bool realtime = false;          //!< Feed every stream at the pace of its audio, default full speed.
+    double seconds = 10.0;          //!< Audio per stream when synthetic.
+    std::string input_path;         //!< Recorded input decoded by every stream, synthetic if empty.
+    std::string output_dir;         //!< Enhanced signals are written there, kept in memory if empty.
+    std::string out_path;
+    std::string baseline_path;
+    double threshold_pct = 5.0;     //!< Worse than the baseline by more than this fails the run.
+};
+
+double Ratio(double num, double den)
+{
+    return den > 0 ? num / den : 0.0;
+}
+
+void WriteJson(std::ostream &os, const PipelineBenchConfig &config, const StreamLoadResult &result)
+{
+    const auto cores = std::max(1u, std::thread::hardware_concurrency());
+    const auto precision = os.precision();
+    os.precision(9);
+    os << "{\n  \"context\": {\"model\": \"" << config.model_path << "\", \"input\": \""
+       << (config.input_path.empty() ? "synthetic" : config.input_path) << "\", \"streams\": " << config.streams
+       << ", \"realtime\": " << (config.realtime ? "true" : "false") << ", \"cores\": " << cores
+       << ", \"isa\": \"" << kernels::InstructionSet() << "\"},\n";
+    os << "  \"results\": {\n";
+    os << "    \"frames\": " << result.frames << ",\n";
+    os << "    \"wall_seconds\": " << result.wall_seconds << ",\n";
+    os << "    \"audio_seconds\": " << result.audio_seconds << ",\n";
+    os << "    \"real_time_factor\": " << Ratio(result.busy_seconds, result.audio_seconds) << ",\n";
+    os << "    \"speed_x\": " << Ratio(result.audio_seconds, result.wall_seconds) << ",\n";
+    os << "    \"frames_per_second\": " << Ratio(result.frames, result.wall_seconds) << ",\n";
+    os << "    \"frames_per_core_second\": " << Ratio(result.frames, result.cpu_seconds) << ",\n";
+    os << "    \"latency_p50_ms\": " << result.latency.p50_us / 1e3 << ",\n";
+    os << "    \"latency_p90_ms\": " << result.latency.p90_us / 1e3 << ",\n";
+    os << "    \"latency_p99_ms\": " << result.latency.p99_us / 1e3 << ",\n";
+    os << "    \"latency_max_ms\": " << result.latency.max_us / 1e3 << ",\n";
+    os << "    \"peak_rss_mb\": " << result.peak_rss_mb << ",\n";
+    os << "    \"cpu_cores_used\": " << Ratio(result.cpu_seconds, result.wall_seconds) << ",\n";
+    os << "    \"cpu_utilization\": " << Ratio(result.cpu_seconds, result.wall_seconds * cores) << "\n";
+    os << "  }\n}" << std::endl;
+    os.precision(precision);
+}
+
+//!
+//! \brief Value of a numeric "key": member anywhere in a JSON text written by WriteJson.
+//!
+bool FindNumber(const std::string &json, const std::string &key, double &value)
+{
+    const auto pos = json.find("\"" + key + "\":");
+    if (pos == std::string::npos) {
+        return false;
+    }
+    const auto *begin = json.c_str() + pos + key.size() + 3;
+    char *end = nullptr;
+    value = strtod(begin, &end);
+    return end != begin;
+}
+
+//!
+//! \brief Compare the gated metrics of current to baseline, printing the table to stderr. Returns false if any
+//!        got worse by more than threshold_pct, or the baseline cannot be read.
+//!
+bool CompareBaseline(const std::string &baseline_path, const std::string &current, double threshold_pct)
+{
+    struct GatedMetric
+    {
+        const char *key;
+        bool lower_is_better;
+    };
+    static const GatedMetric kGated[] = {
+        {"real_time_factor", true},
+        {"frames_per_core_second", false},
+        {"latency_p50_ms", true},
+        {"latency_p99_ms", true},
+        {"peak_rss_mb", true},
+    };
+
+    std::ifstream file(baseline_path);
+    if (!file) {
+        std::cerr << "Error: Unable to open baseline: " << baseline_path << std::endl;
+        return false;
+    }
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    const auto baseline = buffer.str();
+
+    double base_streams = 0, streams = 0;
+    if (FindNumber(baseline, "streams", base_streams) && FindNumber(current, "streams", streams) &&
+        base_streams != streams) {
+        std::cerr << "Warning: baseline ran " << base_streams << " streams, this run " << streams << "." << std::endl;
+    }
+
+    auto pass = true;
+    std::cerr << "***** Baseline " << baseline_path << ", threshold " << threshold_pct << "% *****" << std::endl;
+    for (const auto &metric : kGated) {
+        double base = 0, value = 0;
+        if (!FindNumber(baseline, metric.key, base) || !FindNumber(current, metric.key, value)) {
+            std::cerr << "  " << metric.key << ": missing, skipped" << std::endl;
+            continue;
+        }
+        const auto change_pct = base != 0 ? (value - base) / base * 100.0 : 0.0;
+        const auto worse_pct = metric.lower_is_better ? change_pct : -change_pct;
+        const auto regressed = worse_pct > threshold_pct;
+        pass = pass && !regressed;
+        std::cerr << "  " << metric.key << ": " << base << " -> " << value << " (" << (change_pct >= 0 ? "+" : "")
+                  << change_pct << "%)" << (regressed ? "  REGRESSION" : "") << std::endl;
+    }
+    return pass;
+}
+
+void PrintUsage(const char *prog)
+{
+    std::cout << "Usage: " << prog << " model-file [options]" << std::endl;
+    std::cout << "Options:" << std::endl;
+    std::cout << "  --streams n                     Concurrent streams, one executor each, default 1." << std::endl;
+    std::cout << "  --realtime                      Feed streams at their audio pace, default full speed." << std::endl;
+    std::cout << "  --seconds s                     Synthetic audio per stream, default 10." << std::endl;
+    std::cout << "  --input voice-file              Decode voice-file per stream, default synthetic." << std::endl;
+    std::cout << "  --output-dir dir                Write the enhanced audio of each stream into dir." << std::endl;
+    std::cout << "  --out json-file                 Write the results to json-file instead of stdout." << std::endl;
+    std::cout << "  --baseline json-file            Compare to an earlier run, fail on regression." << std::endl;
+    std::cout << "  --threshold pct                 Tolerated regression against the baseline, default 5." << std::endl;
+}
+
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2) {
+        PrintUsage(argv[0]);
+        return -1;
+    }
+
+    PipelineBenchConfig config;
+    config.model_path = argv[1];
+    for (int i = 2; i < argc; ++i) {
+        if (strcmp(argv[i], "--streams") == 0 && i + 1 < argc) {
+            config.streams = std::max(1, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--realtime") == 0) {
+            config.realtime = true;
+        } else if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) {
+            config.seconds = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--input") == 0 && i + 1 < argc) {
+            config.input_path = argv[++i];
+        } else if (strcmp(argv[i], "--output-dir") == 0 && i + 1 < argc) {
+            config.output_dir = argv[++i];
+        } else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+            config.out_path = argv[++i];
+        } else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc) {
+            config.baseline_path = argv[++i];
+        } else if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc) {
+            config.threshold_pct = atof(argv[++i]);
+        } else {
+            PrintUsage(argv[0]);
+            return -1;
+        }
+    }
+
+    StreamLoadConfig load;
+    load.model_path = config.model_path;
+    load.streams = config.streams;
+    if (!config.input_path.empty()) {
+        load.input_paths.push_back(config.input_path);
+    }
+    load.seconds = config.seconds;
+    load.realtime = config.realtime;
+    load.output_dir = config.output_dir;
+    // stdout carries the JSON results, everything the executors report goes to stderr.
+    auto *stdout_buf = std::cout.rdbuf(std::cerr.rdbuf());
+    const auto result = RunStreamLoad(load);
+    std::cout.rdbuf(stdout_buf);
+    if (result.failed_streams > 0) {
+        std::cerr << "Error: " << result.failed_streams << " of " << config.streams
+                  << " streams failed, no results written." << std::endl;
+        return 1;
+    }
+    std::ostringstream json;
+    WriteJson(json, config, result);
+    if (config.out_path.empty()) {
+        std::cout << json.str();
+    } else {
+        std::ofstream out(config.out_path);
+        if (!out) {
+            std::cerr << "Error: Unable to write results: " << config.out_path << std::endl;
+            return 1;
+        }
+        out << json.str();
+    }
+
+    if (!config.baseline_path.empty() && !CompareBaseline(config.baseline_path, json.str(), config.threshold_pct)) {
+        return 2;
+    }
+    return 0;
+}
@@ -0,0 +1,385 @@
+// StreamLoad.cpp: Impl
+//
+
+#include "StreamLoad.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <iostream>
+#include <thread>
+
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "SocketEndpoint.h"
+
+
+namespace {
+
+std::chrono::nanoseconds Milliseconds(double ms)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::duration<double, std::milli>(ms));
+}
+
+double CpuSeconds(const rusage &usage)
+{
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1e-6;
+}
+
+struct StreamResult
+{
+    bool processed = false;
+    uint64_t frames = 0;
+    uint64_t deadline_misses = 0;
+    uint64_t degraded_frames = 0;
+    double audio_seconds = 0;
+    double busy_seconds = 0;
+};
+
+void RunStream(const StreamLoadConfig &config, int index, StartGate &gate,
+               const std::chrono::steady_clock::time_point &start, LatencyHistogram &latency, StreamResult &result)
+{
+    VoiceFileInputConfig voice_config;
+    TrtExecuteConfig executor_config;
+    executor_config.model_path = config.model_path;
+    executor_config.frame_hop_ms = 1000.0 * voice_config.window_len * voice_config.hot_fraction;
+    executor_config.stream_id = static_cast<uint32_t>(index);
+    executor_config.report_stages = config.report_stages;
+    executor_config.overload = config.overload;
+    TrtExecutor executor(executor_config);
+
+    std::vector<double> samples;
+    auto signal_config = config.signal;
+    if (config.input_paths.empty()) {
+        signal_config.seed += static_cast<uint32_t>(index);
+        samples = SyntheticSignal(signal_config, static_cast<size_t>(config.seconds * signal_config.sample_rate));
+    }
+    gate.ArriveAndWait();
+
+    // Decoding the recorded input is part of the pipeline, so it runs after the gate.
+    std::shared_ptr<VoiceInputStream> voice;
+    if (config.input_paths.empty()) {
+        voice = std::make_shared<VoiceInputStream>(voice_config, samples, signal_config.sample_rate, 1,
+                                                   SF_FORMAT_WAV | SF_FORMAT_FLOAT, &executor);
+    } else {
+        const auto &path = config.input_paths[index % config.input_paths.size()];
+        voice = std::make_shared<LocalFileInputStream>(voice_config, path, &executor);
+    }
+    const auto save_path =
+        config.output_dir.empty() ? std::string() : config.output_dir + "/stream_" + std::to_string(index) + ".wav";
+
+    BenchPacing pacing;
+    pacing.realtime = config.realtime;
+    pacing.hop_ms = executor_config.frame_hop_ms;
+    pacing.burst_frames = std::max(1, config.burst_frames);
+    pacing.start = start + Milliseconds(config.stagger_ms * index / config.streams);
+    auto input = std::make_shared<BenchInputStream>(voice, pacing);
+    auto output = std::make_shared<BenchOutputHandler>(std::make_shared<LocalFileOutputHandler>(voice, save_path),
+                                                       input, &latency, config.deadline_ms);
+    executor.SetInputStream(input);
+    executor.SetOutputHandler(output);
+    result.processed = executor.Process();
+
+    result.frames = output->Frames();
+    result.deadline_misses = output->DeadlineMisses();
+    const auto overload = executor.GetOverloadStats();
+    result.degraded_frames = overload.reused_mask_frames + overload.passthrough_frames;
+    result.audio_seconds = output->Frames() * executor_config.frame_hop_ms / 1000.0;
+    result.busy_seconds = output->BusySeconds();
+}
+
+//!
+//! \brief Samples of a recorded input for a remote stream, mixed down to mono. Empty if it cannot be read.
+//!
+std::vector<float> ReadMono(const std::string &path, int sample_rate)
+{
+    SndfileHandle file(path);
+    if (!file || file.channels() < 1) {
+        std::cerr << "Error: Unable to read input: " << path << std::endl;
+        return {};
+    }
+    if (file.samplerate() != sample_rate) {
+        std::cout << "Warning: " << path << " is at " << file.samplerate() << " Hz, streamed as " << sample_rate
+                  << " Hz." << std::endl;
+    }
+    const auto channels = file.channels();
+    std::vector<float> interleaved(static_cast<size_t>(file.frames()) * channels);
+    interleaved.resize(static_cast<size_t>(file.readf(interleaved.data(), file.frames())) * channels);
+    std::vector<float> mono(interleaved.size() / channels);
+    for (size_t i = 0; i < mono.size(); ++i) {
+        auto sum = 0.0f;
+        for (int c = 0; c < channels; ++c) {
+            sum += interleaved[i * channels + c];
+        }
+        mono[i] = sum / channels;
+    }
+    return mono;
+}
+
+bool SendAll(int fd, const char *data, size_t size)
+{
+    while (size > 0) {
+        // No SIGPIPE if the server went away, the stream just fails.
+        const auto written = send(fd, data, size, MSG_NOSIGNAL);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return false;
+        }
+        data += written;
+        size -= static_cast<size_t>(written);
+    }
+    return true;
+}
+
+//!
+//! \brief A stream through the StreamServer at config.connect_endpoint: a thread sends the hops as they are
+//!        due, this one reads the enhanced hops back. The server answers every hop with one enhanced hop,
+//!        plus one after the end, so hop k of the output is that of input hop k.
+//!
+void RunRemoteStream(const StreamLoadConfig &config, int index, StartGate &gate,
+                     const std::chrono::steady_clock::time_point &start, LatencyHistogram &latency,
+                     StreamResult &result)
+{
+    VoiceFileInputConfig voice_config;
+    const auto sample_rate = config.signal.sample_rate;
+    const auto hop = static_cast<size_t>(voice_config.hot_fraction * static_cast<int>(voice_config.window_len *
+                                                                                      sample_rate));
+    std::vector<float> samples;
+    if (config.input_paths.empty()) {
+        auto signal_config = config.signal;
+        signal_config.seed += static_cast<uint32_t>(index);
+        const auto signal = SyntheticSignal(signal_config, static_cast<size_t>(config.seconds * sample_rate));
+        samples.assign(signal.begin(), signal.end());
+    } else {
+        samples = ReadMono(config.input_paths[index % config.input_paths.size()], sample_rate);
+    }
+    const auto fd = samples.empty() ? -1 : ConnectEndpoint(config.connect_endpoint, "server");
+    gate.ArriveAndWait();
+    if (fd < 0) {
+        return;
+    }
+
+    const auto hop_ns = std::chrono::nanoseconds(static_cast<int64_t>(1e9 * hop / sample_rate));
+    const auto burst = static_cast<size_t>(std::max(1, config.burst_frames));
+    const auto stream_start = start + Milliseconds(config.stagger_ms * index / config.streams);
+    const auto due = [&](size_t k) {
+        return stream_start + hop_ns * static_cast<int64_t>(k / burst * burst + burst - 1);
+    };
+    const auto hops = (samples.size() + hop - 1) / hop;
+    const auto sample_bytes = PcmSampleBytes(config.connect_format);
+
+    auto sent = true;
+    std::thread sender([&]() {
+        std::vector<char> encoded(burst * hop * sample_bytes);
+        for (size_t k = 0; k < hops && sent; k += burst) {
+            std::this_thread::sleep_until(due(k));
+            const auto count = std::min(samples.size(), (k + burst) * hop) - k * hop;
+            EncodePcm(config.connect_format, samples.data() + k * hop, count, encoded.data());
+            sent = SendAll(fd, encoded.data(), count * sample_bytes);
+        }
+        // The server pads the last hop and ends the stream.
+        shutdown(fd, SHUT_WR);
+    });
+
+    std::vector<char> buffer(64 * 1024);
+    const auto hop_bytes = hop * sample_bytes;
+    size_t received = 0;
+    for (;;) {
+        const auto n = read(fd, buffer.data(), buffer.size());
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        const auto now = std::chrono::steady_clock::now();
+        const auto before = received / hop_bytes;
+        received += static_cast<size_t>(n);
+        for (auto k = before; k < std::min(received / hop_bytes, hops); ++k) {
+            const auto hop_latency = std::chrono::duration_cast<std::chrono::nanoseconds>(now - due(k));
+            latency.Record(hop_latency.count());
+            if (config.deadline_ms > 0 && hop_latency > Milliseconds(config.deadline_ms)) {
+                ++result.deadline_misses;
+            }
+            ++result.frames;
+        }
+    }
+    sender.join();
+    close(fd);
+
+    result.processed = sent && result.frames == hops;
+    if (!result.processed) {
+        std::cerr << "Error: stream " << index << " got " << result.frames << " of " << hops << " hops back from "
+                  << config.connect_endpoint << "." << std::endl;
+    }
+    result.audio_seconds = 1.0 * result.frames * hop / sample_rate;
+}
+
+}
+
+BenchInputStream::BenchInputStream(std::shared_ptr<VoiceInputStream> inner, const BenchPacing &pacing)
+    : inner_(std::move(inner)),
+      pacing_(pacing),
+      hop_(Milliseconds(pacing.hop_ms))
+{
+}
+
+std::chrono::steady_clock::time_point BenchInputStream::ArrivalOf(int64_t frame) const
+{
+    const auto burst = pacing_.burst_frames;
+    return pacing_.start + hop_ * (frame / burst * burst + burst - 1);
+}
+
+infer::Dims BenchInputStream::GetDynamicDim(const char *input_name)
+{
+    return inner_->GetDynamicDim(input_name);
+}
+
+std::vector<std::string> BenchInputStream::GetInputTensorNames(const InferEngine &engine)
+{
+    return inner_->GetInputTensorNames(engine);
+}
+
+bool BenchInputStream::TryTake(const std::vector<void *> &host_buffer, const std::vector<size_t> &sizes)
+{
+    if (frames_ == 0 && pacing_.start == std::chrono::steady_clock::time_point()) {
+        pacing_.start = std::chrono::steady_clock::now();
+    }
+    auto arrival = ArrivalOf(frames_);
+    if (pacing_.realtime) {
+        std::this_thread::sleep_until(arrival);
+    }
+    take_start_ = std::chrono::steady_clock::now();
+    if (!pacing_.realtime) {
+        arrival = take_start_;
+    }
+    if (!inner_->TryTake(host_buffer, sizes)) {
+        return false;
+    }
+    arrival_ = arrival;
+    ++frames_;
+    return true;
+}
+
+size_t BenchInputStream::PendingFrames() const
+{
+    if (!pacing_.realtime || frames_ == 0) {
+        return 0;
+    }
+    const auto now = std::chrono::steady_clock::now();
+    size_t pending = 0;
+    for (auto frame = frames_; frame < inner_->FrameCount() && ArrivalOf(frame) <= now; ++frame) {
+        ++pending;
+    }
+    return pending;
+}
+
+void BenchInputStream::SaveState(StreamState &state) const
+{
+    inner_->SaveState(state);
+}
+
+void BenchInputStream::RestoreState(const StreamState &state)
+{
+    inner_->RestoreState(state);
+}
+
+BenchOutputHandler::BenchOutputHandler(std::shared_ptr<LocalFileOutputHandler> inner,
+                                       std::shared_ptr<const BenchInputStream> input, LatencyHistogram *latency,
+                                       double deadline_ms)
+    : inner_(std::move(inner)),
+      input_(std::move(input)),
+      latency_(latency),
+      deadline_(Milliseconds(deadline_ms))
+{
+}
+
+std::vector<std::string> BenchOutputHandler::GetOutputTensorNames(const InferEngine &engine)
+{
+    return inner_->GetOutputTensorNames(engine);
+}
+
+void BenchOutputHandler::SetTensorDim(const char *output_name, const infer::Dims &dims)
+{
+    inner_->SetTensorDim(output_name, dims);
+}
+
+void BenchOutputHandler::Consume(const std::vector<void *> &host_buffer, const std::vector<size_t> &sizes)
+{
+    inner_->Consume(host_buffer, sizes);
+    const auto end = std::chrono::steady_clock::now();
+    const auto latency = std::chrono::duration_cast<std::chrono::nanoseconds>(end - input_->Arrival());
+    latency_->Record(latency.count());
+    if (deadline_.count() > 0 && latency > deadline_) {
+        ++deadline_misses_;
+    }
+    busy_ += end - input_->TakeStart();
+    ++frames_;
+}
+
+void BenchOutputHandler::SaveState(StreamState &state) const
+{
+    inner_->SaveState(state);
+}
+
+void BenchOutputHandler::RestoreState(const StreamState &state)
+{
+    inner_->RestoreState(state);
+}
+
+StartGate::StartGate(int parties) : waiting_(parties)
+{
+}
+
+void StartGate::ArriveAndWait()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (--waiting_ == 0) {
+        cond_.notify_all();
+    }
+    cond_.wait(lock, [this]() { return open_; });
+}
+
+StreamLoadResult RunStreamLoad(const StreamLoadConfig &config)
+{
+    StartGate gate(config.streams);
+    LatencyHistogram latency;
+    std::chrono::steady_clock::time_point start;
+    std::vector<StreamResult> stream_results(config.streams);
+    std::vector<std::thread> threads;
+    const auto run = config.connect_endpoint.empty() ? RunStream : RunRemoteStream;
+    for (int i = 0; i < config.streams; ++i) {
+        threads.emplace_back(run, std::cref(config), i, std::ref(gate), std::cref(start), std::ref(latency),
+                             std::ref(stream_results[i]));
+    }
+
+    rusage usage_start{};
+    gate.Open([&]() {
+        getrusage(RUSAGE_SELF, &usage_start);
+        start = std::chrono::steady_clock::now();
+    });
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    const auto end = std::chrono::steady_clock::now();
+    rusage usage_end{};
+    getrusage(RUSAGE_SELF, &usage_end);
+
+    StreamLoadResult result;
+    for (const auto &stream : stream_results) {
+        result.failed_streams += stream.processed ? 0 : 1;
+        result.frames += stream.frames;
+        result.deadline_misses += stream.deadline_misses;
+        result.degraded_frames += stream.degraded_frames;
+        result.audio_seconds += stream.audio_seconds;
+        result.busy_seconds += stream.busy_seconds;
+    }
+    result.wall_seconds = std::chrono::duration<double>(end - start).count();
+    result.cpu_seconds = CpuSeconds(usage_end) - CpuSeconds(usage_start);
+    result.peak_rss_mb = usage_end.ru_maxrss / 1024.0;
+    result.latency = latency.Summarize();
+    return result;
+}
@@ -0,0 +1,191 @@
+// StreamLoad.h: Concurrent paced voice streams through in-process executors, for the pipeline benchmarks
+//
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "PcmStream.h"
+#include "SyntheticSignal.h"
+#include "VoiceStream.h"
+
+
+struct BenchPacing
+{
+    bool realtime = false;          //!< Feed frames at the pace of the audio, default full speed.
+    double hop_ms = 10.0;
+    int burst_frames = 1;           //!< Frames arrive in bursts of this many, each when its last frame is due.
+    std::chrono::steady_clock::time_point start;    //!< When frame 0 is due, the first TryTake if default.
+};
+
+//!
+//! \brief Wraps the voice input of a stream: paces it and notes when each frame arrived, for the latency.
+//!
+//! \details In real-time mode frame k arrives k hops after the start (at the end of its burst), and its
+//!          latency runs from there, so a stream falling behind shows up as latency. At full speed a frame
+//!          arrives when it is taken.
+//!
+class BenchInputStream : public TrtInputStream
+{
+public:
+    BenchInputStream(std::shared_ptr<VoiceInputStream> inner, const BenchPacing &pacing);
+
+    infer::Dims GetDynamicDim(const char *input_name) override;
+
+    std::vector<std::string> GetInputTensorNames(const InferEngine &engine) override;
+
+    bool TryTake(const std::vector<void *> &host_buffer, const std::vector<size_t> &sizes) override;
+
+    size_t PendingFrames() const override;
+
+    void SaveState(StreamState &state) const override;
+
+    void RestoreState(const StreamState &state) override;
+
+    std::chrono::steady_clock::time_point Arrival() const
+    {
+        return arrival_;
+    }
+
+    std::chrono::steady_clock::time_point TakeStart() const
+    {
+        return take_start_;
+    }
+
+private:
+    std::chrono::steady_clock::time_point ArrivalOf(int64_t frame) const;
+
+    std::shared_ptr<VoiceInputStream> inner_;
+    BenchPacing pacing_;
+    std::chrono::nanoseconds hop_;
+    int64_t frames_ = 0;
+    std::chrono::steady_clock::time_point arrival_;
+    std::chrono::steady_clock::time_point take_start_;
+};
+
+//!
+//! \brief Wraps the synthesis of a stream: records the latency of each frame once it is consumed, counts the
+//!        frames over the deadline, and the time the pipeline was busy, excluding the pacing wait.
+//!
+class BenchOutputHandler : public TrtOutputHandler
+{
+public:
+    //!
+    //! \brief latency is shared by the streams. A deadline_ms of 0 counts no misses.
+    //!
+    BenchOutputHandler(std::shared_ptr<LocalFileOutputHandler> inner, std::shared_ptr<const BenchInputStream> input,
+                       LatencyHistogram *latency, double deadline_ms);
+
+    std::vector<std::string> GetOutputTensorNames(const InferEngine &engine) override;
+
+    void SetTensorDim(const char *output_name, const infer::Dims &dims) override;
+
+    void Consume(const std::vector<void *> &host_buffer, const std::vector<size_t> &sizes) override;
+
+    void SaveState(StreamState &state) const override;
+
+    void RestoreState(const StreamState &state) override;
+
+    uint64_t Frames() const
+    {
+        return frames_;
+    }
+
+    uint64_t DeadlineMisses() const
+    {
+        return deadline_misses_;
+    }
+
+    double BusySeconds() const
+    {
+        return std::chrono::duration<double>(busy_).count();
+    }
+
+private:
+    std::shared_ptr<LocalFileOutputHandler> inner_;
+    std::shared_ptr<const BenchInputStream> input_;
+    LatencyHistogram *latency_;
+    std::chrono::nanoseconds deadline_;
+    uint64_t frames_ = 0;
+    uint64_t deadline_misses_ = 0;
+    std::chrono::steady_clock::duration busy_{0};
+};
+
+struct StreamLoadConfig
+{
+    std::string model_path;
+    int streams = 1;
+    std::vector<std::string> input_paths;   //!< Recorded inputs assigned round robin, synthetic audio if empty.
+    double seconds = 10.0;                  //!< Synthetic audio per stream.
+    SyntheticSignalConfig signal;           //!< The seed is offset by the stream index.
+    bool realtime = false;
+    int burst_frames = 1;
+    double stagger_ms = 0;          //!< In real-time mode stream i starts stagger_ms * i / streams after stream 0.
+    double deadline_ms = 0;         //!< Frame latency above which a frame counts as a deadline miss, 0 none.
+    std::string output_dir;         //!< Enhanced signals are written there, kept in memory if empty.
+    bool report_stages = true;      //!< Let every executor print its stage latency report.
+    OverloadConfig overload;        //!< Passed to every executor, see TrtExecuteConfig.
+    std::string connect_endpoint;   //!< Stream to a StreamServer there instead of running executors, see below.
+    PcmFormat connect_format = PcmFormat::kS16;     //!< PCM format the server was started with.
+};
+
+struct StreamLoadResult
+{
+    int failed_streams = 0;         //!< Whose executor failed, e.g. as the model did not load.
+    uint64_t frames = 0;
+    uint64_t deadline_misses = 0;
+    uint64_t degraded_frames = 0;   //!< Consumed without inference by the overload protection.
+    double wall_seconds = 0;
+    double audio_seconds = 0;
+    double busy_seconds = 0;        //!< Summed over the streams.
+    double cpu_seconds = 0;         //!< Of the process while the streams ran.
+    double peak_rss_mb = 0;
+    LatencySummary latency;
+};
+
+//!
+//! \brief Lets the streams start their timed part together, once every engine is loaded.
+//!
+class StartGate
+{
+public:
+    explicit StartGate(int parties);
+
+    void ArriveAndWait();
+
+    //!
+    //! \brief Wait for every stream to arrive, run on_open, then release them.
+    //!
+    template <typename F>
+    void Open(F on_open)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cond_.wait(lock, [this]() { return waiting_ == 0; });
+        on_open();
+        open_ = true;
+        cond_.notify_all();
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    int waiting_;
+    bool open_ = false;
+};
+
+//!
+//! \brief Run config.streams streams, each with its own executor on its own thread, decode (or synthetic
+//!        audio) to synthesis. Engines are loaded before the timed part starts.
+//!
+//! \details With config.connect_endpoint set, each stream is instead a connection to a StreamServer there,
+//!          connected before the timed part starts. Its hops are sent at the real-time pace of the audio
+//!          whatever config.realtime is, and the latency of a hop runs from when it was due to when its
+//!          enhanced hop is read back. The model is the server's; the CPU time is that of this process only,
+//!          and neither busy time nor degraded frames are known.
+//!
+StreamLoadResult RunStreamLoad(const StreamLoadConfig &config);
@@ -0,0 +1,57 @@
+// SyntheticSignal.cpp: Impl
+//
+
+#include "SyntheticSignal.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <random>
+
+
+std::vector<double> SyntheticSignal(const SyntheticSignalConfig &config, size_t samples)
+{
+    constexpr double pi = 3.141592653589793;
+
+    std::vector<double> signal(samples);
+    std::mt19937 rng(config.seed);
+    std::normal_distribution<double> noise(0.0, 1.0);
+
+    const auto dt = 1.0 / config.sample_rate;
+    const auto noise_gain = std::pow(10.0, -config.snr_db / 20.0) / std::sqrt(2.0);
+    std::exponential_distribution<double> talk(config.talk_s > 0 ? 1.0 / config.talk_s : 1.0);
+    std::exponential_distribution<double> pause(config.pause_s > 0 ? 1.0 / config.pause_s : 1.0);
+    auto talking = true;
+    auto segment_end = config.talk_s > 0 ? talk(rng) : std::numeric_limits<double>::infinity();
+    double gain = 1;
+    double phase = 0;
+    for (size_t i = 0; i < samples; ++i) {
+        const auto t = i * dt;
+        // Pitch glides over a 1.3 s cycle, so neighbouring frames never repeat exactly.
+        const auto glide = 0.5 * (1 - std::cos(2 * pi * t / 1.3));
+        const auto f0 = config.f0_low_hz + (config.f0_high_hz - config.f0_low_hz) * glide;
+        phase += 2 * pi * f0 * dt;
+        double voiced = 0;
+        for (int h = 1; h <= config.harmonics; ++h) {
+            if (h * f0 < config.sample_rate / 2) {
+                voiced += std::sin(h * phase) / h;
+            }
+        }
+        const auto envelope = 0.5 * (1 - std::cos(2 * pi * config.syllable_hz * t));
+        if (t >= segment_end) {
+            talking = !talking;
+            segment_end = t + (talking ? talk(rng) : pause(rng));
+        }
+        // 10 ms ramps between talk and pause, so the cut does not click.
+        gain = std::min(1.0, std::max(0.0, gain + (talking ? dt : -dt) * 100));
+        signal[i] = gain * envelope * voiced + noise_gain * noise(rng);
+    }
+
+    const auto peak = std::max(1e-12, std::abs(*std::max_element(signal.begin(), signal.end(), [](double a, double b) {
+        return std::abs(a) < std::abs(b);
+    })));
+    for (auto &sample : signal) {
+        sample *= 0.5 / peak;
+    }
+    return signal;
+}
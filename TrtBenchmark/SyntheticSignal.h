@@ -0,0 +1,30 @@
+// SyntheticSignal.h: Deterministic speech-like test signals
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+
+struct SyntheticSignalConfig
+{
+    int sample_rate = 16000;
+    double f0_low_hz = 110.0;       //!< The pitch glides between low and high, like intonation.
+    double f0_high_hz = 220.0;
+    int harmonics = 12;
+    double syllable_hz = 4.0;       //!< Rate of the amplitude envelope.
+    double snr_db = 10.0;           //!< Voiced part over the white noise.
+    double talk_s = 0;              //!< Mean talk spurt length, continuous speech if 0.
+    double pause_s = 0;             //!< Mean pause between talk spurts, only noise is left in a pause.
+    uint32_t seed = 1;
+};
+
+//!
+//! \brief Voiced harmonics with a gliding pitch under a syllable-rate envelope plus white noise, peak near
+//!        0.5. The same config and length always give the same samples, so builds are compared on the same
+//!        input and no audio file is needed. With talk_s set, talk spurts and pauses alternate with
+//!        exponentially distributed lengths, like a conversation.
+//!
+std::vector<double> SyntheticSignal(const SyntheticSignalConfig &config, size_t samples);
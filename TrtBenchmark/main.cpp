@@ -0,0 +1,286 @@
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include "AudioUtils.h"
+#include "CpuKernels.h"
+#include "Harness.h"
+#include "SyntheticSignal.h"
+#include "common/arena.h"
+#include "common/staging.h"
+
+
+namespace {
+
+const int kDftSizes[] = {256, 512, 1024, 2048};
+
+// Distinct frames each case cycles through, so the input is not one cache-hot frame.
+constexpr size_t kFrames = 16;
+
+// Binding sizes of one NSNet stream: the feature and mask of 257 bins, one GRU state of 400.
+constexpr size_t kFeatureFloats = 257;
+constexpr size_t kStateFloats = 400;
+
+//!
+//! \brief Frame length of a dft size, 320 samples (20 ms at 16 kHz) for the 512 point DFT of the pipeline.
+//!
+int FrameLength(int dft_size)
+{
+    return dft_size * 5 / 8;
+}
+
+//!
+//! \brief Windowed frames cut from a synthetic signal, hopping half a frame.
+//!
+struct FrameSet
+{
+    explicit FrameSet(int dft_size) : dft_size(dft_size)
+    {
+        const auto frame_len = FrameLength(dft_size);
+        const auto signal = SyntheticSignal(SyntheticSignalConfig(), frame_len / 2 * (kFrames + 1));
+        const auto wind = utils::hamming(frame_len);
+        fft.init(dft_size);
+        for (size_t f = 0; f < kFrames; ++f) {
+            nc::NdArray<double> frame(1, frame_len);
+            for (int i = 0; i < frame_len; ++i) {
+                frame[i] = signal[f * frame_len / 2 + i] * wind[i];
+            }
+            frames.push_back(frame);
+            spectra.push_back(utils::stft(frame, fft, dft_size, false));
+            nc::NdArray<double> mag, phs;
+            utils::mag_phasor(spectra.back(), mag, phs);
+            mags.push_back(mag);
+            feats.push_back(utils::log_pow(mag, -120.0f));
+
+            nc::NdArray<float> complex(1, spectra.back().size());
+            std::copy(spectra.back().begin(), spectra.back().end(), complex.begin());
+            complex_floats.push_back(complex);
+        }
+    }
+
+    int dft_size;
+    audiofft::AudioFFT fft;
+    std::vector<nc::NdArray<double>> frames;
+    std::vector<nc::NdArray<double>> spectra;
+    std::vector<nc::NdArray<double>> mags;
+    std::vector<nc::NdArray<double>> feats;
+    std::vector<nc::NdArray<float>> complex_floats;
+};
+
+void AddAudioUtils(BenchRunner &runner)
+{
+    runner.Add("hamming", "size=320,hop=0.5", 320, "samples", [](uint64_t iterations) {
+        for (uint64_t i = 0; i < iterations; ++i) {
+            DoNotOptimize(utils::hamming(320, 0.5f));
+        }
+    });
+    for (const auto dft_size : kDftSizes) {
+        const auto frame_len = FrameLength(dft_size);
+        const auto params = "size=" + std::to_string(frame_len);
+        runner.Add("hamming", params, frame_len, "samples", [frame_len](uint64_t iterations) {
+            for (uint64_t i = 0; i < iterations; ++i) {
+                DoNotOptimize(utils::hamming(frame_len));
+            }
+        });
+    }
+
+    for (const auto dft_size : kDftSizes) {
+        const auto set = std::make_shared<FrameSet>(dft_size);
+        const auto params = "dft=" + std::to_string(dft_size);
+        const auto bins = static_cast<double>(dft_size / 2 + 1);
+
+        runner.Add("stft", params, FrameLength(dft_size), "samples", [set](uint64_t iterations) {
+            for (uint64_t i = 0; i < iterations; ++i) {
+                DoNotOptimize(utils::stft(set->frames[i % kFrames], set->fft, set->dft_size, false));
+            }
+        });
+        runner.Add("istft", params, dft_size, "samples", [set](uint64_t iterations) {
+            for (uint64_t i = 0; i < iterations; ++i) {
+                DoNotOptimize(utils::istft(set->complex_floats[i % kFrames], set->fft));
+            }
+        });
+        runner.Add("mag_phasor", params, bins, "bins", [set](uint64_t iterations) {
+            nc::NdArray<double> mag, phs;
+            for (uint64_t i = 0; i < iterations; ++i) {
+                utils::mag_phasor(set->spectra[i % kFrames], mag, phs);
+                DoNotOptimize(mag);
+            }
+        });
+        runner.Add("log_pow", params, bins, "bins", [set](uint64_t iterations) {
+            for (uint64_t i = 0; i < iterations; ++i) {
+                DoNotOptimize(utils::log_pow(set->mags[i % kFrames], -120.0f));
+            }
+        });
+        runner.Add("online_mvn", params, bins, "bins", [set](uint64_t iterations) {
+            auto mu = set->feats[0];
+            auto sigma_square = nc::square(mu);
+            auto feat = set->feats[0];
+            for (uint64_t i = 0; i < iterations; ++i) {
+                // Normalizes in place; the copy keeps the input realistic and costs one 2 KiB memcpy.
+                feat = set->feats[i % kFrames];
+                utils::onlineMVN_per_frame(feat, static_cast<int>(i), mu, sigma_square);
+                DoNotOptimize(feat);
+            }
+        });
+        runner.Add("frontend", params, FrameLength(dft_size) / 2, "samples", [set](uint64_t iterations) {
+            nc::NdArray<double> mag, phs;
+            auto mu = set->feats[0];
+            auto sigma_square = nc::square(mu);
+            for (uint64_t i = 0; i < iterations; ++i) {
+                utils::mag_phasor(utils::stft(set->frames[i % kFrames], set->fft, set->dft_size, false), mag, phs);
+                auto feat = utils::log_pow(mag, -120.0f);
+                utils::onlineMVN_per_frame(feat, static_cast<int>(i), mu, sigma_square);
+                DoNotOptimize(feat);
+            }
+        });
+    }
+}
+
+//!
+//! \brief Host side of the binding copies: converting the float views a stream sees to the binding precision,
+//!        and moving width streams' feature and state views into and out of one StagingLayout region.
+//!
+void AddBufferPaths(BenchRunner &runner)
+{
+    for (const size_t count : {kFeatureFloats, kFeatureFloats * 16, kFeatureFloats * 64}) {
+        const auto params = "count=" + std::to_string(count);
+        const auto floats = std::make_shared<kernels::AlignedVector<float>>(count, 0.25f);
+        const auto halves = std::make_shared<std::vector<uint16_t>>(count);
+        const auto values = static_cast<double>(count);
+        runner.Add("float_to_half", params, values, "values", [floats, halves](uint64_t iterations) {
+            for (uint64_t i = 0; i < iterations; ++i) {
+                kernels::FloatToHalf(floats->data(), halves->data(), floats->size());
+                DoNotOptimize(halves->data());
+            }
+        });
+        runner.Add("half_to_float", params, values, "values", [floats, halves](uint64_t iterations) {
+            for (uint64_t i = 0; i < iterations; ++i) {
+                kernels::HalfToFloat(halves->data(), floats->data(), halves->size());
+                DoNotOptimize(floats->data());
+            }
+        });
+    }
+
+    for (const size_t width : {1, 4, 16, 64}) {
+        for (const auto half : {false, true}) {
+            const auto element = half ? sizeof(uint16_t) : sizeof(float);
+            std::vector<size_t> bytes;
+            std::vector<bool> is_input;
+            for (size_t s = 0; s < width; ++s) {
+                bytes.insert(bytes.end(), {kFeatureFloats * element, kStateFloats * element});
+                is_input.insert(is_input.end(), {true, true});
+            }
+            const auto layout = std::make_shared<samplesCommon::StagingLayout>(bytes, is_input, 256);
+            const auto views_bytes = width * (kFeatureFloats + kStateFloats) * sizeof(float);
+            auto views = samplesCommon::ArenaPool::instance().acquire(views_bytes);
+            auto region = samplesCommon::ArenaPool::instance().acquire(layout->inputBytes());
+            auto *view_base = static_cast<float *>(views->carve(views_bytes));
+            auto *region_base = static_cast<char *>(region->carve(layout->inputBytes()));
+            std::fill_n(view_base, views_bytes / sizeof(float), 0.5f);
+
+            const auto params = "width=" + std::to_string(width) + ",precision=" + (half ? "fp16" : "fp32");
+            const auto total = static_cast<double>(views_bytes);
+            const auto copy = [layout, view_base, region_base, half](bool gather) {
+                auto *view = view_base;
+                for (int b = 0; b < layout->nbBindings(); ++b) {
+                    const auto count = layout->view(b).bytes / (half ? sizeof(uint16_t) : sizeof(float));
+                    auto *staged = region_base + layout->view(b).offset;
+                    if (half && gather) {
+                        kernels::FloatToHalf(view, reinterpret_cast<uint16_t *>(staged), count);
+                    } else if (half) {
+                        kernels::HalfToFloat(reinterpret_cast<const uint16_t *>(staged), view, count);
+                    } else if (gather) {
+                        memcpy(staged, view, count * sizeof(float));
+                    } else {
+                        memcpy(view, staged, count * sizeof(float));
+                    }
+                    view += count;
+                }
+            };
+            runner.Add("staging_gather", params, total, "bytes", [copy, views, region](uint64_t iterations) {
+                for (uint64_t i = 0; i < iterations; ++i) {
+                    copy(true);
+                    DoNotOptimize(region);
+                }
+            });
+            runner.Add("staging_scatter", params, total, "bytes", [copy, views, region](uint64_t iterations) {
+                for (uint64_t i = 0; i < iterations; ++i) {
+                    copy(false);
+                    DoNotOptimize(views);
+                }
+            });
+        }
+
+        const auto slab_bytes = width * (kFeatureFloats * 2 + kStateFloats * 2) * sizeof(float);
+        runner.Add("arena_acquire", "width=" + std::to_string(width), 1, "slabs", [slab_bytes](uint64_t iterations) {
+            for (uint64_t i = 0; i < iterations; ++i) {
+                DoNotOptimize(samplesCommon::ArenaPool::instance().acquire(slab_bytes));
+            }
+        });
+    }
+}
+
+void PrintUsage(const char *prog)
+{
+    std::cout << "Usage: " << prog << " [options]" << std::endl;
+    std::cout << "Options:" << std::endl;
+    std::cout << "  --filter text                   Only run cases whose name/params contain text." << std::endl;
+    std::cout << "  --format text|json|csv          Report format, default text." << std::endl;
+    std::cout << "  --out file                      Write the report to file instead of stdout." << std::endl;
+    std::cout << "  --min-time ms                   Time of one repetition, default 100." << std::endl;
+    std::cout << "  --repetitions n                 Repetitions for median/min/max, default 5." << std::endl;
+    std::cout << "  --list                          List the cases and exit." << std::endl;
+}
+
+}
+
+int main(int argc, char **argv)
+{
+    BenchConfig config;
+    std::string out_path;
+    auto list = false;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+            config.filter = argv[++i];
+        } else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+            const std::string format = argv[++i];
+            config.format = format == "json" ? ReportFormat::kJson
+                          : format == "csv"  ? ReportFormat::kCsv
+                                             : ReportFormat::kText;
+        } else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+            out_path = argv[++i];
+        } else if (strcmp(argv[i], "--min-time") == 0 && i + 1 < argc) {
+            config.min_time_ms = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--repetitions") == 0 && i + 1 < argc) {
+            config.repetitions = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--list") == 0) {
+            list = true;
+        } else {
+            PrintUsage(argv[0]);
+            return -1;
+        }
+    }
+
+    BenchRunner runner(config);
+    AddAudioUtils(runner);
+    AddBufferPaths(runner);
+    if (list) {
+        runner.List(std::cout);
+        return 0;
+    }
+
+    runner.Run();
+    if (out_path.empty()) {
+        runner.Report(std::cout);
+        return 0;
+    }
+    std::ofstream out(out_path);
+    if (!out) {
+        std::cerr << "Error: Unable to write report: " << out_path << std::endl;
+        return 1;
+    }
+    runner.Report(out);
+    return 0;
+}
@@ -0,0 +1,186 @@
+// AllocTracker.cpp: Impl, and the replacement global operator new/delete
+//
+
+#include "AllocTracker.h"
+
+#include <cstdlib>
+#include <new>
+
+
+namespace {
+
+// Trivial, so the thread-local needs no initialization guard and is safe to touch from operator new.
+struct ThreadAllocState
+{
+    uint64_t allocations;
+    uint64_t bytes;
+    uint64_t violations;
+    bool guard;
+};
+
+thread_local ThreadAllocState g_alloc;
+
+}
+
+uint64_t AllocTracker::ThreadAllocations()
+{
+    return g_alloc.allocations;
+}
+
+uint64_t AllocTracker::ThreadAllocatedBytes()
+{
+    return g_alloc.bytes;
+}
+
+void AllocTracker::ArmGuard()
+{
+    g_alloc.guard = true;
+}
+
+void AllocTracker::DisarmGuard()
+{
+    g_alloc.guard = false;
+}
+
+uint64_t AllocTracker::ThreadViolations()
+{
+    return g_alloc.violations;
+}
+
+#ifdef TRT_EXECUTOR_ALLOC_TRACKING
+
+namespace {
+
+void Count(size_t size)
+{
+    auto &state = g_alloc;
+    ++state.allocations;
+    state.bytes += size;
+    if (state.guard) {
+        ++state.violations;
+    }
+}
+
+void *Allocate(size_t size)
+{
+    Count(size);
+    return malloc(size ? size : 1);
+}
+
+void *AllocateAligned(size_t size, std::align_val_t alignment)
+{
+    Count(size);
+    const auto align = static_cast<size_t>(alignment);
+    void *p = nullptr;
+    return posix_memalign(&p, align < sizeof(void *) ? sizeof(void *) : align, size ? size : 1) == 0 ? p : nullptr;
+}
+
+}
+
+void *operator new(size_t size)
+{
+    if (auto *p = Allocate(size)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept
+{
+    return Allocate(size);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept
+{
+    return Allocate(size);
+}
+
+void *operator new(size_t size, std::align_val_t alignment)
+{
+    if (auto *p = AllocateAligned(size, alignment)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void *operator new[](size_t size, std::align_val_t alignment)
+{
+    return operator new(size, alignment);
+}
+
+void *operator new(size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept
+{
+    return AllocateAligned(size, alignment);
+}
+
+void *operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept
+{
+    return AllocateAligned(size, alignment);
+}
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept
+{
+    free(p);
+}
+
+void operator delete(void *p, const std::nothrow_t &) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void *p, const std::nothrow_t &) noexcept
+{
+    free(p);
+}
+
+void operator delete(void *p, std::align_val_t) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void *p, std::align_val_t) noexcept
+{
+    free(p);
+}
+
+void operator delete(void *p, size_t, std::align_val_t) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void *p, size_t, std::align_val_t) noexcept
+{
+    free(p);
+}
+
+void operator delete(void *p, std::align_val_t, const std::nothrow_t &) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void *p, std::align_val_t, const std::nothrow_t &) noexcept
+{
+    free(p);
+}
+
+#endif
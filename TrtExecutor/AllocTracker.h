@@ -0,0 +1,45 @@
+// AllocTracker.h: Per-thread heap allocation counters and a zero-allocation guard
+//
+
+#pragma once
+
+#include <cstdint>
+
+
+//!
+//! \brief Counts the operator new calls of every thread, by replacing the global operator new/delete
+//!        (AllocTracker.cpp) when built with TRT_EXECUTOR_ALLOC_TRACKING.
+//!
+//! \details The counters are plain thread-locals, so counting costs an increment and no synchronization.
+//!          A thread can arm the guard, after which its allocations are also counted as violations; that is
+//!          how a steady-state loop proves it does not allocate. Without TRT_EXECUTOR_ALLOC_TRACKING every
+//!          count reads zero and the guard never trips.
+//!
+class AllocTracker
+{
+public:
+#ifdef TRT_EXECUTOR_ALLOC_TRACKING
+    static constexpr bool kEnabled = true;
+#else
+    static constexpr bool kEnabled = false;
+#endif
+
+    //!
+    //! \brief Allocations made by the calling thread so far.
+    //!
+    static uint64_t ThreadAllocations();
+
+    static uint64_t ThreadAllocatedBytes();
+
+    //!
+    //! \brief Count every following allocation of the calling thread as a violation, until DisarmGuard.
+    //!
+    static void ArmGuard();
+
+    static void DisarmGuard();
+
+    //!
+    //! \brief Allocations of the calling thread while its guard was armed.
+    //!
+    static uint64_t ThreadViolations();
+};
@@ -6,30 +6,45 @@
 #include "AudioFFT.h"
 
 
+utils::StftScratch::StftScratch(uint32_t dft_size)
+    : input(dft_size),
+      out_re(audiofft::AudioFFT::ComplexSize(dft_size)),
+      out_im(audiofft::AudioFFT::ComplexSize(dft_size))
+{
+}
+
 nc::NdArray<double> utils::stft(const nc::NdArray<double> &frame, audiofft::AudioFFT &fft, uint32_t dft_size, bool zero_phase)
 {
     auto size = audiofft::AudioFFT::ComplexSize(dft_size);
     nc::NdArray<double> ret(1, 2 * size);
 
-    std::vector<float> input(dft_size);
-    std::vector<float> out_re(size);
-    std::vector<float> out_im(size);
+    StftScratch scratch(dft_size);
+    stft(frame.data(), frame.size(), fft, dft_size, zero_phase, scratch, ret.data());
+
+    return ret;
+}
 
-    if (!zero_phase || frame.size() >= dft_size) {
-        auto cp_size = std::min(dft_size, frame.size());
-        std::copy_n(frame.data(), cp_size, input.data());
+void utils::stft(const double *frame, uint32_t frame_len, audiofft::AudioFFT &fft, uint32_t dft_size, bool zero_phase,
+                 StftScratch &scratch, double *complex)
+{
+    auto size = audiofft::AudioFFT::ComplexSize(dft_size);
+    auto &input = scratch.input;
+    auto &out_re = scratch.out_re;
+    auto &out_im = scratch.out_im;
+
+    std::fill(input.begin(), input.end(), 0.f);
+    if (!zero_phase || frame_len >= dft_size) {
+        auto cp_size = std::min(dft_size, frame_len);
+        std::copy_n(frame, cp_size, input.data());
     } else {
-        auto f_size = frame.size();
-        auto offset = f_size / 2;
-        std::copy_n(frame.data() + offset, frame.size() - offset, input.data());
-        std::copy_n(frame.data(), offset, input.data() + dft_size - offset);
+        auto offset = frame_len / 2;
+        std::copy_n(frame + offset, frame_len - offset, input.data());
+        std::copy_n(frame, offset, input.data() + dft_size - offset);
     }
 
     fft.fft(input.data(), out_re.data(), out_im.data());
-    std::copy_n(out_re.data(), size, ret.data());
-    std::copy_n(out_im.data(), size, ret.data() + size);
-
-    return ret;
+    std::copy_n(out_re.data(), size, complex);
+    std::copy_n(out_im.data(), size, complex + size);
 }
 
 nc::NdArray<float> utils::istft(const nc::NdArray<float> &complex, audiofft::AudioFFT &fft)
@@ -38,17 +53,27 @@ nc::NdArray<float> utils::istft(const nc::NdArray<float> &complex, audiofft::Aud
     auto dft_size = (count - 1) * 2;
     nc::NdArray<float> output(1, dft_size);
 
-    fft.ifft(output.data(), complex.data(), complex.data() + count);
+    istft(complex.data(), count, fft, output.data());
 
     return output;
 }
 
+void utils::istft(const float *complex, uint32_t count, audiofft::AudioFFT &fft, float *output)
+{
+    fft.ifft(output, complex, complex + count);
+}
+
 void utils::mag_phasor(const nc::NdArray<double> &complex, nc::NdArray<double> &mag, nc::NdArray<double> &unit)
 {
     auto count = complex.size() / 2;
     mag = nc::NdArray<double>(1, count);
     unit = nc::NdArray<double>(1, 2 * count);
 
+    mag_phasor(complex.data(), count, mag.data(), unit.data());
+}
+
+void utils::mag_phasor(const double *complex, uint32_t count, double *mag, double *unit)
+{
     for (unsigned i = 0; i < count; ++i) {
         auto hypot = std::hypot(complex[i], complex[i + count]);
         mag[i] = hypot;
@@ -63,30 +88,43 @@ void utils::mag_phasor(const nc::NdArray<double> &complex, nc::NdArray<double> &
 }
 
 nc::NdArray<double> utils::log_pow(const nc::NdArray<double> &sig, float floor)
+{
+    nc::NdArray<double> pspec(1, sig.size());
+    log_pow(sig.data(), sig.size(), pspec.data(), floor);
+
+    return pspec;
+}
+
+void utils::log_pow(const double *sig, uint32_t count, double *out, float floor)
 {
     constexpr double e = 2.718281828459045;
-    auto log10e = nc::log10(e);
-    auto pspec = nc::square(sig);
+    auto log10e = std::log10(e);
     auto non_zero_min = std::numeric_limits<double>::max();
-    for (auto p : pspec) {
-        if (p > 0 && p < non_zero_min) {
-            non_zero_min = p;
+    for (unsigned i = 0; i < count; ++i) {
+        out[i] = sig[i] * sig[i];
+        if (out[i] > 0 && out[i] < non_zero_min) {
+            non_zero_min = out[i];
         }
     }
     if (non_zero_min != std::numeric_limits<double>::max()) {
         auto zero_floor = std::log(non_zero_min) + floor / 10. / log10e;
-        std::transform(pspec.begin(), pspec.end(), pspec.begin(), [zero_floor](double v) {
+        std::transform(out, out + count, out, [zero_floor](double v) {
             return v == 0 ? zero_floor : std::log(v);
             });
     } else {
-        pspec.fill(-80. / 10. / log10e);
+        std::fill_n(out, count, -80. / 10. / log10e);
     }
-
-    return pspec;
 }
 
 void utils::onlineMVN_per_frame(nc::NdArray<double> &feat, int frame_count, nc::NdArray<double> &mu, nc::NdArray<double> &sigma_square,
                                 double frame_shift, double tau_feat, double tau_feat_init, double t_init)
+{
+    onlineMVN_per_frame(feat.data(), feat.size(), frame_count, mu.data(), sigma_square.data(), frame_shift, tau_feat,
+                        tau_feat_init, t_init);
+}
+
+void utils::onlineMVN_per_frame(double *feat, uint32_t count, int frame_count, double *mu, double *sigma_square,
+                                double frame_shift, double tau_feat, double tau_feat_init, double t_init)
 {
     constexpr double sigma_eps = 1e-12;
 
@@ -96,21 +134,16 @@ void utils::onlineMVN_per_frame(nc::NdArray<double> &feat, int frame_count, nc::
 
     auto alpha = frame_count < n_init_frames ? alpha_feat_init : alpha_feat;
 
-    mu *= alpha;
-    mu += (1 - alpha) * feat;
-    sigma_square *= alpha;
-    sigma_square += (1 - alpha) * nc::square(feat);
+    for (unsigned i = 0; i < count; ++i) {
+        mu[i] = mu[i] * alpha + (1 - alpha) * feat[i];
+        sigma_square[i] = sigma_square[i] * alpha + (1 - alpha) * (feat[i] * feat[i]);
 
-    auto sigma_raw = sigma_square - nc::square(mu);
-    for (auto &s : sigma_raw) {
-        if (s < sigma_eps) {
-            s = sigma_eps;
+        auto sigma_raw = sigma_square[i] - mu[i] * mu[i];
+        if (sigma_raw < sigma_eps) {
+            sigma_raw = sigma_eps;
         }
+        feat[i] = (feat[i] - mu[i]) / std::sqrt(sigma_raw);
     }
-    auto sigma = nc::sqrt(sigma_raw);
-
-    feat -= mu;
-    feat /= sigma;
 }
 
 static nc::NdArray<double> hamming_window(int size, int wind_size = -1)
@@ -1,23 +1,57 @@
 #pragma once
 
+#include <vector>
+
 #include "NumCpp.hpp"
 #include "AudioFFT.h"
 
 
 namespace utils {
 
+//!
+//! \brief Work buffers of the stft below, sized once for a dft size.
+//!
+struct StftScratch
+{
+    explicit StftScratch(uint32_t dft_size = 0);
+
+    std::vector<float> input;
+    std::vector<float> out_re;
+    std::vector<float> out_im;
+};
+
 nc::NdArray<double> stft(const nc::NdArray<double> &frame, audiofft::AudioFFT &fft, uint32_t dft_size, bool zero_phase = false);
 
+//!
+//! \brief Same as above without allocating: complex receives the dft_size / 2 + 1 real parts, then as many
+//!        imaginary parts.
+//!
+void stft(const double *frame, uint32_t frame_len, audiofft::AudioFFT &fft, uint32_t dft_size, bool zero_phase,
+          StftScratch &scratch, double *complex);
+
 nc::NdArray<float> istft(const nc::NdArray<float> &complex, audiofft::AudioFFT &fft);
 
+//!
+//! \brief complex holds count real parts then count imaginary parts, output receives (count - 1) * 2 samples.
+//!
+void istft(const float *complex, uint32_t count, audiofft::AudioFFT &fft, float *output);
+
 void mag_phasor(const nc::NdArray<double> &complex, nc::NdArray<double> &mag, nc::NdArray<double> &unit);
 
+void mag_phasor(const double *complex, uint32_t count, double *mag, double *unit);
+
 nc::NdArray<double> log_pow(const nc::NdArray<double> &sig, float floor = -30.0f);
 
+void log_pow(const double *sig, uint32_t count, double *out, float floor = -30.0f);
+
 void onlineMVN_per_frame(nc::NdArray<double> &feat, int frame_count, nc::NdArray<double> &mu,
                          nc::NdArray<double> &sigma_square, double frame_shift = 0.01, double tau_feat = 3,
                          double tau_feat_init = 0.1, double t_init = 0.1);
 
+void onlineMVN_per_frame(double *feat, uint32_t count, int frame_count, double *mu, double *sigma_square,
+                         double frame_shift = 0.01, double tau_feat = 3, double tau_feat_init = 0.1,
+                         double t_init = 0.1);
+
 nc::NdArray<double> hamming(int window_size, float hop = 0.0f);
 
 }
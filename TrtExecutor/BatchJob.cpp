@@ -0,0 +1,349 @@
+// BatchJob.cpp: Impl
+//
+
+#include "BatchJob.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <numeric>
+#include <sstream>
+
+
+namespace {
+
+std::vector<std::string> SplitTabs(const std::string &line)
+{
+    std::vector<std::string> fields;
+    std::istringstream stream(line);
+    for (std::string field; std::getline(stream, field, '\t');) {
+        fields.push_back(field);
+    }
+    return fields;
+}
+
+//!
+//! \brief Messages end up in one field of a report line.
+//!
+std::string OneField(std::string text)
+{
+    std::replace_if(text.begin(), text.end(), [](char c) { return c == '\t' || c == '\n' || c == '\r'; }, ' ');
+    return text;
+}
+
+//!
+//! \brief Path segments with "." and "dir/.." removed; an absolute path starts with a "/" segment.
+//!
+std::vector<std::string> NormalizedSegments(const std::string &path)
+{
+    std::vector<std::string> segments;
+    if (!path.empty() && path[0] == '/') {
+        segments.emplace_back("/");
+    }
+    std::istringstream stream(path);
+    for (std::string segment; std::getline(stream, segment, '/');) {
+        if (segment.empty() || segment == ".") {
+            continue;
+        }
+        if (segment == ".." && !segments.empty() && segments.back() != ".." && segments.back() != "/") {
+            segments.pop_back();
+            continue;
+        }
+        segments.push_back(segment);
+    }
+    return segments;
+}
+
+uint64_t PathHash(const std::string &path)
+{
+    // FNV-1a, the same on every node, unlike std::hash.
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (const auto c : path) {
+        hash = (hash ^ static_cast<unsigned char>(c)) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+double Percentile(std::vector<double> values, double fraction)
+{
+    if (values.empty()) {
+        return 0.0;
+    }
+    const auto index = static_cast<size_t>(fraction * (values.size() - 1) + 0.5);
+    std::nth_element(values.begin(), values.begin() + index, values.end());
+    return values[index];
+}
+
+}
+
+bool LoadManifest(const std::string &path, std::vector<ManifestEntry> &entries)
+{
+    std::ifstream file(path);
+    if (!file) {
+        std::cerr << "Error: Unable to open manifest: " << path << std::endl;
+        return false;
+    }
+    entries.clear();
+    for (std::string line; std::getline(file, line);) {
+        if (line.empty()) {
+            continue;
+        }
+        const auto tab = line.find('\t');
+        // Only what the manifest says, so every node reading it gets the same entries whatever files it sees.
+        ManifestEntry entry{line.substr(0, tab), 0, tab != std::string::npos, {}};
+        if (entry.weighed) {
+            entry.weight = std::strtoull(line.c_str() + tab + 1, nullptr, 10);
+        }
+        entries.push_back(std::move(entry));
+    }
+    return AssignOutputNames(entries);
+}
+
+bool AssignOutputNames(std::vector<ManifestEntry> &entries)
+{
+    std::vector<std::vector<std::string>> segments;
+    segments.reserve(entries.size());
+    for (const auto &entry : entries) {
+        segments.push_back(NormalizedSegments(entry.path));
+    }
+    // The directories, not the file name, of the first entry bound the shared prefix.
+    size_t prefix = segments.empty() || segments[0].empty() ? 0 : segments[0].size() - 1;
+    for (const auto &path : segments) {
+        const auto dirs = path.empty() ? 0 : path.size() - 1;
+        prefix = std::min(prefix, dirs);
+        for (size_t i = 0; i < prefix; ++i) {
+            if (path[i] != segments[0][i]) {
+                prefix = i;
+                break;
+            }
+        }
+    }
+
+    std::map<std::string, const std::string *> owners;
+    for (size_t i = 0; i < entries.size(); ++i) {
+        std::string output;
+        for (size_t k = prefix; k < segments[i].size(); ++k) {
+            if (segments[i][k] == ".." || segments[i][k] == "/") {
+                std::cerr << "Error: output of " << entries[i].path << " would leave the output directory, list "
+                          << "files below one directory." << std::endl;
+                return false;
+            }
+            output += (output.empty() ? "" : "/") + segments[i][k];
+        }
+        if (output.empty()) {
+            std::cerr << "Error: " << entries[i].path << " is not a file path." << std::endl;
+            return false;
+        }
+        const auto owner = owners.emplace(output, &entries[i].path);
+        if (!owner.second) {
+            std::cerr << "Error: " << entries[i].path << " and " << *owner.first->second << " would both be written "
+                      << "to " << output << "." << std::endl;
+            return false;
+        }
+        entries[i].output = std::move(output);
+    }
+    return true;
+}
+
+std::vector<ManifestEntry> ShardManifest(const std::vector<ManifestEntry> &entries, int index, int count)
+{
+    if (count <= 1) {
+        return entries;
+    }
+    std::vector<bool> mine(entries.size(), false);
+    const auto weighed = std::all_of(entries.begin(), entries.end(), [](const ManifestEntry &e) { return e.weighed; });
+    if (!weighed) {
+        // Without a weight for every entry the paths are all every node is sure to agree on.
+        for (size_t i = 0; i < entries.size(); ++i) {
+            mine[i] = PathHash(entries[i].path) % count == static_cast<uint64_t>(index);
+        }
+    } else {
+        std::vector<size_t> order(entries.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::sort(order.begin(), order.end(), [&entries](size_t a, size_t b) {
+            if (entries[a].weight != entries[b].weight) {
+                return entries[a].weight > entries[b].weight;
+            }
+            return entries[a].path != entries[b].path ? entries[a].path < entries[b].path : a < b;
+        });
+
+        std::vector<uint64_t> loads(count, 0);
+        for (const auto i : order) {
+            const auto lightest = std::min_element(loads.begin(), loads.end()) - loads.begin();
+            // Weightless entries would all pile on shard 0, count each as one so they spread too.
+            loads[lightest] += std::max<uint64_t>(1, entries[i].weight);
+            mine[i] = lightest == index;
+        }
+    }
+    std::vector<ManifestEntry> shard;
+    for (size_t i = 0; i < entries.size(); ++i) {
+        if (mine[i]) {
+            shard.push_back(entries[i]);
+        }
+    }
+    return shard;
+}
+
+bool BatchReportWriter::Open(const std::string &path, int shard, int shards, size_t files, size_t skipped)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    out_.open(path, std::ios::app);
+    if (!out_) {
+        std::cerr << "Error: Unable to open batch report: " << path << std::endl;
+        return false;
+    }
+    const auto start_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    out_ << "run\t" << shard << '\t' << shards << '\t' << files << '\t' << skipped << '\t' << start_ms << std::endl;
+    return true;
+}
+
+void BatchReportWriter::File(const std::string &path, bool ok, double audio_seconds, double process_seconds,
+                             const std::string &message)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    out_ << "file\t" << (ok ? "ok" : "error") << '\t' << OneField(path) << '\t' << audio_seconds << '\t'
+         << process_seconds << '\t' << OneField(message) << std::endl;
+}
+
+void BatchReportWriter::End(double wall_seconds)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    out_ << "end\t" << wall_seconds << std::endl;
+}
+
+int MergeBatchReports(const std::vector<std::string> &paths, std::ostream &out)
+{
+    struct FileRecord
+    {
+        int shard;
+        bool ok;
+        double audio_seconds;
+        double process_seconds;
+        std::string message;
+    };
+    struct ShardSummary
+    {
+        int runs = 0;
+        int unfinished_runs = 0;
+        bool finished = false;      //!< The last run ended, earlier ones may have been killed and resumed.
+        double wall_seconds = 0.0;
+    };
+
+    auto shards = 0;
+    auto malformed = false;
+    std::map<int, ShardSummary> summaries;
+    std::map<std::string, FileRecord> files;
+    for (const auto &path : paths) {
+        std::ifstream report(path);
+        if (!report) {
+            std::cerr << "Error: Unable to open batch report: " << path << std::endl;
+            return 1;
+        }
+        auto shard = -1;
+        auto in_run = false;
+        std::string line;
+        for (int number = 1; std::getline(report, line); ++number) {
+            if (line.empty()) {
+                continue;
+            }
+            const auto fields = SplitTabs(line);
+            if (fields.size() >= 3 && fields[0] == "run") {
+                if (in_run) {
+                    ++summaries[shard].unfinished_runs;
+                }
+                shard = std::atoi(fields[1].c_str());
+                shards = std::max(shards, std::atoi(fields[2].c_str()));
+                ++summaries[shard].runs;
+                summaries[shard].finished = false;
+                in_run = true;
+            } else if (fields.size() >= 5 && fields[0] == "file" && shard >= 0) {
+                files[fields[2]] = FileRecord{shard, fields[1] == "ok", std::atof(fields[3].c_str()),
+                                              std::atof(fields[4].c_str()), fields.size() > 5 ? fields[5] : ""};
+            } else if (fields.size() >= 2 && fields[0] == "end" && in_run) {
+                summaries[shard].wall_seconds += std::atof(fields[1].c_str());
+                summaries[shard].finished = true;
+                in_run = false;
+            } else {
+                std::cerr << "Error: Malformed batch report line at " << path << ":" << number << std::endl;
+                malformed = true;
+            }
+        }
+        if (in_run) {
+            ++summaries[shard].unfinished_runs;
+        }
+    }
+
+    struct Totals
+    {
+        size_t ok = 0;
+        size_t errors = 0;
+        double audio_seconds = 0.0;
+        double process_seconds = 0.0;
+    };
+    std::map<int, Totals> shard_totals;
+    Totals totals;
+    std::vector<double> latencies;
+    for (const auto &file : files) {
+        const auto &record = file.second;
+        for (auto *t : {&shard_totals[record.shard], &totals}) {
+            ++(record.ok ? t->ok : t->errors);
+            t->audio_seconds += record.audio_seconds;
+            t->process_seconds += record.process_seconds;
+        }
+        if (record.ok) {
+            latencies.push_back(record.process_seconds);
+        }
+    }
+
+    out << std::fixed << std::setprecision(2);
+    auto elapsed = 0.0;
+    auto wall_sum = 0.0;
+    auto finished = true;
+    for (const auto &summary : summaries) {
+        const auto &t = shard_totals[summary.first];
+        const auto &s = summary.second;
+        out << "shard " << summary.first << "/" << shards << ": " << t.ok << " ok, " << t.errors << " failed, "
+            << t.audio_seconds << " s of audio in " << s.wall_seconds << " s wall (" << s.runs << " runs";
+        if (s.unfinished_runs > 0) {
+            out << ", " << s.unfinished_runs << " unfinished";
+        }
+        out << "), " << (s.wall_seconds > 0.0 ? t.audio_seconds / s.wall_seconds : 0.0) << "x real time"
+            << std::endl;
+        elapsed = std::max(elapsed, s.wall_seconds);
+        wall_sum += s.wall_seconds;
+        finished = finished && s.finished;
+    }
+    std::vector<int> missing;
+    for (int i = 0; i < shards; ++i) {
+        if (summaries.count(i) == 0) {
+            missing.push_back(i);
+        }
+    }
+
+    out << "total: " << totals.ok << " ok, " << totals.errors << " failed, " << totals.audio_seconds / 3600.0
+        << " h of audio, " << totals.process_seconds << " s processing" << std::endl;
+    if (elapsed > 0.0) {
+        out << "throughput: " << totals.audio_seconds / elapsed << "x real time, "
+            << (totals.ok + totals.errors) / elapsed << " files/s over " << elapsed << " s, shard imbalance "
+            << elapsed / (wall_sum / summaries.size()) << std::endl;
+    }
+    out << "per file: p50 " << Percentile(latencies, 0.5) * 1e3 << " ms, p90 " << Percentile(latencies, 0.9) * 1e3
+        << " ms, max " << Percentile(latencies, 1.0) * 1e3 << " ms" << std::endl;
+    if (!missing.empty()) {
+        out << "missing shards:";
+        for (const auto i : missing) {
+            out << " " << i;
+        }
+        out << std::endl;
+    }
+    for (const auto &file : files) {
+        if (!file.second.ok) {
+            out << "failed: " << file.first << ": " << file.second.message << std::endl;
+        }
+    }
+    return totals.errors == 0 && missing.empty() && finished && !malformed ? 0 : 1;
+}
@@ -0,0 +1,76 @@
+// BatchJob.h: Manifest sharding and result reports of batch runs split across processes or machines
+//
+
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <iosfwd>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+struct ManifestEntry
+{
+    std::string path;
+    uint64_t weight;        //!< Relative processing cost as the manifest gives it, 0 without one.
+    bool weighed;           //!< False if the manifest gives no weight.
+    std::string output;     //!< Path of the result under the output directory, see AssignOutputNames.
+};
+
+//!
+//! \brief Load a manifest: one input path per line, optionally followed by a tab and a weight (the length
+//!        in samples, say). The entries depend on the manifest alone, not on the files this node sees. Empty
+//!        lines are skipped, output names are assigned. Returns false after printing an error if the file
+//!        cannot be read or AssignOutputNames fails.
+//!
+bool LoadManifest(const std::string &path, std::vector<ManifestEntry> &entries);
+
+//!
+//! \brief Name the result of every entry by its path relative to the deepest directory all entries share,
+//!        so files of the same name in different directories do not overwrite each other, and every node
+//!        derives the same names from the same manifest. Returns false after printing an error if two entries
+//!        get the same name or a name would leave the output directory.
+//!
+bool AssignOutputNames(std::vector<ManifestEntry> &entries);
+
+//!
+//! \brief The entries of shard index of count, in manifest order. Entries go heaviest first to the lightest
+//!        shard so far, ties broken by path and shard index, so every node computes the same partition from
+//!        the same manifest without talking to the others. If any line of the manifest gives no weight, all
+//!        entries are partitioned by a hash of their path instead.
+//!
+std::vector<ManifestEntry> ShardManifest(const std::vector<ManifestEntry> &entries, int index, int count);
+
+//!
+//! \brief Appends the records of a batch run to the report of its shard, flushed per file so a killed run
+//!        leaves what it finished. Every run of a shard appends to the same report, which MergeBatchReports
+//!        reads back. Safe to use from several workers.
+//!
+//! \details Tab-separated lines:
+//!          run   shard  shards  files  skipped  start-unix-ms
+//!          file  ok|error  path  audio-seconds  process-seconds  message
+//!          end   wall-seconds
+//!
+class BatchReportWriter
+{
+public:
+    bool Open(const std::string &path, int shard, int shards, size_t files, size_t skipped);
+
+    void File(const std::string &path, bool ok, double audio_seconds, double process_seconds,
+              const std::string &message = {});
+
+    void End(double wall_seconds);
+
+private:
+    std::mutex mutex_;
+    std::ofstream out_;
+};
+
+//!
+//! \brief Combine shard reports into per-shard and global throughput and the list of failed files.
+//!        The last record of a path wins, so files a resumed run retried count once. Returns 0 if every
+//!        shard reported, the last run of each finished and no file failed, 1 otherwise.
+//!
+int MergeBatchReports(const std::vector<std::string> &paths, std::ostream &out);
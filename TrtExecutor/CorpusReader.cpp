@@ -0,0 +1,600 @@
+// CorpusReader.cpp: Impl
+//
+
+#include "CorpusReader.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <sndfile.hh>
+
+#include "Timeline.h"
+
+
+namespace {
+
+constexpr unsigned kRingEntries = 64;
+
+//!
+//! \brief libsndfile virtual I/O over the bytes of a file read into memory.
+//!
+struct MemoryFile
+{
+    const std::vector<char> *bytes;
+    sf_count_t offset;
+
+    static sf_count_t Length(void *user)
+    {
+        return static_cast<sf_count_t>(static_cast<MemoryFile *>(user)->bytes->size());
+    }
+
+    static sf_count_t Seek(sf_count_t offset, int whence, void *user)
+    {
+        auto *file = static_cast<MemoryFile *>(user);
+        const auto size = static_cast<sf_count_t>(file->bytes->size());
+        const auto base = whence == SEEK_SET ? 0 : whence == SEEK_CUR ? file->offset : size;
+        file->offset = std::max<sf_count_t>(0, std::min(size, base + offset));
+        return file->offset;
+    }
+
+    static sf_count_t Read(void *ptr, sf_count_t count, void *user)
+    {
+        auto *file = static_cast<MemoryFile *>(user);
+        const auto size = static_cast<sf_count_t>(file->bytes->size());
+        const auto n = std::max<sf_count_t>(0, std::min(count, size - file->offset));
+        if (n > 0) {
+            memcpy(ptr, file->bytes->data() + file->offset, static_cast<size_t>(n));
+            file->offset += n;
+        }
+        return n;
+    }
+
+    static sf_count_t Write(const void *ptr, sf_count_t count, void *user)
+    {
+        return 0;
+    }
+
+    static sf_count_t Tell(void *user)
+    {
+        return static_cast<MemoryFile *>(user)->offset;
+    }
+};
+
+void DecodeBytes(const std::vector<char> &bytes, CorpusFile &file)
+{
+    MemoryFile memory{&bytes, 0};
+    SF_VIRTUAL_IO io{MemoryFile::Length, MemoryFile::Seek, MemoryFile::Read, MemoryFile::Write, MemoryFile::Tell};
+    SndfileHandle snd_file(io, &memory);
+    if (!snd_file || snd_file.channels() <= 0) {
+        file.error = std::string("Unable to decode: ") + snd_file.strError();
+        return;
+    }
+    file.sample_rate = snd_file.samplerate();
+    file.channels = snd_file.channels();
+    file.format = snd_file.format();
+    file.samples.resize(static_cast<size_t>(snd_file.frames() * snd_file.channels()));
+    const auto read = snd_file.read(file.samples.data(), static_cast<sf_count_t>(file.samples.size()));
+    file.samples.resize(static_cast<size_t>(std::max<sf_count_t>(0, read)));
+}
+
+}
+
+//!
+//! \brief Just enough of io_uring over the raw syscalls for reads: one submission and one completion ring.
+//!
+class CorpusReader::Uring
+{
+public:
+    ~Uring()
+    {
+        if (sqes_) {
+            munmap(sqes_, sqes_len_);
+        }
+        if (cq_ptr_ && cq_ptr_ != sq_ptr_) {
+            munmap(cq_ptr_, cq_len_);
+        }
+        if (sq_ptr_) {
+            munmap(sq_ptr_, sq_len_);
+        }
+        if (fd_ >= 0) {
+            close(fd_);
+        }
+    }
+
+    //!
+    //! \brief Returns nullptr if the kernel has no io_uring, forbids it, or cannot read with it.
+    //!
+    static std::unique_ptr<Uring> Create(unsigned entries)
+    {
+        std::unique_ptr<Uring> ring(new Uring());
+        io_uring_params params{};
+        ring->fd_ = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+        if (ring->fd_ < 0 || !ring->Map(params) || !ring->CanRead()) {
+            return nullptr;
+        }
+        return ring;
+    }
+
+    //!
+    //! \brief A cleared entry to fill, nullptr while the submission ring is full.
+    //!
+    io_uring_sqe *NextSqe()
+    {
+        const auto head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+        if (sq_tail_ - head >= sq_entries_) {
+            return nullptr;
+        }
+        const auto index = sq_tail_ & *sq_mask_;
+        sq_array_[index] = index;
+        auto *sqe = &sqes_[index];
+        memset(sqe, 0, sizeof(*sqe));
+        ++sq_tail_;
+        ++unsubmitted_;
+        return sqe;
+    }
+
+    //!
+    //! \brief Submit the filled entries and wait for wait_count completions. Returns false on failure.
+    //!
+    bool Submit(unsigned wait_count)
+    {
+        __atomic_store_n(sq_tail_ptr_, sq_tail_, __ATOMIC_RELEASE);
+        for (;;) {
+            const auto flags = wait_count ? IORING_ENTER_GETEVENTS : 0u;
+            const auto submitted = syscall(__NR_io_uring_enter, fd_, unsubmitted_, wait_count, flags, nullptr, 0);
+            if (submitted >= 0) {
+                unsubmitted_ -= static_cast<unsigned>(submitted);
+                return true;
+            }
+            if (errno != EINTR) {
+                return false;
+            }
+        }
+    }
+
+    //!
+    //! \brief After a failed Submit, take back the entries the kernel did not consume, they never complete.
+    //!        Their user data is appended to user_data.
+    //!
+    void Reclaim(std::vector<uint64_t> &user_data)
+    {
+        const auto head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+        for (auto i = head; i != sq_tail_; ++i) {
+            user_data.push_back(sqes_[sq_array_[i & *sq_mask_]].user_data);
+        }
+        sq_tail_ = head;
+        __atomic_store_n(sq_tail_ptr_, sq_tail_, __ATOMIC_RELEASE);
+        unsubmitted_ = 0;
+    }
+
+    bool PopCompletion(uint64_t &user_data, int32_t &result)
+    {
+        const auto head = *cq_head_;
+        if (head == __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+            return false;
+        }
+        const auto &cqe = cqes_[head & *cq_mask_];
+        user_data = cqe.user_data;
+        result = cqe.res;
+        __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+
+private:
+    Uring() = default;
+
+    bool Map(const io_uring_params &params)
+    {
+        sq_len_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_len_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        const auto single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single_mmap) {
+            sq_len_ = cq_len_ = std::max(sq_len_, cq_len_);
+        }
+        sq_ptr_ = MapRing(sq_len_, IORING_OFF_SQ_RING);
+        cq_ptr_ = single_mmap ? sq_ptr_ : MapRing(cq_len_, IORING_OFF_CQ_RING);
+        sqes_len_ = params.sq_entries * sizeof(io_uring_sqe);
+        sqes_ = static_cast<io_uring_sqe *>(MapRing(sqes_len_, IORING_OFF_SQES));
+        if (!sq_ptr_ || !cq_ptr_ || !sqes_) {
+            return false;
+        }
+
+        auto *sq = static_cast<char *>(sq_ptr_);
+        sq_head_ = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+        sq_tail_ptr_ = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+        sq_mask_ = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+        sq_array_ = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+        sq_entries_ = params.sq_entries;
+        sq_tail_ = *sq_tail_ptr_;
+        auto *cq = static_cast<char *>(cq_ptr_);
+        cq_head_ = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+        cq_tail_ = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+        cq_mask_ = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+        return true;
+    }
+
+    void *MapRing(size_t length, off_t offset) const
+    {
+        auto *ptr = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, offset);
+        return ptr == MAP_FAILED ? nullptr : ptr;
+    }
+
+    //!
+    //! \brief IORING_OP_READ is 5.6, probing is as old, a kernel without the probe cannot read either.
+    //!
+    bool CanRead() const
+    {
+        std::vector<char> storage(sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op));
+        auto *probe = reinterpret_cast<io_uring_probe *>(storage.data());
+        if (syscall(__NR_io_uring_register, fd_, IORING_REGISTER_PROBE, probe, 256) < 0) {
+            return false;
+        }
+        return probe->last_op >= IORING_OP_READ && (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED);
+    }
+
+    int fd_ = -1;
+    void *sq_ptr_ = nullptr;
+    void *cq_ptr_ = nullptr;
+    size_t sq_len_ = 0;
+    size_t cq_len_ = 0;
+    io_uring_sqe *sqes_ = nullptr;
+    size_t sqes_len_ = 0;
+
+    unsigned *sq_head_ = nullptr;
+    unsigned *sq_tail_ptr_ = nullptr;
+    unsigned *sq_mask_ = nullptr;
+    unsigned *sq_array_ = nullptr;
+    unsigned sq_entries_ = 0;
+    unsigned sq_tail_ = 0;      //!< Ours, published to the kernel on Submit.
+    unsigned unsubmitted_ = 0;
+    unsigned *cq_head_ = nullptr;
+    unsigned *cq_tail_ = nullptr;
+    unsigned *cq_mask_ = nullptr;
+    io_uring_cqe *cqes_ = nullptr;
+};
+
+CorpusReader::CorpusReader(const CorpusReaderConfig &config, std::vector<std::string> paths)
+    : config_(config),
+      paths_(std::move(paths)),
+      free_slots_(std::max(1, config.prefetch_files))
+{
+    config_.read_chunk_bytes = std::max<size_t>(4096, config_.read_chunk_bytes);
+    auto ring = config_.io_uring ? Uring::Create(kRingEntries) : nullptr;
+    uses_io_uring_ = ring != nullptr;
+    if (uses_io_uring_) {
+        readers_.emplace_back(&CorpusReader::ReadUring, this, std::move(ring));
+    } else {
+        if (config_.io_uring) {
+            std::cout << "Info: io_uring is not available, reading with a thread pool." << std::endl;
+        }
+        for (int i = 0; i < std::max(1, config_.io_threads); ++i) {
+            readers_.emplace_back(&CorpusReader::ReadPool, this);
+        }
+    }
+    for (int i = 0; i < std::max(1, config_.decode_threads); ++i) {
+        decoders_.emplace_back(&CorpusReader::Decode, this);
+    }
+}
+
+CorpusReader::~CorpusReader()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    slot_cond_.notify_all();
+    raw_cond_.notify_all();
+    decoded_cond_.notify_all();
+    for (auto &thread : readers_) {
+        thread.join();
+    }
+    for (auto &thread : decoders_) {
+        thread.join();
+    }
+}
+
+bool CorpusReader::Next(CorpusFile &file)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    decoded_cond_.wait(lock, [this]() { return stop_ || !decoded_.empty() || handed_out_ == paths_.size(); });
+    if (decoded_.empty()) {
+        return false;
+    }
+    file = std::move(decoded_.front());
+    decoded_.pop_front();
+    ++free_slots_;
+    const auto last = ++handed_out_ == paths_.size();
+    lock.unlock();
+    slot_cond_.notify_one();
+    if (last) {
+        decoded_cond_.notify_all();
+    }
+    return true;
+}
+
+bool CorpusReader::Claim(size_t &index, bool wait)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (wait) {
+        slot_cond_.wait(lock, [this]() { return stop_ || next_path_ == paths_.size() || free_slots_ > 0; });
+    }
+    if (stop_ || next_path_ == paths_.size() || free_slots_ == 0) {
+        return false;
+    }
+    --free_slots_;
+    index = next_path_++;
+    return true;
+}
+
+int CorpusReader::Open(const std::string &path, RawFile &raw) const
+{
+    const auto fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st{};
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        raw.error = std::string("Unable to open: ") + strerror(errno);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    raw.bytes.resize(static_cast<size_t>(st.st_size));
+    return fd;
+}
+
+bool CorpusReader::ReadFully(int fd, RawFile &raw, size_t offset, size_t length)
+{
+    for (const auto end = offset + length; offset < end;) {
+        const auto n = pread(fd, raw.bytes.data() + offset, end - offset, static_cast<off_t>(offset));
+        if (n > 0) {
+            offset += static_cast<size_t>(n);
+        } else if (n == 0 || errno != EINTR) {
+            raw.error = n == 0 ? "Unable to read: file shrank" : std::string("Unable to read: ") + strerror(errno);
+            return false;
+        }
+    }
+    return true;
+}
+
+void CorpusReader::PushRaw(RawFile raw)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    raw_.push_back(std::move(raw));
+    const auto last = ++read_done_ == paths_.size();
+    lock.unlock();
+    if (last) {
+        raw_cond_.notify_all();
+    } else {
+        raw_cond_.notify_one();
+    }
+}
+
+void CorpusReader::ReadPool()
+{
+    Timeline::SetThreadName("corpus_read");
+    // Files the ring was reading when it broke down first, they hold prefetch slots already.
+    for (;;) {
+        PartialFile partial;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (partial_.empty()) {
+                break;
+            }
+            partial = std::move(partial_.front());
+            partial_.pop_front();
+        }
+        TRT_TIMELINE_SCOPE("io", "read_file");
+        for (const auto &chunk : partial.chunks) {
+            if (!partial.raw.error.empty() || !ReadFully(partial.fd, partial.raw, chunk.first, chunk.second)) {
+                break;
+            }
+        }
+        close(partial.fd);
+        if (!partial.raw.error.empty()) {
+            partial.raw.bytes.clear();
+        }
+        PushRaw(std::move(partial.raw));
+    }
+
+    size_t index;
+    while (Claim(index, true)) {
+        TRT_TIMELINE_SCOPE("io", "read_file");
+        RawFile raw;
+        raw.index = index;
+        const auto fd = Open(paths_[index], raw);
+        if (fd >= 0) {
+            ReadFully(fd, raw, 0, raw.bytes.size());
+            close(fd);
+        }
+        PushRaw(std::move(raw));
+    }
+}
+
+void CorpusReader::ReadUring(std::unique_ptr<Uring> ring)
+{
+    Timeline::SetThreadName("corpus_read");
+    struct OpenFile
+    {
+        RawFile raw;
+        int fd;
+        size_t outstanding = 0;     //!< Chunks queued or in flight.
+    };
+    struct Chunk
+    {
+        size_t index;
+        size_t offset;
+        size_t length;
+    };
+
+    std::unordered_map<size_t, OpenFile> files;
+    std::deque<Chunk> queued;
+    std::vector<Chunk> in_flight(kRingEntries);
+    std::vector<uint64_t> free_tags;
+    for (uint64_t tag = 0; tag < kRingEntries; ++tag) {
+        free_tags.push_back(tag);
+    }
+    auto failed = false;
+
+    const auto finish = [&](size_t index) {
+        auto &file = files.at(index);
+        close(file.fd);
+        if (!file.raw.error.empty()) {
+            file.raw.bytes.clear();
+        }
+        PushRaw(std::move(file.raw));
+        files.erase(index);
+    };
+
+    for (;;) {
+        // Start files while slots are free, block for one only when nothing is in flight.
+        size_t index;
+        while (!failed && Claim(index, files.empty())) {
+            RawFile raw;
+            raw.index = index;
+            const auto fd = Open(paths_[index], raw);
+            if (fd < 0 || raw.bytes.empty()) {
+                if (fd >= 0) {
+                    close(fd);
+                }
+                PushRaw(std::move(raw));
+                continue;
+            }
+            auto &file = files.emplace(index, OpenFile{std::move(raw), fd}).first->second;
+            for (size_t offset = 0; offset < file.raw.bytes.size(); offset += config_.read_chunk_bytes) {
+                queued.push_back({index, offset, std::min(config_.read_chunk_bytes, file.raw.bytes.size() - offset)});
+                ++file.outstanding;
+            }
+        }
+        if (!failed && files.empty()) {
+            return;
+        }
+
+        while (!queued.empty() && !free_tags.empty() && !failed) {
+            auto *sqe = ring->NextSqe();
+            if (!sqe) {
+                break;
+            }
+            const auto tag = free_tags.back();
+            free_tags.pop_back();
+            const auto &chunk = in_flight[tag] = queued.front();
+            queued.pop_front();
+            auto &file = files.at(chunk.index);
+            sqe->opcode = IORING_OP_READ;
+            sqe->fd = file.fd;
+            sqe->addr = reinterpret_cast<uint64_t>(file.raw.bytes.data() + chunk.offset);
+            sqe->len = static_cast<uint32_t>(chunk.length);
+            sqe->off = chunk.offset;
+            sqe->user_data = tag;
+        }
+        if (!failed && !ring->Submit(free_tags.size() < kRingEntries ? 1 : 0)) {
+            std::cerr << "Error: io_uring submit failed, reading on with a thread pool: " << strerror(errno)
+                      << std::endl;
+            failed = true;
+            // Only what the kernel took completes, the rest goes back to the queue.
+            std::vector<uint64_t> unsubmitted;
+            ring->Reclaim(unsubmitted);
+            for (const auto tag : unsubmitted) {
+                queued.push_front(in_flight[tag]);
+                free_tags.push_back(tag);
+            }
+        }
+
+        uint64_t tag;
+        int32_t result;
+        while (ring->PopCompletion(tag, result)) {
+            const auto chunk = in_flight[tag];
+            free_tags.push_back(tag);
+            auto &file = files.at(chunk.index);
+            if (result == -EINTR || result == -EAGAIN) {
+                queued.push_front(chunk);
+                continue;
+            }
+            if (result < 0) {
+                file.raw.error = std::string("Unable to read: ") + strerror(-result);
+            } else if (result == 0) {
+                file.raw.error = "Unable to read: file shrank";
+            } else if (static_cast<size_t>(result) < chunk.length) {
+                // Short read, the rest goes again.
+                const auto done = static_cast<size_t>(result);
+                queued.push_front({chunk.index, chunk.offset + done, chunk.length - done});
+                continue;
+            }
+            if (--file.outstanding == 0) {
+                finish(chunk.index);
+            }
+        }
+
+        if (failed) {
+            // The buffers of the reads the kernel took are its own until they complete.
+            if (free_tags.size() == kRingEntries) {
+                break;
+            }
+            std::this_thread::yield();
+        }
+    }
+
+    // The ring broke down: the chunks left of the open files and the rest of the corpus go to a pread pool,
+    // this thread being one of its readers.
+    std::unordered_map<size_t, PartialFile> partial;
+    for (auto &entry : files) {
+        partial.emplace(entry.first, PartialFile{std::move(entry.second.raw), entry.second.fd, {}});
+    }
+    for (const auto &chunk : queued) {
+        partial.at(chunk.index).chunks.emplace_back(chunk.offset, chunk.length);
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto &entry : partial) {
+            partial_.push_back(std::move(entry.second));
+        }
+    }
+    std::vector<std::thread> pool;
+    for (int i = 1; i < std::max(1, config_.io_threads); ++i) {
+        pool.emplace_back(&CorpusReader::ReadPool, this);
+    }
+    ReadPool();
+    for (auto &thread : pool) {
+        thread.join();
+    }
+}
+
+void CorpusReader::Decode()
+{
+    Timeline::SetThreadName("corpus_decode");
+    for (;;) {
+        RawFile raw;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            raw_cond_.wait(lock, [this]() { return stop_ || !raw_.empty() || read_done_ == paths_.size(); });
+            if (stop_ || raw_.empty()) {
+                return;
+            }
+            raw = std::move(raw_.front());
+            raw_.pop_front();
+        }
+
+        CorpusFile file;
+        file.index = raw.index;
+        file.path = paths_[raw.index];
+        file.error = raw.error;
+        if (file.error.empty()) {
+            TRT_TIMELINE_SCOPE("io", "decode_file");
+            DecodeBytes(raw.bytes, file);
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            decoded_.push_back(std::move(file));
+        }
+        decoded_cond_.notify_one();
+    }
+}
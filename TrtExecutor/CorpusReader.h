@@ -0,0 +1,134 @@
+// CorpusReader.h: Read-ahead and decode of a batch of voice files off the worker threads
+//
+
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+
+struct CorpusReaderConfig
+{
+    int prefetch_files = 8;     //!< Files being read, decoded or waiting for a worker at most.
+    int io_threads = 4;         //!< Readers when io_uring is not available.
+    int decode_threads = 2;
+    bool io_uring = true;
+    size_t read_chunk_bytes = 1 << 20;
+};
+
+//!
+//! \brief A decoded file, interleaved samples ready for VoiceInputStream.
+//!
+struct CorpusFile
+{
+    size_t index = 0;           //!< Position in the list of paths.
+    std::string path;
+    std::vector<double> samples;
+    int sample_rate = 0;
+    int channels = 0;
+    int format = 0;             //!< libsndfile format, the output is written with it.
+    std::string error;          //!< Empty unless the file could not be read or decoded.
+};
+
+//!
+//! \brief Reads the bytes of the next files of a corpus ahead of the workers and decodes them on their own
+//!        threads, so storage latency and decoding overlap with inference.
+//!
+//! \details Reads go through one io_uring thread issuing the chunk reads of several files at once, which
+//!          keeps a network mount busy with few threads; where io_uring is unavailable (old kernel, seccomp)
+//!          a pool of io_threads reads with pread. Should a submit fail later on, the ring thread waits for
+//!          the reads the kernel took and hands the rest of the open files and of the corpus to such a pool.
+//!          Opening a file is synchronous in either case. Decoding runs libsndfile over the bytes in memory,
+//!          so any format it reads (WAV, FLAC, OGG) decodes off the workers. At most prefetch_files files are
+//!          held, from the start of their read until Next() hands them out, which bounds the memory.
+//!          Files are handed out in completion order.
+//!
+class CorpusReader
+{
+public:
+    CorpusReader(const CorpusReaderConfig &config, std::vector<std::string> paths);
+
+    ~CorpusReader();
+
+    //!
+    //! \brief Wait for the next decoded file. Returns false once every file was handed out.
+    //!        Safe to call from many workers.
+    //!
+    bool Next(CorpusFile &file);
+
+    bool UsesIoUring() const
+    {
+        return uses_io_uring_;
+    }
+
+private:
+    struct RawFile
+    {
+        size_t index = 0;
+        std::vector<char> bytes;
+        std::string error;
+    };
+
+    //!
+    //! \brief A file the ring was reading when it broke down, its remaining chunks are read by the pool.
+    //!
+    struct PartialFile
+    {
+        RawFile raw;
+        int fd = -1;
+        std::vector<std::pair<size_t, size_t>> chunks;     //!< Offset and length of the chunks left.
+    };
+
+    class Uring;
+
+    void ReadUring(std::unique_ptr<Uring> ring);
+
+    void ReadPool();
+
+    //!
+    //! \brief Open path and size bytes for it, error set on failure. Returns the descriptor, -1 on failure.
+    //!
+    int Open(const std::string &path, RawFile &raw) const;
+
+    //!
+    //! \brief pread length bytes of raw at offset. Returns false with error set on failure.
+    //!
+    static bool ReadFully(int fd, RawFile &raw, size_t offset, size_t length);
+
+    void Decode();
+
+    //!
+    //! \brief Take a prefetch slot and the next path to read. Returns false when there is none left or
+    //!        the reader stops; with wait false also when no slot is free.
+    //!
+    bool Claim(size_t &index, bool wait);
+
+    void PushRaw(RawFile raw);
+
+    CorpusReaderConfig config_;
+    std::vector<std::string> paths_;
+    bool uses_io_uring_ = false;
+
+    std::mutex mutex_;
+    std::condition_variable slot_cond_;
+    std::condition_variable raw_cond_;
+    std::condition_variable decoded_cond_;
+    int free_slots_;
+    size_t next_path_ = 0;
+    size_t handed_out_ = 0;
+    size_t read_done_ = 0;      //!< Files whose read finished, pushed raw.
+    std::deque<PartialFile> partial_;
+    std::deque<RawFile> raw_;
+    std::deque<CorpusFile> decoded_;
+    bool stop_ = false;
+
+    std::vector<std::thread> readers_;
+    std::vector<std::thread> decoders_;
+};
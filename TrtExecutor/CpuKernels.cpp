@@ -0,0 +1,234 @@
+// CpuKernels.cpp: Impl
+//
+
+#include "CpuKernels.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "common/fp16.h"
+
+#if defined(__AVX512F__) || defined(__AVX2__) || defined(__F16C__)
+#include <immintrin.h>
+#endif
+
+
+namespace {
+
+// Columns per block, so the slice of x in use stays in L1 while rows stream from L2/memory.
+constexpr size_t kColumnBlock = 2048;
+
+// Rows per register block: each x vector loaded feeds this many FMAs.
+constexpr size_t kRowBlock = 4;
+
+inline float SigmoidScalar(float v)
+{
+    return 1.0f / (1.0f + std::exp(-v));
+}
+
+#if defined(__AVX512F__)
+
+constexpr const char *kInstructionSet = "avx512";
+
+inline void DotBlock(const float *w, size_t stride, const float *x, size_t cols, float *out, size_t rows)
+{
+    __m512 acc[kRowBlock];
+    for (size_t r = 0; r < rows; ++r) {
+        acc[r] = _mm512_setzero_ps();
+    }
+    for (size_t c = 0; c < cols; c += 16) {
+        const auto xv = _mm512_load_ps(x + c);
+        for (size_t r = 0; r < rows; ++r) {
+            acc[r] = _mm512_fmadd_ps(_mm512_load_ps(w + r * stride + c), xv, acc[r]);
+        }
+    }
+    for (size_t r = 0; r < rows; ++r) {
+        out[r] = _mm512_reduce_add_ps(acc[r]);
+    }
+}
+
+#elif defined(__AVX2__)
+
+constexpr const char *kInstructionSet = "avx2";
+
+inline float HorizontalSum(__m256 v)
+{
+    auto low = _mm256_castps256_ps128(v);
+    auto high = _mm256_extractf128_ps(v, 1);
+    low = _mm_add_ps(low, high);
+    low = _mm_add_ps(low, _mm_movehl_ps(low, low));
+    low = _mm_add_ss(low, _mm_shuffle_ps(low, low, 1));
+    return _mm_cvtss_f32(low);
+}
+
+inline __m256 MultiplyAdd(__m256 a, __m256 b, __m256 c)
+{
+#if defined(__FMA__)
+    return _mm256_fmadd_ps(a, b, c);
+#else
+    return _mm256_add_ps(_mm256_mul_ps(a, b), c);
+#endif
+}
+
+inline void DotBlock(const float *w, size_t stride, const float *x, size_t cols, float *out, size_t rows)
+{
+    // Two accumulators per row hide the FMA latency.
+    __m256 acc0[kRowBlock];
+    __m256 acc1[kRowBlock];
+    for (size_t r = 0; r < rows; ++r) {
+        acc0[r] = _mm256_setzero_ps();
+        acc1[r] = _mm256_setzero_ps();
+    }
+    for (size_t c = 0; c < cols; c += 16) {
+        const auto x0 = _mm256_load_ps(x + c);
+        const auto x1 = _mm256_load_ps(x + c + 8);
+        for (size_t r = 0; r < rows; ++r) {
+            acc0[r] = MultiplyAdd(_mm256_load_ps(w + r * stride + c), x0, acc0[r]);
+            acc1[r] = MultiplyAdd(_mm256_load_ps(w + r * stride + c + 8), x1, acc1[r]);
+        }
+    }
+    for (size_t r = 0; r < rows; ++r) {
+        out[r] = HorizontalSum(_mm256_add_ps(acc0[r], acc1[r]));
+    }
+}
+
+#else
+
+constexpr const char *kInstructionSet = "scalar";
+
+inline void DotBlock(const float *w, size_t stride, const float *x, size_t cols, float *out, size_t rows)
+{
+    for (size_t r = 0; r < rows; ++r) {
+        const auto *row = w + r * stride;
+        float acc = 0.0f;
+        for (size_t c = 0; c < cols; ++c) {
+            acc += row[c] * x[c];
+        }
+        out[r] = acc;
+    }
+}
+
+#endif
+
+}
+
+void kernels::Gemv(const float *w, size_t rows, size_t stride, const float *x, const float *bias, float *y)
+{
+    for (size_t r = 0; r < rows; ++r) {
+        y[r] = bias ? bias[r] : 0.0f;
+    }
+
+    float partial[kRowBlock];
+    for (size_t c0 = 0; c0 < stride; c0 += kColumnBlock) {
+        const auto cols = std::min(kColumnBlock, stride - c0);
+        for (size_t r0 = 0; r0 < rows; r0 += kRowBlock) {
+            const auto block_rows = std::min(kRowBlock, rows - r0);
+            DotBlock(w + r0 * stride + c0, stride, x + c0, cols, partial, block_rows);
+            for (size_t r = 0; r < block_rows; ++r) {
+                y[r0 + r] += partial[r];
+            }
+        }
+    }
+}
+
+void kernels::Relu(float *x, size_t count)
+{
+    for (size_t i = 0; i < count; ++i) {
+        x[i] = std::max(x[i], 0.0f);
+    }
+}
+
+void kernels::Sigmoid(float *x, size_t count)
+{
+    for (size_t i = 0; i < count; ++i) {
+        x[i] = SigmoidScalar(x[i]);
+    }
+}
+
+void kernels::Tanh(float *x, size_t count)
+{
+    for (size_t i = 0; i < count; ++i) {
+        x[i] = std::tanh(x[i]);
+    }
+}
+
+void kernels::GruCellLinearBeforeReset(const float *wx, const float *rh, const float *h_prev, float *h, size_t hidden)
+{
+    const auto *wx_z = wx;
+    const auto *wx_r = wx + hidden;
+    const auto *wx_h = wx + 2 * hidden;
+    const auto *rh_z = rh;
+    const auto *rh_r = rh + hidden;
+    const auto *rh_h = rh + 2 * hidden;
+    for (size_t i = 0; i < hidden; ++i) {
+        const auto z = SigmoidScalar(wx_z[i] + rh_z[i]);
+        const auto r = SigmoidScalar(wx_r[i] + rh_r[i]);
+        const auto n = std::tanh(wx_h[i] + r * rh_h[i]);
+        h[i] = (1.0f - z) * n + z * h_prev[i];
+    }
+}
+
+void kernels::GruResetHidden(const float *wx, const float *rh, const float *h_prev, float *reset_h, size_t hidden)
+{
+    const auto *wx_r = wx + hidden;
+    const auto *rh_r = rh + hidden;
+    for (size_t i = 0; i < hidden; ++i) {
+        reset_h[i] = SigmoidScalar(wx_r[i] + rh_r[i]) * h_prev[i];
+    }
+}
+
+void kernels::GruCellResetBeforeLinear(const float *wx, const float *rh, const float *h_prev, float *h, size_t hidden)
+{
+    const auto *wx_h = wx + 2 * hidden;
+    const auto *rh_h = rh + 2 * hidden;
+    for (size_t i = 0; i < hidden; ++i) {
+        const auto z = SigmoidScalar(wx[i] + rh[i]);
+        const auto n = std::tanh(wx_h[i] + rh_h[i]);
+        h[i] = (1.0f - z) * n + z * h_prev[i];
+    }
+}
+
+void kernels::FloatToHalf(const float *src, uint16_t *dst, size_t count)
+{
+    size_t i = 0;
+#if defined(__AVX512F__)
+    for (; i + 16 <= count; i += 16) {
+        const auto half = _mm512_cvtps_ph(_mm512_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), half);
+    }
+#endif
+#if defined(__F16C__)
+    for (; i + 8 <= count; i += 8) {
+        const auto half = _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), half);
+    }
+#endif
+    for (; i < count; ++i) {
+        dst[i] = samplesCommon::floatToHalf(src[i]);
+    }
+}
+
+void kernels::HalfToFloat(const uint16_t *src, float *dst, size_t count)
+{
+    size_t i = 0;
+#if defined(__AVX512F__)
+    for (; i + 16 <= count; i += 16) {
+        const auto half = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+        _mm512_storeu_ps(dst + i, _mm512_cvtph_ps(half));
+    }
+#endif
+#if defined(__F16C__)
+    for (; i + 8 <= count; i += 8) {
+        const auto half = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(half));
+    }
+#endif
+    for (; i < count; ++i) {
+        dst[i] = samplesCommon::halfToFloat(src[i]);
+    }
+}
+
+const char *kernels::InstructionSet()
+{
+    return kInstructionSet;
+}
@@ -0,0 +1,118 @@
+// CpuKernels.h: SIMD kernels of the CPU inference backend
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+
+namespace kernels {
+
+constexpr size_t kSimdAlign = 64;
+constexpr size_t kSimdFloats = kSimdAlign / sizeof(float);
+
+//!
+//! \brief Round a float count up to whole SIMD registers. Matrix rows and vectors are padded to it with
+//!        zeros so the kernels never need a remainder loop.
+//!
+inline size_t PadFloats(size_t count)
+{
+    return (count + kSimdFloats - 1) / kSimdFloats * kSimdFloats;
+}
+
+template <typename T>
+struct AlignedAllocator
+{
+    using value_type = T;
+
+    AlignedAllocator() = default;
+
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U> &) {}
+
+    T *allocate(size_t n)
+    {
+        const auto bytes = (n * sizeof(T) + kSimdAlign - 1) / kSimdAlign * kSimdAlign;
+#ifdef _MSC_VER
+        auto *p = _aligned_malloc(bytes, kSimdAlign);
+#else
+        auto *p = aligned_alloc(kSimdAlign, bytes);
+#endif
+        if (!p) {
+            throw std::bad_alloc();
+        }
+        return static_cast<T *>(p);
+    }
+
+    void deallocate(T *p, size_t)
+    {
+#ifdef _MSC_VER
+        _aligned_free(p);
+#else
+        free(p);
+#endif
+    }
+
+    template <typename U>
+    bool operator==(const AlignedAllocator<U> &) const { return true; }
+
+    template <typename U>
+    bool operator!=(const AlignedAllocator<U> &) const { return false; }
+};
+
+template <typename T>
+using AlignedVector = std::vector<T, AlignedAllocator<T>>;
+
+//!
+//! \brief y = W * x + bias. W is row-major with \p stride floats per row, stride a multiple of kSimdFloats
+//!        and the padding zeroed; x holds stride floats with a zeroed tail. W, x must be 64-byte aligned.
+//!        \p bias may be nullptr.
+//!
+void Gemv(const float *w, size_t rows, size_t stride, const float *x, const float *bias, float *y);
+
+void Relu(float *x, size_t count);
+
+void Sigmoid(float *x, size_t count);
+
+void Tanh(float *x, size_t count);
+
+//!
+//! \brief Fused GRU gates in ONNX z, r, h order with linear_before_reset = 1:
+//!        z = sigmoid(wx_z + rh_z), r = sigmoid(wx_r + rh_r), n = tanh(wx_h + r * rh_h),
+//!        h = (1 - z) * n + z * h_prev. wx = W * x + Wb and rh = R * h_prev + Rb, both 3 * hidden long.
+//!
+void GruCellLinearBeforeReset(const float *wx, const float *rh, const float *h_prev, float *h, size_t hidden);
+
+//!
+//! \brief First half of a GRU step with linear_before_reset = 0: writes r * h_prev into \p reset_h, the
+//!        input of the R_h product. Only the z and r parts of wx and rh are read.
+//!
+void GruResetHidden(const float *wx, const float *rh, const float *h_prev, float *reset_h, size_t hidden);
+
+//!
+//! \brief Second half of a GRU step with linear_before_reset = 0, where rh_h already is R_h * (r * h_prev) + Rb_h:
+//!        n = tanh(wx_h + rh_h), h = (1 - z) * n + z * h_prev.
+//!
+void GruCellResetBeforeLinear(const float *wx, const float *rh, const float *h_prev, float *h, size_t hidden);
+
+//!
+//! \brief Convert floats to IEEE half precision, rounding to nearest even. No alignment required, F16C or
+//!        AVX-512 when compiled for it, exact scalar conversion otherwise.
+//!
+void FloatToHalf(const float *src, uint16_t *dst, size_t count);
+
+//!
+//! \brief Convert IEEE half precision values to floats, exactly.
+//!
+void HalfToFloat(const uint16_t *src, float *dst, size_t count);
+
+//!
+//! \brief Returns the instruction set the kernels were compiled for.
+//!
+const char *InstructionSet();
+
+}
@@ -0,0 +1,219 @@
+// CudaBackend.cpp: Impl
+//
+
+#include "CudaBackend.h"
+
+#include "common/buffers.h"
+#include "common/logger.h"
+
+#include <algorithm>
+
+
+namespace {
+
+infer::Dims FromTrt(const nvinfer1::Dims &dims)
+{
+    infer::Dims result;
+    result.nbDims = std::min(dims.nbDims, infer::Dims::MAX_DIMS);
+    std::copy_n(dims.d, result.nbDims, result.d);
+    return result;
+}
+
+nvinfer1::Dims ToTrt(const infer::Dims &dims)
+{
+    nvinfer1::Dims result{};
+    result.nbDims = std::min(dims.nbDims, nvinfer1::Dims::MAX_DIMS);
+    std::copy_n(dims.d, result.nbDims, result.d);
+    return result;
+}
+
+}
+
+CudaInferEngine::CudaInferEngine(std::shared_ptr<nvinfer1::ICudaEngine> engine)
+    : engine_(std::move(engine)),
+      dynamic_(false)
+{
+    const auto profiles = std::max(1, engine_->getNbOptimizationProfiles());
+    bindings_per_profile_ = engine_->getNbBindings() / profiles;
+    for (int i = 0; i < bindings_per_profile_; ++i) {
+        const auto dims = engine_->getBindingDimensions(i);
+        dynamic_ = dynamic_ || std::any_of(dims.d, dims.d + dims.nbDims, [](int d) { return d < 0; });
+    }
+    // Handed out from the back, so a single context gets profile 0.
+    for (int i = profiles - 1; dynamic_ && i >= 0; --i) {
+        free_profiles_.push_back(i);
+    }
+}
+
+std::shared_ptr<CudaInferEngine> CudaInferEngine::Deserialize(const void *data, size_t size)
+{
+    auto runtime = std::unique_ptr<nvinfer1::IRuntime, samplesCommon::InferDeleter>(
+        nvinfer1::createInferRuntime(gLogger));
+    auto engine = std::shared_ptr<nvinfer1::ICudaEngine>(
+        runtime->deserializeCudaEngine(data, size), samplesCommon::InferDeleter());
+    if (!engine) {
+        std::cerr << "Error: Unable to deserialize model." << std::endl;
+        return nullptr;
+    }
+    return std::make_shared<CudaInferEngine>(std::move(engine));
+}
+
+int CudaInferEngine::GetNbBindings() const
+{
+    return bindings_per_profile_;
+}
+
+const char *CudaInferEngine::GetBindingName(int index) const
+{
+    return engine_->getBindingName(index);
+}
+
+int CudaInferEngine::GetBindingIndex(const char *name) const
+{
+    return engine_->getBindingIndex(name);
+}
+
+bool CudaInferEngine::BindingIsInput(int index) const
+{
+    return engine_->bindingIsInput(index);
+}
+
+infer::Dims CudaInferEngine::GetBindingDimensions(int index) const
+{
+    return FromTrt(engine_->getBindingDimensions(index));
+}
+
+infer::DataType CudaInferEngine::GetBindingDataType(int index) const
+{
+    switch (engine_->getBindingDataType(index)) {
+        case nvinfer1::DataType::kFLOAT:
+            return infer::DataType::kFLOAT;
+        case nvinfer1::DataType::kHALF:
+            return infer::DataType::kHALF;
+        default:
+            return infer::DataType::kOTHER;
+    }
+}
+
+int CudaInferEngine::MaxContexts() const
+{
+    return dynamic_ ? std::max(1, engine_->getNbOptimizationProfiles()) : 0;
+}
+
+std::unique_ptr<InferContext> CudaInferEngine::CreateContext()
+{
+    std::lock_guard<std::mutex> lock(context_mutex_);
+    if (dynamic_ && free_profiles_.empty()) {
+        std::cerr << "Error: all " << MaxContexts() << " optimization profiles of the engine are in use, build it "
+                  << "with one per worker." << std::endl;
+        return nullptr;
+    }
+    std::unique_ptr<nvinfer1::IExecutionContext, samplesCommon::InferDeleter> context(
+        engine_->createExecutionContext());
+    if (!context) {
+        std::cerr << "Error: Unable to create execution context." << std::endl;
+        return nullptr;
+    }
+    auto profile = -1;
+    if (dynamic_) {
+        profile = free_profiles_.back();
+        if (!context->setOptimizationProfile(profile)) {
+            std::cerr << "Error: Unable to select optimization profile " << profile << "." << std::endl;
+            return nullptr;
+        }
+        free_profiles_.pop_back();
+    }
+    return std::unique_ptr<InferContext>(
+        new CudaInferContext(shared_from_this(), engine_, context.release(), profile, bindings_per_profile_));
+}
+
+void CudaInferEngine::ReleaseProfile(int profile)
+{
+    std::lock_guard<std::mutex> lock(context_mutex_);
+    free_profiles_.push_back(profile);
+}
+
+CudaInferContext::CudaInferContext(std::shared_ptr<CudaInferEngine> owner,
+                                   std::shared_ptr<nvinfer1::ICudaEngine> engine,
+                                   nvinfer1::IExecutionContext *context, int profile, int bindings_per_profile)
+    : owner_(std::move(owner)),
+      engine_(std::move(engine)),
+      profile_(profile),
+      bindings_per_profile_(bindings_per_profile),
+      context_(context)
+{
+}
+
+CudaInferContext::~CudaInferContext()
+{
+    // The profile is free again only once the context using it is gone.
+    buffer_.reset();
+    context_.reset();
+    if (profile_ >= 0) {
+        owner_->ReleaseProfile(profile_);
+    }
+}
+
+int CudaInferContext::ProfileBinding(int index) const
+{
+    if (index < 0 || index >= bindings_per_profile_) {
+        return -1;
+    }
+    return index + std::max(0, profile_) * bindings_per_profile_;
+}
+
+bool CudaInferContext::SetBindingDimensions(int index, const infer::Dims &dims)
+{
+    const auto binding = ProfileBinding(index);
+    return binding >= 0 && context_->setBindingDimensions(binding, ToTrt(dims));
+}
+
+infer::Dims CudaInferContext::GetBindingDimensions(int index) const
+{
+    const auto binding = ProfileBinding(index);
+    return binding >= 0 ? FromTrt(context_->getBindingDimensions(binding)) : infer::Dims();
+}
+
+bool CudaInferContext::AllocateBuffers()
+{
+    buffer_.reset(new samplesCommon::BufferManager(engine_, 1, context_.get()));
+    return true;
+}
+
+void *CudaInferContext::GetHostBuffer(int index)
+{
+    const auto binding = ProfileBinding(index);
+    if (!buffer_ || binding < 0) {
+        return nullptr;
+    }
+    return buffer_->getHostBuffer(engine_->getBindingName(binding));
+}
+
+size_t CudaInferContext::GetBufferSize(int index) const
+{
+    const auto binding = ProfileBinding(index);
+    if (!buffer_ || binding < 0) {
+        return 0;
+    }
+    return buffer_->size(engine_->getBindingName(binding));
+}
+
+void CudaInferContext::CopyInputToDevice()
+{
+    buffer_->copyInputToDevice();
+}
+
+bool CudaInferContext::Execute()
+{
+    return context_->executeV2(buffer_->getDeviceBindings().data());
+}
+
+void CudaInferContext::CopyOutputToHost()
+{
+    buffer_->copyOutputToHost();
+}
+
+const samplesCommon::StagingLayout *CudaInferContext::GetStagingLayout() const
+{
+    return buffer_ ? &buffer_->layout() : nullptr;
+}
@@ -0,0 +1,105 @@
+// CudaBackend.h: TensorRT implementation of the inference backend
+//
+
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <NvInfer.h>
+
+#include "InferBackend.h"
+#include "common/common.h"
+
+
+namespace samplesCommon {
+class BufferManager;
+}
+
+//!
+//! \brief A TensorRT engine. With dynamic shapes, TensorRT 7 needs a distinct optimization profile for every live
+//!        context, so contexts take a free profile and give it back when destroyed.
+//!
+class CudaInferEngine : public InferEngine, public std::enable_shared_from_this<CudaInferEngine>
+{
+public:
+    explicit CudaInferEngine(std::shared_ptr<nvinfer1::ICudaEngine> engine);
+
+    //!
+    //! \brief Deserialize a TensorRT engine from memory. Returns nullptr on failure.
+    //!
+    static std::shared_ptr<CudaInferEngine> Deserialize(const void *data, size_t size);
+
+    int GetNbBindings() const override;
+
+    const char *GetBindingName(int index) const override;
+
+    int GetBindingIndex(const char *name) const override;
+
+    bool BindingIsInput(int index) const override;
+
+    infer::Dims GetBindingDimensions(int index) const override;
+
+    infer::DataType GetBindingDataType(int index) const override;
+
+    int MaxContexts() const override;
+
+    std::unique_ptr<InferContext> CreateContext() override;
+
+    void ReleaseProfile(int profile);
+
+private:
+    std::shared_ptr<nvinfer1::ICudaEngine> engine_;
+    int bindings_per_profile_;          //!< TensorRT repeats the bindings for every optimization profile.
+    bool dynamic_;                      //!< Some binding has a dynamic axis, so contexts need profiles.
+    std::mutex context_mutex_;          //!< Context creation is not thread-safe on one engine, guards free_profiles_.
+    std::vector<int> free_profiles_;
+};
+
+class CudaInferContext : public InferContext
+{
+    template <typename T>
+    using SampleUniquePtr = std::unique_ptr<T, samplesCommon::InferDeleter>;
+
+public:
+    //!
+    //! \brief Binding indices are those of the engine's first profile, the context maps them onto its own profile.
+    //!        The profile is -1 for an engine without dynamic shapes.
+    //!
+    CudaInferContext(std::shared_ptr<CudaInferEngine> owner, std::shared_ptr<nvinfer1::ICudaEngine> engine,
+                     nvinfer1::IExecutionContext *context, int profile, int bindings_per_profile);
+
+    ~CudaInferContext() override;
+
+    bool SetBindingDimensions(int index, const infer::Dims &dims) override;
+
+    infer::Dims GetBindingDimensions(int index) const override;
+
+    bool AllocateBuffers() override;
+
+    void *GetHostBuffer(int index) override;
+
+    size_t GetBufferSize(int index) const override;
+
+    void CopyInputToDevice() override;
+
+    bool Execute() override;
+
+    void CopyOutputToHost() override;
+
+    const samplesCommon::StagingLayout *GetStagingLayout() const override;
+
+private:
+    //!
+    //! \brief Returns -1 for an invalid index.
+    //!
+    int ProfileBinding(int index) const;
+
+    std::shared_ptr<CudaInferEngine> owner_;
+    std::shared_ptr<nvinfer1::ICudaEngine> engine_;
+    int profile_;
+    int bindings_per_profile_;
+    SampleUniquePtr<nvinfer1::IExecutionContext> context_;
+    std::unique_ptr<samplesCommon::BufferManager> buffer_;
+};
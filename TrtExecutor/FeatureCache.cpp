@@ -0,0 +1,316 @@
+// FeatureCache.cpp: Impl
+//
+
+#include "FeatureCache.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+namespace {
+
+constexpr const char *kEntrySuffix = ".feat";
+constexpr const char *kTempInfix = ".tmp.";
+constexpr time_t kStaleTempSeconds = 24 * 3600;
+
+}
+
+void FeatureHasher::Update(const void *data, size_t size)
+{
+    constexpr uint64_t kFnvPrime = 0x100000001b3ull;
+    constexpr uint64_t kPrime1 = 0x9e3779b185ebca87ull;
+    constexpr uint64_t kPrime2 = 0xc2b2ae3d27d4eb4full;
+    const auto round = [this](uint64_t word) {
+        check_ += word * kPrime2;
+        check_ = ((check_ << 31) | (check_ >> 33)) * kPrime1;
+    };
+
+    const auto *bytes = static_cast<const unsigned char *>(data);
+    length_ += size;
+    for (size_t i = 0; i < size; ++i) {
+        hash_ = (hash_ ^ bytes[i]) * kFnvPrime;
+    }
+    for (; size >= sizeof(uint64_t); bytes += sizeof(uint64_t), size -= sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, bytes, sizeof(word));
+        round(word);
+    }
+    if (size > 0) {
+        // The tail with its length in the top byte, so it differs from a word of the same bytes.
+        uint64_t word = static_cast<uint64_t>(size) << 56;
+        memcpy(&word, bytes, size);
+        round(word);
+    }
+}
+
+uint64_t FeatureHasher::Value() const
+{
+    auto hash = hash_;
+    hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ull;
+    hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebull;
+    return hash ^ (hash >> 31);
+}
+
+uint64_t FeatureHasher::Check() const
+{
+    // The xxHash64 avalanche over the rounds and the length.
+    auto hash = check_ ^ length_;
+    hash = (hash ^ (hash >> 33)) * 0xc2b2ae3d27d4eb4full;
+    hash = (hash ^ (hash >> 29)) * 0x165667b19e3779f9ull;
+    return hash ^ (hash >> 32);
+}
+
+FeatureCacheEntry::~FeatureCacheEntry()
+{
+    if (map_) {
+        munmap(map_, size_);
+    }
+    if (!temp_path_.empty()) {
+        unlink(temp_path_.c_str());
+    }
+}
+
+FeatureCache::FeatureCache(const FeatureCacheConfig &config)
+    : config_(config)
+{
+}
+
+std::shared_ptr<FeatureCache> FeatureCache::Open(const FeatureCacheConfig &config)
+{
+    if (mkdir(config.directory.c_str(), 0755) != 0 && errno != EEXIST) {
+        std::cerr << "Error: Unable to create feature cache " << config.directory << ": " << strerror(errno)
+                  << std::endl;
+        return nullptr;
+    }
+    struct stat st{};
+    if (stat(config.directory.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+        std::cerr << "Error: Feature cache " << config.directory << " is not a directory." << std::endl;
+        return nullptr;
+    }
+    std::shared_ptr<FeatureCache> cache(new FeatureCache(config));
+    cache->Scan();
+    return cache;
+}
+
+void FeatureCache::Scan()
+{
+    auto *dir = opendir(config_.directory.c_str());
+    if (!dir) {
+        return;
+    }
+    struct Found
+    {
+        uint64_t key;
+        uint64_t bytes;
+        timespec mtime;
+    };
+    std::vector<Found> found;
+    const auto now = time(nullptr);
+    while (auto *dirent = readdir(dir)) {
+        const std::string name = dirent->d_name;
+        const auto path = config_.directory + "/" + name;
+        struct stat st{};
+        if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+            continue;
+        }
+        if (name.find(kTempInfix) != std::string::npos) {
+            // Left by a writer that died; a live one would have renamed it long ago.
+            if (now - st.st_mtime > kStaleTempSeconds) {
+                unlink(path.c_str());
+            }
+            continue;
+        }
+        uint64_t key;
+        char suffix[8] = {};
+        if (name.size() == 16 + strlen(kEntrySuffix) && sscanf(name.c_str(), "%16" SCNx64 "%7s", &key, suffix) == 2 &&
+            strcmp(suffix, kEntrySuffix) == 0) {
+            found.push_back({key, static_cast<uint64_t>(st.st_size), st.st_mtim});
+        }
+    }
+    closedir(dir);
+
+    std::sort(found.begin(), found.end(), [](const Found &a, const Found &b) {
+        return a.mtime.tv_sec != b.mtime.tv_sec ? a.mtime.tv_sec < b.mtime.tv_sec : a.mtime.tv_nsec < b.mtime.tv_nsec;
+    });
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto &entry : found) {
+        Touch(entry.key, entry.bytes);
+    }
+    Evict();
+    std::cout << "Info: feature cache " << config_.directory << ": " << items_.size() << " entries, "
+              << (bytes_ >> 20) << " of " << (config_.max_bytes >> 20) << " MiB." << std::endl;
+}
+
+std::string FeatureCache::EntryPath(uint64_t key) const
+{
+    char name[32];
+    snprintf(name, sizeof(name), "%016" PRIx64 "%s", key, kEntrySuffix);
+    return config_.directory + "/" + name;
+}
+
+size_t FeatureCache::EntryBytes(uint32_t frame_count, uint32_t bins)
+{
+    // Features, magnitudes and the two halves of the phasors.
+    return feature_cache::kAlignment + 4 * static_cast<size_t>(frame_count) * bins * sizeof(float);
+}
+
+std::unique_ptr<FeatureCacheEntry> FeatureCache::Find(uint64_t key, uint64_t check, uint32_t frame_count,
+                                                      uint32_t bins)
+{
+    const auto path = EntryPath(key);
+    const auto bytes = EntryBytes(frame_count, bins);
+    std::unique_ptr<FeatureCacheEntry> entry;
+    const auto fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st{};
+    if (fd >= 0 && fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) == bytes) {
+        auto *map = mmap(nullptr, bytes, PROT_READ, MAP_SHARED, fd, 0);
+        if (map != MAP_FAILED) {
+            entry.reset(new FeatureCacheEntry());
+            entry->map_ = map;
+            entry->size_ = bytes;
+            const auto *header = static_cast<const feature_cache::EntryHeader *>(map);
+            if (header->magic != feature_cache::kMagic || header->version != feature_cache::kVersion ||
+                header->key != key || header->check != check || header->frame_count != frame_count ||
+                header->bins != bins) {
+                entry.reset();
+            }
+        }
+    }
+    if (entry) {
+        entry->key_ = key;
+        entry->check_ = check;
+        entry->frame_count_ = frame_count;
+        entry->bins_ = bins;
+        entry->data_ = reinterpret_cast<float *>(static_cast<char *>(entry->map_) + feature_cache::kAlignment);
+        madvise(entry->map_, bytes, MADV_WILLNEED);
+        // The modification time is the recency the next Scan() evicts by.
+        futimens(fd, nullptr);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (entry) {
+        ++hits_;
+        Touch(key, bytes);
+    } else {
+        ++misses_;
+    }
+    return entry;
+}
+
+std::unique_ptr<FeatureCacheEntry> FeatureCache::Begin(uint64_t key, uint64_t check, uint32_t frame_count,
+                                                       uint32_t bins)
+{
+    uint64_t serial;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        serial = temp_serial_++;
+    }
+    const auto temp_path = EntryPath(key) + kTempInfix + std::to_string(getpid()) + "." + std::to_string(serial);
+    const auto bytes = EntryBytes(frame_count, bins);
+    const auto fd = open(temp_path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        std::cerr << "Error: Unable to create feature cache entry " << temp_path << ": " << strerror(errno)
+                  << std::endl;
+        return nullptr;
+    }
+    std::unique_ptr<FeatureCacheEntry> entry(new FeatureCacheEntry());
+    entry->temp_path_ = temp_path;
+    void *map = MAP_FAILED;
+    if (ftruncate(fd, static_cast<off_t>(bytes)) == 0) {
+        map = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    const auto error = errno;
+    close(fd);
+    if (map == MAP_FAILED) {
+        std::cerr << "Error: Unable to map feature cache entry " << temp_path << ": " << strerror(error) << std::endl;
+        return nullptr;
+    }
+
+    entry->key_ = key;
+    entry->check_ = check;
+    entry->frame_count_ = frame_count;
+    entry->bins_ = bins;
+    entry->map_ = map;
+    entry->size_ = bytes;
+    entry->data_ = reinterpret_cast<float *>(static_cast<char *>(map) + feature_cache::kAlignment);
+    auto *header = static_cast<feature_cache::EntryHeader *>(map);
+    header->magic = feature_cache::kMagic;
+    header->version = feature_cache::kVersion;
+    header->key = key;
+    header->frame_count = frame_count;
+    header->bins = bins;
+    header->check = check;
+    return entry;
+}
+
+bool FeatureCache::Commit(std::unique_ptr<FeatureCacheEntry> entry)
+{
+    if (!entry || entry->temp_path_.empty()) {
+        return false;
+    }
+    const auto path = EntryPath(entry->key_);
+    if (rename(entry->temp_path_.c_str(), path.c_str()) != 0) {
+        std::cerr << "Error: Unable to commit feature cache entry " << path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    entry->temp_path_.clear();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    Touch(entry->key_, entry->size_);
+    Evict();
+    return true;
+}
+
+void FeatureCache::Touch(uint64_t key, uint64_t bytes)
+{
+    auto it = items_.find(key);
+    if (it != items_.end()) {
+        bytes_ -= it->second.bytes;
+        lru_.erase(it->second.lru);
+    }
+    lru_.push_back(key);
+    items_[key] = Item{bytes, std::prev(lru_.end())};
+    bytes_ += bytes;
+}
+
+void FeatureCache::Evict()
+{
+    while (bytes_ > config_.max_bytes && !lru_.empty()) {
+        const auto key = lru_.front();
+        // Mappings of the entry stay valid for the streams reading it.
+        if (unlink(EntryPath(key).c_str()) != 0 && errno != ENOENT) {
+            std::cout << "Warning: Unable to evict feature cache entry " << EntryPath(key) << ": "
+                      << strerror(errno) << std::endl;
+        }
+        bytes_ -= items_[key].bytes;
+        items_.erase(key);
+        lru_.pop_front();
+    }
+}
+
+uint64_t FeatureCache::Hits() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return hits_;
+}
+
+uint64_t FeatureCache::Misses() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return misses_;
+}
@@ -0,0 +1,200 @@
+// FeatureCache.h: On-disk, memory-mapped store of the frontend output of voice files
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+
+//!
+//! \brief On-disk layout of a feature cache entry, little-endian, one file per entry named by its key.
+//!
+//! \details The file is an EntryHeader padded to kAlignment, then three float32 matrices of frame_count rows:
+//!          the MVN-normalized features (bins per row), the STFT magnitudes (bins per row) and the phasors
+//!          (bins real parts then bins imaginary parts per row). Entries are written under a temporary name
+//!          and renamed into place complete, so a reader never maps a partial one.
+//!
+namespace feature_cache {
+
+constexpr uint32_t kMagic = 0x45434654;  // "TFCE"
+constexpr uint32_t kVersion = 2;
+constexpr size_t kAlignment = 64;
+
+struct EntryHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t key;
+    uint32_t frame_count;
+    uint32_t bins;
+    uint64_t check;         //!< Second hash of the same input, a key collision must match it too.
+};
+
+static_assert(sizeof(EntryHeader) == 32, "feature cache header layout");
+
+}
+
+//!
+//! \brief Two independent 64-bit hashes of the signal and frontend config a cache entry is computed from:
+//!        Value() names the entry, Check() is stored in it and compared on lookup.
+//!
+//! \details Value() is byte-wise FNV-1a, Check() multiplies and rotates each 64-bit word as the xxHash64
+//!          round does; both mix high bits into low ones, so sign flips of samples do not cancel in pairs.
+//!
+class FeatureHasher
+{
+public:
+    void Update(const void *data, size_t size);
+
+    template <typename T>
+    void Update(const T &value)
+    {
+        Update(&value, sizeof(value));
+    }
+
+    uint64_t Value() const;
+
+    uint64_t Check() const;
+
+private:
+    uint64_t hash_ = 0xcbf29ce484222325ull;
+    uint64_t check_ = 0x27d4eb2f165667c5ull;
+    uint64_t length_ = 0;
+};
+
+//!
+//! \brief A mapped cache entry: read-only as found in the cache, writable as begun for a store.
+//!
+class FeatureCacheEntry
+{
+public:
+    ~FeatureCacheEntry();
+
+    FeatureCacheEntry(const FeatureCacheEntry &) = delete;
+    FeatureCacheEntry &operator=(const FeatureCacheEntry &) = delete;
+
+    uint32_t FrameCount() const
+    {
+        return frame_count_;
+    }
+
+    uint32_t Bins() const
+    {
+        return bins_;
+    }
+
+    float *Features(uint32_t frame) const
+    {
+        return data_ + static_cast<size_t>(frame) * bins_;
+    }
+
+    float *Magnitudes(uint32_t frame) const
+    {
+        return data_ + (static_cast<size_t>(frame_count_) + frame) * bins_;
+    }
+
+    float *Phasors(uint32_t frame) const
+    {
+        return data_ + (2 * static_cast<size_t>(frame_count_) + 2 * static_cast<size_t>(frame)) * bins_;
+    }
+
+private:
+    friend class FeatureCache;
+
+    FeatureCacheEntry() = default;
+
+    uint64_t key_ = 0;
+    uint64_t check_ = 0;
+    uint32_t frame_count_ = 0;
+    uint32_t bins_ = 0;
+    void *map_ = nullptr;
+    size_t size_ = 0;
+    float *data_ = nullptr;
+    std::string temp_path_;     //!< Set while a begun entry is not committed, removed if it never is.
+};
+
+struct FeatureCacheConfig
+{
+    std::string directory;
+    uint64_t max_bytes = 8ull << 30;    //!< Least recently used entries are removed past this size.
+};
+
+//!
+//! \brief Size-bounded store of frontend features, so passes over the same corpus (one per model version)
+//!        compute the STFT, log power and MVN of a file once.
+//!
+//! \details Entries are keyed by a hash of the decoded signal and the frontend config and read back with
+//!          mmap, so a hit costs a page-in instead of the frontend. Eviction is least recently used by
+//!          modification time, which a hit refreshes; the index is built from the directory when the cache
+//!          is opened and kept per process, so processes sharing a directory may each overshoot max_bytes
+//!          by the entries the others add. Safe to use from several threads.
+//!
+class FeatureCache
+{
+public:
+    //!
+    //! \brief Open or create the cache in config.directory. Returns nullptr if the directory is not usable.
+    //!
+    static std::shared_ptr<FeatureCache> Open(const FeatureCacheConfig &config);
+
+    //!
+    //! \brief Map the entry of key, nullptr on a miss or if the entry is not of frame_count rows of bins or
+    //!        was stored with another check.
+    //!
+    std::unique_ptr<FeatureCacheEntry> Find(uint64_t key, uint64_t check, uint32_t frame_count, uint32_t bins);
+
+    //!
+    //! \brief Create a writable entry for key to fill and Commit. nullptr if it cannot be created.
+    //!
+    std::unique_ptr<FeatureCacheEntry> Begin(uint64_t key, uint64_t check, uint32_t frame_count, uint32_t bins);
+
+    //!
+    //! \brief Publish a filled entry from Begin and evict down to max_bytes.
+    //!
+    bool Commit(std::unique_ptr<FeatureCacheEntry> entry);
+
+    uint64_t Hits() const;
+
+    uint64_t Misses() const;
+
+private:
+    struct Item
+    {
+        uint64_t bytes;
+        std::list<uint64_t>::iterator lru;
+    };
+
+    explicit FeatureCache(const FeatureCacheConfig &config);
+
+    //!
+    //! \brief Index the entries of the directory, oldest first, and drop stale temporary files.
+    //!
+    void Scan();
+
+    std::string EntryPath(uint64_t key) const;
+
+    //!
+    //! \brief Account key as most recently used, bytes big. Called locked.
+    //!
+    void Touch(uint64_t key, uint64_t bytes);
+
+    void Evict();
+
+    static size_t EntryBytes(uint32_t frame_count, uint32_t bins);
+
+    FeatureCacheConfig config_;
+
+    mutable std::mutex mutex_;
+    std::list<uint64_t> lru_;   //!< Keys, least recently used first.
+    std::unordered_map<uint64_t, Item> items_;
+    uint64_t bytes_ = 0;
+    uint64_t hits_ = 0;
+    uint64_t misses_ = 0;
+    uint64_t temp_serial_ = 0;
+};
@@ -0,0 +1,49 @@
+// InferBackend.cpp: Impl
+//
+
+#include "InferBackend.h"
+
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#ifdef TRT_EXECUTOR_TENSORRT
+#include "CudaBackend.h"
+#endif
+#include "NsNetCpuBackend.h"
+#include "StandInBackend.h"
+
+
+std::shared_ptr<InferEngine> LoadInferEngine(const std::string &model_path)
+{
+    std::ifstream model_file(model_path, std::ios_base::binary);
+    if (!model_file) {
+        std::cerr << "Error: Unable to open model file: " << model_path << std::endl;
+        return nullptr;
+    }
+
+    model_file.seekg(0, std::ios_base::end);
+    const auto file_len = model_file.tellg();
+    model_file.seekg(0, std::ios_base::beg);
+    std::cout << "Info: model file length: " << file_len << "bytes." << std::endl;
+    std::vector<char> file_buffer(file_len);
+    model_file.read(file_buffer.data(), file_len);
+
+    if (NsNetCpuEngine::IsWeightFile(file_buffer.data(), file_buffer.size())) {
+        return NsNetCpuEngine::Parse(file_buffer.data(), file_buffer.size());
+    }
+    if (StandInSpec::IsSpecFile(file_buffer.data(), file_buffer.size())) {
+        StandInSpec spec;
+        if (!spec.Parse(std::string(file_buffer.begin(), file_buffer.end()))) {
+            return nullptr;
+        }
+        return std::make_shared<StandInEngine>(std::move(spec));
+    }
+#ifdef TRT_EXECUTOR_TENSORRT
+    return CudaInferEngine::Deserialize(file_buffer.data(), file_buffer.size());
+#else
+    std::cerr << "Error: " << model_path << " is not a weight or stand-in file, and TensorRT engines need a build "
+              << "with CUDA and TensorRT." << std::endl;
+    return nullptr;
+#endif
+}
@@ -0,0 +1,165 @@
+// InferBackend.h: Inference backend abstraction under TrtExecutor
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+
+#include "common/staging.h"
+
+
+//!
+//! \brief Binding dimensions and element types, the part of the nvinfer1 types the executor uses. Only the
+//!        TensorRT backend sees nvinfer1, so the executor and the CPU backends build without TensorRT. Kept
+//!        in a namespace because the TensorRT sample headers pull nvinfer1 into the global one.
+//!
+namespace infer {
+
+//!
+//! \brief -1 for a dynamic axis.
+//!
+struct Dims
+{
+    static constexpr int MAX_DIMS = 8;
+
+    int nbDims = 0;
+    int d[MAX_DIMS] = {};
+};
+
+struct Dims3 : Dims
+{
+    Dims3(int d0, int d1, int d2)
+    {
+        nbDims = 3;
+        d[0] = d0;
+        d[1] = d1;
+        d[2] = d2;
+    }
+};
+
+inline int64_t Volume(const Dims &dims)
+{
+    int64_t volume = 1;
+    for (int i = 0; i < dims.nbDims; ++i) {
+        volume *= dims.d[i];
+    }
+    return volume;
+}
+
+inline std::ostream &operator<<(std::ostream &os, const Dims &dims)
+{
+    os << "(";
+    for (int i = 0; i < dims.nbDims; ++i) {
+        os << (i ? ", " : "") << dims.d[i];
+    }
+    return os << ")";
+}
+
+enum class DataType : int
+{
+    kFLOAT = 0,
+    kHALF,
+    kOTHER,     //!< Any other type, not supported by the executor.
+};
+
+}
+
+class InferContext;
+
+//!
+//! \brief A loaded model: the binding layout plus a factory of execution contexts.
+//!
+//! \details Mirrors the part of nvinfer1::ICudaEngine the executor uses, so the same input streams and
+//!          output handlers run on TensorRT or on a CPU implementation. Binding dimensions may contain -1
+//!          for dynamic axes, which are resolved per context.
+//!
+class InferEngine
+{
+public:
+    virtual ~InferEngine() = default;
+
+    virtual int GetNbBindings() const = 0;
+
+    virtual const char *GetBindingName(int index) const = 0;
+
+    //!
+    //! \brief Returns -1 if no binding has the name.
+    //!
+    virtual int GetBindingIndex(const char *name) const = 0;
+
+    virtual bool BindingIsInput(int index) const = 0;
+
+    virtual infer::Dims GetBindingDimensions(int index) const = 0;
+
+    virtual infer::DataType GetBindingDataType(int index) const = 0;
+
+    //!
+    //! \brief Contexts of the engine that can be alive at once, 0 for no limit. A TensorRT engine with dynamic
+    //!        shapes has one per optimization profile it was built with.
+    //!
+    virtual int MaxContexts() const
+    {
+        return 0;
+    }
+
+    //!
+    //! \brief Returns nullptr on failure, also when MaxContexts contexts are alive. Executors sharing the engine
+    //!        call this concurrently.
+    //!
+    virtual std::unique_ptr<InferContext> CreateContext() = 0;
+};
+
+//!
+//! \brief Per-stream execution state of an engine: resolved dimensions and the binding buffers.
+//!
+//! \details Set the dynamic dimensions, then AllocateBuffers, then per frame: fill the input host buffers,
+//!          CopyInputToDevice, Execute, CopyOutputToHost and read the output host buffers. Backends running
+//!          on the host implement the copies as no-ops.
+//!
+class InferContext
+{
+public:
+    virtual ~InferContext() = default;
+
+    virtual bool SetBindingDimensions(int index, const infer::Dims &dims) = 0;
+
+    virtual infer::Dims GetBindingDimensions(int index) const = 0;
+
+    virtual bool AllocateBuffers() = 0;
+
+    //!
+    //! \brief Returns nullptr if the buffers are not allocated or the index is invalid.
+    //!
+    virtual void *GetHostBuffer(int index) = 0;
+
+    //!
+    //! \brief Size in bytes of the host buffer of the binding.
+    //!
+    virtual size_t GetBufferSize(int index) const = 0;
+
+    virtual void CopyInputToDevice() = 0;
+
+    virtual bool Execute() = 0;
+
+    virtual void CopyOutputToHost() = 0;
+
+    //!
+    //! \brief Placement of the binding buffers in the input and output staging regions, nullptr if the backend
+    //!        does not stage them. Valid after AllocateBuffers.
+    //!
+    virtual const samplesCommon::StagingLayout *GetStagingLayout() const
+    {
+        return nullptr;
+    }
+};
+
+//!
+//! \brief Load a model, picking the backend from the file content: NSNet weight files run on the CPU
+//!        backend, stand-in spec files on the latency-simulating stand-in, anything else is deserialized
+//!        as a TensorRT engine if built with TRT_EXECUTOR_TENSORRT. Returns nullptr on failure.
+//!
+std::shared_ptr<InferEngine> LoadInferEngine(const std::string &model_path);
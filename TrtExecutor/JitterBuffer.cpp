@@ -0,0 +1,246 @@
+// JitterBuffer.cpp: Impl
+//
+
+#include "JitterBuffer.h"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <limits>
+
+#include "Timeline.h"
+
+
+JitterBuffer::JitterBuffer(const JitterBufferConfig &config, int hop_size)
+    : config_(config),
+      hop_size_(hop_size),
+      us_per_sample_(1e6 / config.sample_rate),
+      last_hop_(hop_size),
+      delay_us_(config.min_delay_ms * 1e3)
+{
+    const auto wanted = static_cast<uint64_t>(config_.capacity_ms * config_.sample_rate / 1e3) + hop_size;
+    uint64_t capacity = 1;
+    while (capacity < wanted) {
+        capacity <<= 1;
+    }
+    samples_.resize(capacity);
+    valid_.resize(capacity);
+    mask_ = capacity - 1;
+    stats_.delay_ms = stats_.max_delay_ms = delay_us_ / 1e3;
+}
+
+void JitterBuffer::Push(uint64_t timestamp, const float *samples, size_t count, int64_t arrival_us)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++stats_.packets;
+    if (!started_) {
+        started_ = true;
+        origin_ = playout_pos_ = end_pos_ = timestamp;
+        base_transit_us_ = last_transit_us_ = arrival_us;
+    } else if (timestamp < origin_ && playout_pos_ == origin_ && !closed_) {
+        // Reordered ahead of the first packet before anything was played, the stream starts earlier.
+        const auto shift_us = static_cast<int64_t>((origin_ - timestamp) * us_per_sample_);
+        base_transit_us_ -= shift_us;
+        last_transit_us_ -= shift_us;
+        origin_ = playout_pos_ = timestamp;
+    }
+    if (closed_ || timestamp < origin_) {
+        ++stats_.late_packets;
+        return;
+    }
+    const auto begin = timestamp;
+    const auto transit = arrival_us - static_cast<int64_t>((begin - origin_) * us_per_sample_);
+    jitter_us_ += (std::abs(static_cast<double>(transit - last_transit_us_)) - jitter_us_) / 16.0;
+    last_transit_us_ = transit;
+    base_transit_us_ = std::min(base_transit_us_, transit);
+
+    if (begin < end_pos_) {
+        ++stats_.reordered_packets;
+    }
+    const auto end = begin + count;
+    if (end <= playout_pos_) {
+        ++stats_.late_packets;
+        return;
+    }
+    if (end > playout_pos_ + samples_.size()) {
+        ++stats_.overflow_packets;
+        return;
+    }
+    // A packet partly played out keeps its part still ahead.
+    for (auto pos = std::max(begin, playout_pos_); pos < end; ++pos) {
+        const auto index = pos & mask_;
+        if (valid_[index]) {
+            ++stats_.duplicate_samples;
+            continue;
+        }
+        samples_[index] = samples[pos - begin];
+        valid_[index] = 1;
+    }
+    end_pos_ = std::max(end_pos_, end);
+}
+
+void JitterBuffer::Close()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = true;
+}
+
+JitterBuffer::PopResult JitterBuffer::Pop(int64_t now_us, float *hop)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!started_ && !closed_) {
+        return PopResult::kNotDue;
+    }
+    if (closed_ && playout_pos_ >= end_pos_) {
+        return PopResult::kEnd;
+    }
+    if (!closed_ && now_us < DueUs(playout_pos_)) {
+        return PopResult::kNotDue;
+    }
+
+    // last_hop_ is already faded by the hops lost before, so each one in a row takes the decay once more.
+    const auto gain = lost_hops_ ? config_.conceal_decay : 1.0f;
+    size_t missing = 0;
+    for (int i = 0; i < hop_size_; ++i) {
+        const auto pos = playout_pos_ + i;
+        const auto index = pos & mask_;
+        if (closed_ && pos >= end_pos_) {
+            hop[i] = 0.0f;
+        } else if (valid_[index]) {
+            hop[i] = samples_[index];
+            valid_[index] = 0;
+        } else {
+            hop[i] = last_hop_[i] * gain;
+            ++missing;
+        }
+    }
+    std::copy_n(hop, hop_size_, last_hop_.data());
+    lost_hops_ = missing ? lost_hops_ + 1 : 0;
+    stats_.concealed_samples += missing;
+    playout_pos_ += hop_size_;
+
+    // Up at once, down by a tenth of a hop per hop.
+    const auto target = TargetDelayUs();
+    delay_us_ = target > delay_us_ ? target : std::max(target, delay_us_ - hop_size_ * us_per_sample_ / 10.0);
+    stats_.delay_ms = delay_us_ / 1e3;
+    stats_.max_delay_ms = std::max(stats_.max_delay_ms, stats_.delay_ms);
+    return PopResult::kHop;
+}
+
+int64_t JitterBuffer::NextDueUs() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (closed_) {
+        return std::numeric_limits<int64_t>::min();
+    }
+    return started_ ? DueUs(playout_pos_) : std::numeric_limits<int64_t>::max();
+}
+
+size_t JitterBuffer::PendingHops(int64_t now_us) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (closed_) {
+        const auto left = (std::max(end_pos_, playout_pos_) - playout_pos_ + hop_size_ - 1) / hop_size_;
+        return left > 0 ? static_cast<size_t>(left - 1) : 0;
+    }
+    const auto late_us = started_ ? now_us - DueUs(playout_pos_) : 0;
+    return late_us > 0 ? static_cast<size_t>(late_us / (hop_size_ * us_per_sample_)) : 0;
+}
+
+uint64_t JitterBuffer::EndPosition() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return end_pos_ - origin_;
+}
+
+JitterStats JitterBuffer::Stats() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto stats = stats_;
+    stats.jitter_ms = jitter_us_ / 1e3;
+    return stats;
+}
+
+int64_t JitterBuffer::DueUs(uint64_t position) const
+{
+    return base_transit_us_ + static_cast<int64_t>((position - origin_ + hop_size_) * us_per_sample_ + delay_us_);
+}
+
+double JitterBuffer::TargetDelayUs() const
+{
+    const auto delay_us = config_.jitter_factor * jitter_us_;
+    return std::min(config_.max_delay_ms * 1e3, std::max(config_.min_delay_ms * 1e3, delay_us));
+}
+
+JitterInputStream::JitterInputStream(const VoiceFileInputConfig &voice, std::shared_ptr<JitterBuffer> buffer,
+                                     TrtExecutor *executor)
+    : buffer_(std::move(buffer)),
+      executor_(executor),
+      frontend_(voice, buffer_->SampleRate()),
+      window_(frontend_.FrameSize()),
+      hop_(frontend_.HopSize())
+{
+    assert(buffer_->HopSize() == frontend_.HopSize());
+}
+
+infer::Dims JitterInputStream::GetDynamicDim(const char *input_name)
+{
+    return infer::Dims3{1, 1, static_cast<int>(frontend_.Bins())};
+}
+
+std::vector<std::string> JitterInputStream::GetInputTensorNames(const InferEngine &engine)
+{
+    return VoiceInputTensorNames(engine);
+}
+
+bool JitterInputStream::TryTake(const std::vector<void *> &host_buffer, const std::vector<size_t> &sizes)
+{
+    const auto hop = static_cast<size_t>(frontend_.HopSize());
+    if (frame_count_ < 0) {
+        const auto result = buffer_->Pop(NowUs(), hop_.data());
+        if (result == JitterBuffer::PopResult::kNotDue) {
+            return false;
+        }
+        if (result == JitterBuffer::PopResult::kEnd) {
+            // Same frame count as VoiceInputStream: until the history of a frame is past the last sample.
+            const auto history = static_cast<uint64_t>(frontend_.FrameSize()) - hop;
+            frame_count_ = static_cast<int64_t>((buffer_->EndPosition() + history + hop - 1) / hop);
+            std::fill(hop_.begin(), hop_.end(), 0.0f);
+        }
+    }
+    if (frame_count_ >= 0 && frontend_.FrameIndex() + 1 >= frame_count_) {
+        executor_->Terminate();
+        return false;
+    }
+    assert(host_buffer.size() == sizes.size());
+    assert(frontend_.Bins() * sizeof(float) == sizes[0]);
+    TRT_TIMELINE_SCOPE("input", "frontend");
+
+    std::copy(window_.begin() + hop, window_.end(), window_.begin());
+    std::copy(hop_.begin(), hop_.end(), window_.end() - hop);
+    std::copy(window_.begin(), window_.end(), frontend_.Frame());
+    frontend_.Analyze(static_cast<float *>(host_buffer[0]));
+    return true;
+}
+
+size_t JitterInputStream::PendingFrames() const
+{
+    return buffer_->PendingHops(NowUs());
+}
+
+void JitterInputStream::SaveState(StreamState &state) const
+{
+    frontend_.SaveState(state);
+}
+
+void JitterInputStream::RestoreState(const StreamState &state)
+{
+    frontend_.RestoreState(state);
+}
+
+int64_t JitterInputStream::NowUs() const
+{
+    const auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::microseconds>(now).count();
+}
@@ -0,0 +1,175 @@
+// JitterBuffer.h: Adaptive jitter buffer with loss concealment for packetized live audio
+//
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "VoiceStream.h"
+
+
+struct JitterBufferConfig
+{
+    int sample_rate = 16000;
+    double min_delay_ms = 20.0;     //!< Playout delay bounds, past the earliest transit seen.
+    double max_delay_ms = 300.0;
+    double jitter_factor = 4.0;     //!< Target delay in multiples of the measured jitter.
+    double capacity_ms = 2000.0;    //!< Samples held ahead of the playout position, later packets are dropped.
+    float conceal_decay = 0.5f;     //!< Gain of the repeated hop per lost hop in a row.
+};
+
+struct JitterStats
+{
+    uint64_t packets = 0;
+    uint64_t reordered_packets = 0;     //!< Arrived after a packet with a later timestamp.
+    uint64_t late_packets = 0;          //!< Arrived after their samples were played out, dropped.
+    uint64_t overflow_packets = 0;      //!< Too far ahead of the playout position, dropped.
+    uint64_t duplicate_samples = 0;
+    uint64_t concealed_samples = 0;
+    double jitter_ms = 0.0;             //!< Interarrival jitter estimate as of RFC 3550.
+    double delay_ms = 0.0;              //!< Playout delay added now.
+    double max_delay_ms = 0.0;
+};
+
+//!
+//! \brief Reorders timestamped packets of a mono stream and plays them out hop by hop on a clock, concealing
+//!        what did not arrive in time.
+//!
+//! \details Timestamps count samples, the stream starts at the earliest one received before the first hop
+//!          is played. The hop [p, p + hop) is due when its last sample is expected, at the earliest transit
+//!          seen plus the playout delay. The delay targets jitter_factor times the RFC 3550 jitter estimate within
+//!          [min_delay_ms, max_delay_ms]; it grows at once and shrinks by a tenth of a hop per hop, so a
+//!          jitter spike is absorbed quickly and the delay settles slowly. Missing samples of a due hop are
+//!          concealed by repeating the last hop with a decaying gain, the frontend never sees a gap or waits
+//!          for a lost packet. Push and Pop may be called from different threads; times are in microseconds
+//!          of any monotonic clock shared by both.
+//!
+class JitterBuffer
+{
+public:
+    enum class PopResult : int
+    {
+        kNotDue = 0,    //!< The next hop is not due yet.
+        kHop,
+        kEnd,           //!< Closed and everything played out.
+    };
+
+    JitterBuffer(const JitterBufferConfig &config, int hop_size);
+
+    void Push(uint64_t timestamp, const float *samples, size_t count, int64_t arrival_us);
+
+    //!
+    //! \brief No more packets: the rest is played out without waiting, lost samples concealed.
+    //!
+    void Close();
+
+    //!
+    //! \brief The next hop into hop, HopSize() samples, if it is due at now_us. Samples past the end of a
+    //!        closed stream are zeros.
+    //!
+    PopResult Pop(int64_t now_us, float *hop);
+
+    //!
+    //! \brief When the next hop is due, INT64_MAX before the first packet, INT64_MIN once closed.
+    //!
+    int64_t NextDueUs() const;
+
+    //!
+    //! \brief Hops due at now_us beyond the next one.
+    //!
+    size_t PendingHops(int64_t now_us) const;
+
+    //!
+    //! \brief End of the stream past the origin, valid once closed.
+    //!
+    uint64_t EndPosition() const;
+
+    int HopSize() const
+    {
+        return hop_size_;
+    }
+
+    int SampleRate() const
+    {
+        return config_.sample_rate;
+    }
+
+    JitterStats Stats() const;
+
+private:
+    int64_t DueUs(uint64_t position) const;
+
+    double TargetDelayUs() const;
+
+    JitterBufferConfig config_;
+    int hop_size_;
+    double us_per_sample_;
+
+    mutable std::mutex mutex_;
+    std::vector<float> samples_;
+    std::vector<uint8_t> valid_;
+    uint64_t mask_;
+    std::vector<float> last_hop_;
+
+    bool started_ = false;
+    bool closed_ = false;
+    uint64_t origin_ = 0;           //!< Timestamp of the first sample of the stream.
+    uint64_t playout_pos_ = 0;      //!< Timestamp of the next sample to play.
+    uint64_t end_pos_ = 0;          //!< Past the latest sample received.
+    int64_t base_transit_us_ = 0;   //!< Earliest arrival minus stream time seen.
+    int64_t last_transit_us_ = 0;
+    double jitter_us_ = 0.0;
+    double delay_us_;
+    int lost_hops_ = 0;             //!< Hops in a row with concealed samples.
+    JitterStats stats_;
+};
+
+//!
+//! \brief Frontend of a stream played out of a JitterBuffer on the steady clock. TryTake returns false until
+//!        the next hop is due, and ends the stream like the file pipeline once the buffer is closed.
+//!
+class JitterInputStream : public TrtInputStream
+{
+public:
+    JitterInputStream(const VoiceFileInputConfig &voice, std::shared_ptr<JitterBuffer> buffer,
+                      TrtExecutor *executor);
+
+    infer::Dims GetDynamicDim(const char *input_name) override;
+
+    std::vector<std::string> GetInputTensorNames(const InferEngine &engine) override;
+
+    bool TryTake(const std::vector<void *> &host_buffer, const std::vector<size_t> &sizes) override;
+
+    size_t PendingFrames() const override;
+
+    void SaveState(StreamState &state) const override;
+
+    void RestoreState(const StreamState &state) override;
+
+    StreamingFrontend &Frontend()
+    {
+        return frontend_;
+    }
+
+    JitterBuffer &Buffer()
+    {
+        return *buffer_;
+    }
+
+protected:
+    //!
+    //! \brief Clock of the playout, steady_clock by default.
+    //!
+    virtual int64_t NowUs() const;
+
+private:
+    std::shared_ptr<JitterBuffer> buffer_;
+    TrtExecutor *executor_;
+    StreamingFrontend frontend_;
+    std::vector<double> window_;
+    std::vector<float> hop_;
+    int64_t frame_count_ = -1;      //!< Known once the buffer is played out.
+};
@@ -0,0 +1,135 @@
+// Metrics.cpp: Impl
+//
+
+#include "Metrics.h"
+
+#include <cmath>
+#include <cstdio>
+#include <sstream>
+#include <vector>
+
+
+size_t metrics_detail::NextShard()
+{
+    static std::atomic<size_t> next{0};
+    return next.fetch_add(1, std::memory_order_relaxed);
+}
+
+uint64_t Counter::Value() const
+{
+    uint64_t value = 0;
+    for (const auto &shard : shards_) {
+        value += shard.value.load(std::memory_order_relaxed);
+    }
+    return value;
+}
+
+Counter &MetricsRegistry::GetCounter(const std::string &name, const std::string &help, const std::string &labels)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto &family = counters_[name];
+    if (family.help.empty()) {
+        family.help = help;
+    }
+    auto &series = family.series[labels];
+    if (!series) {
+        series.reset(new Counter());
+    }
+    return *series;
+}
+
+Gauge &MetricsRegistry::GetGauge(const std::string &name, const std::string &help, const std::string &labels)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto &family = gauges_[name];
+    if (family.help.empty()) {
+        family.help = help;
+    }
+    auto &series = family.series[labels];
+    if (!series) {
+        series.reset(new Gauge());
+    }
+    return *series;
+}
+
+int MetricsRegistry::AddCollector(const std::string &name, const char *type, const std::string &help,
+                                  Collector collector)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto id = next_collector_++;
+    collectors_.emplace(id, CollectorEntry{name, type, help, std::move(collector)});
+    return id;
+}
+
+void MetricsRegistry::RemoveCollector(int id)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    collectors_.erase(id);
+}
+
+void MetricsRegistry::Render(std::ostream &os) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto &family : counters_) {
+        WriteFamily(os, family.first, "counter", family.second.help);
+        for (const auto &series : family.second.series) {
+            WriteSample(os, family.first, series.first, static_cast<double>(series.second->Value()));
+        }
+    }
+    for (const auto &family : gauges_) {
+        WriteFamily(os, family.first, "gauge", family.second.help);
+        for (const auto &series : family.second.series) {
+            WriteSample(os, family.first, series.first, series.second->Value());
+        }
+    }
+    std::map<std::string, std::vector<const CollectorEntry *>> families;
+    for (const auto &collector : collectors_) {
+        families[collector.second.name].push_back(&collector.second);
+    }
+    for (const auto &family : families) {
+        WriteFamily(os, family.first, family.second.front()->type, family.second.front()->help);
+        for (const auto *collector : family.second) {
+            collector->collect(os, family.first);
+        }
+    }
+}
+
+std::string MetricsRegistry::Render() const
+{
+    std::ostringstream os;
+    Render(os);
+    return os.str();
+}
+
+void MetricsRegistry::WriteFamily(std::ostream &os, const std::string &name, const char *type, const std::string &help)
+{
+    os << "# HELP " << name << ' ' << help << '\n';
+    os << "# TYPE " << name << ' ' << type << '\n';
+}
+
+void MetricsRegistry::WriteSample(std::ostream &os, const std::string &name, const std::string &labels, double value)
+{
+    os << name;
+    if (!labels.empty()) {
+        os << '{' << labels << '}';
+    }
+    os << ' ';
+    if (std::isnan(value)) {
+        os << "NaN";
+    } else if (std::isinf(value)) {
+        os << (value > 0 ? "+Inf" : "-Inf");
+    } else {
+        char text[32];
+        snprintf(text, sizeof(text), "%.15g", value);
+        os << text;
+    }
+    os << '\n';
+}
+
+std::string MetricsRegistry::JoinLabels(const std::string &a, const std::string &b)
+{
+    if (a.empty() || b.empty()) {
+        return a + b;
+    }
+    return a + ',' + b;
+}
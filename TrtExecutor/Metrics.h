@@ -0,0 +1,163 @@
+// Metrics.h: Registry of counters and gauges rendered in the Prometheus text format
+//
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+
+
+namespace metrics_detail {
+
+constexpr size_t kShards = 16;
+
+size_t NextShard();
+
+//!
+//! \brief Shard of the calling thread, assigned round robin at its first update.
+//!
+inline size_t ShardIndex()
+{
+    thread_local const size_t index = NextShard() % kShards;
+    return index;
+}
+
+}
+
+//!
+//! \brief Monotonic counter, one cache line per shard so threads updating it do not share a line.
+//!        Add is a relaxed fetch_add on the shard of the calling thread, Value sums the shards.
+//!
+class Counter
+{
+public:
+    void Add(uint64_t n = 1)
+    {
+        shards_[metrics_detail::ShardIndex()].value.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    uint64_t Value() const;
+
+private:
+    struct alignas(64) Shard
+    {
+        std::atomic<uint64_t> value{0};
+    };
+
+    std::array<Shard, metrics_detail::kShards> shards_;
+};
+
+//!
+//! \brief Gauge holding a double. Set is a relaxed store, Add a compare-exchange loop.
+//!
+class Gauge
+{
+public:
+    void Set(double value)
+    {
+        bits_.store(ToBits(value), std::memory_order_relaxed);
+    }
+
+    void Add(double delta)
+    {
+        auto bits = bits_.load(std::memory_order_relaxed);
+        while (!bits_.compare_exchange_weak(bits, ToBits(FromBits(bits) + delta), std::memory_order_relaxed)) {
+        }
+    }
+
+    double Value() const
+    {
+        return FromBits(bits_.load(std::memory_order_relaxed));
+    }
+
+private:
+    static uint64_t ToBits(double value)
+    {
+        uint64_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        return bits;
+    }
+
+    static double FromBits(uint64_t bits)
+    {
+        double value;
+        memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+    alignas(64) std::atomic<uint64_t> bits_{0};
+};
+
+//!
+//! \brief Named metrics and collectors, rendered on demand.
+//!
+//! \details Get* creates a metric on first use and returns the same one for the same name and labels, e.g.
+//!          GetCounter("trt_frames_total", "...", "stream=\"3\""). Metrics live as long as the registry,
+//!          so the hot path keeps the reference and never touches the registry again. Collectors are called
+//!          at render time for values kept elsewhere and write the samples of one family with WriteSample;
+//!          collectors of the same family share its HELP/TYPE header. Registration and rendering take a
+//!          lock, updates do not.
+//!
+class MetricsRegistry
+{
+public:
+    Counter &GetCounter(const std::string &name, const std::string &help, const std::string &labels = "");
+
+    Gauge &GetGauge(const std::string &name, const std::string &help, const std::string &labels = "");
+
+    using Collector = std::function<void(std::ostream &os, const std::string &name)>;
+
+    //!
+    //! \brief Add a collector of family name, returns the id to remove it with. Must be removed before
+    //!        whatever it reads dies.
+    //!
+    int AddCollector(const std::string &name, const char *type, const std::string &help, Collector collector);
+
+    void RemoveCollector(int id);
+
+    //!
+    //! \brief Render every metric in the Prometheus text exposition format, version 0.0.4.
+    //!
+    void Render(std::ostream &os) const;
+
+    std::string Render() const;
+
+    static void WriteFamily(std::ostream &os, const std::string &name, const char *type, const std::string &help);
+
+    static void WriteSample(std::ostream &os, const std::string &name, const std::string &labels, double value);
+
+    //!
+    //! \brief Comma join of two label lists, either may be empty.
+    //!
+    static std::string JoinLabels(const std::string &a, const std::string &b);
+
+private:
+    template <typename T>
+    struct Family
+    {
+        std::string help;
+        std::map<std::string, std::unique_ptr<T>> series;
+    };
+
+    struct CollectorEntry
+    {
+        std::string name;
+        const char *type;
+        std::string help;
+        Collector collect;
+    };
+
+    mutable std::mutex mutex_;
+    std::map<std::string, Family<Counter>> counters_;
+    std::map<std::string, Family<Gauge>> gauges_;
+    std::map<int, CollectorEntry> collectors_;
+    int next_collector_ = 0;
+};
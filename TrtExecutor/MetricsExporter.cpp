@@ -0,0 +1,165 @@
+// MetricsExporter.cpp: Impl
+//
+
+#include "MetricsExporter.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "SocketEndpoint.h"
+
+
+namespace {
+
+// Stop() is noticed within this, the loops poll rather than block.
+constexpr int kPollMs = 100;
+
+void SendAll(int fd, const std::string &data)
+{
+    size_t sent = 0;
+    while (sent < data.size()) {
+        const auto n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0) {
+            return;
+        }
+        sent += static_cast<size_t>(n);
+    }
+}
+
+}
+
+MetricsExporter::MetricsExporter(std::shared_ptr<const MetricsRegistry> registry) : registry_(std::move(registry))
+{
+}
+
+MetricsExporter::~MetricsExporter()
+{
+    Stop();
+}
+
+bool MetricsExporter::Listen(const std::string &endpoint)
+{
+    if (thread_.joinable()) {
+        std::cerr << "Error: metrics exporter already running." << std::endl;
+        return false;
+    }
+
+    listen_fd_ = ListenEndpoint(endpoint, "metrics", unix_path_);
+    if (listen_fd_ < 0) {
+        return false;
+    }
+
+    endpoint_ = endpoint;
+    stop_.store(false, std::memory_order_relaxed);
+    thread_ = std::thread(&MetricsExporter::ServeLoop, this);
+    std::cout << "Info: serving metrics on " << endpoint_ << std::endl;
+    return true;
+}
+
+bool MetricsExporter::WriteFile(const std::string &path, std::chrono::milliseconds interval)
+{
+    if (thread_.joinable()) {
+        std::cerr << "Error: metrics exporter already running." << std::endl;
+        return false;
+    }
+
+    file_path_ = path;
+    interval_ = interval;
+    if (!WriteFileOnce()) {
+        return false;
+    }
+    stop_.store(false, std::memory_order_relaxed);
+    thread_ = std::thread(&MetricsExporter::FileLoop, this);
+    return true;
+}
+
+void MetricsExporter::Stop()
+{
+    if (!thread_.joinable()) {
+        return;
+    }
+
+    stop_.store(true, std::memory_order_relaxed);
+    thread_.join();
+    if (listen_fd_ >= 0) {
+        close(listen_fd_);
+        listen_fd_ = -1;
+    }
+    if (!unix_path_.empty()) {
+        unlink(unix_path_.c_str());
+        unix_path_.clear();
+    }
+    if (!file_path_.empty()) {
+        WriteFileOnce();
+    }
+}
+
+void MetricsExporter::ServeLoop()
+{
+    while (!stop_.load(std::memory_order_relaxed)) {
+        pollfd pfd = {listen_fd_, POLLIN, 0};
+        if (poll(&pfd, 1, kPollMs) <= 0) {
+            continue;
+        }
+        const auto fd = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0) {
+            continue;
+        }
+
+        // The request itself does not matter, wait briefly for it so the client is not reset mid-send.
+        pollfd cfd = {fd, POLLIN, 0};
+        if (poll(&cfd, 1, kPollMs) > 0) {
+            char request[1024];
+            recv(fd, request, sizeof(request), 0);
+        }
+        const auto body = registry_->Render();
+        std::string response = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: ";
+        response += std::to_string(body.size());
+        response += "\r\nConnection: close\r\n\r\n";
+        response += body;
+        SendAll(fd, response);
+        close(fd);
+    }
+}
+
+void MetricsExporter::FileLoop()
+{
+    auto next = std::chrono::steady_clock::now() + interval_;
+    while (!stop_.load(std::memory_order_relaxed)) {
+        const auto now = std::chrono::steady_clock::now();
+        if (now < next) {
+            std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(
+                next - now, std::chrono::milliseconds(kPollMs)));
+            continue;
+        }
+        WriteFileOnce();
+        next += interval_;
+        if (next < now) {
+            next = now + interval_;
+        }
+    }
+}
+
+bool MetricsExporter::WriteFileOnce() const
+{
+    const auto tmp_path = file_path_ + ".tmp";
+    {
+        std::ofstream file(tmp_path, std::ios::trunc);
+        if (!file) {
+            std::cerr << "Error: Unable to write metrics file: " << tmp_path << std::endl;
+            return false;
+        }
+        registry_->Render(file);
+    }
+    if (rename(tmp_path.c_str(), file_path_.c_str()) != 0) {
+        std::cerr << "Error: Unable to rename metrics file to " << file_path_ << std::endl;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,56 @@
+// MetricsExporter.h: Serve a metrics registry over HTTP or write it to a file periodically
+//
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "Metrics.h"
+
+
+//!
+//! \brief Background thread exposing a registry, either answering every HTTP request on a socket with the
+//!        rendered metrics, or rewriting a file at an interval.
+//!
+//! \details Endpoints are "unix:/path/to/socket", "host:port" or "port" (bound to 127.0.0.1). The server
+//!          answers any request with the whole exposition and closes the connection, which is all a
+//!          Prometheus scrape or `curl --unix-socket` needs. The file is written to a temporary name and
+//!          renamed, so readers never see a partial one (node_exporter textfile collector style), and is
+//!          written once more on Stop().
+//!
+class MetricsExporter
+{
+public:
+    explicit MetricsExporter(std::shared_ptr<const MetricsRegistry> registry);
+
+    ~MetricsExporter();
+
+    bool Listen(const std::string &endpoint);
+
+    bool WriteFile(const std::string &path, std::chrono::milliseconds interval);
+
+    void Stop();
+
+private:
+    void ServeLoop();
+
+    void FileLoop();
+
+    bool WriteFileOnce() const;
+
+    std::shared_ptr<const MetricsRegistry> registry_;
+
+    std::string endpoint_;
+    std::string unix_path_;
+    int listen_fd_ = -1;
+
+    std::string file_path_;
+    std::chrono::milliseconds interval_{1000};
+
+    std::thread thread_;
+    std::atomic<bool> stop_{false};
+};
@@ -0,0 +1,320 @@
+// NsNetCpuBackend.cpp: Impl
+//
+
+#include "NsNetCpuBackend.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+
+namespace {
+
+constexpr uint32_t kWeightVersion = 1;
+
+class WeightReader
+{
+public:
+    WeightReader(const void *data, size_t size) : ptr_(static_cast<const char *>(data)), end_(ptr_ + size) {}
+
+    bool ReadU32(uint32_t &value)
+    {
+        return Read(&value, sizeof(value));
+    }
+
+    //!
+    //! \brief Read a rows x cols matrix into rows padded to PadFloats(cols).
+    //!
+    bool ReadMatrix(kernels::AlignedVector<float> &matrix, size_t rows, size_t cols)
+    {
+        const auto stride = kernels::PadFloats(cols);
+        matrix.assign(rows * stride, 0.0f);
+        for (size_t r = 0; r < rows; ++r) {
+            if (!Read(matrix.data() + r * stride, cols * sizeof(float))) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool ReadVector(std::vector<float> &vec, size_t count)
+    {
+        vec.resize(count);
+        return Read(vec.data(), count * sizeof(float));
+    }
+
+    bool AtEnd() const
+    {
+        return ptr_ == end_;
+    }
+
+private:
+    bool Read(void *dst, size_t bytes)
+    {
+        if (static_cast<size_t>(end_ - ptr_) < bytes) {
+            return false;
+        }
+        memcpy(dst, ptr_, bytes);
+        ptr_ += bytes;
+        return true;
+    }
+
+    const char *ptr_;
+    const char *end_;
+};
+
+}
+
+bool NsNetCpuEngine::IsWeightFile(const void *data, size_t size)
+{
+    uint32_t magic = 0;
+    if (size < sizeof(magic)) {
+        return false;
+    }
+    memcpy(&magic, data, sizeof(magic));
+    return magic == kMagic;
+}
+
+std::shared_ptr<NsNetCpuEngine> NsNetCpuEngine::Parse(const void *data, size_t size)
+{
+    WeightReader reader(data, size);
+    uint32_t magic = 0, version = 0, layer_count = 0;
+    auto engine = std::make_shared<NsNetCpuEngine>();
+    if (!reader.ReadU32(magic) || magic != kMagic || !reader.ReadU32(version) || version != kWeightVersion ||
+        !reader.ReadU32(engine->input_size_) || !reader.ReadU32(layer_count) || layer_count == 0) {
+        std::cerr << "Error: invalid NSNet weight file header." << std::endl;
+        return nullptr;
+    }
+
+    auto feature_size = engine->input_size_;
+    engine->layers_.resize(layer_count);
+    for (auto &layer : engine->layers_) {
+        uint32_t type = 0;
+        if (!reader.ReadU32(type) || !reader.ReadU32(layer.input_size) || !reader.ReadU32(layer.output_size) ||
+            !reader.ReadU32(layer.flag) || layer.input_size != feature_size || layer.output_size == 0) {
+            std::cerr << "Error: invalid NSNet layer header." << std::endl;
+            return nullptr;
+        }
+
+        bool read = false;
+        if (type == NsNetLayer::kDense) {
+            layer.type = NsNetLayer::kDense;
+            read = layer.flag <= NsNetLayer::kTanh &&
+                   reader.ReadMatrix(layer.w, layer.output_size, layer.input_size) &&
+                   reader.ReadVector(layer.w_bias, layer.output_size);
+        } else if (type == NsNetLayer::kGru) {
+            layer.type = NsNetLayer::kGru;
+            const auto gates = 3 * layer.output_size;
+            read = reader.ReadMatrix(layer.w, gates, layer.input_size) &&
+                   reader.ReadMatrix(layer.r, gates, layer.output_size) &&
+                   reader.ReadVector(layer.w_bias, gates) &&
+                   reader.ReadVector(layer.r_bias, gates);
+        }
+        if (!read) {
+            std::cerr << "Error: invalid or truncated NSNet layer weights." << std::endl;
+            return nullptr;
+        }
+        feature_size = layer.output_size;
+    }
+    if (!reader.AtEnd()) {
+        std::cerr << "Warning: trailing bytes after NSNet weights are ignored." << std::endl;
+    }
+
+    engine->BuildBindings();
+    std::cout << "Info: NSNet CPU engine with " << layer_count << " layers, kernels: "
+              << kernels::InstructionSet() << std::endl;
+    return engine;
+}
+
+void NsNetCpuEngine::BuildBindings()
+{
+    bindings_.clear();
+    bindings_.push_back({"input", true, input_size_});
+    for (size_t i = 0, k = 0; i < layers_.size(); ++i) {
+        if (layers_[i].type == NsNetLayer::kGru) {
+            bindings_.push_back({"h" + std::to_string(k++) + "_in", true, layers_[i].output_size});
+        }
+    }
+    bindings_.push_back({"output", false, layers_.back().output_size});
+    for (size_t i = 0, k = 0; i < layers_.size(); ++i) {
+        if (layers_[i].type == NsNetLayer::kGru) {
+            bindings_.push_back({"h" + std::to_string(k++) + "_out", false, layers_[i].output_size});
+        }
+    }
+}
+
+int NsNetCpuEngine::GetNbBindings() const
+{
+    return static_cast<int>(bindings_.size());
+}
+
+const char *NsNetCpuEngine::GetBindingName(int index) const
+{
+    return bindings_[index].name.c_str();
+}
+
+int NsNetCpuEngine::GetBindingIndex(const char *name) const
+{
+    auto it = std::find_if(bindings_.begin(), bindings_.end(), [name](const Binding &b) { return b.name == name; });
+    return it == bindings_.end() ? -1 : static_cast<int>(it - bindings_.begin());
+}
+
+bool NsNetCpuEngine::BindingIsInput(int index) const
+{
+    return bindings_[index].input;
+}
+
+infer::Dims NsNetCpuEngine::GetBindingDimensions(int index) const
+{
+    return infer::Dims3{1, 1, static_cast<int>(bindings_[index].size)};
+}
+
+infer::DataType NsNetCpuEngine::GetBindingDataType(int) const
+{
+    return infer::DataType::kFLOAT;
+}
+
+std::unique_ptr<InferContext> NsNetCpuEngine::CreateContext()
+{
+    return std::unique_ptr<InferContext>(new NsNetCpuContext(shared_from_this()));
+}
+
+NsNetCpuContext::NsNetCpuContext(std::shared_ptr<const NsNetCpuEngine> engine) : engine_(std::move(engine))
+{
+}
+
+bool NsNetCpuContext::SetBindingDimensions(int index, const infer::Dims &dims)
+{
+    // Static shapes only, accept the one the engine has.
+    const auto expect = engine_->GetBindingDimensions(index);
+    return infer::Volume(dims) == infer::Volume(expect);
+}
+
+infer::Dims NsNetCpuContext::GetBindingDimensions(int index) const
+{
+    return engine_->GetBindingDimensions(index);
+}
+
+float *NsNetCpuContext::Carve(size_t count)
+{
+    auto ptr = static_cast<float *>(slab_->carve(kernels::PadFloats(count) * sizeof(float)));
+    std::fill_n(ptr, kernels::PadFloats(count), 0.0f);
+    return ptr;
+}
+
+bool NsNetCpuContext::AllocateBuffers()
+{
+    // Everything is sized here once, Execute() never allocates.
+    const auto bind_num = engine_->GetNbBindings();
+    const auto &layers = engine_->Layers();
+    std::vector<size_t> bytes(bind_num);
+    std::vector<bool> is_input(bind_num);
+    for (int i = 0; i < bind_num; ++i) {
+        bytes[i] = kernels::PadFloats(infer::Volume(engine_->GetBindingDimensions(i))) * sizeof(float);
+        is_input[i] = engine_->BindingIsInput(i);
+    }
+    layout_ = samplesCommon::StagingLayout(bytes, is_input, samplesCommon::kArenaAlignment);
+
+    auto slab_bytes = layout_.inputBytes() + layout_.outputBytes();
+    for (const auto &layer : layers) {
+        const auto scratch_floats = layer.type == NsNetLayer::kDense
+            ? kernels::PadFloats(layer.output_size)
+            : 2 * kernels::PadFloats(3 * layer.output_size) + kernels::PadFloats(layer.output_size);
+        slab_bytes += scratch_floats * sizeof(float);
+    }
+    slab_ = samplesCommon::ArenaPool::instance().acquire(slab_bytes);
+    if (!slab_) {
+        return false;
+    }
+
+    auto *inputs = Carve(layout_.inputBytes() / sizeof(float));
+    auto *outputs = Carve(layout_.outputBytes() / sizeof(float));
+    buffers_.resize(bind_num);
+    for (int i = 0; i < bind_num; ++i) {
+        buffers_[i] = static_cast<float *>(layout_.resolve(i, inputs, outputs));
+    }
+
+    output_index_ = engine_->GetBindingIndex("output");
+
+    scratch_.resize(layers.size());
+    for (size_t i = 0, k = 0; i < layers.size(); ++i) {
+        const auto &layer = layers[i];
+        auto &scratch = scratch_[i];
+        if (layer.type == NsNetLayer::kDense) {
+            scratch.out = Carve(layer.output_size);
+            continue;
+        }
+
+        const auto gates = 3 * layer.output_size;
+        scratch.out = Carve(gates);
+        scratch.rh = Carve(gates);
+        scratch.reset_h = Carve(layer.output_size);
+        const auto suffix = std::to_string(k++);
+        scratch.state_in = buffers_[engine_->GetBindingIndex(("h" + suffix + "_in").c_str())];
+        scratch.state_out = buffers_[engine_->GetBindingIndex(("h" + suffix + "_out").c_str())];
+    }
+    return true;
+}
+
+void *NsNetCpuContext::GetHostBuffer(int index)
+{
+    if (index < 0 || index >= static_cast<int>(buffers_.size())) {
+        return nullptr;
+    }
+    return buffers_[index];
+}
+
+size_t NsNetCpuContext::GetBufferSize(int index) const
+{
+    if (index < 0 || index >= engine_->GetNbBindings()) {
+        return 0;
+    }
+    return infer::Volume(engine_->GetBindingDimensions(index)) * sizeof(float);
+}
+
+bool NsNetCpuContext::Execute()
+{
+    if (buffers_.empty()) {
+        return false;
+    }
+
+    const auto &layers = engine_->Layers();
+    const float *x = buffers_[0];
+    for (size_t i = 0; i < layers.size(); ++i) {
+        const auto &layer = layers[i];
+        auto &scratch = scratch_[i];
+        const auto stride = kernels::PadFloats(layer.input_size);
+        const auto out = layer.output_size;
+
+        if (layer.type == NsNetLayer::kDense) {
+            kernels::Gemv(layer.w.data(), out, stride, x, layer.w_bias.data(), scratch.out);
+            switch (layer.flag) {
+                case NsNetLayer::kRelu: kernels::Relu(scratch.out, out); break;
+                case NsNetLayer::kSigmoid: kernels::Sigmoid(scratch.out, out); break;
+                case NsNetLayer::kTanh: kernels::Tanh(scratch.out, out); break;
+                default: break;
+            }
+            x = scratch.out;
+            continue;
+        }
+
+        const auto h_stride = kernels::PadFloats(out);
+        kernels::Gemv(layer.w.data(), 3 * out, stride, x, layer.w_bias.data(), scratch.out);
+        if (layer.flag) {
+            kernels::Gemv(layer.r.data(), 3 * out, h_stride, scratch.state_in, layer.r_bias.data(), scratch.rh);
+            kernels::GruCellLinearBeforeReset(scratch.out, scratch.rh, scratch.state_in,
+                                              scratch.state_out, out);
+        } else {
+            kernels::Gemv(layer.r.data(), 2 * out, h_stride, scratch.state_in, layer.r_bias.data(), scratch.rh);
+            kernels::GruResetHidden(scratch.out, scratch.rh, scratch.state_in, scratch.reset_h, out);
+            kernels::Gemv(layer.r.data() + 2 * out * h_stride, out, h_stride, scratch.reset_h,
+                          layer.r_bias.data() + 2 * out, scratch.rh + 2 * out);
+            kernels::GruCellResetBeforeLinear(scratch.out, scratch.rh, scratch.state_in,
+                                              scratch.state_out, out);
+        }
+        x = scratch.state_out;
+    }
+
+    std::copy_n(x, layers.back().output_size, buffers_[output_index_]);
+    return true;
+}
@@ -0,0 +1,154 @@
+// NsNetCpuBackend.h: CPU implementation of the inference backend for the NSNet FC/GRU stack
+//
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "common/arena.h"
+
+#include "CpuKernels.h"
+#include "InferBackend.h"
+
+
+//!
+//! \brief Layers of an NSNet weight file.
+//!
+//! \details The file is little-endian: the magic "NSNW", uint32 version (1), uint32 input size and
+//!          uint32 layer count, then for each layer uint32 type, input size, output size and flag:
+//!            - type 0, dense: flag is the activation (0 none, 1 relu, 2 sigmoid, 3 tanh), followed by
+//!              float W[out][in] and float b[out].
+//!            - type 1, GRU: flag is linear_before_reset, followed by float W[3 * out][in],
+//!              float R[3 * out][out], float Wb[3 * out] and float Rb[3 * out], gates in ONNX z, r, h order.
+//!          This is the FC/GRU stack of the ONNX model with the initializers dumped in their ONNX layout.
+//!
+struct NsNetLayer
+{
+    enum Type : uint32_t
+    {
+        kDense = 0,
+        kGru = 1,
+    };
+
+    enum Activation : uint32_t
+    {
+        kNone = 0,
+        kRelu = 1,
+        kSigmoid = 2,
+        kTanh = 3,
+    };
+
+    Type type;
+    uint32_t input_size;
+    uint32_t output_size;
+    uint32_t flag;
+
+    // Rows padded to PadFloats(columns) floats.
+    kernels::AlignedVector<float> w;
+    kernels::AlignedVector<float> r;
+    std::vector<float> w_bias;
+    std::vector<float> r_bias;
+};
+
+//!
+//! \brief Runs NSNet on the host. Bindings: input "input" (1, 1, n), output "output" (1, 1, m) and per GRU
+//!        layer k the state pair "h<k>_in"/"h<k>_out" (1, 1, hidden), all float.
+//!
+class NsNetCpuEngine : public InferEngine, public std::enable_shared_from_this<NsNetCpuEngine>
+{
+public:
+    static constexpr uint32_t kMagic = 0x574e534e;  // "NSNW"
+
+    //!
+    //! \brief Returns true if the data starts like an NSNet weight file.
+    //!
+    static bool IsWeightFile(const void *data, size_t size);
+
+    //!
+    //! \brief Parse a weight file. Returns nullptr if malformed.
+    //!
+    static std::shared_ptr<NsNetCpuEngine> Parse(const void *data, size_t size);
+
+    int GetNbBindings() const override;
+
+    const char *GetBindingName(int index) const override;
+
+    int GetBindingIndex(const char *name) const override;
+
+    bool BindingIsInput(int index) const override;
+
+    infer::Dims GetBindingDimensions(int index) const override;
+
+    infer::DataType GetBindingDataType(int index) const override;
+
+    std::unique_ptr<InferContext> CreateContext() override;
+
+    const std::vector<NsNetLayer> &Layers() const
+    {
+        return layers_;
+    }
+
+private:
+    struct Binding
+    {
+        std::string name;
+        bool input;
+        uint32_t size;
+    };
+
+    void BuildBindings();
+
+    uint32_t input_size_ = 0;
+    std::vector<NsNetLayer> layers_;
+    std::vector<Binding> bindings_;
+};
+
+class NsNetCpuContext : public InferContext
+{
+public:
+    explicit NsNetCpuContext(std::shared_ptr<const NsNetCpuEngine> engine);
+
+    bool SetBindingDimensions(int index, const infer::Dims &dims) override;
+
+    infer::Dims GetBindingDimensions(int index) const override;
+
+    bool AllocateBuffers() override;
+
+    void *GetHostBuffer(int index) override;
+
+    size_t GetBufferSize(int index) const override;
+
+    void CopyInputToDevice() override {}
+
+    bool Execute() override;
+
+    void CopyOutputToHost() override {}
+
+    const samplesCommon::StagingLayout *GetStagingLayout() const override
+    {
+        return &layout_;
+    }
+
+private:
+    struct LayerScratch
+    {
+        float *out = nullptr;  // dense output, GRU W * x
+        float *rh = nullptr;   // GRU R * h
+        float *reset_h = nullptr;
+        float *state_in = nullptr;
+        float *state_out = nullptr;
+    };
+
+    float *Carve(size_t count);
+
+    std::shared_ptr<const NsNetCpuEngine> engine_;
+    // Staging regions of the bindings and the scratch are carved from one slab.
+    samplesCommon::StagingLayout layout_;
+    std::shared_ptr<samplesCommon::ArenaSlab> slab_;
+    std::vector<float *> buffers_;
+    std::vector<LayerScratch> scratch_;
+    int output_index_ = -1;
+};
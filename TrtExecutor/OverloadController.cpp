@@ -0,0 +1,89 @@
+// OverloadController.cpp: Impl
+//
+
+#include "OverloadController.h"
+
+
+OverloadController::OverloadController(const OverloadConfig &config) : config_(config)
+{
+}
+
+bool OverloadController::Decide(size_t queue_depth, int mask_age)
+{
+    queue_overloaded_ = queue_depth > config_.queue_high_watermark;
+
+    switch (mode_) {
+        case ProcessingMode::kFull:
+            infer_ = true;
+            break;
+        case ProcessingMode::kReuseMask:
+            // Counted per stream, so streams multiplexed over one executor each get their share of inference.
+            infer_ = mask_age < 0 || mask_age >= config_.reuse_mask_frames;
+            break;
+        case ProcessingMode::kPassThrough:
+            infer_ = false;
+            break;
+    }
+
+    if (infer_) {
+        full_frames_.fetch_add(1, std::memory_order_relaxed);
+    } else if (mode_ == ProcessingMode::kReuseMask) {
+        reused_mask_frames_.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        passthrough_frames_.fetch_add(1, std::memory_order_relaxed);
+    }
+    return infer_;
+}
+
+void OverloadController::Report(double frame_ms)
+{
+    const auto late = frame_ms > config_.frame_deadline_ms;
+    if (late) {
+        deadline_misses_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    if (late || queue_overloaded_) {
+        healthy_run_ = 0;
+        ++overloaded_run_;
+        if (overloaded_run_ >= config_.escalate_frames) {
+            if (mode_ == ProcessingMode::kFull) {
+                StepTo(ProcessingMode::kReuseMask);
+            } else if (mode_ == ProcessingMode::kReuseMask) {
+                StepTo(ProcessingMode::kPassThrough);
+            }
+        }
+        return;
+    }
+
+    // Only frames running inference tell whether inference still fits the deadline.
+    if (infer_) {
+        overloaded_run_ = 0;
+    }
+    ++healthy_run_;
+    if (healthy_run_ >= config_.recover_frames) {
+        if (mode_ == ProcessingMode::kPassThrough) {
+            StepTo(ProcessingMode::kReuseMask);
+        } else if (mode_ == ProcessingMode::kReuseMask) {
+            StepTo(ProcessingMode::kFull);
+        }
+    }
+}
+
+OverloadStats OverloadController::Stats() const
+{
+    OverloadStats stats{};
+    stats.full_frames = full_frames_.load(std::memory_order_relaxed);
+    stats.reused_mask_frames = reused_mask_frames_.load(std::memory_order_relaxed);
+    stats.passthrough_frames = passthrough_frames_.load(std::memory_order_relaxed);
+    stats.deadline_misses = deadline_misses_.load(std::memory_order_relaxed);
+    stats.mode = static_cast<ProcessingMode>(exported_mode_.load(std::memory_order_relaxed));
+    return stats;
+}
+
+void OverloadController::StepTo(ProcessingMode mode)
+{
+    mode_ = mode;
+    exported_mode_.store(static_cast<int>(mode), std::memory_order_relaxed);
+    overloaded_run_ = 0;
+    healthy_run_ = 0;
+}
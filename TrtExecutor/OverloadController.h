@@ -0,0 +1,87 @@
+// OverloadController.h: Deadline-aware load shedding for the executor loop
+//
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+
+struct OverloadConfig
+{
+    bool enabled = false;
+    double frame_deadline_ms = 10.0;    //!< Budget from TryTake to the end of Consume, one hop by default.
+    size_t queue_high_watermark = 4;    //!< Pending input frames above which the node counts as overloaded.
+    int escalate_frames = 3;            //!< Consecutive overloaded frames before stepping to a cheaper mode.
+    int reuse_mask_frames = 4;          //!< Frames reusing the previous mask between two inferences.
+    int recover_frames = 50;            //!< Consecutive healthy frames before stepping back to a costlier mode.
+    float passthrough_smoothing = 0.05f;    //!< Per frame step of the mask towards unity gain in pass-through.
+};
+
+enum class ProcessingMode : int
+{
+    kFull = 0,      //!< Run inference on every frame.
+    kReuseMask,     //!< Run inference once every reuse_mask_frames + 1 frames of a stream, reuse its mask in between.
+    kPassThrough,   //!< No inference, the mask glides to unity gain.
+};
+
+struct OverloadStats
+{
+    uint64_t full_frames;
+    uint64_t reused_mask_frames;
+    uint64_t passthrough_frames;
+    uint64_t deadline_misses;
+    ProcessingMode mode;
+};
+
+//!
+//! \brief Picks the processing mode of each frame from the deadline misses and the input queue depth.
+//!
+//! \details Decide/Report are called from the processing thread only; the counters can be read
+//!          from any thread.
+//!
+class OverloadController
+{
+public:
+    explicit OverloadController(const OverloadConfig &config);
+
+    const OverloadConfig &Config() const
+    {
+        return config_;
+    }
+
+    //!
+    //! \brief Returns true if inference must run for the next frame, given the current input queue depth and
+    //!        the frames since the mask of its stream was inferred, -1 if the stream has no mask to reuse.
+    //!
+    bool Decide(size_t queue_depth, int mask_age);
+
+    //!
+    //! \brief Report the time the frame took, which updates the mode for the following frames.
+    //!
+    void Report(double frame_ms);
+
+    ProcessingMode Mode() const
+    {
+        return mode_;
+    }
+
+    OverloadStats Stats() const;
+
+private:
+    void StepTo(ProcessingMode mode);
+
+    OverloadConfig config_;
+    ProcessingMode mode_ = ProcessingMode::kFull;
+    bool queue_overloaded_ = false;
+    bool infer_ = true;
+    int overloaded_run_ = 0;
+    int healthy_run_ = 0;
+
+    std::atomic<uint64_t> full_frames_{0};
+    std::atomic<uint64_t> reused_mask_frames_{0};
+    std::atomic<uint64_t> passthrough_frames_{0};
+    std::atomic<uint64_t> deadline_misses_{0};
+    std::atomic<int> exported_mode_{0};
+};
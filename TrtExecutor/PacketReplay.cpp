@@ -0,0 +1,89 @@
+// PacketReplay.cpp: Impl
+//
+
+#include "PacketReplay.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <sstream>
+
+
+std::vector<PacketRecord> LoadPacketTrace(const std::string &path)
+{
+    std::ifstream file(path);
+    if (!file) {
+        std::cerr << "Error: Unable to open packet trace: " << path << std::endl;
+        return {};
+    }
+    std::vector<PacketRecord> packets;
+    std::string line;
+    for (int number = 1; std::getline(file, line); ++number) {
+        line = line.substr(0, line.find('#'));
+        std::istringstream fields(line);
+        double arrival_ms;
+        PacketRecord packet{};
+        if (!(fields >> arrival_ms)) {
+            continue;
+        }
+        if (!(fields >> packet.timestamp >> packet.count)) {
+            std::cerr << "Error: Malformed packet at " << path << ":" << number << std::endl;
+            return {};
+        }
+        packet.arrival_us = std::llround(arrival_ms * 1e3);
+        packets.push_back(packet);
+    }
+    if (packets.empty()) {
+        std::cerr << "Error: No packets in packet trace: " << path << std::endl;
+    }
+    std::stable_sort(packets.begin(), packets.end(), [](const PacketRecord &a, const PacketRecord &b) {
+        return a.arrival_us < b.arrival_us;
+    });
+    return packets;
+}
+
+PacketReplayInputStream::PacketReplayInputStream(const VoiceFileInputConfig &voice,
+                                                 std::shared_ptr<JitterBuffer> buffer,
+                                                 std::vector<PacketRecord> packets, std::vector<float> source,
+                                                 TrtExecutor *executor)
+    : JitterInputStream(voice, std::move(buffer), executor),
+      packets_(std::move(packets)),
+      source_(std::move(source))
+{
+}
+
+bool PacketReplayInputStream::TryTake(const std::vector<void *> &host_buffer, const std::vector<size_t> &sizes)
+{
+    Advance();
+    return JitterInputStream::TryTake(host_buffer, sizes);
+}
+
+void PacketReplayInputStream::Advance()
+{
+    auto &buffer = Buffer();
+    for (;;) {
+        const auto due_us = buffer.NextDueUs();
+        if (next_ < packets_.size() && packets_[next_].arrival_us <= due_us) {
+            const auto &packet = packets_[next_++];
+            now_us_ = std::max(now_us_, packet.arrival_us);
+            // Past the end of the source the packet carries silence.
+            payload_.assign(packet.count, 0.0f);
+            if (packet.timestamp < source_.size()) {
+                const auto count = std::min<size_t>(packet.count, source_.size() - packet.timestamp);
+                std::copy_n(source_.begin() + packet.timestamp, count, payload_.begin());
+            }
+            buffer.Push(packet.timestamp, payload_.data(), payload_.size(), now_us_);
+            continue;
+        }
+        if (next_ == packets_.size() && due_us != std::numeric_limits<int64_t>::min()) {
+            buffer.Close();
+            continue;
+        }
+        if (due_us != std::numeric_limits<int64_t>::min()) {
+            now_us_ = std::max(now_us_, due_us);
+        }
+        return;
+    }
+}
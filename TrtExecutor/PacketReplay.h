@@ -0,0 +1,57 @@
+// PacketReplay.h: Replay of packet arrival traces through the jitter buffer
+//
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "JitterBuffer.h"
+
+
+struct PacketRecord
+{
+    int64_t arrival_us;
+    uint64_t timestamp;     //!< First sample of the packet in the source signal.
+    uint32_t count;
+};
+
+//!
+//! \brief Load a packet trace: a text file with one packet per line, "arrival-ms timestamp samples", in any
+//!        order; '#' starts a comment. Lost packets are simply not listed. Returns the packets in arrival
+//!        order, empty after printing an error if the file cannot be read or has no packets.
+//!
+std::vector<PacketRecord> LoadPacketTrace(const std::string &path);
+
+//!
+//! \brief Plays a source signal through a JitterBuffer as the packets of a trace would deliver it.
+//!
+//! \details Runs on a virtual clock that jumps to the next arrival or playout deadline, so a replay is
+//!          deterministic and takes no longer than the processing, however long the trace spans.
+//!
+class PacketReplayInputStream : public JitterInputStream
+{
+public:
+    PacketReplayInputStream(const VoiceFileInputConfig &voice, std::shared_ptr<JitterBuffer> buffer,
+                            std::vector<PacketRecord> packets, std::vector<float> source, TrtExecutor *executor);
+
+    bool TryTake(const std::vector<void *> &host_buffer, const std::vector<size_t> &sizes) override;
+
+protected:
+    int64_t NowUs() const override
+    {
+        return now_us_;
+    }
+
+private:
+    //!
+    //! \brief Deliver the packets arriving up to the next playout deadline and move the clock there.
+    //!
+    void Advance();
+
+    std::vector<PacketRecord> packets_;
+    std::vector<float> source_;
+    std::vector<float> payload_;
+    size_t next_ = 0;
+    int64_t now_us_ = 0;
+};
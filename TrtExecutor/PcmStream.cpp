@@ -0,0 +1,341 @@
+// PcmStream.cpp: Impl
+//
+
+#include "PcmStream.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "Timeline.h"
+
+
+namespace {
+
+bool IsPipe(int fd)
+{
+    struct stat st{};
+    return fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode);
+}
+
+//!
+//! \brief Ask for a pipe of bytes, returns the capacity it has, 0 if fd is no pipe.
+//!
+int GrowPipe(int fd, int bytes)
+{
+    if (!IsPipe(fd)) {
+        return 0;
+    }
+    if (fcntl(fd, F_GETPIPE_SZ) < bytes && fcntl(fd, F_SETPIPE_SZ, bytes) < 0) {
+        std::cout << "Warning: Unable to grow the pipe to " << bytes << " bytes: " << strerror(errno) << std::endl;
+    }
+    return std::max(0, fcntl(fd, F_GETPIPE_SZ));
+}
+
+}
+
+size_t PcmSampleBytes(PcmFormat format)
+{
+    return format == PcmFormat::kS16 ? sizeof(int16_t) : sizeof(float);
+}
+
+void DecodePcm(PcmFormat format, const char *data, size_t count, float *samples)
+{
+    if (format == PcmFormat::kF32) {
+        memcpy(samples, data, count * sizeof(float));
+        return;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        int16_t sample;
+        memcpy(&sample, data + i * sizeof(sample), sizeof(sample));
+        samples[i] = sample / 32768.0f;
+    }
+}
+
+void EncodePcm(PcmFormat format, const float *samples, size_t count, char *data)
+{
+    if (format == PcmFormat::kF32) {
+        memcpy(data, samples, count * sizeof(float));
+        return;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        const auto sample = static_cast<int16_t>(std::lrint(std::max(-1.0f, std::min(1.0f, samples[i])) * 32767.0f));
+        memcpy(data + i * sizeof(sample), &sample, sizeof(sample));
+    }
+}
+
+std::vector<float> ReadPcm(int fd, const PcmPipeConfig &config)
+{
+    const auto channels = static_cast<size_t>(std::max(1, config.channels));
+    const auto frame_bytes = PcmSampleBytes(config.format) * channels;
+    std::vector<char> raw;
+    std::vector<char> chunk(1 << 16);
+    for (;;) {
+        const auto n = read(fd, chunk.data(), chunk.size());
+        if (n > 0) {
+            raw.insert(raw.end(), chunk.begin(), chunk.begin() + n);
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else {
+            if (n < 0) {
+                std::cerr << "Error: Unable to read the input: " << strerror(errno) << std::endl;
+            }
+            break;
+        }
+    }
+
+    const auto frames = raw.size() / frame_bytes;
+    std::vector<float> decoded(frames * channels);
+    DecodePcm(config.format, raw.data(), decoded.size(), decoded.data());
+    std::vector<float> samples(frames);
+    for (size_t i = 0; i < frames; ++i) {
+        double sum = 0.0;
+        for (size_t c = 0; c < channels; ++c) {
+            sum += decoded[i * channels + c];
+        }
+        samples[i] = static_cast<float>(sum / channels);
+    }
+    return samples;
+}
+
+PipeInputStream::PipeInputStream(const VoiceFileInputConfig &voice, const PcmPipeConfig &config, int fd,
+                                 TrtExecutor *executor)
+    : config_(config),
+      fd_(fd),
+      executor_(executor),
+      frontend_(voice, config.sample_rate),
+      frame_bytes_(PcmSampleBytes(config.format) * std::max(1, config.channels))
+{
+    config_.channels = std::max(1, config_.channels);
+    GrowPipe(fd_, config_.pipe_bytes);
+    const auto hop = static_cast<size_t>(frontend_.HopSize());
+    raw_.resize(hop * frame_bytes_);
+    decoded_.resize(hop * config_.channels);
+    window_.resize(frontend_.FrameSize());
+}
+
+infer::Dims PipeInputStream::GetDynamicDim(const char *input_name)
+{
+    return infer::Dims3{1, 1, static_cast<int>(frontend_.Bins())};
+}
+
+std::vector<std::string> PipeInputStream::GetInputTensorNames(const InferEngine &engine)
+{
+    return VoiceInputTensorNames(engine);
+}
+
+size_t PipeInputStream::ReadHop()
+{
+    size_t got = 0;
+    while (got < raw_.size()) {
+        const auto n = read(fd_, raw_.data() + got, raw_.size() - got);
+        if (n > 0) {
+            got += static_cast<size_t>(n);
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else {
+            if (n < 0) {
+                std::cerr << "Error: Unable to read the input: " << strerror(errno) << std::endl;
+            }
+            break;
+        }
+    }
+    return got / frame_bytes_;
+}
+
+bool PipeInputStream::TryTake(const std::vector<void *> &host_buffer, const std::vector<size_t> &sizes)
+{
+    const auto hop = static_cast<size_t>(frontend_.HopSize());
+    size_t got = 0;
+    if (!eof_) {
+        got = ReadHop();
+        samples_ += got;
+        if (got < hop) {
+            // Same frame count as VoiceInputStream: until the history of a frame is past the last sample.
+            eof_ = true;
+            const auto history = static_cast<uint64_t>(frontend_.FrameSize()) - hop;
+            frame_count_ = static_cast<int64_t>((samples_ + history + hop - 1) / hop);
+        }
+    }
+    if (frame_count_ >= 0 && frontend_.FrameIndex() + 1 >= frame_count_) {
+        executor_->Terminate();
+        return false;
+    }
+    assert(host_buffer.size() == sizes.size());
+    assert(frontend_.Bins() * sizeof(float) == sizes[0]);
+    TRT_TIMELINE_SCOPE("input", "frontend");
+
+    std::copy(window_.begin() + hop, window_.end(), window_.begin());
+    auto *tail = window_.data() + window_.size() - hop;
+    DecodePcm(config_.format, raw_.data(), got * config_.channels, decoded_.data());
+    for (size_t i = 0; i < got; ++i) {
+        double sum = 0.0;
+        for (int c = 0; c < config_.channels; ++c) {
+            sum += decoded_[i * config_.channels + c];
+        }
+        tail[i] = sum / config_.channels;
+    }
+    std::fill(tail + got, tail + hop, 0.0);
+
+    std::copy(window_.begin(), window_.end(), frontend_.Frame());
+    frontend_.Analyze(static_cast<float *>(host_buffer[0]));
+    return true;
+}
+
+size_t PipeInputStream::PendingFrames() const
+{
+    int bytes = 0;
+    if (eof_ || ioctl(fd_, FIONREAD, &bytes) != 0) {
+        return 0;
+    }
+    return static_cast<size_t>(bytes) / raw_.size();
+}
+
+void PipeInputStream::SaveState(StreamState &state) const
+{
+    frontend_.SaveState(state);
+}
+
+void PipeInputStream::RestoreState(const StreamState &state)
+{
+    frontend_.RestoreState(state);
+}
+
+PipeOutputHandler::PipeOutputHandler(std::shared_ptr<TrtInputStream> input, StreamingFrontend &frontend,
+                                     const PcmPipeConfig &config, int fd)
+    : input_(std::move(input)),
+      config_(config),
+      fd_(fd),
+      hop_size_(frontend.HopSize()),
+      synthesis_(frontend)
+{
+    config_.channels = std::max(1, config_.channels);
+    config_.block_hops = std::max(1, config_.block_hops);
+    hop_bytes_ = hop_size_ * config_.channels * PcmSampleBytes(config_.format);
+    const auto page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    block_stride_ = (hop_bytes_ * config_.block_hops + page - 1) / page * page;
+
+    const auto pipe_bytes = GrowPipe(fd_, config_.pipe_bytes);
+    splice_ = config_.vmsplice && pipe_bytes > 0;
+    if (splice_) {
+        // Every block takes at least one of the pipe slots, past that many the oldest has been read.
+        block_count_ = pipe_bytes / page + 2;
+    }
+    auto *blocks = mmap(nullptr, block_stride_ * block_count_, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (blocks == MAP_FAILED) {
+        std::cerr << "Error: Unable to allocate the output blocks: " << strerror(errno) << std::endl;
+        failed_ = true;
+        return;
+    }
+    blocks_ = static_cast<char *>(blocks);
+}
+
+PipeOutputHandler::~PipeOutputHandler()
+{
+    Flush();
+    if (blocks_) {
+        munmap(blocks_, block_stride_ * block_count_);
+    }
+}
+
+std::vector<std::string> PipeOutputHandler::GetOutputTensorNames(const InferEngine &engine)
+{
+    return VoiceOutputTensorNames(engine);
+}
+
+void PipeOutputHandler::SetTensorDim(const char *output_name, const infer::Dims &dims)
+{
+    //
+}
+
+void PipeOutputHandler::Consume(const std::vector<void *> &host_buffer, const std::vector<size_t> &sizes)
+{
+    assert(host_buffer.size() == sizes.size());
+    const float *enhanced;
+    {
+        TRT_TIMELINE_SCOPE("output", "synthesis");
+        enhanced = synthesis_.Synthesize(static_cast<const float *>(host_buffer[0]));
+    }
+    if (failed_) {
+        return;
+    }
+
+    const auto hop = static_cast<size_t>(hop_size_);
+    const auto sample_bytes = PcmSampleBytes(config_.format);
+    auto *out = blocks_ + block_ * block_stride_ + block_fill_;
+    if (config_.channels == 1) {
+        EncodePcm(config_.format, enhanced, hop, out);
+    } else {
+        for (size_t i = 0; i < hop; ++i) {
+            for (int c = 0; c < config_.channels; ++c) {
+                EncodePcm(config_.format, enhanced + i, 1, out);
+                out += sample_bytes;
+            }
+        }
+    }
+    block_fill_ += hop_bytes_;
+    if (block_fill_ == hop_bytes_ * config_.block_hops) {
+        Flush();
+    }
+}
+
+void PipeOutputHandler::SaveState(StreamState &state) const
+{
+    synthesis_.SaveState(state);
+}
+
+void PipeOutputHandler::RestoreState(const StreamState &state)
+{
+    synthesis_.RestoreState(state);
+}
+
+bool PipeOutputHandler::Flush()
+{
+    if (failed_ || block_fill_ == 0) {
+        return !failed_;
+    }
+    TRT_TIMELINE_SCOPE("output", "write");
+    failed_ = !WriteBlock(blocks_ + block_ * block_stride_, block_fill_);
+    block_ = (block_ + 1) % block_count_;
+    block_fill_ = 0;
+    return !failed_;
+}
+
+bool PipeOutputHandler::WriteBlock(const char *data, size_t size)
+{
+    while (size > 0) {
+        ssize_t n;
+        if (splice_) {
+            iovec iov{const_cast<char *>(data), size};
+            n = vmsplice(fd_, &iov, 1, 0);
+            if (n < 0 && errno == EINVAL) {
+                // Not a pipe after all, write() from here on. The blocks keep rotating, which stays safe.
+                splice_ = false;
+                continue;
+            }
+        } else {
+            n = write(fd_, data, size);
+        }
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            std::cerr << "Error: Unable to write the output: " << strerror(errno) << std::endl;
+            return false;
+        }
+        data += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
@@ -0,0 +1,147 @@
+// PcmStream.h: Raw PCM codecs, and voice streams over a pipe for shell pipelines
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "VoiceStream.h"
+
+
+enum class PcmFormat : int
+{
+    kS16 = 0,   //!< Signed 16 bit little endian.
+    kF32,       //!< 32 bit float little endian, nominal range [-1, 1].
+};
+
+size_t PcmSampleBytes(PcmFormat format);
+
+void DecodePcm(PcmFormat format, const char *data, size_t count, float *samples);
+
+//!
+//! \brief s16 is clipped to [-1, 1].
+//!
+void EncodePcm(PcmFormat format, const float *samples, size_t count, char *data);
+
+struct PcmPipeConfig
+{
+    PcmFormat format = PcmFormat::kS16;
+    int sample_rate = 16000;
+    int channels = 1;           //!< Interleaved. The input is mixed down, the enhanced signal goes to every channel.
+    int block_hops = 1;         //!< Hops written to the output at once.
+    int pipe_bytes = 1 << 20;   //!< Capacity asked for the pipes, capped by /proc/sys/fs/pipe-max-size.
+    bool vmsplice = true;       //!< Hand output pages to the pipe instead of copying them, if the output is a pipe.
+};
+
+//!
+//! \brief Read fd to its end as PCM in config, mixed down to mono.
+//!
+std::vector<float> ReadPcm(int fd, const PcmPipeConfig &config);
+
+//!
+//! \brief Frontend of raw interleaved PCM read from a file descriptor, usually stdin, hop by hop.
+//!
+//! \details Reads block while the writer is behind. Only one frame of samples is held, at end of input the
+//!          partial hop is zero padded and the stream ends with as many frames as the file pipeline makes
+//!          of the same samples, then the executor is terminated.
+//!
+class PipeInputStream : public TrtInputStream
+{
+public:
+    PipeInputStream(const VoiceFileInputConfig &voice, const PcmPipeConfig &config, int fd, TrtExecutor *executor);
+
+    infer::Dims GetDynamicDim(const char *input_name) override;
+
+    std::vector<std::string> GetInputTensorNames(const InferEngine &engine) override;
+
+    bool TryTake(const std::vector<void *> &host_buffer, const std::vector<size_t> &sizes) override;
+
+    //!
+    //! \brief Whole hops already in the pipe.
+    //!
+    size_t PendingFrames() const override;
+
+    void SaveState(StreamState &state) const override;
+
+    void RestoreState(const StreamState &state) override;
+
+    StreamingFrontend &Frontend()
+    {
+        return frontend_;
+    }
+
+private:
+    //!
+    //! \brief Read up to one hop of frames, returns the number of whole frames read, less only at end of input.
+    //!
+    size_t ReadHop();
+
+    PcmPipeConfig config_;
+    int fd_;
+    TrtExecutor *executor_;
+    StreamingFrontend frontend_;
+    size_t frame_bytes_;        //!< One sample of every channel.
+
+    std::vector<char> raw_;
+    std::vector<float> decoded_;
+    std::vector<double> window_;    //!< The samples of the last frame, mono.
+    uint64_t samples_ = 0;
+    bool eof_ = false;
+    int64_t frame_count_ = -1;      //!< Known once at end of input.
+};
+
+//!
+//! \brief Writes the enhanced signal as raw PCM to a file descriptor, usually stdout, a block at a time.
+//!
+//! \details When the output is a pipe, blocks are vmspliced: the pipe references the pages of the block
+//!          rather than copying them. A block is only reused after more blocks than the pipe has slots were
+//!          written since, by then the reader has consumed it. That holds for readers that read() the
+//!          pipe, as encoders do; one that splices it on keeps the pages referenced, use --no-vmsplice then.
+//!
+class PipeOutputHandler : public TrtOutputHandler
+{
+public:
+    //!
+    //! \brief Synthesis for the frames frontend analyzes, frontend belongs to input.
+    //!
+    PipeOutputHandler(std::shared_ptr<TrtInputStream> input, StreamingFrontend &frontend, const PcmPipeConfig &config,
+                      int fd);
+
+    ~PipeOutputHandler() override;
+
+    std::vector<std::string> GetOutputTensorNames(const InferEngine &engine) override;
+
+    void SetTensorDim(const char *output_name, const infer::Dims &dims) override;
+
+    void Consume(const std::vector<void *> &host_buffer, const std::vector<size_t> &sizes) override;
+
+    void SaveState(StreamState &state) const override;
+
+    void RestoreState(const StreamState &state) override;
+
+    //!
+    //! \brief Write the partial block. Returns false once a write failed.
+    //!
+    bool Flush();
+
+private:
+    bool WriteBlock(const char *data, size_t size);
+
+    std::shared_ptr<TrtInputStream> input_;
+    PcmPipeConfig config_;
+    int fd_;
+    int hop_size_;
+    StreamingSynthesis synthesis_;
+    bool splice_ = false;
+
+    size_t hop_bytes_;
+    size_t block_stride_;       //!< Page aligned, so a block below a page takes one pipe slot.
+    char *blocks_ = nullptr;
+    size_t block_count_ = 1;
+    size_t block_ = 0;          //!< Block being filled.
+    size_t block_fill_ = 0;
+    bool failed_ = false;
+};
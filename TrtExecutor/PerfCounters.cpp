@@ -0,0 +1,187 @@
+// PerfCounters.cpp: Impl
+//
+
+#include "PerfCounters.h"
+
+#include <cerrno>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+
+namespace {
+
+enum EventIndex
+{
+    kCycles = 0,
+    kInstructions,
+    kCacheMisses,
+    kBranchMisses,
+};
+
+#ifdef __linux__
+int OpenEvent(uint64_t config, int group_fd)
+{
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.disabled = group_fd < 0 ? 1 : 0;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, PERF_FLAG_FD_CLOEXEC));
+}
+#endif
+
+}
+
+const char *CpuStageName(CpuStage stage)
+{
+    switch (stage) {
+        case CpuStage::kStft: return "stft";
+        case CpuStage::kMagPhasor: return "mag_phasor";
+        case CpuStage::kLogPow: return "log_pow";
+        case CpuStage::kOnlineMvn: return "online_mvn";
+        case CpuStage::kIstft: return "istft";
+        case CpuStage::kOverlapAdd: return "overlap_add";
+        default: return "unknown";
+    }
+}
+
+PerfCounters::~PerfCounters()
+{
+#ifdef __linux__
+    for (const auto fd : fds_) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+#endif
+}
+
+bool PerfCounters::Open()
+{
+    if (IsOpen()) {
+        return true;
+    }
+
+#ifdef __linux__
+    const uint64_t configs[kEvents] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                                       PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+    for (int i = 0; i < kEvents; ++i) {
+        fds_[i] = OpenEvent(configs[i], i == 0 ? -1 : fds_[0]);
+        if (fds_[i] < 0) {
+            std::cout << "Warning: Unable to open hardware performance counters (" << strerror(errno)
+                      << "), stage counters disabled." << std::endl;
+            for (auto &fd : fds_) {
+                if (fd >= 0) {
+                    close(fd);
+                }
+                fd = -1;
+            }
+            return false;
+        }
+    }
+    leader_fd_ = fds_[0];
+    ioctl(leader_fd_, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(leader_fd_, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    return true;
+#else
+    std::cout << "Warning: hardware performance counters are only supported on Linux." << std::endl;
+    return false;
+#endif
+}
+
+bool PerfCounters::Read(Sample &sample) const
+{
+#ifdef __linux__
+    struct
+    {
+        uint64_t nr;
+        uint64_t time_enabled;
+        uint64_t time_running;
+        uint64_t values[kEvents];
+    } data;
+    if (read(leader_fd_, &data, sizeof(data)) != static_cast<ssize_t>(sizeof(data)) || data.nr != kEvents) {
+        return false;
+    }
+    sample.time_enabled = data.time_enabled;
+    sample.time_running = data.time_running;
+    for (int i = 0; i < kEvents; ++i) {
+        sample.counts[i] = data.values[i];
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+void PerfCounters::Begin(CpuStage stage)
+{
+    if (!IsOpen()) {
+        return;
+    }
+    auto &totals = stages_[static_cast<int>(stage)];
+    totals.begun = Read(totals.begin);
+}
+
+void PerfCounters::End(CpuStage stage)
+{
+    if (!IsOpen()) {
+        return;
+    }
+
+    auto &totals = stages_[static_cast<int>(stage)];
+    Sample end;
+    const auto begun = totals.begun;
+    totals.begun = false;
+    if (!begun || !Read(end)) {
+        return;
+    }
+    // Multiplexed, the group counted for the running part of the enabled time the stage took.
+    const auto running = end.time_running - totals.begin.time_running;
+    if (running == 0) {
+        return;
+    }
+    const auto scale = static_cast<double>(end.time_enabled - totals.begin.time_enabled) / running;
+    for (int i = 0; i < kEvents; ++i) {
+        totals.sums[i] += static_cast<double>(end.counts[i] - totals.begin.counts[i]) * scale;
+    }
+    ++totals.frames;
+}
+
+void PerfCounters::Report(std::ostream &os) const
+{
+    if (!IsOpen()) {
+        return;
+    }
+
+    os << "***** CPU Stage Counters (per frame) *****" << std::endl;
+    const auto flags = os.flags();
+    const auto precision = os.precision();
+    os << std::fixed;
+    for (int i = 0; i < static_cast<int>(CpuStage::kCount); ++i) {
+        const auto &totals = stages_[i];
+        if (totals.frames == 0) {
+            continue;
+        }
+        const auto per_frame = [&totals](int event) { return totals.sums[event] / totals.frames; };
+        const auto ipc = totals.sums[kCycles] > 0 ? totals.sums[kInstructions] / totals.sums[kCycles] : 0.0;
+        os << "  " << std::left << std::setw(12) << CpuStageName(static_cast<CpuStage>(i)) << std::right
+           << " frames: " << totals.frames << std::setprecision(0) << ", cycles: " << per_frame(kCycles)
+           << ", instructions: " << per_frame(kInstructions) << std::setprecision(2) << ", IPC: " << ipc
+           << std::setprecision(1) << ", cache misses: " << per_frame(kCacheMisses)
+           << ", branch misses: " << per_frame(kBranchMisses) << std::endl;
+    }
+    os.flags(flags);
+    os.precision(precision);
+}
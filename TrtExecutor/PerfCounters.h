@@ -0,0 +1,117 @@
+// PerfCounters.h: Hardware performance counters around the CPU stages of the frontend and synthesis
+//
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <ostream>
+
+
+enum class CpuStage : int
+{
+    kStft = 0,
+    kMagPhasor,
+    kLogPow,
+    kOnlineMvn,
+    kIstft,         // includes applying the mask
+    kOverlapAdd,
+    kCount,
+};
+
+const char *CpuStageName(CpuStage stage);
+
+//!
+//! \brief Cycles, instructions, cache misses and branch misses of the calling thread, per CPU stage.
+//!
+//! \details One perf_event_open group of the four hardware events, user space only, opened by Open() on the
+//!          thread that runs the stages (the counters follow that thread). Each stage reads the group before
+//!          and after, so each measurement costs two read() syscalls. In case the kernel multiplexes the PMU,
+//!          the counts a stage adds are scaled by the enabled over the running time it adds. A stage whose
+//!          Begin read failed, or during which the group never ran, is not counted. Not thread-safe; without
+//!          Open() (or if it failed) Begin/End do nothing.
+//!
+class PerfCounters
+{
+public:
+    static constexpr int kEvents = 4;
+
+    PerfCounters() = default;
+
+    ~PerfCounters();
+
+    PerfCounters(const PerfCounters &) = delete;
+
+    PerfCounters &operator=(const PerfCounters &) = delete;
+
+    //!
+    //! \brief Open and enable the counters for the calling thread. Returns false if the kernel refuses, e.g.
+    //!        perf_event_paranoid is above 2 or the PMU is not exposed to a VM.
+    //!
+    bool Open();
+
+    bool IsOpen() const
+    {
+        return leader_fd_ >= 0;
+    }
+
+    void Begin(CpuStage stage);
+
+    void End(CpuStage stage);
+
+    //!
+    //! \brief Print per stage the measured frames, cycles and instructions per frame, IPC, and cache and branch
+    //!        misses per frame.
+    //!
+    void Report(std::ostream &os) const;
+
+private:
+    //!
+    //! \brief Raw counts and times of the group, as read.
+    //!
+    struct Sample
+    {
+        uint64_t time_enabled = 0;
+        uint64_t time_running = 0;
+        std::array<uint64_t, kEvents> counts{};
+    };
+
+    bool Read(Sample &sample) const;
+
+    struct StageTotals
+    {
+        uint64_t frames = 0;
+        std::array<double, kEvents> sums{};
+        Sample begin;
+        bool begun = false;     //!< Begin read the group, End may measure against begin.
+    };
+
+    int leader_fd_ = -1;
+    std::array<int, kEvents> fds_{{-1, -1, -1, -1}};
+    std::array<StageTotals, static_cast<int>(CpuStage::kCount)> stages_;
+};
+
+//!
+//! \brief Measures the enclosing scope as one frame of a stage. counters may be nullptr.
+//!
+class PerfScope
+{
+public:
+    PerfScope(PerfCounters *counters, CpuStage stage) : counters_(counters), stage_(stage)
+    {
+        if (counters_) {
+            counters_->Begin(stage_);
+        }
+    }
+
+    ~PerfScope()
+    {
+        if (counters_) {
+            counters_->End(stage_);
+        }
+    }
+
+private:
+    PerfCounters *counters_;
+    CpuStage stage_;
+};
@@ -0,0 +1,270 @@
+// ShmRing.cpp: Impl
+//
+
+#include "ShmRing.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <new>
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free && std::atomic<uint32_t>::is_always_lock_free,
+              "The ring needs lock-free atomics to share them between processes");
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "Futex words must be plain 32 bit words");
+
+namespace {
+
+constexpr uint32_t kMaxCapacity = 1u << 30;
+
+std::string SegmentName(const std::string &name)
+{
+    return name.empty() || name[0] != '/' ? "/" + name : name;
+}
+
+uint32_t HeaderSize()
+{
+    return static_cast<uint32_t>((sizeof(ShmRingHeader) + 63) / 64 * 64);
+}
+
+uint32_t RoundUpPow2(uint32_t value)
+{
+    uint32_t pow2 = 1;
+    while (pow2 < value) {
+        pow2 <<= 1;
+    }
+    return pow2;
+}
+
+//!
+//! \brief Shared (not private) futex ops, the other side is another process.
+//!
+long FutexWait(std::atomic<uint32_t> *word, uint32_t expected, const timespec *timeout)
+{
+    return syscall(SYS_futex, reinterpret_cast<uint32_t *>(word), FUTEX_WAIT, expected, timeout, nullptr, 0);
+}
+
+void FutexWakeAll(std::atomic<uint32_t> *word)
+{
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(word), FUTEX_WAKE, INT32_MAX, nullptr, nullptr, 0);
+}
+
+}
+
+ShmRing::ShmRing(std::string name, void *base, size_t size, bool owner)
+    : name_(std::move(name)),
+      base_(base),
+      size_(size),
+      owner_(owner),
+      header_(static_cast<ShmRingHeader *>(base)),
+      data_(reinterpret_cast<float *>(static_cast<char *>(base) + header_->header_size))
+{
+}
+
+ShmRing::~ShmRing()
+{
+    munmap(base_, size_);
+    if (owner_) {
+        shm_unlink(name_.c_str());
+    }
+}
+
+std::shared_ptr<ShmRing> ShmRing::Create(const std::string &name, uint32_t capacity, uint32_t sample_rate)
+{
+    if (capacity == 0 || capacity > kMaxCapacity) {
+        std::cerr << "Error: Ring capacity out of range: " << capacity << std::endl;
+        return nullptr;
+    }
+    const auto segment = SegmentName(name);
+    capacity = RoundUpPow2(capacity);
+    const auto size = static_cast<size_t>(HeaderSize()) + static_cast<size_t>(capacity) * sizeof(float);
+
+    // A segment left by a crashed creator would otherwise make O_EXCL fail forever.
+    shm_unlink(segment.c_str());
+    const auto fd = shm_open(segment.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) {
+        std::cerr << "Error: Unable to create shared memory " << segment << ": " << strerror(errno) << std::endl;
+        return nullptr;
+    }
+    if (ftruncate(fd, static_cast<off_t>(size)) != 0) {
+        std::cerr << "Error: Unable to size shared memory " << segment << ": " << strerror(errno) << std::endl;
+        close(fd);
+        shm_unlink(segment.c_str());
+        return nullptr;
+    }
+    auto *base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        std::cerr << "Error: Unable to map shared memory " << segment << ": " << strerror(errno) << std::endl;
+        shm_unlink(segment.c_str());
+        return nullptr;
+    }
+
+    auto *header = new (base) ShmRingHeader();
+    header->version_major = ShmRingHeader::kVersionMajor;
+    header->version_minor = ShmRingHeader::kVersionMinor;
+    header->header_size = HeaderSize();
+    header->capacity = capacity;
+    header->sample_rate = sample_rate;
+    header->channels = 1;
+    // Last, an Open racing with us refuses the segment until the header is complete.
+    std::atomic_thread_fence(std::memory_order_release);
+    header->magic = ShmRingHeader::kMagic;
+    return std::shared_ptr<ShmRing>(new ShmRing(segment, base, size, true));
+}
+
+std::shared_ptr<ShmRing> ShmRing::Open(const std::string &name)
+{
+    const auto segment = SegmentName(name);
+    const auto fd = shm_open(segment.c_str(), O_RDWR, 0);
+    if (fd < 0) {
+        std::cerr << "Error: Unable to open shared memory " << segment << ": " << strerror(errno) << std::endl;
+        return nullptr;
+    }
+    struct stat st{};
+    if (fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(ShmRingHeader))) {
+        std::cerr << "Error: Shared memory " << segment << " is not a ring." << std::endl;
+        close(fd);
+        return nullptr;
+    }
+    const auto size = static_cast<size_t>(st.st_size);
+    auto *base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        std::cerr << "Error: Unable to map shared memory " << segment << ": " << strerror(errno) << std::endl;
+        return nullptr;
+    }
+
+    const auto *header = static_cast<const ShmRingHeader *>(base);
+    const auto magic = header->magic;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    const auto capacity = header->capacity;
+    if (magic != ShmRingHeader::kMagic || header->version_major != ShmRingHeader::kVersionMajor) {
+        std::cerr << "Error: Shared memory " << segment << " is not a version " << ShmRingHeader::kVersionMajor
+                  << " ring." << std::endl;
+    } else if (header->header_size < sizeof(ShmRingHeader) || capacity == 0 || (capacity & (capacity - 1)) ||
+               header->channels != 1 ||
+               size < header->header_size + static_cast<size_t>(capacity) * sizeof(float)) {
+        std::cerr << "Error: Shared memory " << segment << " has a malformed ring header." << std::endl;
+    } else {
+        return std::shared_ptr<ShmRing>(new ShmRing(segment, base, size, false));
+    }
+    munmap(base, size);
+    return nullptr;
+}
+
+void ShmRing::Wake(std::atomic<uint32_t> &seq, const std::atomic<uint32_t> &waiters)
+{
+    // Paired with the waiter registering before it checks again, see WaitUntil.
+    seq.fetch_add(1, std::memory_order_seq_cst);
+    if (waiters.load(std::memory_order_seq_cst) != 0) {
+        FutexWakeAll(&seq);
+    }
+}
+
+template <typename F>
+bool ShmRing::WaitUntil(std::atomic<uint32_t> &seq, std::atomic<uint32_t> &waiters, int timeout_ms, F ready)
+{
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    for (;;) {
+        // The sequence is read before the condition: a wake after this makes the futex wait return at once.
+        const auto observed = seq.load(std::memory_order_seq_cst);
+        if (ready()) {
+            return true;
+        }
+        const auto left = deadline - std::chrono::steady_clock::now();
+        if (left <= std::chrono::nanoseconds::zero()) {
+            return false;
+        }
+        const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(left).count();
+        const timespec timeout{static_cast<time_t>(ns / 1000000000), static_cast<long>(ns % 1000000000)};
+        waiters.fetch_add(1, std::memory_order_seq_cst);
+        if (!ready()) {
+            FutexWait(&seq, observed, &timeout);
+        }
+        waiters.fetch_sub(1, std::memory_order_seq_cst);
+    }
+}
+
+size_t ShmRing::Write(const float *samples, size_t count)
+{
+    auto &header = *header_;
+    const auto write = header.write_pos.load(std::memory_order_relaxed);
+    const auto read = header.read_pos.load(std::memory_order_acquire);
+    const auto written = std::min<size_t>(count, header.capacity - (write - read));
+    const auto offset = static_cast<size_t>(write & (header.capacity - 1));
+    const auto first = std::min<size_t>(written, header.capacity - offset);
+    std::copy_n(samples, first, data_ + offset);
+    std::copy_n(samples + first, written - first, data_);
+    header.write_pos.store(write + written, std::memory_order_release);
+
+    if (written < count) {
+        header.overruns.fetch_add(count - written, std::memory_order_relaxed);
+    }
+    if (written > 0) {
+        Wake(header.data_seq, header.data_waiters);
+    }
+    return written;
+}
+
+void ShmRing::Close()
+{
+    header_->closed.store(1, std::memory_order_release);
+    Wake(header_->data_seq, header_->data_waiters);
+}
+
+bool ShmRing::WaitSpace(size_t count, int timeout_ms)
+{
+    auto &header = *header_;
+    if (count > header.capacity) {
+        return false;
+    }
+    const auto write = header.write_pos.load(std::memory_order_relaxed);
+    return WaitUntil(header.space_seq, header.space_waiters, timeout_ms, [&]() {
+        return header.capacity - (write - header.read_pos.load(std::memory_order_acquire)) >= count;
+    });
+}
+
+bool ShmRing::WaitData(uint64_t pos, int timeout_ms)
+{
+    auto &header = *header_;
+    return WaitUntil(header.data_seq, header.data_waiters, timeout_ms, [&]() {
+        return header.write_pos.load(std::memory_order_acquire) >= pos ||
+               header.closed.load(std::memory_order_acquire) != 0;
+    });
+}
+
+void ShmRing::Advance(uint64_t pos)
+{
+    header_->read_pos.store(pos, std::memory_order_release);
+    Wake(header_->space_seq, header_->space_waiters);
+}
+
+size_t ShmRing::Read(float *samples, size_t count)
+{
+    auto &header = *header_;
+    const auto closed = IsClosed();
+    const auto read = header.read_pos.load(std::memory_order_relaxed);
+    const auto available = static_cast<size_t>(WritePosition() - read);
+    const auto taken = std::min(count, available);
+    const auto offset = static_cast<size_t>(read & (header.capacity - 1));
+    const auto first = std::min<size_t>(taken, header.capacity - offset);
+    std::copy_n(data_ + offset, first, samples);
+    std::copy_n(data_, taken - first, samples + first);
+    if (taken > 0) {
+        Advance(read + taken);
+    }
+    if (taken < count && !closed) {
+        header.underruns.fetch_add(count - taken, std::memory_order_relaxed);
+    }
+    return taken;
+}
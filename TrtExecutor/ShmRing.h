@@ -0,0 +1,177 @@
+// ShmRing.h: Single-producer single-consumer sample ring in POSIX shared memory
+//
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+
+//!
+//! \brief Layout at the start of the shared segment, the samples follow at header_size.
+//!
+//! \details Positions count samples since the ring was created and never wrap, sample pos lives at
+//!          pos % capacity. Each side owns its position and futex word; the other side only reads them.
+//!          A reader refuses a segment with another magic or major version; fields are only ever added at
+//!          the end, before header_size, so a newer minor version stays readable.
+//!
+struct ShmRingHeader
+{
+    static constexpr uint32_t kMagic = 0x474e5254;  // "TRNG"
+    static constexpr uint16_t kVersionMajor = 1;
+    static constexpr uint16_t kVersionMinor = 0;
+
+    uint32_t magic;
+    uint16_t version_major;
+    uint16_t version_minor;
+    uint32_t header_size;
+    uint32_t capacity;      //!< Samples, a power of two.
+    uint32_t sample_rate;
+    uint32_t channels;
+
+    alignas(64) std::atomic<uint64_t> write_pos;
+    std::atomic<uint32_t> data_seq;         //!< Bumped after every write and on close, the consumer waits on it.
+    std::atomic<uint32_t> data_waiters;
+    std::atomic<uint32_t> closed;           //!< Set by the producer after its last write.
+    std::atomic<uint64_t> overruns;         //!< Samples the producer dropped because the ring was full.
+
+    alignas(64) std::atomic<uint64_t> read_pos;
+    std::atomic<uint32_t> space_seq;        //!< Bumped after every read, the producer waits on it.
+    std::atomic<uint32_t> space_waiters;
+    std::atomic<uint64_t> underruns;        //!< Samples the consumer asked for with Read() that were not there.
+};
+
+//!
+//! \brief One direction of a stream between two processes: float samples written once by the producer and
+//!        read in place by the consumer, with futex wakeups on the shared words.
+//!
+//! \details Futexes rather than eventfds, since a futex word in the segment needs nothing passed between
+//!          the processes. Wakeup syscalls are only made when the other side is waiting. Neither side
+//!          blocks the other: a full ring drops the write (counted as overrun), a short Read() returns what
+//!          is there (counted as underrun). Lock-free atomics in the segment are address-free on the
+//!          platforms we run on, which is what makes them usable across processes.
+//!
+class ShmRing
+{
+public:
+    ~ShmRing();
+
+    //!
+    //! \brief Create the segment /name (a leading '/' is added if missing), replacing a stale one. The
+    //!        creator unlinks it on destruction. capacity is rounded up to a power of two.
+    //!        Returns nullptr on failure.
+    //!
+    static std::shared_ptr<ShmRing> Create(const std::string &name, uint32_t capacity, uint32_t sample_rate);
+
+    //!
+    //! \brief Attach to a segment created by Create, in this or another process. Returns nullptr if it
+    //!        does not exist or its header is not one this build understands.
+    //!
+    static std::shared_ptr<ShmRing> Open(const std::string &name);
+
+    //
+    // Producer side.
+    //
+
+    //!
+    //! \brief Append count samples, or as many as fit, the rest is dropped and counted. Returns the
+    //!        number written.
+    //!
+    size_t Write(const float *samples, size_t count);
+
+    //!
+    //! \brief Mark the end of the stream, after the last Write.
+    //!
+    void Close();
+
+    //!
+    //! \brief Wait until count samples fit. Returns false on timeout.
+    //!
+    bool WaitSpace(size_t count, int timeout_ms);
+
+    //
+    // Consumer side.
+    //
+
+    //!
+    //! \brief Wait until the write position reaches pos or the ring is closed. Returns false on timeout.
+    //!
+    bool WaitData(uint64_t pos, int timeout_ms);
+
+    //!
+    //! \brief Sample at pos, which must be in [ReadPosition(), WritePosition()).
+    //!
+    float At(uint64_t pos) const
+    {
+        return data_[pos & (header_->capacity - 1)];
+    }
+
+    //!
+    //! \brief Release the samples before pos to the producer.
+    //!
+    void Advance(uint64_t pos);
+
+    //!
+    //! \brief Copy out up to count samples and release them. Returns the number read.
+    //!
+    size_t Read(float *samples, size_t count);
+
+    uint64_t ReadPosition() const
+    {
+        return header_->read_pos.load(std::memory_order_relaxed);
+    }
+
+    uint64_t WritePosition() const
+    {
+        return header_->write_pos.load(std::memory_order_acquire);
+    }
+
+    //!
+    //! \brief Once true, WritePosition() is final.
+    //!
+    bool IsClosed() const
+    {
+        return header_->closed.load(std::memory_order_acquire) != 0;
+    }
+
+    uint32_t Capacity() const
+    {
+        return header_->capacity;
+    }
+
+    uint32_t SampleRate() const
+    {
+        return header_->sample_rate;
+    }
+
+    uint64_t Overruns() const
+    {
+        return header_->overruns.load(std::memory_order_relaxed);
+    }
+
+    uint64_t Underruns() const
+    {
+        return header_->underruns.load(std::memory_order_relaxed);
+    }
+
+private:
+    ShmRing(std::string name, void *base, size_t size, bool owner);
+
+    static void Wake(std::atomic<uint32_t> &seq, const std::atomic<uint32_t> &waiters);
+
+    //!
+    //! \brief Wait on seq until ready() holds. Returns false on timeout.
+    //!
+    template <typename F>
+    static bool WaitUntil(std::atomic<uint32_t> &seq, std::atomic<uint32_t> &waiters, int timeout_ms, F ready);
+
+    std::string name_;
+    void *base_;
+    size_t size_;
+    bool owner_;
+    ShmRingHeader *header_;
+    float *data_;
+};
@@ -0,0 +1,121 @@
+// ShmStream.cpp: Impl
+//
+
+#include "ShmStream.h"
+
+#include <algorithm>
+#include <cassert>
+
+#include "Timeline.h"
+
+
+namespace {
+
+// The executor loop retries after a short sleep, waiting longer here only saves wakeups.
+constexpr int kWaitMs = 100;
+
+}
+
+ShmInputStream::ShmInputStream(const VoiceFileInputConfig &config, std::shared_ptr<ShmRing> ring,
+                               TrtExecutor *executor)
+    : ring_(std::move(ring)),
+      executor_(executor),
+      frontend_(config, static_cast<int>(ring_->SampleRate())),
+      history_(frontend_.FrameSize() - frontend_.HopSize())
+{
+}
+
+infer::Dims ShmInputStream::GetDynamicDim(const char *input_name)
+{
+    return infer::Dims3{1, 1, static_cast<int>(frontend_.Bins())};
+}
+
+std::vector<std::string> ShmInputStream::GetInputTensorNames(const InferEngine &engine)
+{
+    return VoiceInputTensorNames(engine);
+}
+
+bool ShmInputStream::TryTake(const std::vector<void *> &host_buffer, const std::vector<size_t> &sizes)
+{
+    // Frame k covers the stream samples [k * hop - history, (k + 1) * hop).
+    const int64_t hop = frontend_.HopSize();
+    const auto begin = (frontend_.FrameIndex() + 1) * hop - history_;
+    const auto end = begin + frontend_.FrameSize();
+    ring_->WaitData(static_cast<uint64_t>(end), kWaitMs);
+
+    // Closed first, then the position, so a closed ring has its final position.
+    const auto closed = ring_->IsClosed();
+    const auto written = static_cast<int64_t>(ring_->WritePosition());
+    if (!closed && written < end) {
+        return false;
+    }
+    if (closed && begin >= written) {
+        executor_->Terminate();
+        return false;
+    }
+    assert(host_buffer.size() == sizes.size());
+    assert(frontend_.Bins() * sizeof(float) == sizes[0]);
+    TRT_TIMELINE_SCOPE("input", "frontend");
+
+    auto *frame = frontend_.Frame();
+    for (int64_t pos = begin; pos < end; ++pos) {
+        *frame++ = pos >= 0 && pos < written ? ring_->At(static_cast<uint64_t>(pos)) : 0.0;
+    }
+    frontend_.Analyze(static_cast<float *>(host_buffer[0]));
+    // Only the history of the next frame is still needed.
+    ring_->Advance(static_cast<uint64_t>(std::max<int64_t>(0, begin + hop)));
+    return true;
+}
+
+size_t ShmInputStream::PendingFrames() const
+{
+    const int64_t hop = frontend_.HopSize();
+    const auto next_end = (frontend_.FrameIndex() + 2) * hop;
+    const auto written = static_cast<int64_t>(ring_->WritePosition());
+    return written < next_end ? 0 : static_cast<size_t>((written - next_end) / hop + 1);
+}
+
+void ShmInputStream::SaveState(StreamState &state) const
+{
+    frontend_.SaveState(state);
+}
+
+void ShmInputStream::RestoreState(const StreamState &state)
+{
+    frontend_.RestoreState(state);
+}
+
+ShmOutputHandler::ShmOutputHandler(std::shared_ptr<ShmInputStream> input, std::shared_ptr<ShmRing> ring)
+    : input_(std::move(input)),
+      ring_(std::move(ring)),
+      synthesis_(input_->Frontend())
+{
+}
+
+std::vector<std::string> ShmOutputHandler::GetOutputTensorNames(const InferEngine &engine)
+{
+    return VoiceOutputTensorNames(engine);
+}
+
+void ShmOutputHandler::SetTensorDim(const char *output_name, const infer::Dims &dims)
+{
+    //
+}
+
+void ShmOutputHandler::Consume(const std::vector<void *> &host_buffer, const std::vector<size_t> &sizes)
+{
+    assert(host_buffer.size() == sizes.size());
+    TRT_TIMELINE_SCOPE("output", "synthesis");
+    const auto *enhanced = synthesis_.Synthesize(static_cast<const float *>(host_buffer[0]));
+    ring_->Write(enhanced, input_->Frontend().HopSize());
+}
+
+void ShmOutputHandler::SaveState(StreamState &state) const
+{
+    synthesis_.SaveState(state);
+}
+
+void ShmOutputHandler::RestoreState(const StreamState &state)
+{
+    synthesis_.RestoreState(state);
+}
@@ -0,0 +1,76 @@
+// ShmStream.h: Voice streams over shared-memory rings, for a producer in another process
+//
+
+#pragma once
+
+#include <memory>
+
+#include "ShmRing.h"
+#include "VoiceStream.h"
+
+
+//!
+//! \brief Frontend reading the samples of a stream straight out of a ShmRing another process writes.
+//!
+//! \details Frames are windowed from the ring in place, no copy of the stream is kept; the samples a frame
+//!          no longer needs are released to the producer after it is analyzed. The stream starts with the
+//!          zero history of the file pipeline, and once the producer closes the ring the partial last hop
+//!          is zero padded, so the frames match those VoiceInputStream makes of the same samples. The
+//!          executor is terminated after the last one.
+//!
+class ShmInputStream : public TrtInputStream
+{
+public:
+    ShmInputStream(const VoiceFileInputConfig &config, std::shared_ptr<ShmRing> ring, TrtExecutor *executor);
+
+    infer::Dims GetDynamicDim(const char *input_name) override;
+
+    std::vector<std::string> GetInputTensorNames(const InferEngine &engine) override;
+
+    //!
+    //! \brief Waits a little for the producer, returns false if the next hop is not there yet.
+    //!
+    bool TryTake(const std::vector<void *> &host_buffer, const std::vector<size_t> &sizes) override;
+
+    size_t PendingFrames() const override;
+
+    void SaveState(StreamState &state) const override;
+
+    void RestoreState(const StreamState &state) override;
+
+    StreamingFrontend &Frontend()
+    {
+        return frontend_;
+    }
+
+private:
+    std::shared_ptr<ShmRing> ring_;
+    TrtExecutor *executor_;
+    StreamingFrontend frontend_;
+    int64_t history_;   //!< Samples of the frame before its hop.
+};
+
+//!
+//! \brief Writes every hop of enhanced samples into a ShmRing the other process reads. A hop that does not
+//!        fit is dropped and counted as overrun, the executor never waits for the reader.
+//!
+class ShmOutputHandler : public TrtOutputHandler
+{
+public:
+    ShmOutputHandler(std::shared_ptr<ShmInputStream> input, std::shared_ptr<ShmRing> ring);
+
+    std::vector<std::string> GetOutputTensorNames(const InferEngine &engine) override;
+
+    void SetTensorDim(const char *output_name, const infer::Dims &dims) override;
+
+    void Consume(const std::vector<void *> &host_buffer, const std::vector<size_t> &sizes) override;
+
+    void SaveState(StreamState &state) const override;
+
+    void RestoreState(const StreamState &state) override;
+
+private:
+    std::shared_ptr<ShmInputStream> input_;
+    std::shared_ptr<ShmRing> ring_;
+    StreamingSynthesis synthesis_;
+};
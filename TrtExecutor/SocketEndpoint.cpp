@@ -0,0 +1,142 @@
+// SocketEndpoint.cpp: Impl
+//
+
+#include "SocketEndpoint.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+
+namespace {
+
+constexpr int kBacklog = 64;
+
+bool UnixAddress(const std::string &path, const char *what, sockaddr_un &addr)
+{
+    addr = {};
+    if (path.size() >= sizeof(addr.sun_path)) {
+        std::cerr << "Error: " << what << " socket path too long: " << path << std::endl;
+        return false;
+    }
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    return true;
+}
+
+bool TcpAddress(const std::string &endpoint, const char *what, sockaddr_in &addr)
+{
+    const auto colon = endpoint.rfind(':');
+    const auto host = colon == std::string::npos ? std::string("127.0.0.1") : endpoint.substr(0, colon);
+    const auto port = atoi(endpoint.c_str() + (colon == std::string::npos ? 0 : colon + 1));
+    addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(static_cast<uint16_t>(port));
+    if (port <= 0 || port > 65535 || inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1) {
+        std::cerr << "Error: invalid " << what << " endpoint: " << endpoint << std::endl;
+        return false;
+    }
+    return true;
+}
+
+int ListenUnix(const std::string &path, const char *what, int flags)
+{
+    sockaddr_un addr;
+    if (!UnixAddress(path, what, addr)) {
+        return -1;
+    }
+    unlink(path.c_str());
+
+    const auto fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | flags, 0);
+    if (fd < 0 || bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 || listen(fd, kBacklog) != 0) {
+        std::cerr << "Error: Unable to listen on " << what << " socket: " << path << std::endl;
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    return fd;
+}
+
+int ListenTcp(const std::string &endpoint, const char *what, int flags)
+{
+    sockaddr_in addr;
+    if (!TcpAddress(endpoint, what, addr)) {
+        return -1;
+    }
+
+    const auto fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC | flags, 0);
+    const int reuse = 1;
+    if (fd >= 0) {
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    }
+    if (fd < 0 || bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 || listen(fd, kBacklog) != 0) {
+        std::cerr << "Error: Unable to listen on " << what << " endpoint: " << endpoint << std::endl;
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    return fd;
+}
+
+}
+
+int ListenEndpoint(const std::string &endpoint, const char *what, std::string &unix_path, int flags)
+{
+    if (endpoint.compare(0, 5, "unix:") == 0) {
+        unix_path = endpoint.substr(5);
+        const auto fd = ListenUnix(unix_path, what, flags);
+        if (fd < 0) {
+            unix_path.clear();
+        }
+        return fd;
+    }
+    unix_path.clear();
+    return ListenTcp(endpoint, what, flags);
+}
+
+int ConnectEndpoint(const std::string &endpoint, const char *what)
+{
+    sockaddr_storage storage = {};
+    socklen_t len;
+    int family;
+    if (endpoint.compare(0, 5, "unix:") == 0) {
+        auto &addr = reinterpret_cast<sockaddr_un &>(storage);
+        if (!UnixAddress(endpoint.substr(5), what, addr)) {
+            return -1;
+        }
+        len = sizeof(addr);
+        family = AF_UNIX;
+    } else {
+        auto &addr = reinterpret_cast<sockaddr_in &>(storage);
+        if (!TcpAddress(endpoint, what, addr)) {
+            return -1;
+        }
+        len = sizeof(addr);
+        family = AF_INET;
+    }
+
+    const auto fd = socket(family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, reinterpret_cast<sockaddr *>(&storage), len) != 0) {
+        std::cerr << "Error: Unable to connect to " << what << " endpoint " << endpoint << ": " << strerror(errno)
+                  << std::endl;
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    if (family == AF_INET) {
+        const int no_delay = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+    }
+    return fd;
+}
@@ -0,0 +1,21 @@
+// SocketEndpoint.h: Listening and connected sockets on "unix:path" or "[host:]port" endpoints
+//
+
+#pragma once
+
+#include <string>
+
+
+//!
+//! \brief Bind and listen on endpoint: "unix:/path/to/socket", "host:port" or "port" (bound to 127.0.0.1).
+//!        A stale unix socket file is replaced, its path is stored into unix_path (cleared for TCP) so the
+//!        caller can unlink it when done. flags are or-ed into the socket type (e.g. SOCK_NONBLOCK), what
+//!        names the socket in error messages. Returns -1 on failure.
+//!
+int ListenEndpoint(const std::string &endpoint, const char *what, std::string &unix_path, int flags = 0);
+
+//!
+//! \brief Connect a blocking stream socket to endpoint, same syntax as ListenEndpoint, TCP_NODELAY set for TCP.
+//!        what names the endpoint in error messages. Returns -1 on failure.
+//!
+int ConnectEndpoint(const std::string &endpoint, const char *what);
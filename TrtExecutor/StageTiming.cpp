@@ -0,0 +1,135 @@
+// StageTiming.cpp: Impl
+//
+
+#include "StageTiming.h"
+
+#include <algorithm>
+#include <iomanip>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+
+namespace {
+
+int HighestBit(uint64_t v)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanReverse64(&index, v);
+    return static_cast<int>(index);
+#else
+    return 63 - __builtin_clzll(v);
+#endif
+}
+
+}
+
+const char *StageName(Stage stage)
+{
+    switch (stage) {
+        case Stage::kTake: return "take";
+        case Stage::kCopyIn: return "copy_in";
+        case Stage::kExecute: return "execute";
+        case Stage::kCopyOut: return "copy_out";
+        case Stage::kConsume: return "consume";
+        case Stage::kFrame: return "frame";
+        default: return "unknown";
+    }
+}
+
+LatencyHistogram::LatencyHistogram()
+{
+    Reset();
+}
+
+size_t LatencyHistogram::BucketOf(uint64_t ns)
+{
+    if (ns < kSubBuckets) {
+        return static_cast<size_t>(ns);
+    }
+    // The top kSubBucketBits + 1 bits select the bucket: the octave, then the linear step within it.
+    const auto shift = HighestBit(ns) - kSubBucketBits;
+    const auto mantissa = static_cast<size_t>(ns >> shift);
+    return (static_cast<size_t>(shift) + 1) * kSubBuckets + (mantissa - kSubBuckets);
+}
+
+uint64_t LatencyHistogram::BucketHigh(size_t bucket)
+{
+    if (bucket < kSubBuckets) {
+        return bucket;
+    }
+    const auto shift = bucket / kSubBuckets - 1;
+    const auto mantissa = static_cast<uint64_t>(bucket % kSubBuckets + kSubBuckets);
+    return ((mantissa + 1) << shift) - 1;
+}
+
+LatencySummary LatencyHistogram::Summarize() const
+{
+    LatencySummary summary;
+    // Snapshot the buckets, concurrent records may land in between and are simply in or out.
+    std::array<uint64_t, kBuckets> counts;
+    uint64_t total = 0;
+    for (size_t i = 0; i < kBuckets; ++i) {
+        counts[i] = counts_[i].load(std::memory_order_relaxed);
+        total += counts[i];
+    }
+    if (total == 0) {
+        return summary;
+    }
+
+    const auto max = max_.load(std::memory_order_relaxed);
+    const auto at = [&counts, total, max](double p) {
+        const auto rank = std::max<uint64_t>(1, static_cast<uint64_t>(p * total + 0.5));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < kBuckets; ++i) {
+            seen += counts[i];
+            if (seen >= rank) {
+                return std::min(BucketHigh(i), max) / 1000.0;
+            }
+        }
+        return max / 1000.0;
+    };
+    summary.count = total;
+    summary.mean_us = sum_.load(std::memory_order_relaxed) / 1000.0 / std::max<uint64_t>(1, count_.load(std::memory_order_relaxed));
+    summary.p50_us = at(0.5);
+    summary.p90_us = at(0.9);
+    summary.p99_us = at(0.99);
+    summary.max_us = max / 1000.0;
+    return summary;
+}
+
+void LatencyHistogram::Reset()
+{
+    for (auto &count : counts_) {
+        count.store(0, std::memory_order_relaxed);
+    }
+    count_.store(0, std::memory_order_relaxed);
+    sum_.store(0, std::memory_order_relaxed);
+    max_.store(0, std::memory_order_relaxed);
+}
+
+void StageProfiler::Report(std::ostream &os) const
+{
+    os << "***** Stage Latency (us) *****" << std::endl;
+    const auto flags = os.flags();
+    const auto precision = os.precision();
+    os << std::fixed << std::setprecision(1);
+    for (int i = 0; i < static_cast<int>(Stage::kCount); ++i) {
+        const auto stage = static_cast<Stage>(i);
+        const auto summary = Summarize(stage);
+        if (summary.count == 0) {
+            continue;
+        }
+        os << "  " << std::left << std::setw(9) << StageName(stage) << std::right << " count: " << summary.count
+           << ", mean: " << summary.mean_us << ", p50: " << summary.p50_us << ", p90: " << summary.p90_us
+           << ", p99: " << summary.p99_us << ", max: " << summary.max_us;
+        if (AllocTracker::kEnabled) {
+            os << ", allocs/frame: " << static_cast<double>(Allocations(stage)) / summary.count;
+        }
+        os << std::endl;
+    }
+    os.flags(flags);
+    os.precision(precision);
+}
@@ -0,0 +1,156 @@
+// StageTiming.h: Lock-free latency histograms of the stages of the executor loop
+//
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+
+#include "AllocTracker.h"
+
+//!
+//! \brief Stages of one frame in TrtExecutor::Process. kFrame spans TryTake to the end of Consume.
+//!
+enum class Stage : int
+{
+    kTake = 0,  // TryTake: the frontend
+    kCopyIn,    // half conversion and host to device copy
+    kExecute,
+    kCopyOut,   // device to host copy and half conversion
+    kConsume,   // Consume: the synthesis
+    kFrame,
+    kCount,
+};
+
+const char *StageName(Stage stage);
+
+struct LatencySummary
+{
+    uint64_t count = 0;
+    double mean_us = 0;
+    double p50_us = 0;
+    double p90_us = 0;
+    double p99_us = 0;
+    double max_us = 0;
+};
+
+//!
+//! \brief HDR-style histogram of nanosecond latencies: exact below 32 ns, then 32 linear buckets per power of
+//!        two, so any recorded value is reported within 3.2%. Record is wait-free (relaxed atomics) and may
+//!        run concurrently with Summarize from other threads.
+//!
+class LatencyHistogram
+{
+public:
+    static constexpr int kSubBucketBits = 5;
+    static constexpr size_t kSubBuckets = size_t(1) << kSubBucketBits;
+    static constexpr size_t kBuckets = (64 - kSubBucketBits + 1) * kSubBuckets;
+
+    LatencyHistogram();
+
+    void Record(uint64_t ns)
+    {
+        counts_[BucketOf(ns)].fetch_add(1, std::memory_order_relaxed);
+        count_.fetch_add(1, std::memory_order_relaxed);
+        sum_.fetch_add(ns, std::memory_order_relaxed);
+        auto max = max_.load(std::memory_order_relaxed);
+        while (ns > max && !max_.compare_exchange_weak(max, ns, std::memory_order_relaxed)) {
+        }
+    }
+
+    LatencySummary Summarize() const;
+
+    void Reset();
+
+    static size_t BucketOf(uint64_t ns);
+
+    //!
+    //! \brief Highest value that falls into the bucket.
+    //!
+    static uint64_t BucketHigh(size_t bucket);
+
+private:
+    std::array<std::atomic<uint64_t>, kBuckets> counts_;
+    std::atomic<uint64_t> count_;
+    std::atomic<uint64_t> sum_;
+    std::atomic<uint64_t> max_;
+};
+
+//!
+//! \brief One histogram per stage, plus the heap allocations made in the stage (see AllocTracker).
+//!
+class StageProfiler
+{
+public:
+    void Record(Stage stage, std::chrono::steady_clock::duration elapsed, uint64_t allocations = 0)
+    {
+        const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+        histograms_[static_cast<int>(stage)].Record(ns > 0 ? static_cast<uint64_t>(ns) : 0);
+        if (allocations) {
+            allocations_[static_cast<int>(stage)].fetch_add(allocations, std::memory_order_relaxed);
+        }
+    }
+
+    LatencySummary Summarize(Stage stage) const
+    {
+        return histograms_[static_cast<int>(stage)].Summarize();
+    }
+
+    uint64_t Allocations(Stage stage) const
+    {
+        return allocations_[static_cast<int>(stage)].load(std::memory_order_relaxed);
+    }
+
+    //!
+    //! \brief Print count, mean, p50/p90/p99 and max of every stage that recorded anything, and allocations
+    //!        per frame when built with TRT_EXECUTOR_ALLOC_TRACKING.
+    //!
+    void Report(std::ostream &os) const;
+
+private:
+    std::array<LatencyHistogram, static_cast<int>(Stage::kCount)> histograms_;
+    std::array<std::atomic<uint64_t>, static_cast<int>(Stage::kCount)> allocations_{};
+};
+
+//!
+//! \brief Records the time from construction to destruction into a stage.
+//!
+class StageScope
+{
+public:
+    StageScope(StageProfiler *profiler, Stage stage)
+        : profiler_(profiler), stage_(stage), start_(std::chrono::steady_clock::now()),
+          allocations_(AllocTracker::kEnabled ? AllocTracker::ThreadAllocations() : 0)
+    {
+    }
+
+    ~StageScope()
+    {
+        if (profiler_) {
+            const auto allocations = AllocTracker::kEnabled ? AllocTracker::ThreadAllocations() - allocations_ : 0;
+            profiler_->Record(stage_, std::chrono::steady_clock::now() - start_, allocations);
+        }
+    }
+
+private:
+    StageProfiler *profiler_;
+    Stage stage_;
+    std::chrono::steady_clock::time_point start_;
+    uint64_t allocations_;
+};
+
+// TRT_STAGE_SCOPE(profiler, stage) times the rest of the enclosing block, TRT_STAGE_RECORD(profiler, stage,
+// elapsed, allocations) records a duration and allocation count measured by the caller. Both are compiled out,
+// including the clock reads, unless TRT_EXECUTOR_STAGE_TIMING is defined (the CMake option of the same name).
+#ifdef TRT_EXECUTOR_STAGE_TIMING
+#define TRT_STAGE_CONCAT_(a, b) a##b
+#define TRT_STAGE_CONCAT(a, b) TRT_STAGE_CONCAT_(a, b)
+#define TRT_STAGE_SCOPE(profiler, stage) StageScope TRT_STAGE_CONCAT(stage_scope_, __LINE__)(profiler, stage)
+#define TRT_STAGE_RECORD(profiler, stage, elapsed, allocations) (profiler)->Record(stage, elapsed, allocations)
+#else
+#define TRT_STAGE_SCOPE(profiler, stage) ((void)0)
+#define TRT_STAGE_RECORD(profiler, stage, elapsed, allocations) ((void)0)
+#endif
@@ -0,0 +1,377 @@
+// StandInBackend.cpp: Impl
+//
+
+#include "StandInBackend.h"
+
+#include "common/fp16.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+
+namespace {
+
+constexpr char kSpecMagic[] = "standin";
+
+bool ParseDims(std::istringstream &iss, infer::Dims &dims)
+{
+    dims.nbDims = 0;
+    int dim = 0;
+    while (iss >> dim) {
+        if (dims.nbDims == infer::Dims::MAX_DIMS || dim == 0 || dim < -1) {
+            return false;
+        }
+        dims.d[dims.nbDims++] = dim;
+    }
+    return dims.nbDims > 0;
+}
+
+}
+
+bool StandInSpec::IsSpecFile(const void *data, size_t size)
+{
+    // Skip leading comments and blank lines, the first directive must be the magic.
+    std::istringstream iss(std::string(static_cast<const char *>(data), std::min<size_t>(size, 4096)));
+    std::string line;
+    while (std::getline(iss, line)) {
+        std::istringstream words(line);
+        std::string word;
+        if (!(words >> word) || word[0] == '#') {
+            continue;
+        }
+        return word == kSpecMagic;
+    }
+    return false;
+}
+
+bool StandInSpec::Parse(const std::string &text)
+{
+    std::istringstream iss(text);
+    std::string line;
+    int line_no = 0;
+    bool has_magic = false;
+    while (std::getline(iss, line)) {
+        ++line_no;
+        const auto comment = line.find('#');
+        if (comment != std::string::npos) {
+            line.erase(comment);
+        }
+        std::istringstream words(line);
+        std::string key;
+        if (!(words >> key)) {
+            continue;
+        }
+
+        bool ok = true;
+        if (!has_magic) {
+            int version = 0;
+            ok = key == kSpecMagic && (words >> version) && version == 1;
+            has_magic = true;
+        } else if (key == "input" || key == "output") {
+            Binding binding;
+            binding.input = key == "input";
+            ok = (words >> binding.name) && ParseDims(words, binding.dims);
+            bindings.push_back(binding);
+        } else if (key == "state") {
+            Binding in, out;
+            in.input = true;
+            out.input = false;
+            ok = (words >> in.name >> out.name) && ParseDims(words, in.dims);
+            out.dims = in.dims;
+            states.emplace_back(static_cast<int>(bindings.size()), static_cast<int>(bindings.size() + 1));
+            bindings.push_back(in);
+            bindings.push_back(out);
+        } else if (key == "half") {
+            std::string name;
+            ok = false;
+            while (words >> name) {
+                auto it = std::find_if(bindings.begin(), bindings.end(), [&name](const Binding &b) { return b.name == name; });
+                ok = it != bindings.end();
+                if (!ok) {
+                    break;
+                }
+                it->half = true;
+            }
+        } else if (key == "transform") {
+            std::string kind;
+            ok = static_cast<bool>(words >> kind);
+            if (kind == "echo") {
+                transform = Transform::kEcho;
+            } else if (kind == "scale") {
+                transform = Transform::kScale;
+                ok = ok && (words >> transform_value);
+            } else if (kind == "constant") {
+                transform = Transform::kConstant;
+                ok = ok && (words >> transform_value);
+            } else {
+                ok = false;
+            }
+        } else if (key == "delay_us") {
+            ok = (words >> delay_us) && delay_us >= 0;
+        } else if (key == "jitter") {
+            std::string kind;
+            ok = static_cast<bool>(words >> kind);
+            if (kind == "none") {
+                jitter = Jitter::kNone;
+            } else {
+                jitter = kind == "uniform" ? Jitter::kUniform : kind == "normal" ? Jitter::kNormal : Jitter::kExponential;
+                ok = ok && (kind == "uniform" || kind == "normal" || kind == "exponential") &&
+                     (words >> jitter_us) && jitter_us > 0;
+            }
+        } else if (key == "wait") {
+            std::string kind;
+            ok = (words >> kind) && (kind == "sleep" || kind == "spin");
+            spin = kind == "spin";
+        } else if (key == "seed") {
+            ok = static_cast<bool>(words >> seed);
+        } else if (key == "fail_every") {
+            ok = static_cast<bool>(words >> fail_every);
+        } else {
+            ok = false;
+        }
+
+        if (!ok) {
+            std::cerr << "Error: invalid stand-in spec at line " << line_no << ": " << line << std::endl;
+            return false;
+        }
+    }
+
+    // Besides the states, at least one input and one output for the transform.
+    const auto inputs = std::count_if(bindings.begin(), bindings.end(), [](const Binding &b) { return b.input; });
+    const auto outputs = static_cast<std::ptrdiff_t>(bindings.size()) - inputs;
+    const auto state_count = static_cast<std::ptrdiff_t>(states.size());
+    if (!has_magic || inputs <= state_count || outputs <= state_count) {
+        std::cerr << "Error: stand-in spec needs the magic line, an input and an output binding." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+StandInEngine::StandInEngine(StandInSpec spec) : spec_(std::move(spec))
+{
+}
+
+int StandInEngine::GetNbBindings() const
+{
+    return static_cast<int>(spec_.bindings.size());
+}
+
+const char *StandInEngine::GetBindingName(int index) const
+{
+    return spec_.bindings[index].name.c_str();
+}
+
+int StandInEngine::GetBindingIndex(const char *name) const
+{
+    const auto &bindings = spec_.bindings;
+    auto it = std::find_if(bindings.begin(), bindings.end(), [name](const StandInSpec::Binding &b) { return b.name == name; });
+    return it == bindings.end() ? -1 : static_cast<int>(it - bindings.begin());
+}
+
+bool StandInEngine::BindingIsInput(int index) const
+{
+    return spec_.bindings[index].input;
+}
+
+infer::Dims StandInEngine::GetBindingDimensions(int index) const
+{
+    return spec_.bindings[index].dims;
+}
+
+infer::DataType StandInEngine::GetBindingDataType(int index) const
+{
+    return spec_.bindings[index].half ? infer::DataType::kHALF : infer::DataType::kFLOAT;
+}
+
+std::unique_ptr<InferContext> StandInEngine::CreateContext()
+{
+    // Each context draws its own jitter sequence, reproducible from the seed.
+    return std::unique_ptr<InferContext>(new StandInContext(shared_from_this(), spec_.seed + context_count_++));
+}
+
+StandInContext::StandInContext(std::shared_ptr<const StandInEngine> engine, uint32_t seed)
+    : engine_(std::move(engine)),
+      rng_(seed),
+      uniform_(-1.0, 1.0)
+{
+    const auto &spec = engine_->Spec();
+    for (const auto &binding : spec.bindings) {
+        dims_.push_back(binding.dims);
+    }
+    // The transform reads the first input and writes the first output that is not a state.
+    std::vector<bool> is_state(spec.bindings.size(), false);
+    for (const auto &state : spec.states) {
+        is_state[state.first] = true;
+        is_state[state.second] = true;
+    }
+    for (int i = 0; i < static_cast<int>(spec.bindings.size()); ++i) {
+        if (is_state[i]) {
+            continue;
+        }
+        if (spec.bindings[i].input && first_input_ < 0) {
+            first_input_ = i;
+        }
+        if (!spec.bindings[i].input && first_output_ < 0) {
+            first_output_ = i;
+        }
+    }
+    if (spec.jitter == StandInSpec::Jitter::kExponential) {
+        exponential_ = std::exponential_distribution<double>(1.0 / spec.jitter_us);
+    }
+}
+
+bool StandInContext::SetBindingDimensions(int index, const infer::Dims &dims)
+{
+    if (index < 0 || index >= static_cast<int>(dims_.size()) || !engine_->BindingIsInput(index)) {
+        return false;
+    }
+    dims_[index] = dims;
+    return true;
+}
+
+infer::Dims StandInContext::GetBindingDimensions(int index) const
+{
+    auto dims = dims_[index];
+    if (engine_->BindingIsInput(index)) {
+        return dims;
+    }
+
+    // Dynamic axes of outputs follow the first input.
+    const auto &reference = dims_[first_input_];
+    for (int i = 0; i < dims.nbDims; ++i) {
+        if (dims.d[i] == -1 && i < reference.nbDims) {
+            dims.d[i] = reference.d[i];
+        }
+    }
+    return dims;
+}
+
+bool StandInContext::AllocateBuffers()
+{
+    counts_.resize(dims_.size());
+    halves_.resize(dims_.size());
+    std::vector<size_t> bytes(dims_.size());
+    std::vector<bool> is_input(dims_.size());
+    for (size_t i = 0; i < dims_.size(); ++i) {
+        const auto vol = infer::Volume(GetBindingDimensions(static_cast<int>(i)));
+        if (vol <= 0) {
+            std::cerr << "Error: binding " << engine_->GetBindingName(static_cast<int>(i)) << " has unresolved dims." << std::endl;
+            return false;
+        }
+        counts_[i] = static_cast<size_t>(vol);
+        halves_[i] = engine_->Spec().bindings[i].half;
+        bytes[i] = counts_[i] * (halves_[i] ? sizeof(uint16_t) : sizeof(float));
+        is_input[i] = engine_->BindingIsInput(static_cast<int>(i));
+    }
+    layout_ = samplesCommon::StagingLayout(bytes, is_input, samplesCommon::kArenaAlignment);
+
+    slab_ = samplesCommon::ArenaPool::instance().acquire(layout_.inputBytes() + layout_.outputBytes());
+    if (!slab_) {
+        return false;
+    }
+    auto *inputs = slab_->carve(layout_.inputBytes());
+    auto *outputs = slab_->carve(layout_.outputBytes());
+    memset(inputs, 0, layout_.inputBytes());
+    memset(outputs, 0, layout_.outputBytes());
+    buffers_.resize(dims_.size());
+    for (size_t i = 0; i < dims_.size(); ++i) {
+        buffers_[i] = layout_.resolve(static_cast<int>(i), inputs, outputs);
+    }
+    return true;
+}
+
+void *StandInContext::GetHostBuffer(int index)
+{
+    if (index < 0 || index >= static_cast<int>(buffers_.size())) {
+        return nullptr;
+    }
+    return buffers_[index];
+}
+
+size_t StandInContext::GetBufferSize(int index) const
+{
+    if (index < 0 || index >= static_cast<int>(buffers_.size())) {
+        return 0;
+    }
+    return counts_[index] * (halves_[index] ? sizeof(uint16_t) : sizeof(float));
+}
+
+float StandInContext::Load(int index, size_t i) const
+{
+    if (halves_[index]) {
+        return samplesCommon::halfToFloat(static_cast<const uint16_t *>(buffers_[index])[i]);
+    }
+    return static_cast<const float *>(buffers_[index])[i];
+}
+
+void StandInContext::Store(int index, size_t i, float value)
+{
+    if (halves_[index]) {
+        static_cast<uint16_t *>(buffers_[index])[i] = samplesCommon::floatToHalf(value);
+    } else {
+        static_cast<float *>(buffers_[index])[i] = value;
+    }
+}
+
+double StandInContext::NextDelayUs()
+{
+    const auto &spec = engine_->Spec();
+    double jitter = 0;
+    switch (spec.jitter) {
+        case StandInSpec::Jitter::kNone: break;
+        case StandInSpec::Jitter::kUniform: jitter = spec.jitter_us * uniform_(rng_); break;
+        case StandInSpec::Jitter::kNormal: jitter = spec.jitter_us * normal_(rng_); break;
+        case StandInSpec::Jitter::kExponential: jitter = exponential_(rng_); break;
+    }
+    return std::max(0.0, spec.delay_us + jitter);
+}
+
+bool StandInContext::Execute()
+{
+    if (buffers_.empty()) {
+        return false;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    const auto &spec = engine_->Spec();
+    if (spec.fail_every && ++executions_ % spec.fail_every == 0) {
+        return false;
+    }
+
+    switch (spec.transform) {
+        case StandInSpec::Transform::kEcho:
+        case StandInSpec::Transform::kScale: {
+            const auto scale = spec.transform == StandInSpec::Transform::kEcho ? 1.0f : spec.transform_value;
+            const auto count = std::min(counts_[first_input_], counts_[first_output_]);
+            for (size_t i = 0; i < count; ++i) {
+                Store(first_output_, i, Load(first_input_, i) * scale);
+            }
+            break;
+        }
+        case StandInSpec::Transform::kConstant:
+            for (size_t i = 0; i < counts_[first_output_]; ++i) {
+                Store(first_output_, i, spec.transform_value);
+            }
+            break;
+    }
+    for (const auto &state : spec.states) {
+        for (size_t i = 0; i < counts_[state.first]; ++i) {
+            Store(state.second, i, Load(state.first, i) + 1.0f);
+        }
+    }
+
+    const auto deadline = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<double, std::micro>(NextDelayUs()));
+    if (spec.spin) {
+        while (std::chrono::steady_clock::now() < deadline) {
+        }
+    } else {
+        std::this_thread::sleep_until(deadline);
+    }
+    return true;
+}
@@ -0,0 +1,161 @@
+// StandInBackend.h: Latency-simulating stand-in implementation of the inference backend
+//
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "common/arena.h"
+
+#include "InferBackend.h"
+
+
+//!
+//! \brief Parsed stand-in spec file.
+//!
+//! \details Text file, one directive per line, '#' starts a comment. The first directive must be
+//!          "standin 1". Then:
+//!            input <name> <dims...>                 input binding, e.g. "input input 1 1 257"
+//!            output <name> <dims...>                output binding
+//!            state <in-name> <out-name> <dims...>   recurrent pair, the output is the input plus one, so the
+//!                                                   state counts the frames a stream went through
+//!            half <name>...                         bindings declared above with half precision I/O
+//!            transform echo|scale <k>|constant <v>  how the first output is computed from the first input
+//!            delay_us <us>                          compute time of Execute
+//!            jitter none|uniform <us>|normal <us>|exponential <us>
+//!                                                   added to the delay: uniform in [-us, us], normal with
+//!                                                   stddev us, exponential with mean us; clamped at zero
+//!            wait sleep|spin                        how the compute time is spent, spin keeps a core busy
+//!            seed <n>                               seed of the jitter generator
+//!            fail_every <n>                         every n-th Execute of a context fails, to exercise the
+//!                                                   error paths; 0, the default, never
+//!
+struct StandInSpec
+{
+    enum class Transform
+    {
+        kEcho,
+        kScale,
+        kConstant,
+    };
+
+    enum class Jitter
+    {
+        kNone,
+        kUniform,
+        kNormal,
+        kExponential,
+    };
+
+    struct Binding
+    {
+        std::string name;
+        bool input;
+        infer::Dims dims;
+        bool half = false;
+    };
+
+    std::vector<Binding> bindings;
+    // Pairs of binding indices, input then output.
+    std::vector<std::pair<int, int>> states;
+
+    Transform transform = Transform::kEcho;
+    float transform_value = 1.0f;
+    double delay_us = 0;
+    Jitter jitter = Jitter::kNone;
+    double jitter_us = 0;
+    bool spin = false;
+    uint32_t seed = 0;
+    uint64_t fail_every = 0;
+
+    static bool IsSpecFile(const void *data, size_t size);
+
+    //!
+    //! \brief Parse a spec file content. Returns false and prints the line on error.
+    //!
+    bool Parse(const std::string &text);
+};
+
+class StandInEngine : public InferEngine, public std::enable_shared_from_this<StandInEngine>
+{
+public:
+    explicit StandInEngine(StandInSpec spec);
+
+    int GetNbBindings() const override;
+
+    const char *GetBindingName(int index) const override;
+
+    int GetBindingIndex(const char *name) const override;
+
+    bool BindingIsInput(int index) const override;
+
+    infer::Dims GetBindingDimensions(int index) const override;
+
+    infer::DataType GetBindingDataType(int index) const override;
+
+    std::unique_ptr<InferContext> CreateContext() override;
+
+    const StandInSpec &Spec() const
+    {
+        return spec_;
+    }
+
+private:
+    StandInSpec spec_;
+    std::atomic<uint32_t> context_count_{0};
+};
+
+class StandInContext : public InferContext
+{
+public:
+    StandInContext(std::shared_ptr<const StandInEngine> engine, uint32_t seed);
+
+    bool SetBindingDimensions(int index, const infer::Dims &dims) override;
+
+    infer::Dims GetBindingDimensions(int index) const override;
+
+    bool AllocateBuffers() override;
+
+    void *GetHostBuffer(int index) override;
+
+    size_t GetBufferSize(int index) const override;
+
+    void CopyInputToDevice() override {}
+
+    bool Execute() override;
+
+    void CopyOutputToHost() override {}
+
+    const samplesCommon::StagingLayout *GetStagingLayout() const override
+    {
+        return &layout_;
+    }
+
+private:
+    double NextDelayUs();
+
+    float Load(int index, size_t i) const;
+
+    void Store(int index, size_t i, float value);
+
+    std::shared_ptr<const StandInEngine> engine_;
+    std::vector<infer::Dims> dims_;
+    samplesCommon::StagingLayout layout_;
+    std::shared_ptr<samplesCommon::ArenaSlab> slab_;
+    std::vector<void *> buffers_;
+    std::vector<size_t> counts_;
+    std::vector<bool> halves_;
+    int first_input_ = -1;
+    int first_output_ = -1;
+    uint64_t executions_ = 0;
+
+    std::mt19937 rng_;
+    std::uniform_real_distribution<double> uniform_;
+    std::normal_distribution<double> normal_;
+    std::exponential_distribution<double> exponential_;
+};
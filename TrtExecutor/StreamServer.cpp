@@ -0,0 +1,756 @@
+// StreamServer.cpp: Impl
+//
+
+#include "StreamServer.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <unordered_map>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "SocketEndpoint.h"
+#include "Timeline.h"
+
+
+namespace {
+
+// Stop() is noticed within this, the loops and the workers wait with a timeout rather than block.
+constexpr int kPollMs = 100;
+constexpr int kMaxEvents = 64;
+constexpr size_t kReceiveBytes = 64 * 1024;
+
+// epoll tokens below this are listening sockets, the rest connection ids.
+constexpr uint64_t kFirstConnectionId = 1 << 16;
+
+}
+
+//!
+//! \brief A client stream. The buffers are sized at accept, the mutex guards everything shared between its
+//!        I/O thread and the worker holding it.
+//!
+struct StreamServer::Connection
+{
+    Connection(StreamServer *server, int fd, uint64_t id, int epoll_fd)
+        : server(server),
+          fd(fd),
+          id(id),
+          epoll_fd(epoll_fd)
+    {
+    }
+
+    ~Connection()
+    {
+        close(fd);
+        server->states_.Remove(id);
+        --server->connection_count_;
+        if (server->connections_active_) {
+            server->connections_active_->Add(-1);
+        }
+    }
+
+    StreamServer *const server;
+    const int fd;
+    const uint64_t id;
+    const int epoll_fd;
+
+    std::mutex mutex;
+
+    //!
+    //! \brief [begin, end) is the history the next frame overlaps (window minus hop) followed by the samples
+    //!        not processed yet. Reading stops at input_limit, the room above is for the end of stream padding.
+    //!
+    std::vector<float> samples;
+    size_t begin = 0;
+    size_t end = 0;
+    size_t input_limit = 0;
+
+    //!
+    //! \brief Encoded output not sent yet, in [pending_begin, pending_end).
+    //!
+    std::vector<char> pending;
+    size_t pending_begin = 0;
+    size_t pending_end = 0;
+
+    uint32_t events = 0;
+    bool queued = false;    //!< On the ready queue or in a worker.
+    bool eof = false;       //!< The peer shut down its write side.
+    bool finished = false;  //!< Every hop is processed, close once the output is sent.
+    bool closed = false;
+
+    // Only touched by the I/O thread: bytes of a sample split across reads.
+    char partial[sizeof(float)] = {};
+    size_t partial_len = 0;
+};
+
+struct StreamServer::IoThread
+{
+    int epoll_fd = -1;
+    std::unordered_map<uint64_t, std::shared_ptr<Connection>> connections;
+    std::vector<char> scratch;
+    std::thread thread;
+};
+
+//!
+//! \brief Frontend of the worker: takes a hop from a ready connection, takes its stream state from the store
+//!        and switches the executor to it if needed.
+//!
+class StreamServer::ServerInputStream : public TrtInputStream
+{
+public:
+    ServerInputStream(StreamServer *server, TrtExecutor *executor)
+        : server_(server),
+          executor_(executor),
+          frontend_(server->config_.voice, server->config_.sample_rate)
+    {
+    }
+
+    infer::Dims GetDynamicDim(const char *input_name) override
+    {
+        return infer::Dims3{1, 1, static_cast<int>(frontend_.Bins())};
+    }
+
+    std::vector<std::string> GetInputTensorNames(const InferEngine &engine) override
+    {
+        return VoiceInputTensorNames(engine);
+    }
+
+    bool TryTake(const std::vector<void *> &host_buffer, const std::vector<size_t> &sizes) override
+    {
+        if (in_flight_) {
+            // The last frame failed before Consume, let the connection go on from the state it had.
+            server_->states_.Put(in_flight_->id, state_);
+            server_->Release(in_flight_);
+            in_flight_.reset();
+        }
+        if (!TakeHop()) {
+            return false;
+        }
+        assert(host_buffer.size() == sizes.size());
+        assert(frontend_.Bins() * sizeof(float) == sizes[0]);
+        TRT_TIMELINE_SCOPE("input", "frontend");
+
+        server_->states_.Take(in_flight_->id, state_);
+        if (in_flight_->id != current_id_ || state_.frame_index != frontend_.FrameIndex()) {
+            // Another stream, or this one went through another worker since.
+            executor_->RestoreState(state_);
+            current_id_ = in_flight_->id;
+        }
+        frontend_.Analyze(static_cast<float *>(host_buffer[0]));
+        return true;
+    }
+
+    size_t PendingFrames() const override
+    {
+        std::lock_guard<std::mutex> lock(server_->ready_mutex_);
+        return server_->ready_count_;
+    }
+
+    void SaveState(StreamState &state) const override
+    {
+        frontend_.SaveState(state);
+    }
+
+    void RestoreState(const StreamState &state) override
+    {
+        frontend_.RestoreState(state);
+    }
+
+    //!
+    //! \brief The connection of the frame taken, until Consume hands it back.
+    //!
+    std::shared_ptr<Connection> TakeInFlight()
+    {
+        return std::move(in_flight_);
+    }
+
+    StreamingFrontend &Frontend()
+    {
+        return frontend_;
+    }
+
+    //!
+    //! \brief The stream state of the connection in flight, handed back to the store by Consume.
+    //!
+    StreamState &State()
+    {
+        return state_;
+    }
+
+private:
+    //!
+    //! \brief Wait for a ready connection and copy its next frame out.
+    //!
+    bool TakeHop()
+    {
+        while (auto connection = server_->Pop()) {
+            std::lock_guard<std::mutex> lock(connection->mutex);
+            if (connection->closed) {
+                connection->queued = false;
+                continue;
+            }
+            const auto *samples = connection->samples.data() + connection->begin;
+            std::copy_n(samples, frontend_.FrameSize(), frontend_.Frame());
+            connection->begin += server_->hop_size_;
+            UpdateEvents(*connection);
+            in_flight_ = std::move(connection);
+            return true;
+        }
+        return false;
+    }
+
+    StreamServer *server_;
+    TrtExecutor *executor_;
+    StreamingFrontend frontend_;
+
+    std::shared_ptr<Connection> in_flight_;
+    StreamState state_;
+    uint64_t current_id_ = 0;
+};
+
+//!
+//! \brief Synthesis of the worker: snapshots the stream state back into the store and sends the hop.
+//!
+class StreamServer::ServerOutputHandler : public TrtOutputHandler
+{
+public:
+    ServerOutputHandler(StreamServer *server, TrtExecutor *executor, std::shared_ptr<ServerInputStream> input)
+        : server_(server),
+          executor_(executor),
+          input_(std::move(input)),
+          synthesis_(input_->Frontend())
+    {
+    }
+
+    std::vector<std::string> GetOutputTensorNames(const InferEngine &engine) override
+    {
+        return VoiceOutputTensorNames(engine);
+    }
+
+    void SetTensorDim(const char *output_name, const infer::Dims &dims) override
+    {
+        //
+    }
+
+    void Consume(const std::vector<void *> &host_buffer, const std::vector<size_t> &sizes) override
+    {
+        assert(host_buffer.size() == sizes.size());
+        auto connection = input_->TakeInFlight();
+        if (!connection) {
+            return;
+        }
+        const float *enhanced;
+        {
+            TRT_TIMELINE_SCOPE("output", "synthesis");
+            enhanced = synthesis_.Synthesize(static_cast<const float *>(host_buffer[0]));
+        }
+
+        // The recurrent states were fed back already, this is the state the next hop starts from.
+        auto &state = input_->State();
+        executor_->SnapshotState(state);
+        server_->state_floats_.store(state.recurrent.size(), std::memory_order_relaxed);
+        server_->states_.Put(connection->id, state);
+        server_->Emit(*connection, enhanced);
+        server_->Release(connection);
+    }
+
+    void SaveState(StreamState &state) const override
+    {
+        synthesis_.SaveState(state);
+    }
+
+    void RestoreState(const StreamState &state) override
+    {
+        synthesis_.RestoreState(state);
+    }
+
+private:
+    StreamServer *server_;
+    TrtExecutor *executor_;
+    std::shared_ptr<ServerInputStream> input_;
+    StreamingSynthesis synthesis_;
+};
+
+StreamServer::StreamServer(const StreamServerConfig &config)
+    : config_(config),
+      states_(static_cast<size_t>(std::max(1, config.resident_states)))
+{
+    frame_size_ = static_cast<int>(config_.voice.window_len * config_.sample_rate);
+    hop_size_ = static_cast<int>(config_.voice.hot_fraction * frame_size_);
+    sample_bytes_ = PcmSampleBytes(config_.format);
+}
+
+StreamServer::~StreamServer()
+{
+    Stop();
+}
+
+bool StreamServer::Start(const std::shared_ptr<MetricsRegistry> &registry)
+{
+    if (!workers_.empty()) {
+        std::cerr << "Error: stream server already running." << std::endl;
+        return false;
+    }
+    if (config_.endpoints.empty()) {
+        std::cerr << "Error: no endpoint to serve on." << std::endl;
+        return false;
+    }
+
+    engine_ = LoadInferEngine(config_.model_path);
+    if (!engine_) {
+        std::cerr << "Error: Unable to load model: " << config_.model_path << std::endl;
+        return false;
+    }
+    for (const auto &endpoint : config_.endpoints) {
+        std::string unix_path;
+        const auto fd = ListenEndpoint(endpoint, "server", unix_path, SOCK_NONBLOCK);
+        if (fd < 0) {
+            Stop();
+            return false;
+        }
+        listen_fds_.push_back(fd);
+        unix_paths_.push_back(unix_path);
+    }
+
+    const auto max_connections = std::max(1, config_.max_connections);
+    ready_.assign(max_connections, nullptr);
+    ready_head_ = 0;
+    ready_count_ = 0;
+    next_connection_id_.store(kFirstConnectionId, std::memory_order_relaxed);
+    stop_.store(false, std::memory_order_relaxed);
+    if (registry) {
+        connections_active_ = &registry->GetGauge("trt_server_connections", "Open stream server connections.");
+        connections_total_ = &registry->GetCounter("trt_server_connections_total",
+                                                   "Connections accepted by the stream server.");
+    }
+
+    for (int i = 0; i < std::max(1, config_.io_threads); ++i) {
+        std::unique_ptr<IoThread> io(new IoThread());
+        io->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (io->epoll_fd < 0) {
+            std::cerr << "Error: Unable to create epoll instance." << std::endl;
+            Stop();
+            return false;
+        }
+        for (size_t j = 0; j < listen_fds_.size(); ++j) {
+            epoll_event event = {};
+            event.events = EPOLLIN | EPOLLEXCLUSIVE;
+            event.data.u64 = j;
+            epoll_ctl(io->epoll_fd, EPOLL_CTL_ADD, listen_fds_[j], &event);
+        }
+        io->scratch.resize(kReceiveBytes);
+        io->connections.reserve(max_connections);
+        io->thread = std::thread(&StreamServer::IoLoop, this, std::ref(*io));
+        io_threads_.push_back(std::move(io));
+    }
+
+    auto workers = std::max(1, config_.workers);
+    const auto max_contexts = engine_->MaxContexts();
+    if (max_contexts > 0 && workers > max_contexts) {
+        std::cout << "Warning: the model runs " << max_contexts << " contexts at once, only " << max_contexts
+                  << " of " << workers << " workers start." << std::endl;
+        workers = max_contexts;
+    }
+    for (int i = 0; i < workers; ++i) {
+        TrtExecuteConfig executor_config;
+        executor_config.model_path = config_.model_path;
+        executor_config.frame_hop_ms = 1000.0 * hop_size_ / config_.sample_rate;
+        executor_config.stream_id = static_cast<uint32_t>(i);
+        executor_config.alloc_guard_frames = config_.alloc_guard_frames;
+        executor_config.overload = config_.overload;
+
+        std::unique_ptr<Worker> worker(new Worker());
+        worker->executor.reset(new TrtExecutor(executor_config, engine_));
+        auto input = std::make_shared<ServerInputStream>(this, worker->executor.get());
+        worker->executor->SetInputStream(input);
+        worker->executor->SetOutputHandler(std::make_shared<ServerOutputHandler>(this, worker->executor.get(), input));
+        if (registry) {
+            worker->executor->SetMetrics(registry, "worker=\"" + std::to_string(i) + "\"");
+        }
+        worker->thread = std::thread(&TrtExecutor::Process, worker->executor.get());
+        workers_.push_back(std::move(worker));
+    }
+
+    std::cout << "Info: serving enhancement on";
+    for (const auto &endpoint : config_.endpoints) {
+        std::cout << " " << endpoint;
+    }
+    std::cout << ", " << workers_.size() << " workers, " << io_threads_.size() << " I/O threads, "
+              << (config_.format == PcmFormat::kS16 ? "s16" : "f32") << " PCM at " << config_.sample_rate << " Hz."
+              << std::endl;
+    return true;
+}
+
+bool StreamServer::Reload()
+{
+    auto engine = LoadInferEngine(config_.model_path);
+    if (!engine) {
+        std::cerr << "Error: reload of " << config_.model_path << " failed, keep serving the current model."
+                  << std::endl;
+        return false;
+    }
+    // Every worker creates its context on the new engine while the old one still runs.
+    const auto max_contexts = engine->MaxContexts();
+    if (max_contexts > 0 && max_contexts < static_cast<int>(workers_.size())) {
+        std::cerr << "Error: reloaded model runs " << max_contexts << " contexts at once, fewer than the "
+                  << workers_.size() << " workers, keep serving the current model." << std::endl;
+        return false;
+    }
+    auto switching = 0;
+    for (auto &worker : workers_) {
+        switching += worker->executor->Reload(engine) ? 1 : 0;
+    }
+    engine_ = std::move(engine);
+    std::cout << "Info: model reloaded from " << config_.model_path << ", " << switching << " of " << workers_.size()
+              << " workers switch at their next frame." << std::endl;
+    return true;
+}
+
+void StreamServer::Stop()
+{
+    stop_.store(true, std::memory_order_relaxed);
+    ready_cond_.notify_all();
+    for (auto &worker : workers_) {
+        worker->executor->Terminate();
+    }
+    for (auto &io : io_threads_) {
+        if (io->thread.joinable()) {
+            io->thread.join();
+        }
+        if (io->epoll_fd >= 0) {
+            close(io->epoll_fd);
+        }
+    }
+    for (auto &worker : workers_) {
+        if (worker->thread.joinable()) {
+            worker->thread.join();
+        }
+    }
+    // Executors go first, their streams may still hold a connection.
+    workers_.clear();
+    io_threads_.clear();
+    for (auto &connection : ready_) {
+        connection.reset();
+    }
+    ready_count_ = 0;
+
+    for (auto fd : listen_fds_) {
+        close(fd);
+    }
+    listen_fds_.clear();
+    for (const auto &path : unix_paths_) {
+        if (!path.empty()) {
+            unlink(path.c_str());
+        }
+    }
+    unix_paths_.clear();
+}
+
+void StreamServer::IoLoop(IoThread &io)
+{
+    Timeline::SetThreadName("server_io");
+    epoll_event events[kMaxEvents];
+    while (!stop_.load(std::memory_order_relaxed)) {
+        const auto count = epoll_wait(io.epoll_fd, events, kMaxEvents, kPollMs);
+        for (int i = 0; i < count; ++i) {
+            const auto token = events[i].data.u64;
+            if (token < listen_fds_.size()) {
+                Accept(io, listen_fds_[token]);
+                continue;
+            }
+            const auto it = io.connections.find(token);
+            if (it == io.connections.end()) {
+                continue;
+            }
+            // A copy, Close() drops the map entry.
+            const auto connection = it->second;
+            if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                Close(io, connection);
+                continue;
+            }
+            if (events[i].events & EPOLLIN) {
+                Receive(io, connection);
+            }
+            if (events[i].events & EPOLLOUT) {
+                Flush(io, connection);
+            }
+        }
+    }
+
+    for (auto &entry : io.connections) {
+        std::lock_guard<std::mutex> lock(entry.second->mutex);
+        entry.second->closed = true;
+        shutdown(entry.second->fd, SHUT_RDWR);
+    }
+    io.connections.clear();
+}
+
+void StreamServer::Accept(IoThread &io, int listen_fd)
+{
+    for (;;) {
+        const auto fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            // Drained, or another I/O thread took it.
+            return;
+        }
+        // Counted until the last reference is gone, which bounds what the ready queue holds.
+        if (connection_count_.fetch_add(1) >= static_cast<int>(ready_.size())) {
+            --connection_count_;
+            std::cout << "Warning: stream server at its connection limit, connection refused." << std::endl;
+            close(fd);
+            continue;
+        }
+        const int no_delay = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+
+        auto connection = std::make_shared<Connection>(this, fd, next_connection_id_++, io.epoll_fd);
+        const auto history = static_cast<size_t>(frame_size_ - hop_size_);
+        const auto buffered = static_cast<size_t>(std::max(2, config_.buffer_hops)) * hop_size_;
+        connection->input_limit = history + buffered;
+        connection->samples.assign(connection->input_limit + 2 * hop_size_, 0.f);
+        connection->end = history;
+        connection->pending.resize(buffered * sample_bytes_);
+        // So that snapshots into its state do not allocate on the frame path either.
+        StreamState state;
+        const auto bins = audiofft::AudioFFT::ComplexSize(config_.voice.dft_size);
+        state.Reserve(state_floats_.load(std::memory_order_relaxed), bins, hop_size_,
+                      config_.overload.enabled ? bins : 0);
+        states_.Add(connection->id, std::move(state));
+        if (connections_active_) {
+            connections_active_->Add(1);
+            connections_total_->Add();
+        }
+
+        epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.u64 = connection->id;
+        connection->events = event.events;
+        if (epoll_ctl(io.epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+            std::cerr << "Error: Unable to watch connection " << connection->id << "." << std::endl;
+            continue;
+        }
+        io.connections.emplace(connection->id, std::move(connection));
+    }
+}
+
+void StreamServer::Receive(IoThread &io, const std::shared_ptr<Connection> &connection)
+{
+    auto &c = *connection;
+    size_t room = 0;
+    {
+        std::lock_guard<std::mutex> lock(c.mutex);
+        if (c.closed) {
+            return;
+        }
+        if (c.begin > 0) {
+            std::copy(c.samples.begin() + c.begin, c.samples.begin() + c.end, c.samples.begin());
+            c.end -= c.begin;
+            c.begin = 0;
+        }
+        room = c.input_limit - c.end;
+        if (room == 0) {
+            // Full, UpdateEvents stops reading until a worker takes a hop.
+            UpdateEvents(c);
+            return;
+        }
+    }
+
+    auto *buffer = io.scratch.data();
+    memcpy(buffer, c.partial, c.partial_len);
+    const auto want = std::min(room * sample_bytes_, io.scratch.size()) - c.partial_len;
+    const auto n = recv(c.fd, buffer + c.partial_len, want, 0);
+    if (n < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            Close(io, connection);
+        }
+        return;
+    }
+
+    bool ready = false;
+    {
+        std::lock_guard<std::mutex> lock(c.mutex);
+        if (n == 0) {
+            // Zero pad the partial last hop, plus one hop for the overlap-add tail, like the file pipeline.
+            c.eof = true;
+            const auto buffered = c.end - c.begin - (frame_size_ - hop_size_);
+            const auto pad = (hop_size_ - buffered % hop_size_) % hop_size_ + hop_size_;
+            std::fill_n(c.samples.begin() + c.end, pad, 0.f);
+            c.end += pad;
+            c.partial_len = 0;
+        } else {
+            const auto total = c.partial_len + static_cast<size_t>(n);
+            const auto count = total / sample_bytes_;
+            DecodePcm(config_.format, buffer, count, c.samples.data() + c.end);
+            c.end += count;
+            c.partial_len = total - count * sample_bytes_;
+            memcpy(c.partial, buffer + count * sample_bytes_, c.partial_len);
+        }
+        ready = MarkReady(c);
+        UpdateEvents(c);
+    }
+    if (ready) {
+        Push(connection);
+    }
+}
+
+void StreamServer::Flush(IoThread &io, const std::shared_ptr<Connection> &connection)
+{
+    auto &c = *connection;
+    auto failed = false;
+    auto done = false;
+    auto ready = false;
+    {
+        std::lock_guard<std::mutex> lock(c.mutex);
+        if (c.closed) {
+            return;
+        }
+        if (c.pending_end > c.pending_begin) {
+            const auto n = send(c.fd, c.pending.data() + c.pending_begin, c.pending_end - c.pending_begin,
+                                MSG_NOSIGNAL | MSG_DONTWAIT);
+            if (n > 0) {
+                c.pending_begin += static_cast<size_t>(n);
+            } else if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                failed = true;
+            }
+            if (c.pending_begin == c.pending_end) {
+                c.pending_begin = c.pending_end = 0;
+            }
+        }
+        done = c.finished && c.pending_begin == c.pending_end;
+        ready = MarkReady(c);
+        UpdateEvents(c);
+    }
+    if (failed || done) {
+        Close(io, connection);
+    } else if (ready) {
+        Push(connection);
+    }
+}
+
+void StreamServer::Close(IoThread &io, const std::shared_ptr<Connection> &connection)
+{
+    {
+        std::lock_guard<std::mutex> lock(connection->mutex);
+        if (connection->closed) {
+            return;
+        }
+        connection->closed = true;
+    }
+    epoll_ctl(io.epoll_fd, EPOLL_CTL_DEL, connection->fd, nullptr);
+    // The descriptor itself is closed with the last reference, a worker may still hold one.
+    shutdown(connection->fd, SHUT_RDWR);
+    io.connections.erase(connection->id);
+}
+
+bool StreamServer::MarkReady(Connection &connection) const
+{
+    const auto hop_bytes = hop_size_ * sample_bytes_;
+    if (connection.queued || connection.closed ||
+        connection.end - connection.begin < static_cast<size_t>(frame_size_) ||
+        connection.pending.size() - (connection.pending_end - connection.pending_begin) < hop_bytes) {
+        return false;
+    }
+    connection.queued = true;
+    return true;
+}
+
+void StreamServer::UpdateEvents(Connection &connection)
+{
+    if (connection.closed) {
+        return;
+    }
+    uint32_t events = 0;
+    if (!connection.eof && connection.end - connection.begin < connection.input_limit) {
+        events |= EPOLLIN;
+    }
+    if (connection.pending_end > connection.pending_begin || connection.finished) {
+        events |= EPOLLOUT;
+    }
+    if (events != connection.events) {
+        epoll_event event = {};
+        event.events = events;
+        event.data.u64 = connection.id;
+        epoll_ctl(connection.epoll_fd, EPOLL_CTL_MOD, connection.fd, &event);
+        connection.events = events;
+    }
+}
+
+void StreamServer::Push(std::shared_ptr<Connection> connection)
+{
+    {
+        std::lock_guard<std::mutex> lock(ready_mutex_);
+        assert(ready_count_ < ready_.size());
+        ready_[(ready_head_ + ready_count_) % ready_.size()] = std::move(connection);
+        ++ready_count_;
+    }
+    ready_cond_.notify_one();
+}
+
+std::shared_ptr<StreamServer::Connection> StreamServer::Pop()
+{
+    std::unique_lock<std::mutex> lock(ready_mutex_);
+    ready_cond_.wait_for(lock, std::chrono::milliseconds(kPollMs),
+                         [this]() { return ready_count_ > 0 || stop_.load(std::memory_order_relaxed); });
+    if (ready_count_ == 0) {
+        return nullptr;
+    }
+    auto connection = std::move(ready_[ready_head_]);
+    ready_head_ = (ready_head_ + 1) % ready_.size();
+    --ready_count_;
+    return connection;
+}
+
+void StreamServer::Emit(Connection &connection, const float *samples)
+{
+    std::lock_guard<std::mutex> lock(connection.mutex);
+    if (connection.closed) {
+        return;
+    }
+    const auto hop_bytes = hop_size_ * sample_bytes_;
+    if (connection.pending.size() - connection.pending_end < hop_bytes) {
+        std::copy(connection.pending.begin() + connection.pending_begin,
+                  connection.pending.begin() + connection.pending_end, connection.pending.begin());
+        connection.pending_end -= connection.pending_begin;
+        connection.pending_begin = 0;
+    }
+    const auto was_empty = connection.pending_begin == connection.pending_end;
+    EncodePcm(config_.format, samples, hop_size_, connection.pending.data() + connection.pending_end);
+    connection.pending_end += hop_bytes;
+    if (!was_empty) {
+        // Queued behind earlier output, the I/O thread sends it when the socket drains.
+        return;
+    }
+
+    const auto n = send(connection.fd, connection.pending.data() + connection.pending_begin, hop_bytes,
+                        MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (n > 0) {
+        connection.pending_begin += static_cast<size_t>(n);
+    }
+    if (connection.pending_begin == connection.pending_end) {
+        connection.pending_begin = connection.pending_end = 0;
+    }
+}
+
+void StreamServer::Release(const std::shared_ptr<Connection> &connection)
+{
+    auto ready = false;
+    {
+        std::lock_guard<std::mutex> lock(connection->mutex);
+        connection->queued = false;
+        if (connection->eof && connection->end - connection->begin < static_cast<size_t>(frame_size_)) {
+            connection->finished = true;
+        }
+        ready = MarkReady(*connection);
+        UpdateEvents(*connection);
+    }
+    if (ready) {
+        Push(connection);
+    }
+}
@@ -0,0 +1,165 @@
+// StreamServer.h: Long-running enhancement server streaming raw PCM over Unix or TCP sockets
+//
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Metrics.h"
+#include "PcmStream.h"
+#include "StreamState.h"
+#include "VoiceStream.h"
+
+
+struct StreamServerConfig
+{
+    std::string model_path;
+    std::vector<std::string> endpoints;     //!< "unix:/path" or "[host:]port", TCP binds 127.0.0.1 by default.
+    int workers = 1;                //!< Executors sharing the engine, each with its own context, capped at MaxContexts.
+    int io_threads = 1;
+    int max_connections = 256;
+    int resident_states = 64;       //!< Stream states kept resident, the least recently used idle ones beyond.
+    PcmFormat format = PcmFormat::kS16;
+    int sample_rate = 16000;
+    int buffer_hops = 50;           //!< Input and output buffered per connection before the peer is throttled.
+    int alloc_guard_frames = -1;    //!< Passed to the worker executors, see TrtExecuteConfig.
+    OverloadConfig overload;        //!< Per worker; each connection reuses only its own mask.
+    VoiceFileInputConfig voice;
+};
+
+//!
+//! \brief Serves the enhancement to many concurrent streams from one warm process.
+//!
+//! \details A client connects and writes mono PCM at config.sample_rate in config.format. For every hop of
+//!          samples received (10 ms) it reads one hop of enhanced samples back, one hop late like the file
+//!          pipeline. After the client shuts down its write side the partial last hop is zero padded, the
+//!          remaining output is sent and the server closes the connection, so the output has exactly as
+//!          many hops as the file pipeline writes for the same input.
+//!
+//!          I/O threads each run an epoll loop over their share of the connections (the listening sockets
+//!          are in every loop, accepts are spread by EPOLLEXCLUSIVE). A connection with a full hop is put
+//!          on a ready queue. Workers each run a TrtExecutor on its own context of one shared engine; a
+//!          worker takes a connection, restores its stream state (recurrent state, normalization, overlap)
+//!          into the executor unless it still holds it, processes the hop and snapshots the state back, so
+//!          any number of streams multiplex over the workers. A connection is on the queue or in a worker
+//!          at most once at a time, which keeps its hops in order. The states live in a StreamStateStore:
+//!          beyond config.resident_states, those of the connections idle the longest are serialized.
+//!
+//!          Connection buffers and stream state are sized when it is accepted: once full the server stops reading from it,
+//!          and stops processing it while its output is not read, so a slow peer is throttled by the socket
+//!          flow control instead of growing buffers. Past the first frame of each stream the frame path
+//!          does not allocate, unless it brings back an evicted state.
+//!
+class StreamServer
+{
+public:
+    explicit StreamServer(const StreamServerConfig &config);
+
+    ~StreamServer();
+
+    //!
+    //! \brief Load the engine, listen on the endpoints and start the threads. With a registry the workers
+    //!        publish their executor metrics labelled worker="i", plus the connection counts.
+    //!        Returns false if the engine cannot be loaded or an endpoint cannot be listened on.
+    //!
+    bool Start(const std::shared_ptr<MetricsRegistry> &registry = nullptr);
+
+    //!
+    //! \brief Load config.model_path again, e.g. after it was replaced, and switch every worker to it at its next
+    //!        frame. Connections keep their stream state if the state bindings did not change, otherwise they
+    //!        restart. Returns false, the workers keeping the running model, if it cannot be loaded; a worker
+    //!        still switching from the previous reload keeps that one.
+    //!
+    bool Reload();
+
+    //!
+    //! \brief Close the listeners and all connections and join the threads.
+    //!
+    void Stop();
+
+private:
+    struct Connection;
+    class ServerInputStream;
+    class ServerOutputHandler;
+
+    struct Worker
+    {
+        std::unique_ptr<TrtExecutor> executor;
+        std::thread thread;
+    };
+
+    struct IoThread;
+
+    void IoLoop(IoThread &io);
+
+    void Accept(IoThread &io, int listen_fd);
+
+    void Receive(IoThread &io, const std::shared_ptr<Connection> &connection);
+
+    void Flush(IoThread &io, const std::shared_ptr<Connection> &connection);
+
+    void Close(IoThread &io, const std::shared_ptr<Connection> &connection);
+
+    //!
+    //! \brief Queue the connection if it has a hop to process, room for its output and is not queued yet.
+    //!        Called with its mutex held, returns true if the caller must Push it once released.
+    //!
+    bool MarkReady(Connection &connection) const;
+
+    static void UpdateEvents(Connection &connection);
+
+    void Push(std::shared_ptr<Connection> connection);
+
+    //!
+    //! \brief Returns nullptr if nothing got ready within the poll interval.
+    //!
+    std::shared_ptr<Connection> Pop();
+
+    //!
+    //! \brief Encode a hop of enhanced samples into the output of connection and send what the socket takes.
+    //!
+    void Emit(Connection &connection, const float *samples);
+
+    //!
+    //! \brief Hand a connection back after its hop, queueing it again if another hop is ready.
+    //!
+    void Release(const std::shared_ptr<Connection> &connection);
+
+    StreamServerConfig config_;
+    int hop_size_ = 0;
+    int frame_size_ = 0;
+    size_t sample_bytes_ = 0;
+
+    std::shared_ptr<InferEngine> engine_;
+
+    std::vector<int> listen_fds_;
+    std::vector<std::string> unix_paths_;
+
+    std::vector<std::unique_ptr<IoThread>> io_threads_;
+    std::vector<std::unique_ptr<Worker>> workers_;
+
+    //!
+    //! \brief Connections with a hop to process, a ring as deep as the connection limit.
+    //!
+    std::mutex ready_mutex_;
+    std::condition_variable ready_cond_;
+    std::vector<std::shared_ptr<Connection>> ready_;
+    size_t ready_head_ = 0;
+    size_t ready_count_ = 0;
+
+    std::atomic<size_t> state_floats_{0};   //!< Recurrent state size, to size the state of new connections.
+    StreamStateStore states_;
+    std::atomic<int> connection_count_{0};
+    std::atomic<uint64_t> next_connection_id_{0};
+    Gauge *connections_active_ = nullptr;
+    Counter *connections_total_ = nullptr;
+
+    std::atomic<bool> stop_{false};
+};
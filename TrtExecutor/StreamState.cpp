@@ -0,0 +1,281 @@
+// StreamState.cpp: Impl
+//
+
+#include "StreamState.h"
+
+#include <cassert>
+#include <cstring>
+#include <iostream>
+#include <utility>
+
+
+namespace {
+
+constexpr uint32_t kStateMagic = 0x31535354;   // "TSS1"
+constexpr uint32_t kStateVersion = 2;
+
+struct StateHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    int64_t frame_index;
+    uint32_t recurrent_count;
+    uint32_t mu_count;
+    uint32_t sigma_square_count;
+    uint32_t overlap_count;
+    uint32_t mask_count;
+    int32_t mask_age;
+};
+
+template <typename T>
+char *WriteArray(char *dst, const std::vector<T> &src)
+{
+    const auto bytes = src.size() * sizeof(T);
+    if (bytes) {
+        memcpy(dst, src.data(), bytes);
+    }
+    return dst + bytes;
+}
+
+template <typename T>
+const char *ReadArray(const char *src, uint32_t count, std::vector<T> &dst)
+{
+    dst.resize(count);
+    const auto bytes = count * sizeof(T);
+    if (bytes) {
+        memcpy(dst.data(), src, bytes);
+    }
+    return src + bytes;
+}
+
+}
+
+void StreamState::Clear()
+{
+    frame_index = -1;
+    recurrent.clear();
+    mu.clear();
+    sigma_square.clear();
+    overlap.clear();
+    mask.clear();
+    mask_age = -1;
+}
+
+size_t StreamState::SerializedSize() const
+{
+    return sizeof(StateHeader) + recurrent.size() * sizeof(float) + mu.size() * sizeof(double) +
+           sigma_square.size() * sizeof(double) + overlap.size() * sizeof(float) + mask.size() * sizeof(float);
+}
+
+void StreamState::SerializeTo(std::vector<char> &out) const
+{
+    out.resize(SerializedSize());
+
+    StateHeader header{};
+    header.magic = kStateMagic;
+    header.version = kStateVersion;
+    header.frame_index = frame_index;
+    header.recurrent_count = static_cast<uint32_t>(recurrent.size());
+    header.mu_count = static_cast<uint32_t>(mu.size());
+    header.sigma_square_count = static_cast<uint32_t>(sigma_square.size());
+    header.overlap_count = static_cast<uint32_t>(overlap.size());
+    header.mask_count = static_cast<uint32_t>(mask.size());
+    header.mask_age = mask_age;
+
+    char *ptr = out.data();
+    memcpy(ptr, &header, sizeof(header));
+    ptr += sizeof(header);
+    ptr = WriteArray(ptr, recurrent);
+    ptr = WriteArray(ptr, mu);
+    ptr = WriteArray(ptr, sigma_square);
+    ptr = WriteArray(ptr, overlap);
+    ptr = WriteArray(ptr, mask);
+    assert(ptr == out.data() + out.size());
+}
+
+bool StreamState::DeserializeFrom(const char *data, size_t len)
+{
+    if (len < sizeof(StateHeader)) {
+        return false;
+    }
+
+    StateHeader header{};
+    memcpy(&header, data, sizeof(header));
+    if (header.magic != kStateMagic || header.version != kStateVersion) {
+        return false;
+    }
+    const auto expect = sizeof(StateHeader) + header.recurrent_count * sizeof(float) +
+                        header.mu_count * sizeof(double) + header.sigma_square_count * sizeof(double) +
+                        header.overlap_count * sizeof(float) + header.mask_count * sizeof(float);
+    if (len != expect) {
+        return false;
+    }
+
+    frame_index = header.frame_index;
+    const char *ptr = data + sizeof(header);
+    ptr = ReadArray(ptr, header.recurrent_count, recurrent);
+    ptr = ReadArray(ptr, header.mu_count, mu);
+    ptr = ReadArray(ptr, header.sigma_square_count, sigma_square);
+    ptr = ReadArray(ptr, header.overlap_count, overlap);
+    ReadArray(ptr, header.mask_count, mask);
+    mask_age = header.mask_age;
+    return true;
+}
+
+void StreamState::Reserve(size_t recurrent_count, size_t bins, size_t overlap_count, size_t mask_count)
+{
+    recurrent.reserve(recurrent_count);
+    mu.reserve(bins);
+    sigma_square.reserve(bins);
+    overlap.reserve(overlap_count);
+    mask.reserve(mask_count);
+}
+
+StreamStateStore::StreamStateStore(size_t resident_capacity) : resident_capacity_(resident_capacity)
+{
+}
+
+void StreamStateStore::Add(uint64_t stream_id, StreamState state)
+{
+    assert(stream_id != kNoStream);
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(stream_id);
+    if (it == entries_.end()) {
+        it = entries_.emplace(stream_id, Entry()).first;
+        ++resident_count_;
+    } else {
+        auto &entry = it->second;
+        assert(!entry.taken);
+        if (entry.resident) {
+            UnlinkIdle(entry);
+        } else {
+            entry.blob = std::vector<char>();
+            entry.resident = true;
+            ++resident_count_;
+        }
+    }
+
+    auto &entry = it->second;
+    entry.state = std::move(state);
+    PushIdle(stream_id, entry);
+    EvictOverCapacity();
+}
+
+void StreamStateStore::Take(uint64_t stream_id, StreamState &state)
+{
+    assert(stream_id != kNoStream);
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(stream_id);
+    if (it == entries_.end()) {
+        state.Clear();
+        auto &entry = entries_[stream_id];
+        entry.taken = true;
+        ++resident_count_;
+        return;
+    }
+
+    auto &entry = it->second;
+    assert(!entry.taken);
+    if (entry.resident) {
+        UnlinkIdle(entry);
+        std::swap(entry.state, state);
+    } else {
+        if (!state.DeserializeFrom(entry.blob.data(), entry.blob.size())) {
+            // Not to go on from whatever state held before, the stream starts over instead.
+            std::cout << "Warning: evicted state of stream " << stream_id << " is corrupt, the stream is reset."
+                      << std::endl;
+            state.Clear();
+        }
+        entry.blob = std::vector<char>();
+        entry.resident = true;
+        ++resident_count_;
+    }
+    entry.taken = true;
+}
+
+void StreamStateStore::Put(uint64_t stream_id, StreamState &state)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(stream_id);
+    if (it == entries_.end()) {
+        return;
+    }
+
+    auto &entry = it->second;
+    assert(entry.taken);
+    std::swap(entry.state, state);
+    entry.taken = false;
+    PushIdle(stream_id, entry);
+    EvictOverCapacity();
+}
+
+void StreamStateStore::Remove(uint64_t stream_id)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(stream_id);
+    if (it == entries_.end()) {
+        return;
+    }
+
+    auto &entry = it->second;
+    if (entry.resident) {
+        if (!entry.taken) {
+            UnlinkIdle(entry);
+        }
+        --resident_count_;
+    }
+    entries_.erase(it);
+}
+
+size_t StreamStateStore::ResidentCount() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return resident_count_;
+}
+
+uint64_t StreamStateStore::EvictionCount() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return evictions_;
+}
+
+void StreamStateStore::PushIdle(uint64_t stream_id, Entry &entry)
+{
+    entry.idle_prev = kNoStream;
+    entry.idle_next = idle_head_;
+    if (idle_head_ != kNoStream) {
+        entries_.at(idle_head_).idle_prev = stream_id;
+    } else {
+        idle_tail_ = stream_id;
+    }
+    idle_head_ = stream_id;
+}
+
+void StreamStateStore::UnlinkIdle(Entry &entry)
+{
+    if (entry.idle_prev != kNoStream) {
+        entries_.at(entry.idle_prev).idle_next = entry.idle_next;
+    } else {
+        idle_head_ = entry.idle_next;
+    }
+    if (entry.idle_next != kNoStream) {
+        entries_.at(entry.idle_next).idle_prev = entry.idle_prev;
+    } else {
+        idle_tail_ = entry.idle_prev;
+    }
+    entry.idle_prev = kNoStream;
+    entry.idle_next = kNoStream;
+}
+
+void StreamStateStore::EvictOverCapacity()
+{
+    while (resident_count_ > resident_capacity_ && idle_tail_ != kNoStream) {
+        auto &victim = entries_.at(idle_tail_);
+        UnlinkIdle(victim);
+        victim.state.SerializeTo(victim.blob);
+        victim.state = StreamState();
+        victim.resident = false;
+        --resident_count_;
+        ++evictions_;
+    }
+}
@@ -0,0 +1,129 @@
+// StreamState.h: Per-stream recurrent and normalization state
+//
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <limits>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+
+//!
+//! \brief All the state one audio stream carries from frame to frame.
+//!
+//! \details The recurrent part is the packed content of the executor's state input bindings (GRU hidden
+//!          states) in binding order, those of the main model then those of the added ones in AddModel
+//!          order. The normalization part is the online MVN accumulators of the input stream, and the
+//!          overlap part is the overlap-add tail of the output handler. The mask is the last mask of the
+//!          stream, which the overload protection reuses instead of running inference.
+//!          Snapshot and restore only copy into vectors that keep their capacity, so after the first
+//!          round trip of a stream they do not allocate.
+//!
+struct StreamState
+{
+    int64_t frame_index = -1;
+    std::vector<float> recurrent;
+    std::vector<double> mu;
+    std::vector<double> sigma_square;
+    std::vector<float> overlap;
+    std::vector<float> mask;        //!< Empty if the stream has none yet.
+    int32_t mask_age = -1;          //!< Frames since the mask was inferred.
+
+    void Clear();
+
+    //!
+    //! \brief Returns the size in bytes of the serialized form.
+    //!
+    size_t SerializedSize() const;
+
+    //!
+    //! \brief Serialize into \p out, replacing its content. The layout is a fixed header followed by the
+    //!        raw arrays in host byte order, so it is only meant to move between processes of one host
+    //!        architecture.
+    //!
+    void SerializeTo(std::vector<char> &out) const;
+
+    //!
+    //! \brief Restore from a blob produced by SerializeTo. Returns false if the blob is malformed.
+    //!
+    bool DeserializeFrom(const char *data, size_t len);
+
+    //!
+    //! \brief Reserve room for the given element counts, so snapshots into the state do not allocate.
+    //!
+    void Reserve(size_t recurrent_count, size_t bins, size_t overlap_count, size_t mask_count);
+};
+
+//!
+//! \brief The states of many streams, of which only a bounded number stay resident.
+//!
+//! \details A stream is taken while a worker processes it and idle otherwise. Once more than
+//!          \p resident_capacity states are resident, the least recently used idle one is evicted: serialized
+//!          into a compact blob and its vectors released. Taking an evicted stream deserializes it again.
+//!          Resident states are swapped in and out and the LRU order is linked through the entries, so only
+//!          added, new and evicted streams allocate. Stream id ~0 is reserved. Thread-safe.
+//!
+class StreamStateStore
+{
+public:
+    explicit StreamStateStore(size_t resident_capacity);
+
+    //!
+    //! \brief Register \p stream_id with \p state as its state, typically a cleared one with buffers reserved,
+    //!        so the first hops of the stream do not allocate. Replaces the state of a known idle stream.
+    //!
+    void Add(uint64_t stream_id, StreamState state);
+
+    //!
+    //! \brief Move the state of \p stream_id into \p state, which must be handed back by Put. A stream seen
+    //!        for the first time, or whose evicted blob does not deserialize, gets a cleared state.
+    //!
+    void Take(uint64_t stream_id, StreamState &state);
+
+    //!
+    //! \brief Hand back the state of a taken stream, now its most recently used, and evict over capacity.
+    //!        \p state gets buffers to reuse. Dropped if the stream was removed meanwhile.
+    //!
+    void Put(uint64_t stream_id, StreamState &state);
+
+    void Remove(uint64_t stream_id);
+
+    size_t ResidentCount() const;
+
+    uint64_t EvictionCount() const;
+
+private:
+    static constexpr uint64_t kNoStream = std::numeric_limits<uint64_t>::max();
+
+    struct Entry
+    {
+        StreamState state;
+        std::vector<char> blob;     //!< The serialized state while evicted.
+        uint64_t idle_prev = kNoStream;     //!< The idle stream used more recently, while idle.
+        uint64_t idle_next = kNoStream;     //!< The idle stream used less recently, while idle.
+        bool taken = false;
+        bool resident = true;
+    };
+
+    //!
+    //! \brief Link \p entry of \p stream_id in front of the idle streams.
+    //!
+    void PushIdle(uint64_t stream_id, Entry &entry);
+
+    void UnlinkIdle(Entry &entry);
+
+    void EvictOverCapacity();
+
+    const size_t resident_capacity_;
+    mutable std::mutex mutex_;
+    size_t resident_count_ = 0;
+    uint64_t evictions_ = 0;
+
+    // Resident idle streams, a list linked through their entries from the most recently used.
+    uint64_t idle_head_ = kNoStream;
+    uint64_t idle_tail_ = kNoStream;
+    std::unordered_map<uint64_t, Entry> entries_;
+};
@@ -0,0 +1,282 @@
+// TensorTrace.cpp: Impl
+//
+
+#include "TensorTrace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+namespace {
+
+size_t AlignTrace(size_t bytes)
+{
+    return (bytes + trace::kAlignment - 1) / trace::kAlignment * trace::kAlignment;
+}
+
+int64_t NowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool MatchSizes(const std::vector<trace::Tensor> &tensors, const std::vector<void *> &buffers,
+                const std::vector<size_t> &sizes)
+{
+    if (tensors.size() != buffers.size() || tensors.size() != sizes.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < tensors.size(); ++i) {
+        if (tensors[i].bytes != sizes[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+}
+
+TensorTraceWriter::TensorTraceWriter(const std::string &path, bool with_outputs)
+    : path_(path),
+      with_outputs_(with_outputs)
+{
+}
+
+TensorTraceWriter::~TensorTraceWriter()
+{
+    Close();
+}
+
+bool TensorTraceWriter::Begin(std::vector<trace::Tensor> inputs, std::vector<trace::Tensor> outputs)
+{
+    Close();
+    inputs_ = std::move(inputs);
+    outputs_ = std::move(outputs);
+
+    // Timestamp slot first, then every tensor on its own 64-byte boundary.
+    size_t offset = trace::kAlignment;
+    for (auto &tensor : inputs_) {
+        tensor.offset = offset;
+        offset += AlignTrace(tensor.bytes);
+    }
+    for (auto &tensor : outputs_) {
+        tensor.offset = with_outputs_ ? offset : 0;
+        offset += with_outputs_ ? AlignTrace(tensor.bytes) : 0;
+    }
+    frame_bytes_ = offset;
+    data_offset_ = AlignTrace(sizeof(trace::FileHeader) + (inputs_.size() + outputs_.size()) * sizeof(trace::TensorDesc));
+    frame_count_ = 0;
+    capacity_ = 0;
+    frame_open_ = false;
+    layout_warned_ = false;
+
+    fd_ = open(path_.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd_ < 0) {
+        std::cerr << "Error: Unable to create trace file: " << path_ << std::endl;
+        return false;
+    }
+    if (!Reserve(256)) {
+        Close();
+        return false;
+    }
+
+    auto *header = reinterpret_cast<trace::FileHeader *>(map_);
+    header->magic = trace::kMagic;
+    header->version = trace::kVersion;
+    header->input_count = static_cast<uint32_t>(inputs_.size());
+    header->output_count = static_cast<uint32_t>(outputs_.size());
+    header->has_outputs = with_outputs_ ? 1 : 0;
+    header->frame_bytes = frame_bytes_;
+    header->data_offset = data_offset_;
+    auto *desc = reinterpret_cast<trace::TensorDesc *>(map_ + sizeof(trace::FileHeader));
+    for (const auto *tensors : {&inputs_, &outputs_}) {
+        for (const auto &tensor : *tensors) {
+            strncpy(desc->name, tensor.name.c_str(), trace::kNameSize - 1);
+            desc->nb_dims = tensor.dims.nbDims;
+            std::copy_n(tensor.dims.d, std::min(tensor.dims.nbDims, 8), desc->dims);
+            desc->bytes = tensor.bytes;
+            desc->offset = tensor.offset;
+            ++desc;
+        }
+    }
+    std::cout << "Info: recording tensor trace to " << path_ << ", " << frame_bytes_ << " bytes per frame." << std::endl;
+    return true;
+}
+
+bool TensorTraceWriter::Reserve(uint64_t frames)
+{
+    if (frames <= capacity_) {
+        return true;
+    }
+
+    const auto new_capacity = std::max<uint64_t>(frames, capacity_ * 2);
+    const auto new_size = static_cast<size_t>(data_offset_ + new_capacity * frame_bytes_);
+    if (map_) {
+        munmap(map_, map_size_);
+        map_ = nullptr;
+    }
+    if (ftruncate(fd_, static_cast<off_t>(new_size)) != 0) {
+        std::cerr << "Error: Unable to grow trace file: " << path_ << std::endl;
+        return false;
+    }
+    auto *map = mmap(nullptr, new_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if (map == MAP_FAILED) {
+        std::cerr << "Error: Unable to map trace file: " << path_ << std::endl;
+        return false;
+    }
+    map_ = static_cast<char *>(map);
+    map_size_ = new_size;
+    capacity_ = new_capacity;
+    return true;
+}
+
+char *TensorTraceWriter::Frame(uint64_t index) const
+{
+    return map_ + data_offset_ + index * frame_bytes_;
+}
+
+void TensorTraceWriter::WriteInputs(const std::vector<void *> &buffers, const std::vector<size_t> &sizes)
+{
+    frame_open_ = false;
+    if (fd_ < 0) {
+        return;
+    }
+    if (!MatchSizes(inputs_, buffers, sizes)) {
+        if (!layout_warned_) {
+            std::cout << "Warning: input tensors changed layout, frames are not recorded anymore." << std::endl;
+            layout_warned_ = true;
+        }
+        return;
+    }
+    if (!Reserve(frame_count_ + 1)) {
+        Close();
+        return;
+    }
+
+    const auto now = NowNs();
+    if (frame_count_ == 0) {
+        start_ns_ = now;
+    }
+    auto *frame = Frame(frame_count_);
+    const auto timestamp = static_cast<uint64_t>(now - start_ns_);
+    memcpy(frame, &timestamp, sizeof(timestamp));
+    for (size_t i = 0; i < inputs_.size(); ++i) {
+        memcpy(frame + inputs_[i].offset, buffers[i], inputs_[i].bytes);
+    }
+    ++frame_count_;
+    frame_open_ = true;
+}
+
+void TensorTraceWriter::WriteOutputs(const std::vector<void *> &buffers, const std::vector<size_t> &sizes)
+{
+    if (!frame_open_ || !with_outputs_) {
+        return;
+    }
+    frame_open_ = false;
+    if (!MatchSizes(outputs_, buffers, sizes)) {
+        // Left zero, as the file grew.
+        return;
+    }
+    auto *frame = Frame(frame_count_ - 1);
+    for (size_t i = 0; i < outputs_.size(); ++i) {
+        memcpy(frame + outputs_[i].offset, buffers[i], outputs_[i].bytes);
+    }
+}
+
+void TensorTraceWriter::Close()
+{
+    if (fd_ < 0) {
+        return;
+    }
+
+    const auto size = static_cast<size_t>(data_offset_ + frame_count_ * frame_bytes_);
+    if (map_) {
+        reinterpret_cast<trace::FileHeader *>(map_)->frame_count = frame_count_;
+        munmap(map_, map_size_);
+        map_ = nullptr;
+    }
+    if (ftruncate(fd_, static_cast<off_t>(size)) != 0) {
+        std::cout << "Warning: Unable to trim trace file: " << path_ << std::endl;
+    }
+    ::close(fd_);
+    fd_ = -1;
+    std::cout << "Info: recorded " << frame_count_ << " frames to " << path_ << std::endl;
+}
+
+TensorTraceReader::~TensorTraceReader()
+{
+    if (map_) {
+        munmap(map_, map_size_);
+    }
+}
+
+bool TensorTraceReader::Open(const std::string &path)
+{
+    const auto fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Error: Unable to open trace file: " << path << std::endl;
+        return false;
+    }
+    struct stat st = {};
+    fstat(fd, &st);
+    map_size_ = static_cast<size_t>(st.st_size);
+    auto *map = map_size_ >= sizeof(trace::FileHeader) ? mmap(nullptr, map_size_, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        std::cerr << "Error: Unable to map trace file: " << path << std::endl;
+        map_size_ = 0;
+        return false;
+    }
+    map_ = static_cast<char *>(map);
+
+    const auto *header = reinterpret_cast<const trace::FileHeader *>(map_);
+    const auto desc_end = sizeof(trace::FileHeader) +
+                          (static_cast<uint64_t>(header->input_count) + header->output_count) * sizeof(trace::TensorDesc);
+    if (header->magic != trace::kMagic || header->version != trace::kVersion || desc_end > header->data_offset ||
+        header->data_offset + header->frame_count * header->frame_bytes > map_size_) {
+        std::cerr << "Error: invalid or truncated trace file: " << path << std::endl;
+        return false;
+    }
+
+    has_outputs_ = header->has_outputs != 0;
+    frame_count_ = header->frame_count;
+    frame_bytes_ = header->frame_bytes;
+    data_offset_ = header->data_offset;
+    const auto *desc = reinterpret_cast<const trace::TensorDesc *>(map_ + sizeof(trace::FileHeader));
+    for (uint32_t i = 0; i < header->input_count + header->output_count; ++i, ++desc) {
+        trace::Tensor tensor;
+        tensor.name.assign(desc->name, strnlen(desc->name, trace::kNameSize));
+        tensor.dims.nbDims = std::min(desc->nb_dims, 8);
+        std::copy_n(desc->dims, tensor.dims.nbDims, tensor.dims.d);
+        tensor.bytes = desc->bytes;
+        tensor.offset = desc->offset;
+        const auto recorded = i < header->input_count || has_outputs_;
+        if (recorded && tensor.offset + tensor.bytes > frame_bytes_) {
+            std::cerr << "Error: trace tensor " << tensor.name << " lies outside the frame." << std::endl;
+            return false;
+        }
+        (i < header->input_count ? inputs_ : outputs_).push_back(tensor);
+    }
+    std::cout << "Info: trace " << path << ": " << frame_count_ << " frames, " << inputs_.size() << " inputs, "
+              << outputs_.size() << (has_outputs_ ? " recorded" : " unrecorded") << " outputs." << std::endl;
+    return true;
+}
+
+uint64_t TensorTraceReader::TimestampNs(uint64_t frame) const
+{
+    uint64_t timestamp;
+    memcpy(&timestamp, map_ + data_offset_ + frame * frame_bytes_, sizeof(timestamp));
+    return timestamp;
+}
+
+const void *TensorTraceReader::Data(uint64_t frame, const trace::Tensor &tensor) const
+{
+    return map_ + data_offset_ + frame * frame_bytes_ + tensor.offset;
+}
@@ -0,0 +1,184 @@
+// TensorTrace.h: Binary, memory-mapped trace of the per-frame tensors of the executor
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "InferBackend.h"
+
+
+//!
+//! \brief On-disk layout of a tensor trace, little-endian, POSIX mmap'd by writer and reader.
+//!
+//! \details The file is a TraceFileHeader, input_count + output_count TraceTensorDesc (inputs first, in the
+//!          order of TrtInputStream::GetInputTensorNames, then outputs in the order of
+//!          TrtOutputHandler::GetOutputTensorNames), then frame_count frames of frame_bytes each starting at
+//!          data_offset. A frame is a uint64 timestamp in nanoseconds since the first frame, padded to 64
+//!          bytes, followed by the tensors at the offsets of their descriptors. Tensors are the float views
+//!          the streams see, the inputs as taken before inference, the outputs as handed to Consume. Output
+//!          descriptors are always present, their data only if has_outputs is set.
+//!
+namespace trace {
+
+constexpr uint32_t kMagic = 0x43525454;  // "TTRC"
+constexpr uint32_t kVersion = 1;
+constexpr size_t kAlignment = 64;
+constexpr size_t kNameSize = 64;
+
+struct FileHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t input_count;
+    uint32_t output_count;
+    uint32_t has_outputs;
+    uint32_t reserved;
+    uint64_t frame_count;
+    uint64_t frame_bytes;
+    uint64_t data_offset;
+};
+
+struct TensorDesc
+{
+    char name[kNameSize];
+    int32_t nb_dims;
+    int32_t dims[8];
+    uint32_t reserved;
+    uint64_t bytes;
+    uint64_t offset;  // In the frame.
+};
+
+static_assert(sizeof(FileHeader) == 48, "trace header layout");
+static_assert(sizeof(TensorDesc) == 120, "trace tensor descriptor layout");
+
+//!
+//! \brief A tensor as described to the writer and read back from a trace.
+//!
+struct Tensor
+{
+    std::string name;
+    infer::Dims dims;
+    size_t bytes;
+    size_t offset;  // In the frame, filled by the writer/reader.
+};
+
+}
+
+//!
+//! \brief Appends frames to a trace file. The file grows by doubling its mapping, frames are plain memcpy.
+//!
+class TensorTraceWriter
+{
+public:
+    TensorTraceWriter(const std::string &path, bool with_outputs);
+
+    ~TensorTraceWriter();
+
+    TensorTraceWriter(const TensorTraceWriter &) = delete;
+
+    TensorTraceWriter &operator=(const TensorTraceWriter &) = delete;
+
+    //!
+    //! \brief Create the file for tensors of this layout. Returns false on I/O error, the writer is then inert.
+    //!
+    bool Begin(std::vector<trace::Tensor> inputs, std::vector<trace::Tensor> outputs);
+
+    //!
+    //! \brief Start a new frame with these input views. Frames whose layout does not match Begin are dropped.
+    //!
+    void WriteInputs(const std::vector<void *> &buffers, const std::vector<size_t> &sizes);
+
+    //!
+    //! \brief Add the output views to the frame started by WriteInputs. No-op without outputs.
+    //!
+    void WriteOutputs(const std::vector<void *> &buffers, const std::vector<size_t> &sizes);
+
+    //!
+    //! \brief Finalize the header and trim the file. Called by the destructor.
+    //!
+    void Close();
+
+    uint64_t FrameCount() const
+    {
+        return frame_count_;
+    }
+
+private:
+    bool Reserve(uint64_t frames);
+
+    char *Frame(uint64_t index) const;
+
+    std::string path_;
+    bool with_outputs_;
+    int fd_ = -1;
+    char *map_ = nullptr;
+    size_t map_size_ = 0;
+
+    std::vector<trace::Tensor> inputs_;
+    std::vector<trace::Tensor> outputs_;
+    uint64_t frame_bytes_ = 0;
+    uint64_t data_offset_ = 0;
+    uint64_t frame_count_ = 0;
+    uint64_t capacity_ = 0;
+    bool frame_open_ = false;
+    bool layout_warned_ = false;
+    int64_t start_ns_ = 0;
+};
+
+//!
+//! \brief Read-only view of a trace file.
+//!
+class TensorTraceReader
+{
+public:
+    TensorTraceReader() = default;
+
+    ~TensorTraceReader();
+
+    TensorTraceReader(const TensorTraceReader &) = delete;
+
+    TensorTraceReader &operator=(const TensorTraceReader &) = delete;
+
+    //!
+    //! \brief Map and validate a trace. Returns false and prints why if it is not a valid trace.
+    //!
+    bool Open(const std::string &path);
+
+    uint64_t FrameCount() const
+    {
+        return frame_count_;
+    }
+
+    bool HasOutputs() const
+    {
+        return has_outputs_;
+    }
+
+    const std::vector<trace::Tensor> &Inputs() const
+    {
+        return inputs_;
+    }
+
+    const std::vector<trace::Tensor> &Outputs() const
+    {
+        return outputs_;
+    }
+
+    uint64_t TimestampNs(uint64_t frame) const;
+
+    const void *Data(uint64_t frame, const trace::Tensor &tensor) const;
+
+private:
+    char *map_ = nullptr;
+    size_t map_size_ = 0;
+    std::vector<trace::Tensor> inputs_;
+    std::vector<trace::Tensor> outputs_;
+    bool has_outputs_ = false;
+    uint64_t frame_count_ = 0;
+    uint64_t frame_bytes_ = 0;
+    uint64_t data_offset_ = 0;
+};
@@ -0,0 +1,180 @@
+// AllocGuardTest.cpp: The executor loop does not allocate once warm, on a stand-in engine
+//
+// usage: AllocGuardTest. Only built with TRT_EXECUTOR_ALLOC_TRACKING, which the CI preset turns on.
+//
+// A stream that does not allocate must leave the guard without violations, and one whose Consume allocates
+// every frame must be caught. Steady Take/Put hops over a StreamStateStore, as the stream server does them, must
+// not allocate either, nor slabs acquired from a warm ArenaPool, as opening a stream does.
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "AllocTracker.h"
+#include "common/arena.h"
+#include "StandInBackend.h"
+#include "TestCheck.h"
+#include "TrtExecutor.h"
+
+
+namespace {
+
+constexpr int kFrames = 200;
+constexpr int kWarmUpFrames = 10;
+constexpr int kFeatureSize = 8;
+constexpr int kStoreStreams = 3;
+constexpr int kStoreHops = 400;
+constexpr int kArenaAcquires = 100;
+
+std::shared_ptr<InferEngine> MakeEngine()
+{
+    StandInSpec spec;
+    const auto parsed = spec.Parse("standin 1\ninput input 1 1 8\nstate h_in h_out 1 1 4\noutput output 1 1 8\n"
+                                   "transform scale 0.5\n");
+    return parsed ? std::make_shared<StandInEngine>(spec) : nullptr;
+}
+
+class TestInputStream : public TrtInputStream
+{
+public:
+    explicit TestInputStream(TrtExecutor *executor) : executor_(executor)
+    {
+    }
+
+    infer::Dims GetDynamicDim(const char *input_name) override
+    {
+        return infer::Dims3(1, 1, kFeatureSize);
+    }
+
+    std::vector<std::string> GetInputTensorNames(const InferEngine &engine) override
+    {
+        return {"input", "h_in"};
+    }
+
+    bool TryTake(const std::vector<void *> &host_buffer, const std::vector<size_t> &sizes) override
+    {
+        if (frames_ == kFrames) {
+            executor_->Terminate();
+            return false;
+        }
+        auto *feature = static_cast<float *>(host_buffer[0]);
+        std::fill(feature, feature + sizes[0] / sizeof(float), 1.0f);
+        ++frames_;
+        return true;
+    }
+
+private:
+    TrtExecutor *executor_;
+    int frames_ = 0;
+};
+
+class TestOutputHandler : public TrtOutputHandler
+{
+public:
+    explicit TestOutputHandler(bool allocate) : allocate_(allocate)
+    {
+    }
+
+    std::vector<std::string> GetOutputTensorNames(const InferEngine &engine) override
+    {
+        return {"output", "h_out"};
+    }
+
+    void SetTensorDim(const char *output_name, const infer::Dims &dims) override
+    {
+    }
+
+    void Consume(const std::vector<void *> &host_buffer, const std::vector<size_t> &sizes) override
+    {
+        if (allocate_) {
+            // A copy of the mask per frame, the kind of allocation the guard is there to catch.
+            const auto *mask = static_cast<const float *>(host_buffer[0]);
+            masks_.push_back(std::make_unique<std::vector<float>>(mask, mask + sizes[0] / sizeof(float)));
+        }
+    }
+
+private:
+    bool allocate_;
+    std::vector<std::unique_ptr<std::vector<float>>> masks_;
+};
+
+uint64_t RunGuarded(bool allocate)
+{
+    TrtExecuteConfig config;
+    config.report_stages = false;
+    config.alloc_guard_frames = kWarmUpFrames;
+    TrtExecutor executor(config, MakeEngine());
+    executor.SetInputStream(std::make_shared<TestInputStream>(&executor));
+    executor.SetOutputHandler(std::make_shared<TestOutputHandler>(allocate));
+    TEST_CHECK(executor.Process());
+    return executor.GetAllocationViolations();
+}
+
+//!
+//! \brief Allocations of kStoreHops hops spread over resident streams, each taking the state, writing a snapshot
+//!        of the same size into it and handing it back.
+//!
+uint64_t StoreHopAllocations()
+{
+    StreamStateStore store(kStoreStreams);
+    for (int id = 0; id < kStoreStreams; ++id) {
+        StreamState state;
+        state.Reserve(4, kFeatureSize, kFeatureSize, kFeatureSize);
+        store.Add(id, std::move(state));
+    }
+
+    StreamState state;
+    const auto before = AllocTracker::ThreadViolations();
+    AllocTracker::ArmGuard();
+    for (int hop = 0; hop < kStoreHops; ++hop) {
+        const auto id = static_cast<uint64_t>(hop % kStoreStreams);
+        store.Take(id, state);
+        state.frame_index = hop;
+        state.recurrent.assign(4, 1.0f);
+        state.mu.assign(kFeatureSize, 0.0);
+        state.sigma_square.assign(kFeatureSize, 1.0);
+        state.overlap.assign(kFeatureSize, 0.0f);
+        store.Put(id, state);
+    }
+    AllocTracker::DisarmGuard();
+    TEST_CHECK(store.EvictionCount() == 0);
+    return AllocTracker::ThreadViolations() - before;
+}
+
+//!
+//! \brief Allocations of kArenaAcquires slab acquires and releases of two size classes after a warm-up one.
+//!
+uint64_t ArenaAcquireAllocations()
+{
+    auto &pool = samplesCommon::ArenaPool::instance();
+    const auto acquire = [&pool]() {
+        auto views = pool.acquire(1000);
+        auto region = pool.acquire(3 * samplesCommon::ArenaPool::kPageBytes);
+        const auto ok = views && region && views->carve(512) && region->used() == 0;
+        const auto shared = region;
+        return ok && shared.use_count() == 2;
+    };
+    TEST_CHECK(acquire());
+
+    const auto before = AllocTracker::ThreadViolations();
+    AllocTracker::ArmGuard();
+    auto ok = true;
+    for (int i = 0; i < kArenaAcquires; ++i) {
+        ok = acquire() && ok;
+    }
+    AllocTracker::DisarmGuard();
+    TEST_CHECK(ok);
+    return AllocTracker::ThreadViolations() - before;
+}
+
+}
+
+int main()
+{
+    TEST_CHECK(RunGuarded(false) == 0);
+    TEST_CHECK(RunGuarded(true) >= kFrames - kWarmUpFrames);
+    TEST_CHECK(StoreHopAllocations() == 0);
+    TEST_CHECK(ArenaAcquireAllocations() == 0);
+    return TEST_RESULT();
+}
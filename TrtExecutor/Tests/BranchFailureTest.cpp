@@ -0,0 +1,151 @@
+// BranchFailureTest.cpp: An added model whose inference fails leaves the frame to the other models
+//
+// usage: BranchFailureTest spec-file, the stand-in of data/standin_failing.standin.
+//
+// The main model scales a feature of ones by 0.5, the added one outputs ones but fails every third frame. Combined,
+// the mask is their average, or the main mask alone on the frames the added model failed, which count as degraded.
+// With its own output handler, the added model is not consumed on those frames.
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "StandInBackend.h"
+#include "TestCheck.h"
+#include "TrtExecutor.h"
+
+
+namespace {
+
+constexpr int kFrames = 12;
+constexpr int kFailEvery = 3;
+constexpr int kFeatureSize = 8;
+
+std::shared_ptr<InferEngine> MakeEngine()
+{
+    StandInSpec spec;
+    const auto parsed = spec.Parse("standin 1\ninput input 1 1 8\nstate h_in h_out 1 1 4\noutput output 1 1 8\n"
+                                   "transform scale 0.5\n");
+    return parsed ? std::make_shared<StandInEngine>(spec) : nullptr;
+}
+
+class TestInputStream : public TrtInputStream
+{
+public:
+    explicit TestInputStream(TrtExecutor *executor) : executor_(executor)
+    {
+    }
+
+    infer::Dims GetDynamicDim(const char *input_name) override
+    {
+        return infer::Dims3(1, 1, kFeatureSize);
+    }
+
+    std::vector<std::string> GetInputTensorNames(const InferEngine &engine) override
+    {
+        return {"input", "h_in"};
+    }
+
+    bool TryTake(const std::vector<void *> &host_buffer, const std::vector<size_t> &sizes) override
+    {
+        if (frames_ == kFrames) {
+            executor_->Terminate();
+            return false;
+        }
+        auto *feature = static_cast<float *>(host_buffer[0]);
+        std::fill(feature, feature + sizes[0] / sizeof(float), 1.0f);
+        ++frames_;
+        return true;
+    }
+
+private:
+    TrtExecutor *executor_;
+    int frames_ = 0;
+};
+
+//!
+//! \brief Keeps the first mask value of every frame consumed.
+//!
+class RecordingOutputHandler : public TrtOutputHandler
+{
+public:
+    std::vector<std::string> GetOutputTensorNames(const InferEngine &engine) override
+    {
+        return {"output", "h_out"};
+    }
+
+    void SetTensorDim(const char *output_name, const infer::Dims &dims) override
+    {
+    }
+
+    void Consume(const std::vector<void *> &host_buffer, const std::vector<size_t> &sizes) override
+    {
+        masks.push_back(*static_cast<const float *>(host_buffer[0]));
+    }
+
+    std::vector<float> masks;
+};
+
+bool FailsAt(int frame)
+{
+    return (frame + 1) % kFailEvery == 0;
+}
+
+void TestCombined(const std::string &spec_path)
+{
+    TrtExecuteConfig config;
+    config.report_stages = false;
+    auto registry = std::make_shared<MetricsRegistry>();
+    TrtExecutor executor(config, MakeEngine());
+    executor.SetMetrics(registry);
+    auto output = std::make_shared<RecordingOutputHandler>();
+    executor.SetInputStream(std::make_shared<TestInputStream>(&executor));
+    executor.SetOutputHandler(output);
+    TEST_CHECK(executor.AddModel(spec_path));
+    // A failed added model does not fail the frame.
+    TEST_CHECK(executor.Process());
+
+    TEST_CHECK(output->masks.size() == kFrames);
+    for (int i = 0; i < static_cast<int>(output->masks.size()); ++i) {
+        TEST_CHECK_NEAR(output->masks[i], FailsAt(i) ? 0.5f : 0.75f, 1e-6f);
+    }
+    TEST_CHECK(registry->GetCounter("trt_frames_total", "").Value() == kFrames);
+    TEST_CHECK(registry->GetCounter("trt_frames_degraded_total", "").Value() == kFrames / kFailEvery);
+    TEST_CHECK(registry->GetCounter("trt_frames_failed_total", "").Value() == 0);
+}
+
+void TestSeparate(const std::string &spec_path)
+{
+    TrtExecuteConfig config;
+    config.report_stages = false;
+    TrtExecutor executor(config, MakeEngine());
+    auto output = std::make_shared<RecordingOutputHandler>();
+    auto branch_output = std::make_shared<RecordingOutputHandler>();
+    executor.SetInputStream(std::make_shared<TestInputStream>(&executor));
+    executor.SetOutputHandler(output);
+    TEST_CHECK(executor.AddModel(spec_path, branch_output));
+    TEST_CHECK(executor.Process());
+
+    TEST_CHECK(output->masks.size() == kFrames);
+    for (const auto mask : output->masks) {
+        TEST_CHECK_NEAR(mask, 0.5f, 1e-6f);
+    }
+    TEST_CHECK(branch_output->masks.size() == kFrames - kFrames / kFailEvery);
+    for (const auto mask : branch_output->masks) {
+        TEST_CHECK_NEAR(mask, 1.0f, 1e-6f);
+    }
+}
+
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 2) {
+        std::cerr << "usage: " << argv[0] << " spec-file" << std::endl;
+        return 2;
+    }
+    TestCombined(argv[1]);
+    TestSeparate(argv[1]);
+    return TEST_RESULT();
+}
@@ -0,0 +1,167 @@
+// FeatureCacheTest.cpp: Streams reading their frames from the feature cache snapshot the state of uncached ones
+//
+// usage: FeatureCacheTest
+//
+// A first pass over a signal fills the cache, a second one reads every frame from it. Both must give the same
+// features, and a state saved halfway by the second pass must hold the normalization state of an uncached pass:
+// the MVN of the frames read from the cache is computed again when the state is saved. A stream restored from it
+// without the cache must then go on with the features of the uncached pass. A polarity-inverted copy of the signal
+// and one with two samples negated must miss: sign flips in pairs used to cancel out of the key.
+
+#include <cmath>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "StandInBackend.h"
+#include "TestCheck.h"
+#include "TrtExecutor.h"
+#include "VoiceStream.h"
+
+
+namespace {
+
+constexpr int kSampleRate = 16000;
+constexpr int kSignalSize = kSampleRate / 2 + 77;
+constexpr int kSnapshotFrame = 20;
+constexpr size_t kBins = 257;
+
+std::vector<double> MakeSignal()
+{
+    std::mt19937 rng(11);
+    std::normal_distribution<double> noise(0.0, 0.05);
+    std::vector<double> signal(kSignalSize);
+    for (int i = 0; i < kSignalSize; ++i) {
+        signal[i] = 0.4 * std::sin(2 * M_PI * 300.0 * i / kSampleRate) + noise(rng);
+    }
+    return signal;
+}
+
+std::shared_ptr<InferEngine> MakeEngine()
+{
+    StandInSpec spec;
+    const auto parsed = spec.Parse("standin 1\ninput input 1 1 257\noutput output 1 1 257\ntransform scale 1\n");
+    return parsed ? std::make_shared<StandInEngine>(spec) : nullptr;
+}
+
+//!
+//! \brief Take frames [first, last) of input, returns their features one after the other.
+//!
+std::vector<float> Take(VoiceInputStream &input, int first, int last)
+{
+    std::vector<float> features;
+    std::vector<float> frame(kBins);
+    const std::vector<void *> buffers{frame.data()};
+    const std::vector<size_t> sizes{kBins * sizeof(float)};
+    for (int i = first; i < last; ++i) {
+        if (!TEST_CHECK(input.TryTake(buffers, sizes))) {
+            break;
+        }
+        features.insert(features.end(), frame.begin(), frame.end());
+    }
+    return features;
+}
+
+//!
+//! \brief Hashes and checks of a signal, its inverted copy and the signal with two samples negated all differ.
+//!
+void TestHasherSignFlips(const std::vector<double> &signal)
+{
+    const auto even = signal.size() & ~size_t(1);
+    std::vector<std::vector<double>> variants(3, std::vector<double>(signal.begin(), signal.begin() + even));
+    for (auto &sample : variants[1]) {
+        sample = -sample;
+    }
+    variants[2][10] = -variants[2][10];
+    variants[2][even - 3] = -variants[2][even - 3];
+
+    std::vector<uint64_t> values;
+    std::vector<uint64_t> checks;
+    for (const auto &variant : variants) {
+        FeatureHasher hasher;
+        hasher.Update(variant.data(), variant.size() * sizeof(double));
+        values.push_back(hasher.Value());
+        checks.push_back(hasher.Check());
+    }
+    for (size_t i = 0; i < variants.size(); ++i) {
+        for (size_t j = i + 1; j < variants.size(); ++j) {
+            TEST_CHECK(values[i] != values[j]);
+            TEST_CHECK(checks[i] != checks[j]);
+        }
+    }
+}
+
+}
+
+int main()
+{
+    char directory[] = "/tmp/FeatureCacheTest.XXXXXX";
+    if (!TEST_CHECK(mkdtemp(directory))) {
+        return 1;
+    }
+    FeatureCacheConfig cache_config;
+    cache_config.directory = directory;
+    auto cache = FeatureCache::Open(cache_config);
+    if (!TEST_CHECK(cache)) {
+        return 1;
+    }
+
+    TrtExecuteConfig config;
+    config.report_stages = false;
+    TrtExecutor executor(config, MakeEngine());
+    const auto signal = MakeSignal();
+    const VoiceFileInputConfig voice;
+    TestHasherSignFlips(signal);
+
+    // The uncached pass fills the cache, its state halfway is the reference.
+    VoiceInputStream filling(voice, signal, kSampleRate, 1, 0, &executor);
+    filling.SetFeatureCache(cache);
+    const auto frames = filling.FrameCount();
+    const auto reference = Take(filling, 0, kSnapshotFrame);
+    StreamState uncached;
+    filling.SaveState(uncached);
+    const auto reference_rest = Take(filling, kSnapshotFrame, frames);
+    std::vector<float> frame(kBins);
+    TEST_CHECK(!filling.TryTake({frame.data()}, {kBins * sizeof(float)}));
+    TEST_CHECK(cache->Misses() == 1);
+
+    VoiceInputStream reading(voice, signal, kSampleRate, 1, 0, &executor);
+    reading.SetFeatureCache(cache);
+    TEST_CHECK(cache->Hits() == 1);
+    TEST_CHECK(Take(reading, 0, kSnapshotFrame) == reference);
+    StreamState cached;
+    reading.SaveState(cached);
+    TEST_CHECK(cached.frame_index == uncached.frame_index);
+    TEST_CHECK(!cached.mu.empty() && cached.mu == uncached.mu);
+    TEST_CHECK(cached.sigma_square == uncached.sigma_square);
+    TEST_CHECK(Take(reading, kSnapshotFrame, frames) == reference_rest);
+
+    // Resumed without the cache from the state of the cached pass.
+    VoiceInputStream resumed(voice, signal, kSampleRate, 1, 0, &executor);
+    resumed.RestoreState(cached);
+    TEST_CHECK(Take(resumed, kSnapshotFrame, frames) == reference_rest);
+
+    // Other signals, they must not get the features of the cached one.
+    auto inverted = signal;
+    for (auto &sample : inverted) {
+        sample = -sample;
+    }
+    auto two_negated = signal;
+    two_negated[100] = -two_negated[100];
+    two_negated[kSignalSize / 2] = -two_negated[kSignalSize / 2];
+    for (const auto *other : {&inverted, &two_negated}) {
+        VoiceInputStream missing(voice, *other, kSampleRate, 1, 0, &executor);
+        missing.SetFeatureCache(cache);
+    }
+    TEST_CHECK(cache->Hits() == 1);
+    TEST_CHECK(cache->Misses() == 3);
+
+    cache.reset();
+    const auto command = std::string("rm -rf ") + directory;
+    TEST_CHECK(system(command.c_str()) == 0);
+    return TEST_RESULT();
+}
@@ -0,0 +1,234 @@
+// Fp16Test.cpp: Half precision conversions of CpuKernels and common/fp16.h
+//
+// Built once per code path of CpuKernels.cpp (FP16_TEST_PATH: scalar, avx2 with F16C, avx512), which picks its
+// conversion loops at compile time. Exits with 77, skipped, if this CPU lacks the path.
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "CpuKernels.h"
+#include "TestCheck.h"
+#include "common/fp16.h"
+
+
+namespace {
+
+constexpr int kSkipped = 77;
+
+uint32_t Bits(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+bool IsHalfNan(uint16_t half)
+{
+    return (half & 0x7c00) == 0x7c00 && (half & 0x3ff) != 0;
+}
+
+//!
+//! \brief The value of a half, from its definition rather than bit manipulation.
+//!
+double HalfValue(uint16_t half)
+{
+    const auto sign = half & 0x8000 ? -1.0 : 1.0;
+    const int exponent = (half >> 10) & 0x1f;
+    const int mantissa = half & 0x3ff;
+    if (exponent == 0x1f) {
+        return mantissa ? std::numeric_limits<double>::quiet_NaN() : sign * std::numeric_limits<double>::infinity();
+    }
+    if (exponent == 0) {
+        return sign * std::ldexp(mantissa, -24);
+    }
+    return sign * std::ldexp(1024 + mantissa, exponent - 25);
+}
+
+std::vector<float> ToFloats(const std::vector<uint16_t> &halves)
+{
+    std::vector<float> floats(halves.size());
+    kernels::HalfToFloat(halves.data(), floats.data(), halves.size());
+    return floats;
+}
+
+std::vector<uint16_t> ToHalves(const std::vector<float> &floats)
+{
+    std::vector<uint16_t> halves(floats.size());
+    kernels::FloatToHalf(floats.data(), halves.data(), floats.size());
+    return halves;
+}
+
+void TestHalfToFloatExhaustive()
+{
+    std::vector<uint16_t> halves(65536);
+    for (size_t i = 0; i < halves.size(); ++i) {
+        halves[i] = static_cast<uint16_t>(i);
+    }
+    const auto floats = ToFloats(halves);
+    auto mismatches = 0;
+    for (size_t i = 0; i < halves.size(); ++i) {
+        const auto half = halves[i];
+        const auto expect = HalfValue(half);
+        const auto scalar = samplesCommon::halfToFloat(half);
+        bool ok;
+        if (IsHalfNan(half)) {
+            // The hardware quiets signaling NaNs, only NaN-ness and the sign are portable.
+            const auto negative = (half & 0x8000) != 0;
+            ok = std::isnan(floats[i]) && std::isnan(scalar) && std::signbit(floats[i]) == negative &&
+                 std::signbit(scalar) == negative;
+        } else {
+            // Exact, including the sign of zero.
+            ok = floats[i] == expect && scalar == expect && std::signbit(floats[i]) == std::signbit(expect) &&
+                 Bits(floats[i]) == Bits(scalar);
+        }
+        if (!ok && mismatches++ < 8) {
+            std::cerr << "half 0x" << std::hex << half << std::dec << ": " << floats[i] << " (scalar " << scalar
+                      << "), expected " << expect << std::endl;
+        }
+    }
+    TEST_CHECK(mismatches == 0);
+}
+
+void TestFloatToHalfRoundTrip()
+{
+    // Every finite half survives the round trip exactly.
+    std::vector<uint16_t> halves;
+    for (uint32_t h = 0; h < 65536; ++h) {
+        if ((h & 0x7c00) != 0x7c00) {
+            halves.push_back(static_cast<uint16_t>(h));
+        }
+    }
+    TEST_CHECK(ToHalves(ToFloats(halves)) == halves);
+
+    // Random floats over the normal half range land within half an ulp, 2^-11 relative.
+    std::mt19937 rng(20260101);
+    std::uniform_real_distribution<float> exponent(-14.0f, 15.99f);
+    std::vector<float> floats(100003);
+    for (auto &value : floats) {
+        value = std::exp2(exponent(rng)) * (rng() & 1 ? -1.0f : 1.0f);
+    }
+    const auto back = ToFloats(ToHalves(floats));
+    auto worst = 0.0;
+    for (size_t i = 0; i < floats.size(); ++i) {
+        worst = std::max(worst, std::fabs(static_cast<double>(back[i]) - floats[i]) / std::fabs(floats[i]));
+    }
+    std::cout << "Info: worst relative round-trip error " << worst << std::endl;
+    TEST_CHECK(worst <= std::ldexp(1.0, -11));
+
+    // Rounding matches the scalar reference bit for bit, ties to even included.
+    std::vector<float> ties;
+    for (uint32_t h = 0; h < 0x7bff; ++h) {
+        const auto low = HalfValue(static_cast<uint16_t>(h));
+        const auto high = HalfValue(static_cast<uint16_t>(h + 1));
+        ties.push_back(static_cast<float>((low + high) / 2));
+        ties.push_back(-static_cast<float>((low + high) / 2));
+    }
+    const auto tie_halves = ToHalves(ties);
+    auto tie_mismatches = 0;
+    for (size_t i = 0; i < ties.size(); ++i) {
+        const auto h = static_cast<uint16_t>(i / 2);
+        const auto expect = static_cast<uint16_t>((h & 1 ? h + 1 : h) | (i & 1 ? 0x8000 : 0));
+        if (tie_halves[i] != expect || samplesCommon::floatToHalf(ties[i]) != expect) {
+            ++tie_mismatches;
+        }
+    }
+    TEST_CHECK(tie_mismatches == 0);
+}
+
+void TestSpecialValues()
+{
+    const auto inf = std::numeric_limits<float>::infinity();
+    const std::vector<float> values = {
+        0.0f, -0.0f, inf, -inf, std::numeric_limits<float>::quiet_NaN(), -std::numeric_limits<float>::quiet_NaN(),
+        65504.0f, 65519.0f, 65520.0f, -65520.0f, 1e10f,
+        std::ldexp(1.0f, -14), std::ldexp(1.0f, -24), -std::ldexp(1.0f, -24), std::ldexp(3.0f, -26),
+        std::ldexp(1.0f, -25), std::ldexp(1.0f, -26), std::numeric_limits<float>::denorm_min(),
+        std::numeric_limits<float>::min(), std::ldexp(1023.0f, -24)};
+    const std::vector<uint16_t> expect = {
+        0x0000, 0x8000, 0x7c00, 0xfc00, 0x7e00, 0xfe00,
+        0x7bff, 0x7bff, 0x7c00, 0xfc00, 0x7c00,
+        0x0400, 0x0001, 0x8001, 0x0001,
+        0x0000, 0x0000, 0x0000,
+        0x0000, 0x03ff};
+    // Padded past one AVX-512 block so both the vector loops and the scalar tail see every value.
+    auto padded = values;
+    padded.insert(padded.end(), values.begin(), values.end());
+    const auto halves = ToHalves(padded);
+    for (size_t i = 0; i < padded.size(); ++i) {
+        const auto want = expect[i % values.size()];
+        const auto scalar = samplesCommon::floatToHalf(padded[i]);
+        if (IsHalfNan(want)) {
+            TEST_CHECK(IsHalfNan(halves[i]) && (halves[i] & 0x8000) == (want & 0x8000));
+            TEST_CHECK(IsHalfNan(scalar) && (scalar & 0x8000) == (want & 0x8000));
+        } else if (!TEST_CHECK(halves[i] == want && scalar == want)) {
+            std::cerr << "value " << padded[i] << " at " << i << ": 0x" << std::hex << halves[i] << " (scalar 0x"
+                      << scalar << "), expected 0x" << want << std::dec << std::endl;
+        }
+    }
+}
+
+void TestTailLengths()
+{
+    // Every count up to three AVX-512 blocks from an odd start, with guards around the destination.
+    constexpr uint16_t kGuard = 0xbeef;
+    const float kFloatGuard = -12345.0f;
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<float> value(-70000.0f, 70000.0f);
+    std::vector<float> source(64);
+    for (auto &v : source) {
+        v = value(rng);
+    }
+    for (size_t count = 0; count <= 48; ++count) {
+        std::vector<uint16_t> halves(count + 3, kGuard);
+        kernels::FloatToHalf(source.data() + 1, halves.data() + 1, count);
+        TEST_CHECK(halves[0] == kGuard && halves[count + 1] == kGuard && halves[count + 2] == kGuard);
+        std::vector<float> floats(count + 3, kFloatGuard);
+        kernels::HalfToFloat(halves.data() + 1, floats.data() + 1, count);
+        TEST_CHECK(floats[0] == kFloatGuard && floats[count + 1] == kFloatGuard);
+        for (size_t i = 0; i < count; ++i) {
+            const auto expect = samplesCommon::floatToHalf(source[i + 1]);
+            TEST_CHECK(halves[i + 1] == expect);
+            TEST_CHECK(Bits(floats[i + 1]) == Bits(samplesCommon::halfToFloat(expect)));
+        }
+    }
+}
+
+bool CpuSupportsPath(const std::string &path)
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    if (path == "avx512") {
+        return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("f16c");
+    }
+    if (path == "avx2") {
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") && __builtin_cpu_supports("f16c");
+    }
+#endif
+    return path == "scalar";
+}
+
+}
+
+int main()
+{
+    const std::string path = FP16_TEST_PATH;
+    if (!CpuSupportsPath(path)) {
+        std::cout << "Info: this CPU cannot run the " << path << " path, skipped." << std::endl;
+        return kSkipped;
+    }
+    // The conversions have no name of their own, the kernels of the same build tell what it was built for.
+    if (!TEST_CHECK(path == kernels::InstructionSet())) {
+        std::cerr << "built for " << kernels::InstructionSet() << " instead of " << path << std::endl;
+        return TEST_RESULT();
+    }
+    TestHalfToFloatExhaustive();
+    TestFloatToHalfRoundTrip();
+    TestSpecialValues();
+    TestTailLengths();
+    return TEST_RESULT();
+}
@@ -0,0 +1,269 @@
+// JitterBufferTest.cpp: Reordering, late drops, concealment and delay adaptation of the jitter buffer
+//
+// usage: JitterBufferTest
+//
+// Packets arriving out of order must be played out in sequence, packets whose samples were played out already
+// dropped and counted, and a lost hop replaced by the last one with a gain decaying per hop lost in a row. The
+// playout delay must grow with the measured jitter and shrink back once arrivals are regular again. A packet trace
+// replayed through the executor must give as many frames as the file pipeline does from the same samples.
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <numeric>
+#include <vector>
+
+#include "PacketReplay.h"
+#include "StandInBackend.h"
+#include "TestCheck.h"
+#include "TrtExecutor.h"
+
+
+namespace {
+
+constexpr int kSampleRate = 16000;
+constexpr int kHop = 160;                   // 10 ms.
+constexpr int64_t kHopUs = 10000;
+constexpr int64_t kLongAfter = std::numeric_limits<int64_t>::max() / 2;
+constexpr int kSignalSize = kSampleRate + 77;   // Not a whole number of hops, the last one is padded.
+
+JitterBufferConfig MakeConfig()
+{
+    JitterBufferConfig config;
+    config.sample_rate = kSampleRate;
+    config.min_delay_ms = 1.0;
+    config.max_delay_ms = 50.0;
+    return config;
+}
+
+//!
+//! \brief A hop of samples first, first + 1, ...
+//!
+std::vector<float> Ramp(float first)
+{
+    std::vector<float> hop(kHop);
+    std::iota(hop.begin(), hop.end(), first);
+    return hop;
+}
+
+void TestReorder()
+{
+    JitterBuffer buffer(MakeConfig(), kHop);
+    buffer.Push(0, Ramp(0.0f).data(), kHop, 0);
+    buffer.Push(2 * kHop, Ramp(2 * kHop).data(), kHop, 100);
+    buffer.Push(kHop, Ramp(kHop).data(), kHop, 200);
+
+    std::vector<float> hop(kHop);
+    for (int i = 0; i < 3; ++i) {
+        TEST_CHECK(buffer.Pop(kLongAfter, hop.data()) == JitterBuffer::PopResult::kHop);
+        TEST_CHECK(hop == Ramp(static_cast<float>(i * kHop)));
+    }
+    const auto stats = buffer.Stats();
+    TEST_CHECK(stats.packets == 3);
+    TEST_CHECK(stats.reordered_packets == 1);
+    TEST_CHECK(stats.late_packets == 0);
+    TEST_CHECK(stats.concealed_samples == 0);
+}
+
+void TestLateDrop()
+{
+    JitterBuffer buffer(MakeConfig(), kHop);
+    buffer.Push(0, Ramp(0.0f).data(), kHop, 0);
+    std::vector<float> hop(kHop);
+    TEST_CHECK(buffer.Pop(kLongAfter, hop.data()) == JitterBuffer::PopResult::kHop);
+    TEST_CHECK(buffer.Pop(kLongAfter, hop.data()) == JitterBuffer::PopResult::kHop);
+
+    // The second hop was concealed, its packet comes too late.
+    buffer.Push(kHop, Ramp(kHop).data(), kHop, kLongAfter);
+    auto stats = buffer.Stats();
+    TEST_CHECK(stats.late_packets == 1);
+    TEST_CHECK(stats.concealed_samples == kHop);
+
+    // Partly played out, the part still ahead is kept.
+    buffer.Push(kHop + kHop / 2, Ramp(0.0f).data(), kHop, kLongAfter);
+    TEST_CHECK(buffer.Pop(kLongAfter, hop.data()) == JitterBuffer::PopResult::kHop);
+    TEST_CHECK(hop[0] == kHop / 2 && hop[kHop / 2 - 1] == kHop - 1);
+    stats = buffer.Stats();
+    TEST_CHECK(stats.late_packets == 1);
+    TEST_CHECK(stats.concealed_samples == kHop + kHop / 2);
+}
+
+void TestConcealment()
+{
+    auto config = MakeConfig();
+    config.conceal_decay = 0.5f;
+    JitterBuffer buffer(config, kHop);
+    buffer.Push(0, Ramp(1.0f).data(), kHop, 0);
+
+    std::vector<float> hop(kHop);
+    TEST_CHECK(buffer.Pop(kLongAfter, hop.data()) == JitterBuffer::PopResult::kHop);
+    TEST_CHECK(hop == Ramp(1.0f));
+
+    // The first lost hop repeats the last one, every further one in a row is the previous one at the decay gain.
+    auto previous = hop;
+    auto gain = 1.0f;
+    for (int lost = 0; lost < 4; ++lost) {
+        TEST_CHECK(buffer.Pop(kLongAfter, hop.data()) == JitterBuffer::PopResult::kHop);
+        auto ok = true;
+        for (int i = 0; i < kHop; ++i) {
+            ok = ok && std::fabs(hop[i] - previous[i] * gain) <= 1e-6f * std::fabs(previous[i]);
+        }
+        TEST_CHECK(ok);
+        previous = hop;
+        gain = config.conceal_decay;
+    }
+    TEST_CHECK(buffer.Stats().concealed_samples == 4 * kHop);
+
+    // Samples arriving again end the concealment, the next loss starts over at full gain.
+    buffer.Push(5 * kHop, Ramp(100.0f).data(), kHop, kLongAfter);
+    TEST_CHECK(buffer.Pop(kLongAfter, hop.data()) == JitterBuffer::PopResult::kHop);
+    TEST_CHECK(hop == Ramp(100.0f));
+    TEST_CHECK(buffer.Pop(kLongAfter, hop.data()) == JitterBuffer::PopResult::kHop);
+    TEST_CHECK(hop == Ramp(100.0f));
+    TEST_CHECK(buffer.Stats().concealed_samples == 5 * kHop);
+
+    buffer.Close();
+    TEST_CHECK(buffer.Pop(kLongAfter, hop.data()) == JitterBuffer::PopResult::kEnd);
+}
+
+//!
+//! \brief Push count hops from packet first on, arriving offset_us(k) late, playing out what is due meanwhile.
+//!
+template <typename F>
+void Deliver(JitterBuffer &buffer, int first, int count, F offset_us)
+{
+    std::vector<float> hop(kHop);
+    const auto payload = Ramp(0.0f);
+    for (int k = first; k < first + count; ++k) {
+        const auto arrival = k * kHopUs + offset_us(k);
+        buffer.Push(static_cast<uint64_t>(k) * kHop, payload.data(), kHop, arrival);
+        while (buffer.Pop(arrival, hop.data()) == JitterBuffer::PopResult::kHop) {
+        }
+    }
+}
+
+void TestAdaptiveDelay()
+{
+    const auto config = MakeConfig();
+    JitterBuffer buffer(config, kHop);
+    const auto regular = [](int) { return int64_t(0); };
+    Deliver(buffer, 0, 50, regular);
+    auto stats = buffer.Stats();
+    TEST_CHECK(stats.jitter_ms < 0.01);
+    TEST_CHECK_NEAR(stats.delay_ms, config.min_delay_ms, 1e-6);
+
+    // Every other packet 6 ms late.
+    Deliver(buffer, 50, 50, [](int k) { return int64_t(k % 2 ? 6000 : 0); });
+    stats = buffer.Stats();
+    TEST_CHECK(stats.jitter_ms > 4.0);
+    TEST_CHECK(stats.delay_ms > 10.0 && stats.delay_ms <= config.max_delay_ms);
+    const auto peak_ms = stats.max_delay_ms;
+    TEST_CHECK(peak_ms >= stats.delay_ms);
+
+    // Regular again: the jitter estimate decays and the delay follows it down, a tenth of a hop per hop.
+    Deliver(buffer, 100, 5, regular);
+    stats = buffer.Stats();
+    TEST_CHECK(stats.delay_ms < stats.max_delay_ms && stats.delay_ms > 10.0);
+    Deliver(buffer, 105, 300, regular);
+    stats = buffer.Stats();
+    TEST_CHECK_NEAR(stats.delay_ms, config.min_delay_ms, 1e-6);
+    TEST_CHECK(stats.max_delay_ms >= peak_ms);
+}
+
+std::shared_ptr<InferEngine> MakeEngine()
+{
+    StandInSpec spec;
+    const auto parsed = spec.Parse("standin 1\ninput input 1 1 257\nstate h_in h_out 1 1 4\n"
+                                   "output output 1 1 257\ntransform scale 0.1\n");
+    return parsed ? std::make_shared<StandInEngine>(spec) : nullptr;
+}
+
+class CountingOutputHandler : public TrtOutputHandler
+{
+public:
+    std::vector<std::string> GetOutputTensorNames(const InferEngine &engine) override
+    {
+        return VoiceOutputTensorNames(engine);
+    }
+
+    void SetTensorDim(const char *output_name, const infer::Dims &dims) override
+    {
+    }
+
+    void Consume(const std::vector<void *> &host_buffer, const std::vector<size_t> &sizes) override
+    {
+        ++frames;
+    }
+
+    int frames = 0;
+};
+
+int RunFrames(const std::shared_ptr<TrtInputStream> &input, TrtExecutor &executor)
+{
+    auto output = std::make_shared<CountingOutputHandler>();
+    executor.SetInputStream(input);
+    executor.SetOutputHandler(output);
+    TEST_CHECK(executor.Process());
+    return output->frames;
+}
+
+void TestReplayFrameCount()
+{
+    std::vector<float> signal(kSignalSize);
+    for (int i = 0; i < kSignalSize; ++i) {
+        signal[i] = static_cast<float>(0.5 * std::sin(2 * M_PI * 440.0 * i / kSampleRate));
+    }
+
+    TrtExecuteConfig config;
+    config.report_stages = false;
+    int reference_frames;
+    {
+        TrtExecutor executor(config, MakeEngine());
+        auto input = std::make_shared<VoiceInputStream>(VoiceFileInputConfig(),
+                                                        std::vector<double>(signal.begin(), signal.end()),
+                                                        kSampleRate, 1, 0, &executor);
+        reference_frames = RunFrames(input, executor);
+        TEST_CHECK(reference_frames == input->FrameCount());
+    }
+
+    // 20 ms packets with jitter, every fourth pair swapped and the seventh lost; the last one carries the end.
+    std::vector<PacketRecord> packets;
+    const auto packet_samples = 2 * kHop;
+    for (int k = 0; k * packet_samples < kSignalSize; ++k) {
+        const auto count = std::min(packet_samples, kSignalSize - k * packet_samples);
+        const auto jitter = (k * 7919) % 5 * 1000;
+        const auto swap = k % 4 == 1 ? 25000 : 0;
+        if (k != 7) {
+            packets.push_back({k * 2 * kHopUs + jitter + swap, static_cast<uint64_t>(k) * packet_samples,
+                               static_cast<uint32_t>(count)});
+        }
+    }
+    std::stable_sort(packets.begin(), packets.end(), [](const PacketRecord &a, const PacketRecord &b) {
+        return a.arrival_us < b.arrival_us;
+    });
+
+    TrtExecutor executor(config, MakeEngine());
+    auto buffer = std::make_shared<JitterBuffer>(MakeConfig(), kHop);
+    auto input = std::make_shared<PacketReplayInputStream>(VoiceFileInputConfig(), buffer, packets, signal,
+                                                           &executor);
+    TEST_CHECK(input->Frontend().HopSize() == kHop);
+    TEST_CHECK(RunFrames(input, executor) == reference_frames);
+    const auto stats = buffer->Stats();
+    TEST_CHECK(stats.packets == packets.size());
+    TEST_CHECK(stats.reordered_packets > 0);
+    TEST_CHECK(stats.concealed_samples >= static_cast<uint64_t>(packet_samples));
+    TEST_CHECK(buffer->EndPosition() == static_cast<uint64_t>(kSignalSize));
+}
+
+}
+
+int main()
+{
+    TestReorder();
+    TestLateDrop();
+    TestConcealment();
+    TestAdaptiveDelay();
+    TestReplayFrameCount();
+    return TEST_RESULT();
+}
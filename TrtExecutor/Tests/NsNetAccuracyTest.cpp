@@ -0,0 +1,140 @@
+// NsNetAccuracyTest.cpp: NSNet CPU backend against ONNX Runtime on a small exported model
+//
+// usage: NsNetAccuracyTest weight-file reference-file, both made by data/make_nsnet_reference.py.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "InferBackend.h"
+#include "TestCheck.h"
+
+
+namespace {
+
+constexpr uint32_t kReferenceMagic = 0x524e534e;  // "NSNR"
+constexpr float kTolerance = 1e-4f;
+
+struct Reference
+{
+    uint32_t frames = 0;
+    uint32_t input_size = 0;
+    uint32_t output_size = 0;
+    uint32_t state_count = 0;
+    uint32_t state_size = 0;
+    std::vector<float> data;    //!< Per frame: input, output, then every state.
+
+    size_t FrameFloats() const
+    {
+        return input_size + output_size + static_cast<size_t>(state_count) * state_size;
+    }
+
+    const float *Frame(uint32_t frame) const
+    {
+        return data.data() + frame * FrameFloats();
+    }
+};
+
+bool LoadReference(const std::string &path, Reference &ref)
+{
+    std::ifstream file(path, std::ios_base::binary);
+    uint32_t header[7] = {};
+    if (!file.read(reinterpret_cast<char *>(header), sizeof(header)) || header[0] != kReferenceMagic ||
+        header[1] != 1) {
+        std::cerr << "Error: " << path << " is not an NSNet reference file." << std::endl;
+        return false;
+    }
+    ref.frames = header[2];
+    ref.input_size = header[3];
+    ref.output_size = header[4];
+    ref.state_count = header[5];
+    ref.state_size = header[6];
+    ref.data.resize(ref.frames * ref.FrameFloats());
+    if (!file.read(reinterpret_cast<char *>(ref.data.data()), ref.data.size() * sizeof(float))) {
+        std::cerr << "Error: " << path << " is truncated." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+float MaxError(const float *a, const float *b, size_t count)
+{
+    float error = 0.0f;
+    for (size_t i = 0; i < count; ++i) {
+        error = std::max(error, std::fabs(a[i] - b[i]));
+    }
+    return error;
+}
+
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 3) {
+        std::cerr << "usage: " << argv[0] << " weight-file reference-file" << std::endl;
+        return 2;
+    }
+    Reference ref;
+    if (!LoadReference(argv[2], ref)) {
+        return 2;
+    }
+    auto engine = LoadInferEngine(argv[1]);
+    if (!TEST_CHECK(engine)) {
+        return 1;
+    }
+    auto context = engine->CreateContext();
+    if (!TEST_CHECK(context) || !TEST_CHECK(context->AllocateBuffers())) {
+        return 1;
+    }
+
+    const auto input = engine->GetBindingIndex("input");
+    const auto output = engine->GetBindingIndex("output");
+    TEST_CHECK(input >= 0 && output >= 0);
+    TEST_CHECK(context->GetBufferSize(input) == ref.input_size * sizeof(float));
+    TEST_CHECK(context->GetBufferSize(output) == ref.output_size * sizeof(float));
+    std::vector<int> state_in(ref.state_count);
+    std::vector<int> state_out(ref.state_count);
+    for (uint32_t k = 0; k < ref.state_count; ++k) {
+        const auto prefix = "h" + std::to_string(k);
+        state_in[k] = engine->GetBindingIndex((prefix + "_in").c_str());
+        state_out[k] = engine->GetBindingIndex((prefix + "_out").c_str());
+        TEST_CHECK(state_in[k] >= 0 && state_out[k] >= 0);
+        TEST_CHECK(context->GetBufferSize(state_out[k]) == ref.state_size * sizeof(float));
+    }
+    if (test::Failures()) {
+        return 1;
+    }
+
+    // Frame by frame as the executor streams it, the states fed back from the outputs.
+    float mask_error = 0.0f;
+    float state_error = 0.0f;
+    for (uint32_t t = 0; t < ref.frames; ++t) {
+        const auto *frame = ref.Frame(t);
+        memcpy(context->GetHostBuffer(input), frame, ref.input_size * sizeof(float));
+        context->CopyInputToDevice();
+        if (!TEST_CHECK(context->Execute())) {
+            return 1;
+        }
+        context->CopyOutputToHost();
+
+        const auto *mask = static_cast<const float *>(context->GetHostBuffer(output));
+        mask_error = std::max(mask_error, MaxError(mask, frame + ref.input_size, ref.output_size));
+        for (uint32_t k = 0; k < ref.state_count; ++k) {
+            const auto *expect = frame + ref.input_size + ref.output_size + k * ref.state_size;
+            const auto *state = static_cast<const float *>(context->GetHostBuffer(state_out[k]));
+            state_error = std::max(state_error, MaxError(state, expect, ref.state_size));
+            memcpy(context->GetHostBuffer(state_in[k]), state, ref.state_size * sizeof(float));
+        }
+    }
+
+    std::cout << "Info: " << ref.frames << " frames, max error mask " << mask_error << ", states " << state_error
+              << std::endl;
+    TEST_CHECK(mask_error <= kTolerance);
+    TEST_CHECK(state_error <= kTolerance);
+    return TEST_RESULT();
+}
@@ -0,0 +1,198 @@
+// ReloadTest.cpp: Model swaps of a running executor on stand-in engines
+//
+// usage: ReloadTest spec-file, the stand-in of data/standin_wide_state.standin.
+//
+// Frames 1-5 run a model scaling the feature by 0.5, frames 6-10 one scaling by 2 with the same state bindings,
+// switched to from the stream, and frames 11-15 the spec file, loaded in the background, whose state is wider.
+// The stand-in state counts the frames of the stream, so it carries over the first switch and restarts at the
+// second.
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "StandInBackend.h"
+#include "TestCheck.h"
+#include "TrtExecutor.h"
+
+
+namespace {
+
+constexpr int kFrames = 15;
+constexpr int kFeatureSize = 8;
+
+std::shared_ptr<InferEngine> MakeEngine(int state_size, float scale)
+{
+    StandInSpec spec;
+    const auto parsed = spec.Parse("standin 1\ninput input 1 1 8\nstate h_in h_out 1 1 " +
+                                   std::to_string(state_size) + "\noutput output 1 1 8\ntransform scale " +
+                                   std::to_string(scale) + "\n");
+    return parsed ? std::make_shared<StandInEngine>(spec) : nullptr;
+}
+
+//!
+//! \brief Where the executor calls back into its stream, which must be the thread running Process().
+//!
+struct CallbackThreads
+{
+    std::thread::id process;
+    std::atomic<int> foreign{0};
+    std::atomic<int> output_name_queries{0};
+
+    void Note()
+    {
+        if (std::this_thread::get_id() != process) {
+            ++foreign;
+        }
+    }
+};
+
+class TestInputStream : public TrtInputStream
+{
+public:
+    TestInputStream(TrtExecutor *executor, CallbackThreads *threads, std::shared_ptr<InferEngine> same_layout,
+                    std::string wide_state_path)
+        : executor_(executor), threads_(threads), same_layout_(std::move(same_layout)),
+          wide_state_path_(std::move(wide_state_path))
+    {
+    }
+
+    infer::Dims GetDynamicDim(const char *input_name) override
+    {
+        threads_->Note();
+        return infer::Dims3(1, 1, kFeatureSize);
+    }
+
+    std::vector<std::string> GetInputTensorNames(const InferEngine &engine) override
+    {
+        threads_->Note();
+        return {"input", "h_in"};
+    }
+
+    bool TryTake(const std::vector<void *> &host_buffer, const std::vector<size_t> &sizes) override
+    {
+        if (frames_ == kFrames) {
+            executor_->Terminate();
+            return false;
+        }
+        if (waiting_for_ >= 0) {
+            // The background load is done once the executor has built the context of the new model.
+            if (threads_->output_name_queries.load() == waiting_for_ &&
+                std::chrono::steady_clock::now() < wait_until_) {
+                return false;
+            }
+            waiting_for_ = -1;
+        }
+        auto *feature = static_cast<float *>(host_buffer[0]);
+        std::fill(feature, feature + sizes[0] / sizeof(float), 1.0f);
+        ++frames_;
+        if (frames_ == 5) {
+            TEST_CHECK(executor_->Reload(same_layout_));
+        } else if (frames_ == 10) {
+            waiting_for_ = threads_->output_name_queries.load();
+            wait_until_ = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+            TEST_CHECK(executor_->Reload(wide_state_path_));
+        }
+        return true;
+    }
+
+private:
+    TrtExecutor *executor_;
+    CallbackThreads *threads_;
+    std::shared_ptr<InferEngine> same_layout_;
+    std::string wide_state_path_;
+    int frames_ = 0;
+    int waiting_for_ = -1;
+    std::chrono::steady_clock::time_point wait_until_;
+};
+
+class TestOutputHandler : public TrtOutputHandler
+{
+public:
+    explicit TestOutputHandler(CallbackThreads *threads) : threads_(threads)
+    {
+    }
+
+    std::vector<std::string> GetOutputTensorNames(const InferEngine &engine) override
+    {
+        threads_->Note();
+        ++threads_->output_name_queries;
+        return {"output", "h_out"};
+    }
+
+    void SetTensorDim(const char *output_name, const infer::Dims &dims) override
+    {
+        threads_->Note();
+    }
+
+    void Consume(const std::vector<void *> &host_buffer, const std::vector<size_t> &sizes) override
+    {
+        masks.push_back(static_cast<const float *>(host_buffer[0])[0]);
+        states.push_back(static_cast<const float *>(host_buffer[1])[0]);
+        state_sizes.push_back(sizes[1] / sizeof(float));
+    }
+
+    std::vector<float> masks;
+    std::vector<float> states;
+    std::vector<size_t> state_sizes;
+
+private:
+    CallbackThreads *threads_;
+};
+
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 2) {
+        std::cerr << "usage: " << argv[0] << " spec-file" << std::endl;
+        return 2;
+    }
+    auto first = MakeEngine(4, 0.5f);
+    auto same_layout = MakeEngine(4, 2.0f);
+    if (!TEST_CHECK(first) || !TEST_CHECK(same_layout)) {
+        return 1;
+    }
+
+    TrtExecuteConfig config;
+    config.report_stages = false;
+    TrtExecutor executor(config, first);
+    CallbackThreads threads;
+    auto output = std::make_shared<TestOutputHandler>(&threads);
+    executor.SetInputStream(std::make_shared<TestInputStream>(&executor, &threads, same_layout, argv[1]));
+    executor.SetOutputHandler(output);
+
+    auto processed = false;
+    std::thread process([&]() {
+        threads.process = std::this_thread::get_id();
+        processed = executor.Process();
+    });
+    process.join();
+
+    TEST_CHECK(processed);
+    TEST_CHECK(threads.foreign == 0);
+    if (!TEST_CHECK(output->masks.size() == kFrames)) {
+        return 1;
+    }
+    for (int frame = 1; frame <= kFrames; ++frame) {
+        const auto i = frame - 1;
+        if (frame <= 5) {
+            TEST_CHECK_NEAR(output->masks[i], 0.5f, 1e-6f);
+            TEST_CHECK_NEAR(output->states[i], static_cast<float>(frame), 1e-6f);
+        } else if (frame <= 10) {
+            // Same state bindings: the count goes on.
+            TEST_CHECK_NEAR(output->masks[i], 2.0f, 1e-6f);
+            TEST_CHECK_NEAR(output->states[i], static_cast<float>(frame), 1e-6f);
+        } else {
+            // Wider state: it restarts from zero.
+            TEST_CHECK_NEAR(output->masks[i], 3.0f, 1e-6f);
+            TEST_CHECK_NEAR(output->states[i], static_cast<float>(frame - 10), 1e-6f);
+            TEST_CHECK(output->state_sizes[i] == 6);
+        }
+    }
+    return TEST_RESULT();
+}
@@ -0,0 +1,300 @@
+// ShmRingTest.cpp: Shared-memory rings, alone and carrying a stream through the executor
+//
+// usage: ShmRingTest
+//
+// The ring alone: positions across the wrap-around, overruns of a full ring and underruns of a short read, waits
+// woken from another thread, and Open refusing a segment of another magic or major version. Then a producer thread
+// streams a signal through an input ring much shorter than it to ShmInputStream, the executor runs a stand-in
+// model, and a consumer thread drains what ShmOutputHandler writes: as many hops, in the same order, as the file
+// pipeline enhances from the same samples.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "ShmRing.h"
+#include "ShmStream.h"
+#include "StandInBackend.h"
+#include "TestCheck.h"
+#include "TrtExecutor.h"
+
+
+namespace {
+
+constexpr uint32_t kSampleRate = 16000;
+constexpr int kSignalSize = kSampleRate + 77;   // Not a whole number of hops, the last one is padded.
+constexpr uint32_t kInputCapacity = 512;
+constexpr int kWaitMs = 10000;                  // Only reached if a wakeup is lost.
+
+std::string SegmentName(const char *suffix)
+{
+    return "/ShmRingTest-" + std::to_string(getpid()) + "-" + suffix;
+}
+
+double ElapsedMs(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+//!
+//! \brief A second mapping of the header of segment name, to damage it behind the ring's back.
+//!
+ShmRingHeader *MapHeader(const std::string &name)
+{
+    const auto fd = shm_open(name.c_str(), O_RDWR, 0);
+    if (fd < 0) {
+        return nullptr;
+    }
+    auto *base = mmap(nullptr, sizeof(ShmRingHeader), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    return base == MAP_FAILED ? nullptr : static_cast<ShmRingHeader *>(base);
+}
+
+void TestPositions()
+{
+    const auto name = SegmentName("positions");
+    auto producer = ShmRing::Create(name, 6, kSampleRate);
+    auto consumer = producer ? ShmRing::Open(name) : nullptr;
+    if (!TEST_CHECK(consumer)) {
+        return;
+    }
+    TEST_CHECK(consumer->Capacity() == 8);
+    TEST_CHECK(consumer->SampleRate() == kSampleRate);
+
+    std::vector<float> samples(16);
+    std::iota(samples.begin(), samples.end(), 0.0f);
+    std::vector<float> read(16);
+    TEST_CHECK(producer->Write(samples.data(), 5) == 5);
+    TEST_CHECK(consumer->Read(read.data(), 3) == 3);
+    TEST_CHECK(read[0] == 0.0f && read[2] == 2.0f);
+
+    // Samples 5-10 wrap around the end of the ring, after which it is full.
+    TEST_CHECK(producer->Write(samples.data() + 5, 6) == 6);
+    TEST_CHECK(producer->Write(samples.data() + 11, 2) == 0);
+    TEST_CHECK(producer->Overruns() == 2);
+    TEST_CHECK(consumer->WritePosition() == 11);
+    for (uint64_t pos = 3; pos < 11; ++pos) {
+        TEST_CHECK(consumer->At(pos) == static_cast<float>(pos));
+    }
+
+    TEST_CHECK(consumer->Read(read.data(), 10) == 8);
+    for (int i = 0; i < 8; ++i) {
+        TEST_CHECK(read[i] == static_cast<float>(3 + i));
+    }
+    TEST_CHECK(consumer->Underruns() == 2);
+    TEST_CHECK(!producer->WaitSpace(9, 0));
+    TEST_CHECK(producer->WaitSpace(8, 0));
+
+    // Past the close, a short read is the end of the stream, not an underrun.
+    producer->Close();
+    TEST_CHECK(consumer->IsClosed());
+    TEST_CHECK(consumer->Read(read.data(), 4) == 0);
+    TEST_CHECK(consumer->Underruns() == 2);
+}
+
+void TestWakeups()
+{
+    const auto name = SegmentName("wakeups");
+    auto producer = ShmRing::Create(name, 8, kSampleRate);
+    auto consumer = producer ? ShmRing::Open(name) : nullptr;
+    if (!TEST_CHECK(consumer)) {
+        return;
+    }
+    std::vector<float> samples(8, 1.0f);
+
+    TEST_CHECK(!consumer->WaitData(1, 20));
+
+    // Each wait is woken by the other side well before its timeout.
+    auto start = std::chrono::steady_clock::now();
+    std::thread writer([&]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        producer->Write(samples.data(), samples.size());
+    });
+    TEST_CHECK(consumer->WaitData(8, kWaitMs));
+    TEST_CHECK(ElapsedMs(start) < kWaitMs / 2);
+    writer.join();
+
+    start = std::chrono::steady_clock::now();
+    std::thread reader([&]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        consumer->Read(samples.data(), 4);
+    });
+    TEST_CHECK(producer->WaitSpace(4, kWaitMs));
+    TEST_CHECK(ElapsedMs(start) < kWaitMs / 2);
+    reader.join();
+
+    start = std::chrono::steady_clock::now();
+    std::thread closer([&]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        producer->Close();
+    });
+    TEST_CHECK(consumer->WaitData(100, kWaitMs));
+    TEST_CHECK(ElapsedMs(start) < kWaitMs / 2);
+    TEST_CHECK(consumer->IsClosed());
+    closer.join();
+}
+
+void TestVersionChecks()
+{
+    const auto name = SegmentName("version");
+    TEST_CHECK(ShmRing::Create(name, 0, kSampleRate) == nullptr);
+    auto ring = ShmRing::Create(name, 8, kSampleRate);
+    auto *header = ring ? MapHeader(name) : nullptr;
+    if (!TEST_CHECK(header)) {
+        return;
+    }
+
+    TEST_CHECK(ShmRing::Open(name) != nullptr);
+    // Fields are only added in minor versions, a newer one stays readable.
+    header->version_minor = ShmRingHeader::kVersionMinor + 1;
+    TEST_CHECK(ShmRing::Open(name) != nullptr);
+    header->version_major = ShmRingHeader::kVersionMajor + 1;
+    TEST_CHECK(ShmRing::Open(name) == nullptr);
+    header->version_major = ShmRingHeader::kVersionMajor;
+    header->magic = 0;
+    TEST_CHECK(ShmRing::Open(name) == nullptr);
+    header->magic = ShmRingHeader::kMagic;
+    header->capacity = 6;
+    TEST_CHECK(ShmRing::Open(name) == nullptr);
+    header->capacity = 8;
+    TEST_CHECK(ShmRing::Open(name) != nullptr);
+    TEST_CHECK(ShmRing::Open(SegmentName("missing")) == nullptr);
+    munmap(header, sizeof(ShmRingHeader));
+}
+
+std::shared_ptr<InferEngine> MakeEngine()
+{
+    // The mask follows the features, so a frame out of order changes the output.
+    StandInSpec spec;
+    const auto parsed = spec.Parse("standin 1\ninput input 1 1 257\nstate h_in h_out 1 1 4\n"
+                                   "output output 1 1 257\ntransform scale 0.1\n");
+    return parsed ? std::make_shared<StandInEngine>(spec) : nullptr;
+}
+
+std::vector<float> MakeSignal()
+{
+    std::mt19937 rng(7);
+    std::normal_distribution<float> noise(0.0f, 0.01f);
+    std::vector<float> signal(kSignalSize);
+    for (int i = 0; i < kSignalSize; ++i) {
+        const auto t = static_cast<double>(i) / kSampleRate;
+        signal[i] = static_cast<float>(0.5 * std::sin(2 * M_PI * (100 + 2000 * t) * t)) + noise(rng);
+    }
+    return signal;
+}
+
+//!
+//! \brief The same signal through the file pipeline, held in memory.
+//!
+std::vector<float> Reference(const std::vector<float> &signal)
+{
+    TrtExecuteConfig config;
+    config.report_stages = false;
+    TrtExecutor executor(config, MakeEngine());
+    auto input = std::make_shared<VoiceInputStream>(VoiceFileInputConfig(),
+                                                    std::vector<double>(signal.begin(), signal.end()), kSampleRate,
+                                                    1, 0, &executor);
+    auto output = std::make_shared<LocalFileOutputHandler>(input, "");
+    executor.SetInputStream(input);
+    executor.SetOutputHandler(output);
+    TEST_CHECK(executor.Process());
+    return std::vector<float>(output->Enhanced().begin(), output->Enhanced().end());
+}
+
+void TestStream()
+{
+    const auto input_name = SegmentName("input");
+    const auto output_name = SegmentName("output");
+    const auto signal = MakeSignal();
+    // The producer creates both rings; the output one holds the whole stream, so no hop is dropped.
+    auto input_ring = ShmRing::Create(input_name, kInputCapacity, kSampleRate);
+    auto output_ring = ShmRing::Create(output_name, 2 * kSignalSize, kSampleRate);
+    if (!TEST_CHECK(input_ring && output_ring)) {
+        return;
+    }
+
+    // The enhancement side attaches as in main's ShmStream.
+    auto enhancer_input = ShmRing::Open(input_name);
+    auto enhancer_output = ShmRing::Open(output_name);
+    if (!TEST_CHECK(enhancer_input && enhancer_output)) {
+        return;
+    }
+    TrtExecuteConfig config;
+    config.report_stages = false;
+    TrtExecutor executor(config, MakeEngine());
+    auto input_stream = std::make_shared<ShmInputStream>(VoiceFileInputConfig(), enhancer_input, &executor);
+    executor.SetInputStream(input_stream);
+    executor.SetOutputHandler(std::make_shared<ShmOutputHandler>(input_stream, enhancer_output));
+
+    // Odd sized writes, waiting for room, so the ring wraps at every position and never overruns.
+    std::thread producer([&]() {
+        size_t pos = 0;
+        size_t chunk = 1;
+        while (pos < signal.size()) {
+            const auto count = std::min(chunk, signal.size() - pos);
+            if (!input_ring->WaitSpace(count, kWaitMs)) {
+                break;
+            }
+            pos += input_ring->Write(signal.data() + pos, count);
+            chunk = chunk % 97 + 13;
+        }
+        input_ring->Close();
+    });
+    std::vector<float> received;
+    std::thread consumer([&]() {
+        std::vector<float> buffer(kInputCapacity);
+        for (;;) {
+            const auto pos = output_ring->ReadPosition();
+            output_ring->WaitData(pos + 1, kWaitMs);
+            const auto closed = output_ring->IsClosed();
+            const auto available = static_cast<size_t>(output_ring->WritePosition() - pos);
+            if (closed && available == 0) {
+                break;
+            }
+            const auto count = output_ring->Read(buffer.data(), std::min(available, buffer.size()));
+            received.insert(received.end(), buffer.begin(), buffer.begin() + count);
+        }
+    });
+    TEST_CHECK(executor.Process());
+    enhancer_output->Close();
+    producer.join();
+    consumer.join();
+
+    TEST_CHECK(input_ring->WritePosition() == kSignalSize);
+    TEST_CHECK(input_ring->WritePosition() > 8 * input_ring->Capacity());
+    TEST_CHECK(input_ring->Overruns() == 0);
+    TEST_CHECK(input_ring->Underruns() == 0);
+    TEST_CHECK(output_ring->Overruns() == 0);
+    TEST_CHECK(output_ring->Underruns() == 0);
+
+    const auto hop = input_stream->Frontend().HopSize();
+    const auto reference = Reference(signal);
+    TEST_CHECK(received.size() % hop == 0);
+    TEST_CHECK(received.size() == (kSignalSize + hop - 1) / hop * hop + hop);
+    TEST_CHECK(received.size() == reference.size());
+    for (size_t i = 0; i < std::min(received.size(), reference.size()); ++i) {
+        TEST_CHECK_NEAR(received[i], reference[i], 1e-4f);
+    }
+}
+
+}
+
+int main()
+{
+    TestPositions();
+    TestWakeups();
+    TestVersionChecks();
+    TestStream();
+    return TEST_RESULT();
+}
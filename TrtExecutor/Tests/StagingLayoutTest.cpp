@@ -0,0 +1,139 @@
+// StagingLayoutTest.cpp: Offsets, alignment, region sizes and view bounds of samplesCommon::StagingLayout
+//
+
+#include <cstddef>
+#include <random>
+#include <sstream>
+#include <vector>
+
+#include "common/staging.h"
+#include "TestCheck.h"
+
+
+namespace {
+
+using samplesCommon::StagingLayout;
+
+size_t AlignUp(size_t bytes, size_t alignment)
+{
+    return (bytes + alignment - 1) / alignment * alignment;
+}
+
+//!
+//! \brief The invariants every layout keeps, whatever the sizes and directions.
+//!
+void CheckInvariants(const StagingLayout &layout, const std::vector<size_t> &bytes, const std::vector<bool> &is_input,
+                     size_t alignment)
+{
+    TEST_CHECK(layout.nbBindings() == static_cast<int>(bytes.size()));
+    TEST_CHECK(layout.alignment() == alignment);
+    TEST_CHECK(layout.inputBytes() % alignment == 0);
+    TEST_CHECK(layout.outputBytes() % alignment == 0);
+
+    size_t input_end = 0;
+    size_t output_end = 0;
+    for (int i = 0; i < layout.nbBindings(); ++i) {
+        const auto &view = layout.view(i);
+        TEST_CHECK(view.isInput == is_input[i]);
+        TEST_CHECK(view.bytes == bytes[i]);
+        TEST_CHECK(view.offset % alignment == 0);
+
+        // Packed in binding order: each view starts where the previous one of its region ends, aligned.
+        auto &end = view.isInput ? input_end : output_end;
+        TEST_CHECK(view.offset == end);
+        end = view.offset + AlignUp(view.bytes, alignment);
+        TEST_CHECK(view.offset + view.bytes <= (view.isInput ? layout.inputBytes() : layout.outputBytes()));
+    }
+    TEST_CHECK(layout.inputBytes() == input_end);
+    TEST_CHECK(layout.outputBytes() == output_end);
+
+    // Resolved views lie in their region and do not overlap.
+    std::vector<char> input(layout.inputBytes() + 1);
+    std::vector<char> output(layout.outputBytes() + 1);
+    for (int i = 0; i < layout.nbBindings(); ++i) {
+        const auto &view = layout.view(i);
+        auto *base = view.isInput ? input.data() : output.data();
+        auto *address = static_cast<char *>(layout.resolve(i, input.data(), output.data()));
+        TEST_CHECK(address == base + view.offset);
+        for (int j = 0; j < i; ++j) {
+            const auto &other = layout.view(j);
+            if (other.isInput == view.isInput && other.bytes && view.bytes) {
+                TEST_CHECK(other.offset + other.bytes <= view.offset || view.offset + view.bytes <= other.offset);
+            }
+        }
+    }
+}
+
+void TestMixedBindings()
+{
+    // An NSNet-like context: a float feature, a half mask, GRU states both ways and an odd-sized extra.
+    const std::vector<size_t> bytes = {257 * 4, 400 * 4, 400 * 4, 257 * 2, 400 * 4, 400 * 4, 3};
+    const std::vector<bool> is_input = {true, true, true, false, false, false, true};
+    const StagingLayout layout(bytes, is_input, 64);
+    CheckInvariants(layout, bytes, is_input, 64);
+
+    TEST_CHECK(layout.view(0).offset == 0);
+    TEST_CHECK(layout.view(1).offset == 1088);
+    TEST_CHECK(layout.view(2).offset == 2688);
+    TEST_CHECK(layout.view(6).offset == 4288);
+    TEST_CHECK(layout.inputBytes() == 4352);
+    TEST_CHECK(layout.view(3).offset == 0);
+    TEST_CHECK(layout.view(4).offset == 576);
+    TEST_CHECK(layout.view(5).offset == 2176);
+    TEST_CHECK(layout.outputBytes() == 3776);
+
+    std::ostringstream dump;
+    layout.dump(dump, {"input", "h1_in", "h2_in", "output", "h1_out", "h2_out"});
+    TEST_CHECK(dump.str().find("inputs 4352 bytes, outputs 3776 bytes, aligned to 64") != std::string::npos);
+    TEST_CHECK(dump.str().find("[3] output: output +0, 514 bytes") != std::string::npos);
+    TEST_CHECK(dump.str().find("[6] : input +4288, 3 bytes") != std::string::npos);
+}
+
+void TestEdgeCases()
+{
+    const StagingLayout empty;
+    TEST_CHECK(empty.nbBindings() == 0);
+    TEST_CHECK(empty.inputBytes() == 0 && empty.outputBytes() == 0);
+
+    // Byte alignment packs tight, empty bindings take no room.
+    const std::vector<size_t> bytes = {5, 0, 3, 7, 0};
+    const std::vector<bool> is_input = {true, true, true, false, false};
+    const StagingLayout tight(bytes, is_input, 1);
+    CheckInvariants(tight, bytes, is_input, 1);
+    TEST_CHECK(tight.view(2).offset == 5);
+    TEST_CHECK(tight.inputBytes() == 8 && tight.outputBytes() == 7);
+
+    // Only outputs: the input region is empty.
+    const StagingLayout outputs({16, 17}, {false, false}, 16);
+    CheckInvariants(outputs, {16, 17}, {false, false}, 16);
+    TEST_CHECK(outputs.inputBytes() == 0 && outputs.outputBytes() == 48);
+}
+
+void TestRandomLayouts()
+{
+    std::mt19937 rng(20260101);
+    std::uniform_int_distribution<size_t> size(0, 5000);
+    std::uniform_int_distribution<int> count(1, 12);
+    for (const size_t alignment : {1, 2, 16, 64, 256, 4096}) {
+        for (int round = 0; round < 50; ++round) {
+            const auto n = count(rng);
+            std::vector<size_t> bytes(n);
+            std::vector<bool> is_input(n);
+            for (int i = 0; i < n; ++i) {
+                bytes[i] = size(rng);
+                is_input[i] = rng() & 1;
+            }
+            CheckInvariants(StagingLayout(bytes, is_input, alignment), bytes, is_input, alignment);
+        }
+    }
+}
+
+}
+
+int main()
+{
+    TestMixedBindings();
+    TestEdgeCases();
+    TestRandomLayouts();
+    return TEST_RESULT();
+}
@@ -0,0 +1,408 @@
+// StreamStateTest.cpp: Snapshot, restore, reset and migration of a stream running a main and an added model
+//
+// usage: StreamStateTest spec-file, the stand-in of data/standin_wide_state.standin, added to a main model.
+//
+// The stand-in state counts the frames of the stream, so after n frames every state float of both models is n.
+// Frame boundaries seen from TryTake check that the recurrent part of a snapshot covers the state of both
+// models, that restoring a state of the main model only resets both, and that restoring a snapshot brings
+// both back. A stream serialized halfway and restored into another executor must go on with the outputs of
+// an uninterrupted run, malformed and other-version blobs must be refused, and StreamStateStore must evict
+// the least recently used idle states and bring them back intact.
+
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "StandInBackend.h"
+#include "TestCheck.h"
+#include "TrtExecutor.h"
+
+
+namespace {
+
+constexpr int kFrames = 8;
+constexpr int kMigrateFrame = 5;
+constexpr int kFeatureSize = 8;
+constexpr size_t kMainStateFloats = 4;
+constexpr size_t kAddedStateFloats = 6;
+
+std::shared_ptr<InferEngine> MakeEngine()
+{
+    StandInSpec spec;
+    const auto parsed = spec.Parse("standin 1\ninput input 1 1 8\nstate h_in h_out 1 1 4\noutput output 1 1 8\n"
+                                   "transform scale 0.5\n");
+    return parsed ? std::make_shared<StandInEngine>(spec) : nullptr;
+}
+
+//!
+//! \brief Checks the snapshot taken at a frame boundary holds both states, all equal to count.
+//!
+bool CheckSnapshot(const TrtExecutor &executor, float count, int frame)
+{
+    StreamState state;
+    executor.SnapshotState(state);
+    if (!TEST_CHECK(state.recurrent.size() == kMainStateFloats + kAddedStateFloats)) {
+        return false;
+    }
+    auto ok = true;
+    for (const auto value : state.recurrent) {
+        ok = ok && value == count;
+    }
+    if (!ok) {
+        std::cerr << "  after frame " << frame << ", expected every state float to be " << count << std::endl;
+    }
+    return TEST_CHECK(ok);
+}
+
+class TestInputStream : public TrtInputStream
+{
+public:
+    explicit TestInputStream(TrtExecutor *executor) : executor_(executor)
+    {
+    }
+
+    infer::Dims GetDynamicDim(const char *input_name) override
+    {
+        return infer::Dims3(1, 1, kFeatureSize);
+    }
+
+    std::vector<std::string> GetInputTensorNames(const InferEngine &engine) override
+    {
+        return {"input", "h_in"};
+    }
+
+    bool TryTake(const std::vector<void *> &host_buffer, const std::vector<size_t> &sizes) override
+    {
+        if (frames_ == kFrames) {
+            executor_->Terminate();
+            return false;
+        }
+        if (frames_ == 3) {
+            CheckSnapshot(*executor_, 3.0f, frames_);
+            executor_->SnapshotState(saved_);
+
+            // A state of the main model alone does not fit, the stream restarts in both models.
+            StreamState main_only = saved_;
+            main_only.recurrent.resize(kMainStateFloats);
+            TEST_CHECK(!executor_->RestoreState(main_only));
+            CheckSnapshot(*executor_, 0.0f, frames_);
+        } else if (frames_ == 4) {
+            CheckSnapshot(*executor_, 1.0f, frames_);
+            TEST_CHECK(executor_->RestoreState(saved_));
+            CheckSnapshot(*executor_, 3.0f, frames_);
+        } else if (frames_ == 5) {
+            CheckSnapshot(*executor_, 4.0f, frames_);
+        }
+        auto *feature = static_cast<float *>(host_buffer[0]);
+        std::fill(feature, feature + sizes[0] / sizeof(float), 1.0f);
+        ++frames_;
+        return true;
+    }
+
+private:
+    TrtExecutor *executor_;
+    StreamState saved_;
+    int frames_ = 0;
+};
+
+class TestOutputHandler : public TrtOutputHandler
+{
+public:
+    std::vector<std::string> GetOutputTensorNames(const InferEngine &engine) override
+    {
+        return {"output", "h_out"};
+    }
+
+    void SetTensorDim(const char *output_name, const infer::Dims &dims) override
+    {
+    }
+
+    void Consume(const std::vector<void *> &host_buffer, const std::vector<size_t> &sizes) override
+    {
+        ++frames;
+    }
+
+    int frames = 0;
+};
+
+
+//!
+//! \brief Feeds frames first to last - 1, frame f filled with f + 1, and stops at last, or at stop_at after
+//!        serializing the state of the stream into blob.
+//!
+class SequenceInputStream : public TrtInputStream
+{
+public:
+    SequenceInputStream(TrtExecutor *executor, int first, int last, std::vector<char> *blob = nullptr)
+        : executor_(executor), frame_(first), last_(last), blob_(blob)
+    {
+    }
+
+    infer::Dims GetDynamicDim(const char *input_name) override
+    {
+        return infer::Dims3(1, 1, kFeatureSize);
+    }
+
+    std::vector<std::string> GetInputTensorNames(const InferEngine &engine) override
+    {
+        return {"input", "h_in"};
+    }
+
+    bool TryTake(const std::vector<void *> &host_buffer, const std::vector<size_t> &sizes) override
+    {
+        if (frame_ == last_) {
+            if (blob_) {
+                StreamState state;
+                executor_->SnapshotState(state);
+                state.SerializeTo(*blob_);
+            }
+            executor_->Terminate();
+            return false;
+        }
+        auto *feature = static_cast<float *>(host_buffer[0]);
+        std::fill(feature, feature + sizes[0] / sizeof(float), static_cast<float>(frame_ + 1));
+        ++frame_;
+        return true;
+    }
+
+private:
+    TrtExecutor *executor_;
+    int frame_;
+    int last_;
+    std::vector<char> *blob_;
+};
+
+//!
+//! \brief Keeps a copy of every output of every frame, the mask and the state of the main model.
+//!
+class RecordingOutputHandler : public TrtOutputHandler
+{
+public:
+    std::vector<std::string> GetOutputTensorNames(const InferEngine &engine) override
+    {
+        return {"output", "h_out"};
+    }
+
+    void SetTensorDim(const char *output_name, const infer::Dims &dims) override
+    {
+    }
+
+    void Consume(const std::vector<void *> &host_buffer, const std::vector<size_t> &sizes) override
+    {
+        for (size_t i = 0; i < host_buffer.size(); ++i) {
+            const auto *values = static_cast<const float *>(host_buffer[i]);
+            outputs.emplace_back(values, values + sizes[i] / sizeof(float));
+        }
+    }
+
+    std::vector<std::vector<float>> outputs;
+};
+
+//!
+//! \brief Run frames [first, last) of the stream, from state if not nullptr, serializing the state at last into
+//!        blob if not nullptr. Returns the outputs.
+//!
+std::vector<std::vector<float>> RunFrames(const std::string &spec_path, int first, int last,
+                                          const StreamState *state, std::vector<char> *blob)
+{
+    TrtExecuteConfig config;
+    config.report_stages = false;
+    TrtExecutor executor(config, MakeEngine());
+    auto output = std::make_shared<RecordingOutputHandler>();
+    executor.SetInputStream(std::make_shared<SequenceInputStream>(&executor, first, last, blob));
+    executor.SetOutputHandler(output);
+    if (!TEST_CHECK(executor.AddModel(spec_path))) {
+        return {};
+    }
+    if (state) {
+        TEST_CHECK(executor.RestoreState(*state));
+    }
+    TEST_CHECK(executor.Process());
+    return output->outputs;
+}
+
+//!
+//! \brief Serialize a stream halfway, restore it into a fresh executor as another process would, and check the
+//!        outputs, the state fed back included, against a run that was not interrupted.
+//!
+void TestMigration(const std::string &spec_path)
+{
+    const auto reference = RunFrames(spec_path, 0, kFrames, nullptr, nullptr);
+    std::vector<char> blob;
+    auto outputs = RunFrames(spec_path, 0, kMigrateFrame, nullptr, &blob);
+
+    StreamState state;
+    if (!TEST_CHECK(state.DeserializeFrom(blob.data(), blob.size()))) {
+        return;
+    }
+    TEST_CHECK(state.recurrent.size() == kMainStateFloats + kAddedStateFloats);
+    const auto rest = RunFrames(spec_path, kMigrateFrame, kFrames, &state, nullptr);
+    outputs.insert(outputs.end(), rest.begin(), rest.end());
+    TEST_CHECK(outputs.size() == 2 * kFrames);
+    TEST_CHECK(outputs == reference);
+}
+
+//!
+//! \brief Blobs cut short, overlong, with a wrong magic, wrong counts or of another version are refused.
+//!
+void TestMalformedBlobs()
+{
+    StreamState state;
+    state.frame_index = 7;
+    state.recurrent.assign(kMainStateFloats, 1.0f);
+    state.mu.assign(3, 0.5);
+    state.sigma_square.assign(3, 2.0);
+    state.overlap.assign(5, 0.25f);
+    std::vector<char> blob;
+    state.SerializeTo(blob);
+    TEST_CHECK(blob.size() == state.SerializedSize());
+
+    StreamState restored;
+    TEST_CHECK(restored.DeserializeFrom(blob.data(), blob.size()));
+    TEST_CHECK(restored.frame_index == 7 && restored.recurrent == state.recurrent && restored.mu == state.mu &&
+               restored.sigma_square == state.sigma_square && restored.overlap == state.overlap &&
+               restored.mask.empty() && restored.mask_age == -1);
+
+    TEST_CHECK(!restored.DeserializeFrom(blob.data(), 0));
+    TEST_CHECK(!restored.DeserializeFrom(blob.data(), 8));
+    TEST_CHECK(!restored.DeserializeFrom(blob.data(), blob.size() - 1));
+    auto longer = blob;
+    longer.push_back(0);
+    TEST_CHECK(!restored.DeserializeFrom(longer.data(), longer.size()));
+
+    // The header starts with the magic and the version, then the frame index and the array counts.
+    auto bad_magic = blob;
+    bad_magic[0] ^= 0x5a;
+    TEST_CHECK(!restored.DeserializeFrom(bad_magic.data(), bad_magic.size()));
+    auto bad_count = blob;
+    uint32_t count;
+    memcpy(&count, bad_count.data() + 16, sizeof(count));
+    TEST_CHECK(count == kMainStateFloats);
+    ++count;
+    memcpy(bad_count.data() + 16, &count, sizeof(count));
+    TEST_CHECK(!restored.DeserializeFrom(bad_count.data(), bad_count.size()));
+
+    auto other_version = blob;
+    uint32_t version;
+    memcpy(&version, other_version.data() + 4, sizeof(version));
+    ++version;
+    memcpy(other_version.data() + 4, &version, sizeof(version));
+    TEST_CHECK(!restored.DeserializeFrom(other_version.data(), other_version.size()));
+}
+
+//!
+//! \brief Hand stream id back to store with every state float set to value.
+//!
+void PutState(StreamStateStore &store, uint64_t id, float value)
+{
+    StreamState state;
+    store.Take(id, state);
+    state.frame_index = static_cast<int64_t>(value);
+    state.recurrent.assign(kMainStateFloats, value);
+    state.overlap.assign(2, value);
+    store.Put(id, state);
+}
+
+bool HasState(StreamStateStore &store, uint64_t id, float value)
+{
+    StreamState state;
+    store.Take(id, state);
+    const auto ok = state.frame_index == static_cast<int64_t>(value) &&
+                    state.recurrent == std::vector<float>(kMainStateFloats, value) &&
+                    state.overlap == std::vector<float>(2, value);
+    store.Put(id, state);
+    return ok;
+}
+
+//!
+//! \brief Beyond its capacity the store evicts the least recently used idle state, taken states stay.
+//!
+void TestStateStore()
+{
+    StreamStateStore store(2);
+    PutState(store, 1, 1.0f);
+    PutState(store, 2, 2.0f);
+    TEST_CHECK(store.ResidentCount() == 2 && store.EvictionCount() == 0);
+    PutState(store, 3, 3.0f);
+    TEST_CHECK(store.ResidentCount() == 2 && store.EvictionCount() == 1);
+
+    // 1 went first; brought back, it pushes out 3, the least recently used now.
+    TEST_CHECK(HasState(store, 2, 2.0f));
+    TEST_CHECK(store.EvictionCount() == 1);
+    TEST_CHECK(HasState(store, 1, 1.0f));
+    TEST_CHECK(store.EvictionCount() == 2);
+    TEST_CHECK(HasState(store, 3, 3.0f));
+    TEST_CHECK(store.EvictionCount() == 3);
+
+    // Taken states are never evicted, so with both resident streams taken a new one goes once idle.
+    StreamState first;
+    StreamState second;
+    store.Take(1, first);
+    store.Take(3, second);
+    PutState(store, 4, 4.0f);
+    TEST_CHECK(store.ResidentCount() == 2 && store.EvictionCount() == 4);
+    store.Put(1, first);
+    store.Put(3, second);
+    TEST_CHECK(HasState(store, 1, 1.0f) && HasState(store, 3, 3.0f));
+    TEST_CHECK(store.EvictionCount() == 4);
+    TEST_CHECK(HasState(store, 4, 4.0f));
+
+    // A stream removed while taken is dropped when handed back, and starts cleared when seen again.
+    StreamState removed;
+    store.Take(4, removed);
+    store.Remove(4);
+    store.Put(4, removed);
+    TEST_CHECK(store.ResidentCount() == 1);
+    StreamState fresh;
+    store.Take(4, fresh);
+    TEST_CHECK(fresh.frame_index == -1 && fresh.recurrent.empty());
+    store.Remove(4);
+    TEST_CHECK(store.ResidentCount() == 1);
+
+    // An added stream starts from the state it was added with, and counts as its most recently used.
+    StreamState reserved;
+    reserved.Reserve(kMainStateFloats, 16, 2, 0);
+    store.Add(5, std::move(reserved));
+    TEST_CHECK(store.ResidentCount() == 2 && store.EvictionCount() == 5);
+    PutState(store, 6, 6.0f);
+    TEST_CHECK(store.EvictionCount() == 6);
+    StreamState added;
+    store.Take(5, added);
+    TEST_CHECK(added.frame_index == -1 && added.recurrent.empty() && added.mu.capacity() >= 16);
+    store.Put(5, added);
+    TEST_CHECK(HasState(store, 1, 1.0f) && HasState(store, 6, 6.0f));
+}
+
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 2) {
+        std::cerr << "usage: " << argv[0] << " spec-file" << std::endl;
+        return 2;
+    }
+    auto engine = MakeEngine();
+    if (!TEST_CHECK(engine)) {
+        return 1;
+    }
+
+    TrtExecuteConfig config;
+    config.report_stages = false;
+    TrtExecutor executor(config, engine);
+    auto output = std::make_shared<TestOutputHandler>();
+    executor.SetInputStream(std::make_shared<TestInputStream>(&executor));
+    executor.SetOutputHandler(output);
+    if (!TEST_CHECK(executor.AddModel(argv[1]))) {
+        return 1;
+    }
+
+    TEST_CHECK(executor.Process());
+    TEST_CHECK(output->frames == kFrames);
+
+    TestMigration(argv[1]);
+    TestMalformedBlobs();
+    TestStateStore();
+    return TEST_RESULT();
+}
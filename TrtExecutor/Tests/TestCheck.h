@@ -0,0 +1,37 @@
+// TestCheck.h: Minimal checks for the executor tests, each test is a plain executable run by CTest
+//
+
+#pragma once
+
+#include <cmath>
+#include <iostream>
+
+
+namespace test {
+
+//!
+//! \brief Failed checks so far, the exit code of a test is TEST_RESULT().
+//!
+inline int &Failures()
+{
+    static int failures = 0;
+    return failures;
+}
+
+inline bool Check(bool ok, const char *expr, const char *file, int line)
+{
+    if (!ok) {
+        std::cerr << file << ":" << line << ": check failed: " << expr << std::endl;
+        ++Failures();
+    }
+    return ok;
+}
+
+}
+
+#define TEST_CHECK(cond) test::Check(static_cast<bool>(cond), #cond, __FILE__, __LINE__)
+
+#define TEST_CHECK_NEAR(a, b, tolerance) \
+    test::Check(std::fabs((a) - (b)) <= (tolerance), #a " ~ " #b, __FILE__, __LINE__)
+
+#define TEST_RESULT() (test::Failures() == 0 ? 0 : 1)
@@ -0,0 +1,104 @@
+#!/usr/bin/env python3
+# make_nsnet_reference.py: Build a small NSNet-shaped ONNX model, export its weights and ONNX Runtime outputs
+#
+# Writes, next to this script:
+#   nsnet_small.nsnw  the FC/GRU stack in the NSNet weight format of NsNetCpuBackend.h
+#   nsnet_small.ref   the reference run, little-endian: magic "NSNR", uint32 version (1), uint32 frame count,
+#                     uint32 input size, uint32 output size, uint32 state count, uint32 size per state, then per
+#                     frame float input[input size], float output[output size] and float h<k>_out[state size]
+#                     for each state k in order.
+#
+# Layer sizes are not multiples of the SIMD width, so the kernel tails are covered. The first GRU computes the
+# reset gate before the linear transform, the second after (linear_before_reset), so both GRU kernels are too.
+#
+# Needs numpy, onnx and onnxruntime. Re-run only to change the model, the outputs are checked in.
+
+import os
+import struct
+
+import numpy as np
+import onnx
+import onnxruntime
+from onnx import TensorProto, helper, numpy_helper
+
+INPUT_SIZE = 13
+DENSE_SIZE = 20
+HIDDEN_SIZE = 24
+FRAMES = 32
+SEED = 20260101
+
+DENSE, GRU = 0, 1
+NONE, RELU, SIGMOID = 0, 1, 2
+
+
+def main():
+    rng = np.random.default_rng(SEED)
+
+    def weights(*shape):
+        return (rng.standard_normal(shape) * 0.4).astype(np.float32)
+
+    dense_w, dense_b = weights(DENSE_SIZE, INPUT_SIZE), weights(DENSE_SIZE)
+    gru = []
+    for input_size, linear_before_reset in ((DENSE_SIZE, 0), (HIDDEN_SIZE, 1)):
+        gru.append({
+            'w': weights(3 * HIDDEN_SIZE, input_size),
+            'r': weights(3 * HIDDEN_SIZE, HIDDEN_SIZE),
+            'wb': weights(3 * HIDDEN_SIZE),
+            'rb': weights(3 * HIDDEN_SIZE),
+            'lbr': linear_before_reset,
+        })
+    out_w, out_b = weights(INPUT_SIZE, HIDDEN_SIZE), weights(INPUT_SIZE)
+
+    # The ONNX graph runs the whole sequence [frames, 1, features] at once; Y of a GRU is its state per frame.
+    inits = [numpy_helper.from_array(dense_w.T.copy(), 'dense_w'), numpy_helper.from_array(dense_b, 'dense_b'),
+             numpy_helper.from_array(out_w.T.copy(), 'out_w'), numpy_helper.from_array(out_b, 'out_b')]
+    nodes = [helper.make_node('MatMul', ['input', 'dense_w'], ['dense_mm']),
+             helper.make_node('Add', ['dense_mm', 'dense_b'], ['dense_add']),
+             helper.make_node('Relu', ['dense_add'], ['dense'])]
+    x = 'dense'
+    for k, layer in enumerate(gru):
+        inits += [numpy_helper.from_array(layer['w'][None], f'gru{k}_w'),
+                  numpy_helper.from_array(layer['r'][None], f'gru{k}_r'),
+                  numpy_helper.from_array(np.concatenate([layer['wb'], layer['rb']])[None], f'gru{k}_b')]
+        nodes += [helper.make_node('GRU', [x, f'gru{k}_w', f'gru{k}_r', f'gru{k}_b'], [f'gru{k}_y'],
+                                   hidden_size=HIDDEN_SIZE, linear_before_reset=layer['lbr']),
+                  helper.make_node('Squeeze', [f'gru{k}_y', 'axis1'], [f'h{k}'])]
+        x = f'h{k}'
+    inits.append(numpy_helper.from_array(np.array([1], dtype=np.int64), 'axis1'))
+    nodes += [helper.make_node('MatMul', [x, 'out_w'], ['out_mm']),
+              helper.make_node('Add', ['out_mm', 'out_b'], ['out_add']),
+              helper.make_node('Sigmoid', ['out_add'], ['output'])]
+    graph = helper.make_graph(
+        nodes, 'nsnet_small',
+        [helper.make_tensor_value_info('input', TensorProto.FLOAT, [FRAMES, 1, INPUT_SIZE])],
+        [helper.make_tensor_value_info('output', TensorProto.FLOAT, [FRAMES, 1, INPUT_SIZE]),
+         helper.make_tensor_value_info('h0', TensorProto.FLOAT, [FRAMES, 1, HIDDEN_SIZE]),
+         helper.make_tensor_value_info('h1', TensorProto.FLOAT, [FRAMES, 1, HIDDEN_SIZE])],
+        inits)
+    model = helper.make_model(graph, opset_imports=[helper.make_opsetid('', 14)], ir_version=8)
+    onnx.checker.check_model(model)
+
+    features = rng.standard_normal((FRAMES, 1, INPUT_SIZE)).astype(np.float32)
+    session = onnxruntime.InferenceSession(model.SerializeToString(), providers=['CPUExecutionProvider'])
+    output, h0, h1 = session.run(None, {'input': features})
+
+    here = os.path.dirname(os.path.abspath(__file__))
+    with open(os.path.join(here, 'nsnet_small.nsnw'), 'wb') as f:
+        f.write(struct.pack('<4I', 0x574e534e, 1, INPUT_SIZE, 4))
+        f.write(struct.pack('<4I', DENSE, INPUT_SIZE, DENSE_SIZE, RELU))
+        f.write(dense_w.tobytes() + dense_b.tobytes())
+        for layer in gru:
+            f.write(struct.pack('<4I', GRU, layer['w'].shape[1], HIDDEN_SIZE, layer['lbr']))
+            f.write(layer['w'].tobytes() + layer['r'].tobytes() + layer['wb'].tobytes() + layer['rb'].tobytes())
+        f.write(struct.pack('<4I', DENSE, HIDDEN_SIZE, INPUT_SIZE, SIGMOID))
+        f.write(out_w.tobytes() + out_b.tobytes())
+
+    with open(os.path.join(here, 'nsnet_small.ref'), 'wb') as f:
+        f.write(struct.pack('<7I', 0x524e534e, 1, FRAMES, INPUT_SIZE, INPUT_SIZE, 2, HIDDEN_SIZE))
+        for t in range(FRAMES):
+            for tensor in (features, output, h0, h1):
+                f.write(tensor.reshape(FRAMES, -1)[t].astype('<f4').tobytes())
+
+
+if __name__ == '__main__':
+    main()
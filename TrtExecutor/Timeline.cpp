@@ -0,0 +1,224 @@
+// Timeline.cpp: Impl
+//
+
+#include "Timeline.h"
+
+#include <cinttypes>
+#include <csignal>
+#include <cstdio>
+#include <iostream>
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+
+std::atomic<bool> Timeline::enabled_{false};
+std::atomic<bool> Timeline::dump_requested_{false};
+
+namespace {
+
+struct ThreadState
+{
+    void *buffer = nullptr;
+    const char *name = nullptr;
+    uint32_t stream = 0;
+    int64_t frame = -1;
+};
+
+thread_local ThreadState g_thread;
+
+// Polling period of the dump thread for SIGUSR1 requests and Disable().
+constexpr auto kDumpPoll = std::chrono::milliseconds(100);
+
+void WriteJsonString(FILE *file, const char *text)
+{
+    fputc('"', file);
+    for (const auto *c = text ? text : ""; *c; ++c) {
+        if (*c == '"' || *c == '\\') {
+            fputc('\\', file);
+        }
+        fputc(static_cast<unsigned char>(*c) < 0x20 ? ' ' : *c, file);
+    }
+    fputc('"', file);
+}
+
+}
+
+Timeline &Timeline::Instance()
+{
+    // Leaked, threads may still record while static destructors run.
+    static auto *timeline = new Timeline();
+    return *timeline;
+}
+
+bool Timeline::Enable(const std::string &path, size_t events_per_thread)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (IsEnabled()) {
+        return false;
+    }
+
+    size_t capacity = 1;
+    while (capacity < events_per_thread) {
+        capacity <<= 1;
+    }
+    events_per_thread_ = capacity;
+    path_ = path;
+    origin_ns_ = NowNs();
+    stop_.store(false, std::memory_order_relaxed);
+    dump_thread_ = std::thread(&Timeline::DumpLoop, this);
+    std::signal(SIGUSR1, [](int) { dump_requested_.store(true, std::memory_order_relaxed); });
+    enabled_.store(true, std::memory_order_relaxed);
+    std::cout << "Info: recording timeline to " << path_ << ", SIGUSR1 dumps it." << std::endl;
+    return true;
+}
+
+void Timeline::Disable()
+{
+    if (!enabled_.exchange(false, std::memory_order_relaxed)) {
+        return;
+    }
+    stop_.store(true, std::memory_order_relaxed);
+    if (dump_thread_.joinable()) {
+        dump_thread_.join();
+    }
+    std::signal(SIGUSR1, SIG_DFL);
+    Dump();
+}
+
+void Timeline::SetThreadName(const char *name)
+{
+    g_thread.name = name;
+    if (g_thread.buffer) {
+        static_cast<ThreadBuffer *>(g_thread.buffer)->name.store(name, std::memory_order_relaxed);
+    }
+}
+
+void Timeline::SetThreadStream(uint32_t stream)
+{
+    g_thread.stream = stream;
+}
+
+void Timeline::SetThreadFrame(int64_t frame)
+{
+    g_thread.frame = frame;
+}
+
+Timeline::ThreadBuffer *Timeline::CurrentBuffer()
+{
+    if (g_thread.buffer) {
+        return static_cast<ThreadBuffer *>(g_thread.buffer);
+    }
+
+    // First event of the thread: the only time it takes the lock.
+    auto &timeline = Instance();
+    std::lock_guard<std::mutex> lock(timeline.mutex_);
+    std::unique_ptr<ThreadBuffer> buffer(new ThreadBuffer());
+    buffer->events.reset(new Event[timeline.events_per_thread_]);
+    buffer->mask = timeline.events_per_thread_ - 1;
+    buffer->tid = static_cast<int>(syscall(SYS_gettid));
+    buffer->name.store(g_thread.name, std::memory_order_relaxed);
+    g_thread.buffer = buffer.get();
+    timeline.buffers_.push_back(std::move(buffer));
+    return static_cast<ThreadBuffer *>(g_thread.buffer);
+}
+
+void Timeline::Record(const char *category, const char *name, uint64_t start_ns, uint64_t end_ns)
+{
+    if (!IsEnabled()) {
+        return;
+    }
+
+    auto &buffer = *CurrentBuffer();
+    const auto index = buffer.head.load(std::memory_order_relaxed);
+    auto &event = buffer.events[index & buffer.mask];
+    // Zero marks the slot as being written, a reader that saw the previous sequence discards its copy.
+    event.seq.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    event.category.store(category, std::memory_order_relaxed);
+    event.name.store(name, std::memory_order_relaxed);
+    event.start_ns.store(start_ns, std::memory_order_relaxed);
+    event.dur_ns.store(end_ns > start_ns ? end_ns - start_ns : 0, std::memory_order_relaxed);
+    event.frame.store(g_thread.frame, std::memory_order_relaxed);
+    event.stream.store(g_thread.stream, std::memory_order_relaxed);
+    event.seq.store(index + 1, std::memory_order_release);
+    buffer.head.store(index + 1, std::memory_order_release);
+}
+
+bool Timeline::Dump()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (path_.empty()) {
+        return false;
+    }
+
+    const auto tmp_path = path_ + ".tmp";
+    auto *file = fopen(tmp_path.c_str(), "w");
+    if (!file) {
+        std::cerr << "Error: Unable to write timeline: " << tmp_path << std::endl;
+        return false;
+    }
+
+    const auto pid = static_cast<int>(getpid());
+    uint64_t written = 0;
+    auto first = true;
+    fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", file);
+    for (const auto &buffer : buffers_) {
+        if (const auto *name = buffer->name.load(std::memory_order_relaxed)) {
+            fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":",
+                    first ? "" : ",\n", pid, buffer->tid);
+            WriteJsonString(file, name);
+            fputs("}}", file);
+            first = false;
+        }
+
+        const auto head = buffer->head.load(std::memory_order_acquire);
+        const auto capacity = buffer->mask + 1;
+        for (auto index = head > capacity ? head - capacity : 0; index < head; ++index) {
+            const auto &event = buffer->events[index & buffer->mask];
+            const auto seq = event.seq.load(std::memory_order_acquire);
+            if (seq != index + 1) {
+                continue;
+            }
+            const auto *category = event.category.load(std::memory_order_relaxed);
+            const auto *name = event.name.load(std::memory_order_relaxed);
+            const auto start_ns = event.start_ns.load(std::memory_order_relaxed);
+            const auto dur_ns = event.dur_ns.load(std::memory_order_relaxed);
+            const auto frame = event.frame.load(std::memory_order_relaxed);
+            const auto stream = event.stream.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (event.seq.load(std::memory_order_relaxed) != seq) {
+                continue;
+            }
+
+            fputs(first ? "{\"name\":" : ",\n{\"name\":", file);
+            WriteJsonString(file, name);
+            fputs(",\"cat\":", file);
+            WriteJsonString(file, category);
+            const auto ts_ns = start_ns > origin_ns_ ? start_ns - origin_ns_ : 0;
+            fprintf(file, ",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d,"
+                          "\"args\":{\"stream\":%" PRIu32 ",\"frame\":%" PRId64 "}}",
+                    ts_ns / 1000.0, dur_ns / 1000.0, pid, buffer->tid, stream, frame);
+            first = false;
+            ++written;
+        }
+    }
+    fputs("\n]}\n", file);
+    const auto ok = fclose(file) == 0 && rename(tmp_path.c_str(), path_.c_str()) == 0;
+    if (!ok) {
+        std::cerr << "Error: Unable to write timeline: " << path_ << std::endl;
+        return false;
+    }
+    std::cout << "Info: wrote " << written << " timeline events to " << path_ << std::endl;
+    return true;
+}
+
+void Timeline::DumpLoop()
+{
+    while (!stop_.load(std::memory_order_relaxed)) {
+        std::this_thread::sleep_for(kDumpPoll);
+        if (dump_requested_.exchange(false, std::memory_order_relaxed)) {
+            Dump();
+        }
+    }
+}
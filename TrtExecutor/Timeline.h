@@ -0,0 +1,142 @@
+// Timeline.h: Per-thread event recorder exported as a Chrome/Perfetto trace
+//
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+//!
+//! \brief Records complete ("X") events of scopes on every thread and writes them as Chrome trace-event JSON,
+//!        which chrome://tracing and ui.perfetto.dev open.
+//!
+//! \details Every thread writes into its own ring of the last events_per_thread events, without locks or
+//!          read-modify-write atomics; the dump reads the rings concurrently and skips events being
+//!          overwritten (per-event sequence, seqlock style). Events carry the stream and frame set on the
+//!          thread with SetThreadStream/SetThreadFrame. Disabled, a scope costs one relaxed load.
+//!          Once enabled, the trace is written on SIGUSR1 and by Disable().
+//!
+class Timeline
+{
+public:
+    static Timeline &Instance();
+
+    //!
+    //! \brief Start recording, dumps go to path. Returns false if already enabled.
+    //!
+    bool Enable(const std::string &path, size_t events_per_thread = 1 << 16);
+
+    //!
+    //! \brief Stop recording and write the trace a last time.
+    //!
+    void Disable();
+
+    static bool IsEnabled()
+    {
+        return enabled_.load(std::memory_order_relaxed);
+    }
+
+    //!
+    //! \brief Write every event still in the rings. Returns false if the file cannot be written.
+    //!
+    bool Dump();
+
+    //!
+    //! \brief Name of the calling thread in the trace. name must outlive the timeline, e.g. a literal.
+    //!
+    static void SetThreadName(const char *name);
+
+    static void SetThreadStream(uint32_t stream);
+
+    static void SetThreadFrame(int64_t frame);
+
+    //!
+    //! \brief Record an event of the calling thread. category and name must outlive the timeline.
+    //!
+    static void Record(const char *category, const char *name, uint64_t start_ns, uint64_t end_ns);
+
+    static uint64_t NowNs()
+    {
+        return ToNs(std::chrono::steady_clock::now());
+    }
+
+    static uint64_t ToNs(std::chrono::steady_clock::time_point time)
+    {
+        return static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count());
+    }
+
+private:
+    struct Event
+    {
+        std::atomic<uint64_t> seq{0};
+        std::atomic<const char *> category{nullptr};
+        std::atomic<const char *> name{nullptr};
+        std::atomic<uint64_t> start_ns{0};
+        std::atomic<uint64_t> dur_ns{0};
+        std::atomic<int64_t> frame{0};
+        std::atomic<uint32_t> stream{0};
+    };
+
+    struct ThreadBuffer
+    {
+        std::unique_ptr<Event[]> events;
+        size_t mask = 0;
+        std::atomic<uint64_t> head{0};
+        int tid = 0;
+        std::atomic<const char *> name{nullptr};
+    };
+
+    Timeline() = default;
+
+    static ThreadBuffer *CurrentBuffer();
+
+    void DumpLoop();
+
+    static std::atomic<bool> enabled_;
+    static std::atomic<bool> dump_requested_;
+
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<ThreadBuffer>> buffers_;
+    size_t events_per_thread_ = 0;
+    std::string path_;
+    uint64_t origin_ns_ = 0;
+
+    std::thread dump_thread_;
+    std::atomic<bool> stop_{false};
+};
+
+//!
+//! \brief Records the enclosing scope as an event, if the timeline is enabled at construction.
+//!
+class TimelineScope
+{
+public:
+    TimelineScope(const char *category, const char *name)
+        : category_(category), name_(name), start_ns_(Timeline::IsEnabled() ? Timeline::NowNs() : 0)
+    {
+    }
+
+    ~TimelineScope()
+    {
+        if (start_ns_) {
+            Timeline::Record(category_, name_, start_ns_, Timeline::NowNs());
+        }
+    }
+
+private:
+    const char *category_;
+    const char *name_;
+    uint64_t start_ns_;
+};
+
+#define TRT_TIMELINE_CONCAT_(a, b) a##b
+#define TRT_TIMELINE_CONCAT(a, b) TRT_TIMELINE_CONCAT_(a, b)
+#define TRT_TIMELINE_SCOPE(category, name) TimelineScope TRT_TIMELINE_CONCAT(timeline_scope_, __LINE__)(category, name)
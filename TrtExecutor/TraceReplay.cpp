@@ -0,0 +1,172 @@
+// TraceReplay.cpp: Impl
+//
+
+#include "TraceReplay.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+
+TraceReplayInputStream::TraceReplayInputStream(std::shared_ptr<const TensorTraceReader> reader,
+                                               const TraceReplayConfig &config, TrtExecutor *executor)
+    : reader_(std::move(reader)),
+      config_(config),
+      executor_(executor)
+{
+}
+
+infer::Dims TraceReplayInputStream::GetDynamicDim(const char *input_name)
+{
+    for (const auto &tensor : reader_->Inputs()) {
+        if (tensor.name == input_name) {
+            return tensor.dims;
+        }
+    }
+    std::cout << "Warning: " << input_name << " is not in the trace, using the dims of the first input." << std::endl;
+    return reader_->Inputs().front().dims;
+}
+
+std::vector<std::string> TraceReplayInputStream::GetInputTensorNames(const InferEngine &)
+{
+    std::vector<std::string> ret;
+    for (const auto &tensor : reader_->Inputs()) {
+        ret.push_back(tensor.name);
+    }
+    return ret;
+}
+
+bool TraceReplayInputStream::TryTake(const std::vector<void *> &host_buffer, const std::vector<size_t> &sizes)
+{
+    const auto frame = cur_frame_ + 1;
+    if (frame >= static_cast<int64_t>(reader_->FrameCount())) {
+        executor_->Terminate();
+        return false;
+    }
+
+    const auto &inputs = reader_->Inputs();
+    const auto count = config_.feed_states ? inputs.size() : 1;
+    if (host_buffer.size() < count) {
+        std::cerr << "Error: engine takes fewer inputs than the trace has." << std::endl;
+        executor_->Terminate();
+        return false;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        if (sizes[i] != inputs[i].bytes) {
+            std::cerr << "Error: trace tensor " << inputs[i].name << " has " << inputs[i].bytes
+                      << " bytes, the engine binding " << sizes[i] << "." << std::endl;
+            executor_->Terminate();
+            return false;
+        }
+    }
+
+    if (frame == 0) {
+        start_ = std::chrono::steady_clock::now();
+    }
+    if (config_.realtime) {
+        std::this_thread::sleep_until(start_ + std::chrono::nanoseconds(reader_->TimestampNs(frame)));
+    }
+    for (size_t i = 0; i < count; ++i) {
+        memcpy(host_buffer[i], reader_->Data(frame, inputs[i]), inputs[i].bytes);
+    }
+    cur_frame_ = frame;
+    take_time_ = std::chrono::steady_clock::now();
+    return true;
+}
+
+size_t TraceReplayInputStream::PendingFrames() const
+{
+    if (!config_.realtime || cur_frame_ < 0) {
+        return 0;
+    }
+
+    const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_);
+    size_t pending = 0;
+    for (auto frame = static_cast<uint64_t>(cur_frame_) + 1; frame < reader_->FrameCount(); ++frame) {
+        if (reader_->TimestampNs(frame) > static_cast<uint64_t>(elapsed.count())) {
+            break;
+        }
+        ++pending;
+    }
+    return pending;
+}
+
+TraceReplayOutputHandler::TraceReplayOutputHandler(std::shared_ptr<const TensorTraceReader> reader,
+                                                   std::shared_ptr<const TraceReplayInputStream> input,
+                                                   bool compare, float tolerance)
+    : reader_(std::move(reader)),
+      input_(std::move(input)),
+      compare_(compare && reader_->HasOutputs()),
+      tolerance_(tolerance)
+{
+    if (compare && !reader_->HasOutputs()) {
+        std::cout << "Warning: the trace has no recorded outputs, nothing to compare." << std::endl;
+    }
+    latencies_ms_.reserve(reader_->FrameCount());
+}
+
+std::vector<std::string> TraceReplayOutputHandler::GetOutputTensorNames(const InferEngine &)
+{
+    std::vector<std::string> ret;
+    for (const auto &tensor : reader_->Outputs()) {
+        ret.push_back(tensor.name);
+    }
+    return ret;
+}
+
+void TraceReplayOutputHandler::Consume(const std::vector<void *> &host_buffer, const std::vector<size_t> &sizes)
+{
+    last_consume_ = std::chrono::steady_clock::now();
+    if (latencies_ms_.empty()) {
+        first_take_ = input_->TakeTime();
+    }
+    const std::chrono::duration<float, std::milli> latency = last_consume_ - input_->TakeTime();
+    latencies_ms_.push_back(latency.count());
+
+    if (!compare_) {
+        return;
+    }
+    const auto frame = static_cast<uint64_t>(input_->CurFrame());
+    const auto &outputs = reader_->Outputs();
+    double frame_error = 0;
+    for (size_t i = 0; i < outputs.size() && i < host_buffer.size(); ++i) {
+        if (sizes[i] != outputs[i].bytes) {
+            frame_error = INFINITY;
+            continue;
+        }
+        const auto *expect = static_cast<const float *>(reader_->Data(frame, outputs[i]));
+        const auto *actual = static_cast<const float *>(host_buffer[i]);
+        for (size_t k = 0; k < outputs[i].bytes / sizeof(float); ++k) {
+            frame_error = std::max(frame_error, static_cast<double>(std::abs(expect[k] - actual[k])));
+        }
+    }
+    max_abs_error_ = std::max(max_abs_error_, frame_error);
+    mismatched_frames_ += frame_error > tolerance_ ? 1 : 0;
+    ++compared_frames_;
+}
+
+bool TraceReplayOutputHandler::Report() const
+{
+    if (latencies_ms_.empty()) {
+        std::cout << "Info: no frames replayed." << std::endl;
+        return true;
+    }
+
+    auto sorted = latencies_ms_;
+    std::sort(sorted.begin(), sorted.end());
+    const auto percentile = [&sorted](double p) { return sorted[static_cast<size_t>(p * (sorted.size() - 1))]; };
+    const std::chrono::duration<double> elapsed = last_consume_ - first_take_;
+    std::cout << "Info: replayed " << sorted.size() << " frames in " << elapsed.count() << " s, "
+              << (elapsed.count() > 0 ? sorted.size() / elapsed.count() : 0.0) << " frames/s." << std::endl;
+    std::cout << "Info: latency ms p50: " << percentile(0.5) << ", p90: " << percentile(0.9)
+              << ", p99: " << percentile(0.99) << ", max: " << sorted.back() << std::endl;
+
+    if (!compare_) {
+        return true;
+    }
+    std::cout << "Info: compared " << compared_frames_ << " frames, max abs error: " << max_abs_error_
+              << ", frames over " << tolerance_ << ": " << mismatched_frames_ << std::endl;
+    return mismatched_frames_ == 0;
+}
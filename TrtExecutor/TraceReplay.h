@@ -0,0 +1,102 @@
+// TraceReplay.h: Replay a tensor trace through the executor, bypassing decode and the frontend
+//
+
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "TensorTrace.h"
+#include "TrtExecutor.h"
+
+
+struct TraceReplayConfig
+{
+    // Feed frames at the recorded timestamps instead of as fast as the executor takes them.
+    bool realtime = false;
+    // Also feed the recorded recurrent states, making every frame independent of the previous ones.
+    bool feed_states = false;
+};
+
+//!
+//! \brief Feeds the recorded input tensors of a trace, then terminates the executor.
+//!
+class TraceReplayInputStream : public TrtInputStream
+{
+public:
+    TraceReplayInputStream(std::shared_ptr<const TensorTraceReader> reader, const TraceReplayConfig &config,
+                           TrtExecutor *executor);
+
+    infer::Dims GetDynamicDim(const char *input_name) override;
+
+    std::vector<std::string> GetInputTensorNames(const InferEngine &engine) override;
+
+    bool TryTake(const std::vector<void *> &host_buffer, const std::vector<size_t> &sizes) override;
+
+    //!
+    //! \brief Frames already due in real-time mode. Zero at full speed, where every frame is available.
+    //!
+    size_t PendingFrames() const override;
+
+    //!
+    //! \brief Index of the frame last taken, -1 before the first.
+    //!
+    int64_t CurFrame() const
+    {
+        return cur_frame_;
+    }
+
+    std::chrono::steady_clock::time_point TakeTime() const
+    {
+        return take_time_;
+    }
+
+private:
+    std::shared_ptr<const TensorTraceReader> reader_;
+    TraceReplayConfig config_;
+    TrtExecutor *executor_;
+
+    int64_t cur_frame_ = -1;
+    std::chrono::steady_clock::time_point start_;
+    std::chrono::steady_clock::time_point take_time_;
+};
+
+//!
+//! \brief Measures the replay and compares the outputs against the recorded ones.
+//!
+//! \details Latency is from the end of TryTake to Consume, i.e. inference and output conversion. With
+//!          recorded outputs, every element is compared and frames with an absolute error over the tolerance
+//!          are counted. Report() prints a summary.
+//!
+class TraceReplayOutputHandler : public TrtOutputHandler
+{
+public:
+    TraceReplayOutputHandler(std::shared_ptr<const TensorTraceReader> reader,
+                             std::shared_ptr<const TraceReplayInputStream> input, bool compare, float tolerance);
+
+    std::vector<std::string> GetOutputTensorNames(const InferEngine &engine) override;
+
+    void SetTensorDim(const char *, const infer::Dims &) override {}
+
+    void Consume(const std::vector<void *> &host_buffer, const std::vector<size_t> &sizes) override;
+
+    //!
+    //! \brief Print throughput, latency percentiles and the comparison. Returns false if outputs differ.
+    //!
+    bool Report() const;
+
+private:
+    std::shared_ptr<const TensorTraceReader> reader_;
+    std::shared_ptr<const TraceReplayInputStream> input_;
+    bool compare_;
+    float tolerance_;
+
+    std::vector<float> latencies_ms_;
+    std::chrono::steady_clock::time_point first_take_;
+    std::chrono::steady_clock::time_point last_consume_;
+    double max_abs_error_ = 0;
+    uint64_t mismatched_frames_ = 0;
+    uint64_t compared_frames_ = 0;
+};
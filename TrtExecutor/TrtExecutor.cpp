@@ -3,35 +3,46 @@
 
 #include "TrtExecutor.h"
 
+#include <algorithm>
+#include <cassert>
+#include <cstring>
 #include <fstream>
+#include <iostream>
 #include <thread>
 
-#include "common/buffers.h"
-#include "common/logger.h"
 
-
-TrtExecutor::TrtExecutor(const TrtExecuteConfig &config) : config_(config), terminate_(false)
+TrtExecutor::TrtExecutor(const TrtExecuteConfig &config)
+    : config_(config),
+      reloading_(false),
+      reload_ready_(false),
+      overload_(config.overload),
+      profiler_(std::make_shared<StageProfiler>()),
+      terminate_(false)
 {
-    std::ifstream model_file(config_.model_path, std::ios_base::binary);
-    if (!model_file) {
-        std::cerr << "Error: Unable to open model file: " << config_.model_path << std::endl;
+    engine_ = LoadInferEngine(config_.model_path);
+    if (!engine_) {
         assert(false);
     }
+}
 
-    model_file.seekg(0, std::ios_base::end);
-    const auto file_len = model_file.tellg();
-    model_file.seekg(0, std::ios_base::beg);
-    std::cout << "Info: model file length: " << file_len << "bytes." << std::endl;
-    std::vector<char> file_buffer(file_len);
-    model_file.read(file_buffer.data(), file_len);
+TrtExecutor::TrtExecutor(const TrtExecuteConfig &config, std::shared_ptr<InferEngine> engine)
+    : config_(config),
+      engine_(std::move(engine)),
+      reloading_(false),
+      reload_ready_(false),
+      overload_(config.overload),
+      profiler_(std::make_shared<StageProfiler>()),
+      terminate_(false)
+{
+    assert(engine_);
+}
 
-    auto runtime = SampleUniquePtr<nvinfer1::IRuntime>(nvinfer1::createInferRuntime(gLogger));
-    engine_ = std::shared_ptr<nvinfer1::ICudaEngine>(
-        runtime->deserializeCudaEngine(file_buffer.data(), file_len), samplesCommon::InferDeleter());
-    if (!engine_) {
-        std::cerr << "Error: Unable to deserialize model." << std::endl;
-        assert(false);
+TrtExecutor::~TrtExecutor()
+{
+    if (reload_thread_.joinable()) {
+        reload_thread_.join();
     }
+    RemoveMetrics();
 }
 
 void TrtExecutor::SetInputStream(const std::shared_ptr<TrtInputStream> &input)
@@ -44,84 +55,458 @@ void TrtExecutor::SetOutputHandler(const std::shared_ptr<TrtOutputHandler> &outp
     output_ = output;
 }
 
-static bool IsDynamicDim(const Dims &dims)
+static bool IsDynamicDim(const infer::Dims &dims)
 {
     return std::any_of(dims.d, dims.d + dims.nbDims, [](int dim) { return dim == -1; });
 }
 
+void TrtExecutor::AnnounceOutputDims(const ExecutionInstance &instance, TrtOutputHandler &output)
+{
+    for (int i = 0; i < instance.engine->GetNbBindings(); ++i) {
+        if (!instance.engine->BindingIsInput(i)) {
+            output.SetTensorDim(instance.engine->GetBindingName(i), instance.context->GetBindingDimensions(i));
+        }
+    }
+}
+
 static bool ValidateBuffer(const std::vector<void *> &buffer)
 {
     return std::all_of(std::begin(buffer), std::end(buffer), [](void *p) { return p != nullptr; });
 }
 
-void TrtExecutor::Process()
+std::unique_ptr<TrtExecutor::ExecutionInstance>
+TrtExecutor::CreateInstance(const std::shared_ptr<InferEngine> &engine, TrtOutputHandler &output) const
 {
-    if (!input_) {
-        std::cout << "Warning: no input stream for trt executor." << std::endl;
-        return;
-    }
-    if (!output_) {
-        std::cout << "Warning: no output handler for trt executor." << std::endl;
-        return;
+    std::unique_ptr<ExecutionInstance> instance(new ExecutionInstance());
+    instance->engine = engine;
+    instance->context = engine->CreateContext();
+    if (!instance->context) {
+        return nullptr;
     }
 
-    SampleUniquePtr<nvinfer1::IExecutionContext> context(engine_->createExecutionContext());
-    context->setOptimizationProfile(0);
-    const auto bind_num = engine_->getNbBindings();
+    auto *context = instance->context.get();
+    const auto bind_num = engine->GetNbBindings();
     for (int i = 0; i < bind_num; ++i) {
-        if (engine_->bindingIsInput(i) && IsDynamicDim(engine_->getBindingDimensions(i))) {
-            const auto dims = input_->GetDynamicDim(engine_->getBindingName(i));
-            context->setBindingDimensions(i, dims);
+        if (engine->BindingIsInput(i) && IsDynamicDim(engine->GetBindingDimensions(i))) {
+            const auto dims = input_->GetDynamicDim(engine->GetBindingName(i));
+            context->SetBindingDimensions(i, dims);
         }
     }
-    for (int i = 0; i < bind_num; ++i) {
-        if (!engine_->bindingIsInput(i)) {
-            output_->SetTensorDim(engine_->getBindingName(i), context->getBindingDimensions(i));
-        }
+    AnnounceOutputDims(*instance, output);
+
+    if (!context->AllocateBuffers()) {
+        std::cerr << "Error: Unable to allocate binding buffers." << std::endl;
+        return nullptr;
     }
 
     std::cout << "***** Context Info *****" << std::endl;
+    std::vector<std::string> binding_names(bind_num);
     for (int i = 0; i < bind_num; ++i) {
-        auto dims = context->getBindingDimensions(i);
-        std::cout << "  [" << i << "] " << (engine_->bindingIsInput(i) ? "Input" : "Output");
-        std::cout << ", Name: " << engine_->getBindingName(i) << ", Dim: " << dims << std::endl;
+        auto dims = context->GetBindingDimensions(i);
+        binding_names[i] = engine->GetBindingName(i);
+        std::cout << "  [" << i << "] " << (engine->BindingIsInput(i) ? "Input" : "Output");
+        std::cout << ", Name: " << binding_names[i] << ", Dim: " << dims << std::endl;
+    }
+    if (const auto *layout = context->GetStagingLayout()) {
+        layout->dump(std::cout, binding_names);
     }
 
-    samplesCommon::BufferManager buffer_(engine_, 1, context.get());
+    const auto input_tensor_names = input_->GetInputTensorNames(*engine);
+    instance->input_names = input_tensor_names;
+    instance->input_host_buffers.resize(input_tensor_names.size());
+    instance->input_sizes.resize(input_tensor_names.size());
+    for (size_t i = 0; i < input_tensor_names.size(); ++i) {
+        const auto index = engine->GetBindingIndex(input_tensor_names[i].c_str());
+        if (index < 0) {
+            std::cerr << "Error: model has no binding named " << input_tensor_names[i] << "." << std::endl;
+            return nullptr;
+        }
+        if (!BindHostView(*instance, index, true, instance->input_host_buffers[i], instance->input_sizes[i])) {
+            return nullptr;
+        }
+    }
+    assert(ValidateBuffer(instance->input_host_buffers));
 
-    const auto input_tensor_names = input_->GetInputTensorNames(*engine_);
-    std::vector<void *> input_host_buffers(input_tensor_names.size());
-    std::vector<size_t> input_sizes(input_tensor_names.size());
-    for (int i = 0; i < input_tensor_names.size(); ++i) {
-        input_host_buffers[i] = buffer_.getHostBuffer(input_tensor_names[i]);
-        input_sizes[i] = buffer_.size(input_tensor_names[i]);
+    const auto output_tensor_names = output.GetOutputTensorNames(*engine);
+    instance->output_names = output_tensor_names;
+    instance->output_host_buffers.resize(output_tensor_names.size());
+    instance->output_sizes.resize(output_tensor_names.size());
+    for (size_t i = 0; i < output_tensor_names.size(); ++i) {
+        const auto index = engine->GetBindingIndex(output_tensor_names[i].c_str());
+        if (index < 0) {
+            std::cerr << "Error: model has no binding named " << output_tensor_names[i] << "." << std::endl;
+            return nullptr;
+        }
+        if (!BindHostView(*instance, index, false, instance->output_host_buffers[i], instance->output_sizes[i])) {
+            return nullptr;
+        }
     }
-    assert(ValidateBuffer(input_host_buffers));
+    assert(ValidateBuffer(instance->output_host_buffers));
 
-    const auto output_tensor_names = output_->GetOutputTensorNames(*engine_);
-    std::vector<void *> output_host_buffers(output_tensor_names.size());
-    std::vector<size_t> output_sizes(output_tensor_names.size());
-    for (int i = 0; i < output_tensor_names.size(); ++i) {
-        output_host_buffers[i] = buffer_.getHostBuffer(output_tensor_names[i]);
-        output_sizes[i] = buffer_.size(output_tensor_names[i]);
+    BindStates(*instance, input_tensor_names);
+    return instance;
+}
+
+bool TrtExecutor::BindHostView(ExecutionInstance &instance, int index, bool input, void *&view, size_t &size)
+{
+    view = instance.context->GetHostBuffer(index);
+    size = instance.context->GetBufferSize(index);
+    if (!view) {
+        return true;
+    }
+
+    switch (instance.engine->GetBindingDataType(index)) {
+        case infer::DataType::kFLOAT:
+            return true;
+        case infer::DataType::kHALF: {
+            const auto count = size / sizeof(uint16_t);
+            instance.shadows.emplace_back(count, 0.0f);
+            auto *shadow = instance.shadows.back().data();
+            auto &halves = input ? instance.half_inputs : instance.half_outputs;
+            halves.push_back({shadow, static_cast<uint16_t *>(view), count});
+            view = shadow;
+            size = count * sizeof(float);
+            return true;
+        }
+        default:
+            std::cerr << "Error: binding " << instance.engine->GetBindingName(index)
+                      << " is neither float nor half, not supported." << std::endl;
+            return false;
     }
-    assert(ValidateBuffer(output_host_buffers));
+}
+
+bool TrtExecutor::Process()
+{
+    if (!input_) {
+        std::cout << "Warning: no input stream for trt executor." << std::endl;
+        return false;
+    }
+    if (!output_) {
+        std::cout << "Warning: no output handler for trt executor." << std::endl;
+        return false;
+    }
+
+    if (reload_ready_.load(std::memory_order_acquire)) {
+        // A reload finished while idle, start right on the new engine.
+        std::lock_guard<std::mutex> lock(reload_mutex_);
+        engine_ = std::move(reload_engine_);
+        reload_ready_.store(false, std::memory_order_relaxed);
+    }
+    if (!instance_ || !ReuseInstances()) {
+        // The contexts of the last run go first, the new ones may need their optimization profiles.
+        ReleaseInstances();
+        instance_ = CreateInstance(engine_, *output_);
+        if (!instance_ || !CreateBranches()) {
+            std::cerr << "Error: Unable to create the execution context, nothing processed." << std::endl;
+            ReleaseInstances();
+            return false;
+        }
+    }
+    processing_ = true;
+    const auto overload_enabled = config_.overload.enabled;
+    if (has_pending_state_) {
+        if (!ApplyRecurrentState(pending_state_)) {
+            ResetStream();
+            std::cout << "Warning: stream state does not match the state bindings, the stream is reset." << std::endl;
+        } else {
+            ApplyMask(pending_state_);
+        }
+        has_pending_state_ = false;
+    }
+    if (trace_ && !BeginTrace()) {
+        trace_.reset();
+    }
+    if (metrics_) {
+        frame_metrics_.streams_active->Add(1);
+    }
+    Timeline::SetThreadName("executor");
+    Timeline::SetThreadStream(config_.stream_id);
+    int64_t frame_index = 0;
+    uint64_t failed_frames = 0;
+    uint64_t partial_frames = 0;    // Inferred without an added model that failed.
+    auto branches_ok = true;        // As of the last inferred frame, whose outputs the buffers hold.
+    for (auto &branch : branches_) {
+        branch.ok = true;
+    }
+    if (config_.alloc_guard_frames >= 0 && !AllocTracker::kEnabled) {
+        std::cout << "Warning: allocation guard needs a build with TRT_EXECUTOR_ALLOC_TRACKING, ignored." << std::endl;
+    }
+    const auto violations_before = AllocTracker::ThreadViolations();
 
     while (!terminate_.load(std::memory_order::memory_order_relaxed)) {
-        const auto take_res = input_->TryTake(input_host_buffers, input_sizes);
+        if (reload_ready_.load(std::memory_order_acquire)) {
+            SwapInstance();
+        }
+
+        auto &instance = *instance_;
+        Timeline::SetThreadFrame(frame_index);
+        if (frame_index == config_.alloc_guard_frames) {
+            AllocTracker::ArmGuard();
+        }
+        const auto frame_allocations = AllocTracker::ThreadAllocations();
+        const auto frame_start = std::chrono::steady_clock::now();
+        const auto take_res = input_->TryTake(instance.input_host_buffers, instance.input_sizes);
         if (!take_res) {
             std::this_thread::sleep_for(std::chrono::milliseconds(1));
             continue;
         }
+        ++frame_index;
+        const auto take_end = std::chrono::steady_clock::now();
+        TRT_STAGE_RECORD(profiler_.get(), Stage::kTake, take_end - frame_start,
+                         AllocTracker::ThreadAllocations() - frame_allocations);
+        if (Timeline::IsEnabled()) {
+            Timeline::Record("executor", "take", Timeline::ToNs(frame_start), Timeline::ToNs(take_end));
+        }
+        if (trace_) {
+            TRT_TIMELINE_SCOPE("io", "trace_write");
+            trace_->WriteInputs(instance.input_host_buffers, instance.input_sizes);
+        }
 
-        buffer_.copyInputToDevice();
-        if (!context->executeV2(buffer_.getDeviceBindings().data())) {
-            std::cout << "Warning: Unable to execute context." << std::endl;
+        const auto pending = overload_enabled || metrics_ ? input_->PendingFrames() : 0;
+        const auto infer = !overload_enabled || overload_.Decide(pending, mask_age_);
+        if (infer) {
+            if (!RunInstance(instance, profiler_.get())) {
+                std::cout << "Warning: Unable to execute context." << std::endl;
+                mask_age_ = -1;
+                ++failed_frames;
+                if (metrics_) {
+                    frame_metrics_.failed_frames->Add();
+                }
+                continue;
+            }
+            branches_ok = true;
+            for (auto &branch : branches_) {
+                auto &branch_instance = *branch.instance;
+                memcpy(branch_instance.input_host_buffers[0], instance.input_host_buffers[0], instance.input_sizes[0]);
+                branch.ok = RunInstance(branch_instance, nullptr);
+                if (!branch.ok) {
+                    std::cout << "Warning: Unable to execute context of an added model." << std::endl;
+                    branches_ok = false;
+                }
+            }
+            if (!branches_ok) {
+                ++partial_frames;
+            }
+            CombineMasks();
+            mask_age_ = 0;
+        } else {
+            if (overload_.Mode() == ProcessingMode::kPassThrough) {
+                // Without a mask of this stream the buffers hold another stream's, start from unity gain instead.
+                const auto from_unity = mask_age_ < 0;
+                GlideMaskToUnity(instance, from_unity);
+                for (auto &branch : branches_) {
+                    GlideMaskToUnity(*branch.instance, from_unity);
+                }
+            }
+            // Past reuse_mask_frames the age only needs to say the mask is due.
+            const auto due = config_.overload.reuse_mask_frames;
+            mask_age_ = mask_age_ < 0 ? due : std::min(mask_age_ + 1, due);
+        }
+        if (trace_) {
+            TRT_TIMELINE_SCOPE("io", "trace_write");
+            trace_->WriteOutputs(instance.output_host_buffers, instance.output_sizes);
+        }
+        {
+            TRT_STAGE_SCOPE(profiler_.get(), Stage::kConsume);
+            TRT_TIMELINE_SCOPE("executor", "consume");
+            output_->Consume(instance.output_host_buffers, instance.output_sizes);
+            for (auto &branch : branches_) {
+                if (branch.output && branch.ok) {
+                    branch.output->Consume(branch.instance->output_host_buffers, branch.instance->output_sizes);
+                }
+            }
+        }
+        const auto frame_end = std::chrono::steady_clock::now();
+        TRT_STAGE_RECORD(profiler_.get(), Stage::kFrame, frame_end - frame_start,
+                         AllocTracker::ThreadAllocations() - frame_allocations);
+        if (Timeline::IsEnabled()) {
+            Timeline::Record("executor", "frame", Timeline::ToNs(frame_start), Timeline::ToNs(frame_end));
+        }
+
+        const std::chrono::duration<double, std::milli> frame_ms = frame_end - frame_start;
+        if (overload_enabled) {
+            overload_.Report(frame_ms.count());
+        }
+        if (metrics_) {
+            UpdateFrameMetrics(frame_ms.count(), infer && branches_ok, pending);
+        }
+    }
+    // Terminate() ends this run only, the executor can process again.
+    terminate_.store(false, std::memory_order::memory_order_relaxed);
+    if (metrics_) {
+        frame_metrics_.streams_active->Add(-1);
+    }
+    AllocTracker::DisarmGuard();
+    alloc_violations_.store(AllocTracker::ThreadViolations() - violations_before, std::memory_order_relaxed);
+
+    processing_ = false;
+    if (!config_.keep_context) {
+        ReleaseInstances();
+    }
+    if (trace_) {
+        trace_->Close();
+    }
+#ifdef TRT_EXECUTOR_STAGE_TIMING
+    if (config_.report_stages) {
+        profiler_->Report(std::cout);
+    }
+#endif
+    if (config_.alloc_guard_frames >= 0 && AllocTracker::kEnabled) {
+        const auto violations = alloc_violations_.load(std::memory_order_relaxed);
+        if (violations) {
+            std::cerr << "Error: " << violations << " heap allocations after " << config_.alloc_guard_frames
+                      << " warm-up frames." << std::endl;
+        } else {
+            std::cout << "Info: no heap allocations after " << config_.alloc_guard_frames << " warm-up frames." << std::endl;
+        }
+    }
+
+    if (overload_enabled) {
+        const auto stats = overload_.Stats();
+        std::cout << "Info: frames full: " << stats.full_frames << ", mask reused: " << stats.reused_mask_frames;
+        std::cout << ", pass-through: " << stats.passthrough_frames << ", deadline misses: " << stats.deadline_misses << std::endl;
+    }
+    if (failed_frames) {
+        std::cerr << "Error: " << failed_frames << " of " << frame_index << " frames failed to execute." << std::endl;
+    }
+    if (partial_frames) {
+        std::cout << "Warning: " << partial_frames << " of " << frame_index << " frames ran without an added model "
+                  << "that failed to execute." << std::endl;
+    }
+    return failed_frames == 0;
+}
+
+bool TrtExecutor::AddModel(const std::string &model_path, const std::shared_ptr<TrtOutputHandler> &output)
+{
+    auto engine = LoadInferEngine(model_path);
+    if (!engine) {
+        return false;
+    }
+
+    Branch branch;
+    branch.engine = std::move(engine);
+    branch.output = output;
+    branches_.push_back(std::move(branch));
+    return true;
+}
+
+bool TrtExecutor::CreateBranches()
+{
+    for (auto &branch : branches_) {
+        auto &output = branch.output ? *branch.output : *output_;
+        branch.instance = CreateInstance(branch.engine, output);
+        if (!branch.instance) {
+            return false;
+        }
+
+        // The features are shared, and a combined mask is merged element by element.
+        const auto &instance = *branch.instance;
+        if (instance.input_sizes[0] != instance_->input_sizes[0] ||
+            (!branch.output && instance.output_sizes[0] != instance_->output_sizes[0])) {
+            std::cerr << "Error: added model does not match the feature/mask size of the main model." << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool TrtExecutor::ReuseInstances()
+{
+    if (instance_->engine != engine_ || input_->GetInputTensorNames(*engine_) != instance_->input_names ||
+        output_->GetOutputTensorNames(*engine_) != instance_->output_names) {
+        return false;
+    }
+    for (int i = 0; i < engine_->GetNbBindings(); ++i) {
+        if (engine_->BindingIsInput(i) && IsDynamicDim(engine_->GetBindingDimensions(i))) {
+            const auto dims = input_->GetDynamicDim(engine_->GetBindingName(i));
+            const auto bound = instance_->context->GetBindingDimensions(i);
+            if (dims.nbDims != bound.nbDims || !std::equal(dims.d, dims.d + dims.nbDims, bound.d)) {
+                return false;
+            }
+        }
+    }
+    for (const auto &branch : branches_) {
+        if (!branch.instance) {
+            return false;
+        }
+    }
+
+    mask_age_ = -1;
+    ForEachStateBinding([](const StateBinding &binding) { memset(binding.input, 0, binding.size); });
+    AnnounceOutputDims(*instance_, *output_);
+    for (const auto &branch : branches_) {
+        if (!branch.output) {
+            AnnounceOutputDims(*branch.instance, *output_);
+        }
+    }
+    return true;
+}
+
+void TrtExecutor::ReleaseInstances()
+{
+    instance_.reset();
+    for (auto &branch : branches_) {
+        branch.instance.reset();
+    }
+}
+
+bool TrtExecutor::RunInstance(ExecutionInstance &instance, StageProfiler *profiler)
+{
+    {
+        TRT_STAGE_SCOPE(profiler, Stage::kCopyIn);
+        TRT_TIMELINE_SCOPE("infer", "copy_in");
+        for (const auto &half : instance.half_inputs) {
+            kernels::FloatToHalf(half.view, half.binding, half.count);
+        }
+        instance.context->CopyInputToDevice();
+    }
+    {
+        TRT_STAGE_SCOPE(profiler, Stage::kExecute);
+        TRT_TIMELINE_SCOPE("infer", "execute");
+        if (!instance.context->Execute()) {
+            return false;
+        }
+    }
+    {
+        TRT_STAGE_SCOPE(profiler, Stage::kCopyOut);
+        TRT_TIMELINE_SCOPE("infer", "copy_out");
+        instance.context->CopyOutputToHost();
+        for (const auto &half : instance.half_outputs) {
+            kernels::HalfToFloat(half.binding, half.view, half.count);
+        }
+    }
+    FeedbackStates(instance);
+    return true;
+}
+
+void TrtExecutor::CombineMasks()
+{
+    auto *mask = static_cast<float *>(instance_->output_host_buffers[0]);
+    const auto len = instance_->output_sizes[0] / sizeof(float);
+    int count = 1;
+    for (const auto &branch : branches_) {
+        if (branch.output || !branch.ok) {
             continue;
         }
 
-        buffer_.copyOutputToHost();
-        output_->Consume(output_host_buffers, output_sizes);
+        const auto *other = static_cast<const float *>(branch.instance->output_host_buffers[0]);
+        switch (config_.mask_combine) {
+            case MaskCombine::kAverage:
+                std::transform(mask, mask + len, other, mask, std::plus<float>());
+                break;
+            case MaskCombine::kMin:
+                std::transform(mask, mask + len, other, mask, [](float a, float b) { return std::min(a, b); });
+                break;
+            case MaskCombine::kMax:
+                std::transform(mask, mask + len, other, mask, [](float a, float b) { return std::max(a, b); });
+                break;
+        }
+        ++count;
+    }
+
+    if (config_.mask_combine == MaskCombine::kAverage && count > 1) {
+        const auto scale = 1.0f / count;
+        std::transform(mask, mask + len, mask, [scale](float v) { return v * scale; });
     }
 }
 
@@ -129,3 +514,357 @@ void TrtExecutor::Terminate()
 {
     terminate_.store(true, std::memory_order::memory_order_relaxed);
 }
+
+bool TrtExecutor::Reload(const std::string &model_path)
+{
+    if (reloading_.exchange(true) || reload_ready_.load(std::memory_order_acquire)) {
+        std::cout << "Warning: a reload is already in progress." << std::endl;
+        return false;
+    }
+    if (reload_thread_.joinable()) {
+        reload_thread_.join();
+    }
+
+    reload_thread_ = std::thread([this, model_path]() {
+        Timeline::SetThreadName("reload");
+        TRT_TIMELINE_SCOPE("executor", "reload");
+        auto engine = LoadInferEngine(model_path);
+        if (engine) {
+            std::lock_guard<std::mutex> lock(reload_mutex_);
+            reload_engine_ = std::move(engine);
+            reload_ready_.store(true, std::memory_order_release);
+            std::cout << "Info: model reloaded from " << model_path << ", switching at next frame." << std::endl;
+        } else {
+            std::cerr << "Error: reload of " << model_path << " failed, keep running the current model." << std::endl;
+        }
+        reloading_.store(false);
+    });
+    return true;
+}
+
+bool TrtExecutor::Reload(std::shared_ptr<InferEngine> engine)
+{
+    if (reloading_.exchange(true) || reload_ready_.load(std::memory_order_acquire)) {
+        std::cout << "Warning: a reload is already in progress." << std::endl;
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> lock(reload_mutex_);
+        reload_engine_ = std::move(engine);
+        reload_ready_.store(true, std::memory_order_release);
+    }
+    reloading_.store(false);
+    return true;
+}
+
+void TrtExecutor::SwapInstance()
+{
+    std::shared_ptr<InferEngine> engine;
+    {
+        std::lock_guard<std::mutex> lock(reload_mutex_);
+        engine = std::move(reload_engine_);
+        reload_ready_.store(false, std::memory_order_relaxed);
+    }
+    TRT_TIMELINE_SCOPE("executor", "swap_instance");
+    auto next = CreateInstance(engine, *output_);
+    if (!next) {
+        std::cerr << "Error: Unable to create the execution context of the reloaded model, keep running the current "
+                  << "model." << std::endl;
+        AnnounceOutputDims(*instance_, *output_);
+        return;
+    }
+
+    // The stream keeps writing the same feature and reading the same mask, those must not change.
+    if (next->input_sizes.empty() || next->output_sizes.empty() ||
+        next->input_sizes[0] != instance_->input_sizes[0] || next->output_sizes[0] != instance_->output_sizes[0]) {
+        std::cerr << "Error: reloaded model has different feature/mask sizes, keep running the current model." << std::endl;
+        AnnounceOutputDims(*instance_, *output_);
+        return;
+    }
+
+    // Same size, so the last mask stays valid for the overload protection to reuse.
+    memcpy(next->output_host_buffers[0], instance_->output_host_buffers[0], next->output_sizes[0]);
+    if (IsStateLayoutCompatible(*instance_, *next)) {
+        for (size_t i = 0; i < next->state_bindings.size(); ++i) {
+            memcpy(next->state_bindings[i].input, instance_->state_bindings[i].input, next->state_bindings[i].size);
+        }
+    } else {
+        std::cout << "Warning: reloaded model has different state bindings, its recurrent state is reset."
+                  << std::endl;
+    }
+
+    // The old instance is drained: this is a frame boundary of the only thread using it.
+    instance_ = std::move(next);
+    engine_ = instance_->engine;
+}
+
+void TrtExecutor::SnapshotState(StreamState &state) const
+{
+    if (instance_) {
+        state.recurrent.resize(StateFloats());
+        auto *dst = state.recurrent.data();
+        ForEachStateBinding([&dst](const StateBinding &binding) {
+            memcpy(dst, binding.input, binding.size);
+            dst += binding.size / sizeof(float);
+        });
+    } else {
+        state.recurrent.clear();
+    }
+    // Only needed to reuse it under overload; masks of added models are not saved, so those streams infer again.
+    if (instance_ && config_.overload.enabled && mask_age_ >= 0 && branches_.empty()) {
+        const auto *mask = static_cast<const float *>(instance_->output_host_buffers[0]);
+        state.mask.assign(mask, mask + instance_->output_sizes[0] / sizeof(float));
+        state.mask_age = mask_age_;
+    } else {
+        state.mask.clear();
+        state.mask_age = -1;
+    }
+
+    if (input_) {
+        input_->SaveState(state);
+    }
+    if (output_) {
+        output_->SaveState(state);
+    }
+}
+
+bool TrtExecutor::RestoreState(const StreamState &state)
+{
+    if (!processing_) {
+        // Not processing yet, apply once the state bindings are created or reused.
+        pending_state_ = state;
+        has_pending_state_ = true;
+    } else if (!ApplyRecurrentState(state)) {
+        ResetStream();
+        std::cout << "Warning: stream state does not match the state bindings, the stream is reset." << std::endl;
+        return false;
+    } else {
+        ApplyMask(state);
+    }
+
+    if (input_) {
+        input_->RestoreState(state);
+    }
+    if (output_) {
+        output_->RestoreState(state);
+    }
+    return true;
+}
+
+void TrtExecutor::ResetStream()
+{
+    mask_age_ = -1;
+    ForEachStateBinding([](const StateBinding &binding) { memset(binding.input, 0, binding.size); });
+    // A default state restarts the normalization and the overlap-add of a stream.
+    const StreamState fresh;
+    if (input_) {
+        input_->RestoreState(fresh);
+    }
+    if (output_) {
+        output_->RestoreState(fresh);
+    }
+    for (auto &branch : branches_) {
+        if (branch.output) {
+            branch.output->RestoreState(fresh);
+        }
+    }
+}
+
+size_t TrtExecutor::StateFloats() const
+{
+    size_t floats = 0;
+    ForEachStateBinding([&floats](const StateBinding &binding) { floats += binding.size / sizeof(float); });
+    return floats;
+}
+
+void TrtExecutor::BindStates(ExecutionInstance &instance, const std::vector<std::string> &input_names)
+{
+    instance.state_bindings.clear();
+    instance.state_floats = 0;
+
+    // The first tensor of each side is the feature/mask, the rest are paired recurrent states.
+    const auto count = std::min(instance.input_host_buffers.size(), instance.output_host_buffers.size());
+    for (size_t i = 1; i < count; ++i) {
+        if (instance.input_sizes[i] != instance.output_sizes[i]) {
+            std::cout << "Warning: state binding " << i << " has mismatched input/output sizes, skipped." << std::endl;
+            continue;
+        }
+        memset(instance.input_host_buffers[i], 0, instance.input_sizes[i]);
+        instance.state_bindings.push_back(
+            {input_names[i], instance.input_host_buffers[i], instance.output_host_buffers[i], instance.input_sizes[i]});
+        instance.state_floats += instance.input_sizes[i] / sizeof(float);
+    }
+}
+
+bool TrtExecutor::IsStateLayoutCompatible(const ExecutionInstance &from, const ExecutionInstance &to)
+{
+    return std::equal(from.state_bindings.begin(), from.state_bindings.end(),
+                      to.state_bindings.begin(), to.state_bindings.end(),
+                      [](const StateBinding &a, const StateBinding &b) { return a.name == b.name && a.size == b.size; });
+}
+
+void TrtExecutor::FeedbackStates(ExecutionInstance &instance)
+{
+    for (const auto &binding : instance.state_bindings) {
+        memcpy(binding.input, binding.output, binding.size);
+    }
+}
+
+void TrtExecutor::GlideMaskToUnity(ExecutionInstance &instance, bool from_unity) const
+{
+    // Smooth the gain towards pass-through so leaving enhancement does not click.
+    const auto alpha = from_unity ? 1.0f : config_.overload.passthrough_smoothing;
+    auto *mask = static_cast<float *>(instance.output_host_buffers[0]);
+    const auto len = instance.output_sizes[0] / sizeof(float);
+    for (size_t i = 0; i < len; ++i) {
+        mask[i] += alpha * (1.0f - mask[i]);
+    }
+}
+
+OverloadStats TrtExecutor::GetOverloadStats() const
+{
+    return overload_.Stats();
+}
+
+LatencySummary TrtExecutor::GetStageLatency(Stage stage) const
+{
+    return profiler_->Summarize(stage);
+}
+
+void TrtExecutor::SetStageProfiler(const std::shared_ptr<StageProfiler> &profiler)
+{
+    profiler_ = profiler;
+}
+
+uint64_t TrtExecutor::GetAllocationViolations() const
+{
+    return alloc_violations_.load(std::memory_order_relaxed);
+}
+
+void TrtExecutor::SetMetrics(const std::shared_ptr<MetricsRegistry> &registry, const std::string &labels)
+{
+    RemoveMetrics();
+    metrics_ = registry;
+    if (!metrics_) {
+        return;
+    }
+
+    auto &metrics = *metrics_;
+    frame_metrics_.frames = &metrics.GetCounter(
+        "trt_frames_total", "Frames taken from the input stream and consumed.", labels);
+    frame_metrics_.degraded_frames = &metrics.GetCounter(
+        "trt_frames_degraded_total",
+        "Frames consumed without inference by the overload protection, or without an added model that failed.", labels);
+    frame_metrics_.failed_frames = &metrics.GetCounter(
+        "trt_frames_failed_total", "Frames dropped because inference failed.", labels);
+    frame_metrics_.streams_active = &metrics.GetGauge("trt_streams_active", "Streams being processed.", labels);
+    frame_metrics_.queue_depth = &metrics.GetGauge(
+        "trt_input_queue_depth", "Frames available but not taken yet, as of the last frame.", labels);
+    frame_metrics_.real_time_factor = &metrics.GetGauge(
+        "trt_real_time_factor", "Processing time over audio time of a frame, smoothed over about 20 frames.", labels);
+
+    metric_collectors_.push_back(metrics.AddCollector(
+        "trt_deadline_misses_total", "counter", "Frames over the overload deadline.",
+        [this, labels](std::ostream &os, const std::string &name) {
+            MetricsRegistry::WriteSample(os, name, labels, static_cast<double>(overload_.Stats().deadline_misses));
+        }));
+    metric_collectors_.push_back(metrics.AddCollector(
+        "trt_processing_mode", "gauge", "Overload processing mode: 0 full, 1 reuse mask, 2 pass-through.",
+        [this, labels](std::ostream &os, const std::string &name) {
+            MetricsRegistry::WriteSample(os, name, labels, static_cast<double>(overload_.Stats().mode));
+        }));
+#ifdef TRT_EXECUTOR_STAGE_TIMING
+    metric_collectors_.push_back(metrics.AddCollector(
+        "trt_stage_latency_seconds", "summary", "Latency of the stages of a frame of the main model.",
+        [this, labels](std::ostream &os, const std::string &name) {
+            for (int i = 0; i < static_cast<int>(Stage::kCount); ++i) {
+                const auto stage = static_cast<Stage>(i);
+                const auto summary = profiler_->Summarize(stage);
+                const auto stage_labels =
+                    MetricsRegistry::JoinLabels(labels, std::string("stage=\"") + StageName(stage) + "\"");
+                const auto quantile = [&](const char *q, double us) {
+                    const auto quantile_labels = std::string("quantile=\"") + q + "\"";
+                    MetricsRegistry::WriteSample(os, name, MetricsRegistry::JoinLabels(stage_labels, quantile_labels),
+                                                 us * 1e-6);
+                };
+                quantile("0.5", summary.p50_us);
+                quantile("0.9", summary.p90_us);
+                quantile("0.99", summary.p99_us);
+                MetricsRegistry::WriteSample(os, name + "_sum", stage_labels, summary.mean_us * summary.count * 1e-6);
+                MetricsRegistry::WriteSample(os, name + "_count", stage_labels, static_cast<double>(summary.count));
+            }
+        }));
+#endif
+}
+
+void TrtExecutor::RemoveMetrics()
+{
+    if (!metrics_) {
+        return;
+    }
+    for (const auto id : metric_collectors_) {
+        metrics_->RemoveCollector(id);
+    }
+    metric_collectors_.clear();
+    frame_metrics_ = FrameMetrics();
+    metrics_.reset();
+}
+
+void TrtExecutor::UpdateFrameMetrics(double frame_ms, bool inferred, size_t pending)
+{
+    frame_metrics_.frames->Add();
+    if (!inferred) {
+        frame_metrics_.degraded_frames->Add();
+    }
+    frame_metrics_.queue_depth->Set(static_cast<double>(pending));
+    smoothed_frame_ms_ += 0.05 * (frame_ms - smoothed_frame_ms_);
+    frame_metrics_.real_time_factor->Set(config_.frame_hop_ms > 0 ? smoothed_frame_ms_ / config_.frame_hop_ms : 0.0);
+}
+
+void TrtExecutor::SetTraceWriter(const std::shared_ptr<TensorTraceWriter> &writer)
+{
+    trace_ = writer;
+}
+
+bool TrtExecutor::BeginTrace()
+{
+    const auto describe = [this](const std::vector<std::string> &names, const std::vector<size_t> &sizes) {
+        std::vector<trace::Tensor> tensors;
+        for (size_t i = 0; i < names.size(); ++i) {
+            const auto index = instance_->engine->GetBindingIndex(names[i].c_str());
+            tensors.push_back({names[i], instance_->context->GetBindingDimensions(index), sizes[i], 0});
+        }
+        return tensors;
+    };
+    return trace_->Begin(describe(instance_->input_names, instance_->input_sizes),
+                         describe(instance_->output_names, instance_->output_sizes));
+}
+
+void TrtExecutor::ApplyMask(const StreamState &state)
+{
+    if (state.mask_age < 0 || state.mask.size() * sizeof(float) != instance_->output_sizes[0]) {
+        mask_age_ = -1;
+        return;
+    }
+    memcpy(instance_->output_host_buffers[0], state.mask.data(), instance_->output_sizes[0]);
+    mask_age_ = state.mask_age;
+}
+
+bool TrtExecutor::ApplyRecurrentState(const StreamState &state)
+{
+    if (state.recurrent.empty()) {
+        // A fresh stream starts from zero states.
+        ForEachStateBinding([](const StateBinding &binding) { memset(binding.input, 0, binding.size); });
+        return true;
+    }
+    if (state.recurrent.size() != StateFloats()) {
+        return false;
+    }
+
+    const auto *src = state.recurrent.data();
+    ForEachStateBinding([&src](const StateBinding &binding) {
+        memcpy(binding.input, src, binding.size);
+        src += binding.size / sizeof(float);
+    });
+    return true;
+}
@@ -7,10 +7,17 @@
 #include <vector>
 #include <memory>
 #include <atomic>
+#include <mutex>
+#include <thread>
 
-#include <NvInfer.h>
-
-#include "common/common.h"
+#include "CpuKernels.h"
+#include "InferBackend.h"
+#include "Metrics.h"
+#include "OverloadController.h"
+#include "StageTiming.h"
+#include "StreamState.h"
+#include "TensorTrace.h"
+#include "Timeline.h"
 
 
 class TrtInputStream
@@ -18,11 +25,27 @@ class TrtInputStream
 public:
     virtual ~TrtInputStream() = default;
 
-    virtual Dims GetDynamicDim(const char *input_name) = 0;
+    virtual infer::Dims GetDynamicDim(const char *input_name) = 0;
 
-    virtual std::vector<std::string> GetInputTensorNames(const nvinfer1::ICudaEngine &engine) = 0;
+    //!
+    //! \brief The first name is the feature tensor. The rest are recurrent states, each fed from the output
+    //!        tensor at the same position of TrtOutputHandler::GetOutputTensorNames after every frame.
+    //!
+    virtual std::vector<std::string> GetInputTensorNames(const InferEngine &engine) = 0;
 
     virtual bool TryTake(const std::vector<void *> &host_buffer, const std::vector<size_t> &sizes) = 0;
+
+    //!
+    //! \brief Number of frames already available but not taken yet. Drives the overload protection.
+    //!
+    virtual size_t PendingFrames() const { return 0; }
+
+    //!
+    //! \brief Save the normalization state and frame counter of the stream. Default has no state.
+    //!
+    virtual void SaveState(StreamState &) const {}
+
+    virtual void RestoreState(const StreamState &) {}
 };
 
 class TrtOutputHandler
@@ -30,40 +53,338 @@ class TrtOutputHandler
 public:
     virtual ~TrtOutputHandler() = default;
 
-    virtual std::vector<std::string> GetOutputTensorNames(const nvinfer1::ICudaEngine &engine) = 0;
+    virtual std::vector<std::string> GetOutputTensorNames(const InferEngine &engine) = 0;
 
-    virtual void SetTensorDim(const char *output_name, const Dims &dims) = 0;
+    virtual void SetTensorDim(const char *output_name, const infer::Dims &dims) = 0;
 
     virtual void Consume(const std::vector<void *> &host_buffer, const std::vector<size_t> &sizes) = 0;
+
+    //!
+    //! \brief Save the synthesis state (overlap-add tail) of the stream. Default has no state.
+    //!
+    virtual void SaveState(StreamState &) const {}
+
+    virtual void RestoreState(const StreamState &) {}
+};
+
+//!
+//! \brief How the masks of models added without an output handler are merged into the main model's mask.
+//!
+enum class MaskCombine : int
+{
+    kAverage = 0,
+    kMin,
+    kMax,
 };
 
 struct TrtExecuteConfig
 {
     std::string model_path;
+    OverloadConfig overload;
+    MaskCombine mask_combine = MaskCombine::kAverage;
+    double frame_hop_ms = 10.0;     //!< Audio duration of one frame, for the real-time factor metric.
+    uint32_t stream_id = 0;         //!< Identifies the stream in timeline events.
+    int alloc_guard_frames = -1;    //!< Frames of warm-up after which allocating in the loop is a violation, -1 off.
+    bool report_stages = true;      //!< Print the stage latency report at the end of Process().
+    bool keep_context = false;      //!< Keep the execution contexts once Process() returns, for the next run.
 };
 
 class TrtExecutor
 {
-    template <typename T>
-    using SampleUniquePtr = std::unique_ptr<T, samplesCommon::InferDeleter>;
-
 public:
     explicit TrtExecutor(const TrtExecuteConfig &config);
 
+    //!
+    //! \brief Run an engine already loaded, e.g. shared by several executors, each with its own context.
+    //!        config.model_path is not loaded.
+    //!
+    TrtExecutor(const TrtExecuteConfig &config, std::shared_ptr<InferEngine> engine);
+
+    ~TrtExecutor();
+
     void SetInputStream(const std::shared_ptr<TrtInputStream> &input);
 
     void SetOutputHandler(const std::shared_ptr<TrtOutputHandler> &output);
 
-    void Process();
+    //!
+    //! \brief Run frames until Terminate(). Returns false if the execution context cannot be created, in which
+    //!        case nothing is taken from the input stream, or if any frame failed to execute and was dropped.
+    //!
+    //! \details Terminate() ends one run: Process() can be called again, e.g. for the next file after setting
+    //!          its input stream and output handler. With TrtExecuteConfig::keep_context the next run starts a
+    //!          fresh stream on the contexts of the last one, as long as the streams ask for the same tensors.
+    //!
+    bool Process();
 
     void Terminate();
 
+    //!
+    //! \brief Load a new model in the background and switch to it at the next frame boundary of Process().
+    //!
+    //! \details The engine is loaded on a background thread. Its execution context and buffers are created at
+    //!          the frame boundary, on the thread running Process(), so the input stream and output handler are
+    //!          only ever called from there. The recurrent state of the running stream is carried over if the
+    //!          state bindings of both engines have the same names and sizes, otherwise it is reset. The old
+    //!          engine is freed after the switch. Returns false if a reload is already in progress.
+    //!
+    bool Reload(const std::string &model_path);
+
+    //!
+    //! \brief Switch to an engine already loaded, e.g. shared by several executors, at the next frame boundary
+    //!        of Process(), as Reload does. Returns false if a reload is already in progress.
+    //!
+    bool Reload(std::shared_ptr<InferEngine> engine);
+
+    //!
+    //! \brief Feed the features of the input stream to one more model. The frontend runs once per frame for
+    //!        all models, each model keeps its own recurrent state. With an output handler the outputs of the
+    //!        model go there, otherwise its mask is combined into the main model's mask according to
+    //!        TrtExecuteConfig::mask_combine before Consume. Must be called before Process().
+    //!        Returns false if the model cannot be loaded.
+    //!
+    bool AddModel(const std::string &model_path, const std::shared_ptr<TrtOutputHandler> &output = nullptr);
+
+    //!
+    //! \brief Snapshot the state of the current stream: the recurrent state bindings of the main model and of
+    //!        the added ones, the last mask if the overload protection is enabled, plus whatever the input
+    //!        stream and the main output handler save. Must be called at a frame boundary, i.e. from the
+    //!        thread running Process() (inside TryTake/Consume) or while Process() is not running, in which
+    //!        case the recurrent part and the mask are empty unless the contexts are kept.
+    //!
+    void SnapshotState(StreamState &state) const;
+
+    //!
+    //! \brief Restore a state taken by SnapshotState. Same threading rule as SnapshotState.
+    //!        If the recurrent part does not match the state bindings of the engines, the stream is reset to a
+    //!        fresh one instead (zero recurrent state, input stream and output handler restarted) and false
+    //!        is returned; a state restored before Process() is checked, and reset, once it starts.
+    //!
+    bool RestoreState(const StreamState &state);
+
+    //!
+    //! \brief Counters of full and degraded frames. Can be called from any thread.
+    //!
+    OverloadStats GetOverloadStats() const;
+
+    //!
+    //! \brief Record the input views of every frame taken, before inference, and the output views as handed
+    //!        to Consume, into a tensor trace. Recording stops if a reload changes the tensor layout. Must be
+    //!        called before Process().
+    //!
+    void SetTraceWriter(const std::shared_ptr<TensorTraceWriter> &writer);
+
+    //!
+    //! \brief Latency percentiles of a stage of the main model so far. Can be called from any thread. All zero
+    //!        unless built with TRT_EXECUTOR_STAGE_TIMING.
+    //!
+    LatencySummary GetStageLatency(Stage stage) const;
+
+    //!
+    //! \brief Record the stage latencies into profiler instead of a profiler of this executor, e.g. one shared
+    //!        by the executors of a batch to report them together. Must be called before Process().
+    //!
+    void SetStageProfiler(const std::shared_ptr<StageProfiler> &profiler);
+
+    //!
+    //! \brief Heap allocations of the Process() thread after TrtExecuteConfig::alloc_guard_frames frames, as of
+    //!        the end of Process(). Needs a build with TRT_EXECUTOR_ALLOC_TRACKING.
+    //!
+    uint64_t GetAllocationViolations() const;
+
+    //!
+    //! \brief Publish frame counters, queue depth, real-time factor, overload and stage latency metrics of
+    //!        this executor into registry, every series labelled with labels (e.g. stream="3", may be empty).
+    //!        Executors sharing a registry need distinct labels. Must be called before Process().
+    //!
+    void SetMetrics(const std::shared_ptr<MetricsRegistry> &registry, const std::string &labels = "");
+
 private:
+    //!
+    //! \brief A recurrent state: the output tensor is fed back into the input tensor after every frame.
+    //!
+    struct StateBinding
+    {
+        std::string name;
+        void *input;
+        const void *output;
+        size_t size;
+    };
+
+    //!
+    //! \brief A half precision binding and the float view of it handed to the streams.
+    //!
+    struct HalfBinding
+    {
+        float *view;
+        uint16_t *binding;
+        size_t count;
+    };
+
+    //!
+    //! \brief An engine with its execution context, buffers and the host views handed to the streams.
+    //!
+    //! \details The views are float. Float bindings are viewed directly, half bindings through a float shadow
+    //!          converted into host staging before the input copy and out of it after the output copy.
+    //!
+    struct ExecutionInstance
+    {
+        std::shared_ptr<InferEngine> engine;
+        std::unique_ptr<InferContext> context;
+
+        std::vector<std::string> input_names;
+        std::vector<void *> input_host_buffers;
+        std::vector<size_t> input_sizes;
+        std::vector<std::string> output_names;
+        std::vector<void *> output_host_buffers;
+        std::vector<size_t> output_sizes;
+
+        std::vector<kernels::AlignedVector<float>> shadows;
+        std::vector<HalfBinding> half_inputs;
+        std::vector<HalfBinding> half_outputs;
+
+        std::vector<StateBinding> state_bindings;
+        size_t state_floats = 0;
+    };
+
+    //!
+    //! \brief A model added by AddModel, fed with the features of the main model.
+    //!
+    struct Branch
+    {
+        std::shared_ptr<InferEngine> engine;
+        std::shared_ptr<TrtOutputHandler> output;
+        std::unique_ptr<ExecutionInstance> instance;
+        bool ok = true;     //!< The last inferred frame ran, else its outputs are stale: not combined nor consumed.
+    };
+
+    std::unique_ptr<ExecutionInstance> CreateInstance(const std::shared_ptr<InferEngine> &engine,
+                                                      TrtOutputHandler &output) const;
+
+    //!
+    //! \brief Tell output the dims of the output bindings of instance.
+    //!
+    static void AnnounceOutputDims(const ExecutionInstance &instance, TrtOutputHandler &output);
+
+    static bool BindHostView(ExecutionInstance &instance, int index, bool input, void *&view, size_t &size);
+
+    bool CreateBranches();
+
+    //!
+    //! \brief Whether the kept instances can run the current streams: same engine and the same tensors. If so,
+    //!        zero their recurrent state for the new stream and announce the output dims.
+    //!
+    bool ReuseInstances();
+
+    void ReleaseInstances();
+
+    //!
+    //! \brief Run one frame. The copy and execute stages are recorded into profiler unless it is nullptr.
+    //!
+    static bool RunInstance(ExecutionInstance &instance, StageProfiler *profiler);
+
+    void CombineMasks();
+
+    static void BindStates(ExecutionInstance &instance, const std::vector<std::string> &input_names);
+
+    static bool IsStateLayoutCompatible(const ExecutionInstance &from, const ExecutionInstance &to);
+
+    void SwapInstance();
+
+    static void FeedbackStates(ExecutionInstance &instance);
+
+    //!
+    //! \brief Step the mask towards unity gain, or set it there if from_unity.
+    //!
+    void GlideMaskToUnity(ExecutionInstance &instance, bool from_unity) const;
+
+    //!
+    //! \brief Visit the state bindings of the main model, then those of each added model in AddModel order,
+    //!        the layout of StreamState::recurrent. Needs the instances.
+    //!
+    template <typename F>
+    void ForEachStateBinding(F visit) const
+    {
+        for (const auto &binding : instance_->state_bindings) {
+            visit(binding);
+        }
+        for (const auto &branch : branches_) {
+            if (branch.instance) {
+                for (const auto &binding : branch.instance->state_bindings) {
+                    visit(binding);
+                }
+            }
+        }
+    }
+
+    size_t StateFloats() const;
+
+    //!
+    //! \brief Load the recurrent part of state into the state bindings of all models. Returns false, leaving
+    //!        them untouched, if its size does not match.
+    //!
+    bool ApplyRecurrentState(const StreamState &state);
+
+    //!
+    //! \brief Load the mask of state into the mask buffer for the overload protection to reuse, or note that
+    //!        the buffer holds no mask of the stream if state has none of its size.
+    //!
+    void ApplyMask(const StreamState &state);
+
+    //!
+    //! \brief Restart the current stream from scratch: zero recurrent state of all models, fresh input stream
+    //!        and output handlers. Needs the instances.
+    //!
+    void ResetStream();
+
+    bool BeginTrace();
+
+    void UpdateFrameMetrics(double frame_ms, bool inferred, size_t pending);
+
+    void RemoveMetrics();
+
     TrtExecuteConfig config_;
 
-    std::shared_ptr<nvinfer1::ICudaEngine> engine_;
+    std::shared_ptr<InferEngine> engine_;
     std::shared_ptr<TrtInputStream> input_;
     std::shared_ptr<TrtOutputHandler> output_;
 
+    std::unique_ptr<ExecutionInstance> instance_;
+    std::vector<Branch> branches_;
+    bool has_pending_state_ = false;
+    StreamState pending_state_;
+    int mask_age_ = -1;     //!< Frames since the mask in the buffers was inferred for the current stream, -1 if not.
+    bool processing_ = false;   //!< Inside a run of Process(), with the instances set up for its stream.
+
+    std::thread reload_thread_;
+    std::mutex reload_mutex_;
+    std::shared_ptr<InferEngine> reload_engine_;
+    std::atomic<bool> reloading_;
+    std::atomic<bool> reload_ready_;
+
+    OverloadController overload_;
+
+    std::shared_ptr<TensorTraceWriter> trace_;
+
+    std::shared_ptr<StageProfiler> profiler_;
+    std::atomic<uint64_t> alloc_violations_{0};
+
+    //!
+    //! \brief Series updated by the loop, owned by the registry.
+    //!
+    struct FrameMetrics
+    {
+        Counter *frames = nullptr;
+        Counter *degraded_frames = nullptr;
+        Counter *failed_frames = nullptr;
+        Gauge *streams_active = nullptr;
+        Gauge *queue_depth = nullptr;
+        Gauge *real_time_factor = nullptr;
+    };
+
+    std::shared_ptr<MetricsRegistry> metrics_;
+    FrameMetrics frame_metrics_;
+    std::vector<int> metric_collectors_;
+    double smoothed_frame_ms_ = 0;
+
     std::atomic<bool> terminate_;
 };
@@ -0,0 +1,462 @@
+// VoiceStream.cpp: Impl
+//
+
+#include "VoiceStream.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <iostream>
+
+#include "Timeline.h"
+
+
+namespace {
+
+//!
+//! \brief Part of the feature cache key, bump it when the frontend computes anything differently.
+//!
+constexpr uint32_t kFrontendRevision = 1;
+
+}
+
+std::vector<std::string> VoiceInputTensorNames(const InferEngine &engine)
+{
+    std::vector<std::string> ret;
+    ret.emplace_back("input");
+    for (int i = 0; i < engine.GetNbBindings(); ++i) {
+        if (engine.BindingIsInput(i) && strcmp(engine.GetBindingName(i), "input") != 0) {
+            ret.emplace_back(engine.GetBindingName(i));
+        }
+    }
+    return ret;
+}
+
+std::vector<std::string> VoiceOutputTensorNames(const InferEngine &engine)
+{
+    std::vector<std::string> ret;
+    ret.emplace_back("output");
+    for (int i = 0; i < engine.GetNbBindings(); ++i) {
+        if (!engine.BindingIsInput(i) && strcmp(engine.GetBindingName(i), "output") != 0) {
+            ret.emplace_back(engine.GetBindingName(i));
+        }
+    }
+    return ret;
+}
+
+VoiceInputStream::VoiceInputStream(const VoiceFileInputConfig &config, TrtExecutor *executor)
+    : config_(config),
+      executor_(executor)
+{
+}
+
+VoiceInputStream::VoiceInputStream(const VoiceFileInputConfig &config, const std::vector<double> &samples,
+                                   int sample_rate, int channels, int format, TrtExecutor *executor)
+    : VoiceInputStream(config, executor)
+{
+    auto *sig_ptr = Prepare(samples.size(), sample_rate, channels, format);
+    std::copy(samples.begin(), samples.end(), sig_ptr);
+}
+
+double *VoiceInputStream::Prepare(size_t count, int sample_rate, int channels, int format)
+{
+    sampling_rate_ = sample_rate;
+    channels_ = channels;
+    format_ = format;
+
+    fft_.init(config_.dft_size);
+
+    int frame_size = static_cast<int>(config_.window_len * sampling_rate_);
+    wind_ = utils::hamming(frame_size, config_.hot_fraction);
+
+    int s_size = static_cast<int>(count);
+    int f_size = wind_.size();
+    int h_size = static_cast<int>(config_.hot_fraction * frame_size);
+    hot_fraction_size_ = h_size;
+
+    int s_start = h_size - f_size;
+    int s_end = s_size;
+    int n_frame = static_cast<int>(std::ceil(1.0 * (s_end - s_start) / h_size));
+    frame_count_ = n_frame;
+
+    int zp_left = -s_start;
+    int zp_right = (n_frame - 1) * h_size + f_size - zp_left - s_size;
+
+    sig_pad_ = nc::zeros<double>(1, s_size + zp_left + zp_right);
+    return sig_pad_.data() + zp_left;
+}
+
+infer::Dims VoiceInputStream::GetDynamicDim(const char *input_name)
+{
+    std::cout << "Info: Get dim for " << input_name << std::endl;
+    return infer::Dims3{1, 1, 257};
+}
+
+std::vector<std::string> VoiceInputStream::GetInputTensorNames(const InferEngine &engine)
+{
+    return VoiceInputTensorNames(engine);
+}
+
+void VoiceInputStream::SetFeatureCache(std::shared_ptr<FeatureCache> cache)
+{
+    cache_ = std::move(cache);
+    cached_.reset();
+    cache_fill_.reset();
+    cache_filled_ = 0;
+    if (!cache_ || frame_count_ == 0) {
+        return;
+    }
+
+    FeatureHasher hasher;
+    hasher.Update(kFrontendRevision);
+    hasher.Update(config_.window_len);
+    hasher.Update(config_.hot_fraction);
+    hasher.Update(config_.dft_size);
+    hasher.Update(config_.spectral_floor);
+    hasher.Update(sampling_rate_);
+    hasher.Update(channels_);
+    hasher.Update(frame_count_);
+    hasher.Update(sig_pad_.data(), sig_pad_.size() * sizeof(double));
+    const auto key = hasher.Value();
+    const auto check = hasher.Check();
+    const auto bins = static_cast<uint32_t>(audiofft::AudioFFT::ComplexSize(config_.dft_size));
+    const auto frame_count = static_cast<uint32_t>(frame_count_);
+
+    cached_ = cache_->Find(key, check, frame_count, bins);
+    if (cached_) {
+        x_mag_ = nc::NdArray<double>(1, bins);
+        x_phs_ = nc::NdArray<double>(1, 2 * bins);
+    } else {
+        cache_fill_ = cache_->Begin(key, check, frame_count, bins);
+    }
+}
+
+bool VoiceInputStream::TryTake(const std::vector<void *> &host_buffer, const std::vector<size_t> &sizes)
+{
+    ++cur_frame_;
+    if (cur_frame_ >= frame_count_) {
+        if (cache_fill_ && cache_filled_ == frame_count_) {
+            cache_->Commit(std::move(cache_fill_));
+        }
+        cache_fill_.reset();
+        executor_->Terminate();
+        return false;
+    }
+    assert(host_buffer.size() == sizes.size());
+    auto *input = static_cast<float *>(host_buffer[0]);
+    const auto frame = static_cast<uint32_t>(cur_frame_);
+    if (cached_) {
+        TRT_TIMELINE_SCOPE("input", "feature_cache");
+        const auto bins = cached_->Bins();
+        assert(bins * sizeof(float) == sizes[0]);
+        std::copy_n(cached_->Features(frame), bins, input);
+        std::copy_n(cached_->Magnitudes(frame), bins, x_mag_.data());
+        std::copy_n(cached_->Phasors(frame), 2 * bins, x_phs_.data());
+        return true;
+    }
+    TRT_TIMELINE_SCOPE("input", "frontend");
+
+    // cur frame data
+    int frame_start = cur_frame_ * hot_fraction_size_;
+    int frame_end = frame_start + wind_.size();
+    nc::NdArray<double> spec;
+    {
+        PerfScope scope(perf_, CpuStage::kStft);
+        auto frame_sig_pad = sig_pad_(sig_pad_.rSlice(), nc::Slice(frame_start, frame_end)) * wind_;
+        spec = utils::stft(frame_sig_pad, fft_, config_.dft_size, false);
+    }
+    {
+        PerfScope scope(perf_, CpuStage::kMagPhasor);
+        utils::mag_phasor(spec, x_mag_, x_phs_);
+    }
+
+    nc::NdArray<double> feat;
+    {
+        PerfScope scope(perf_, CpuStage::kLogPow);
+        feat = utils::log_pow(x_mag_, config_.spectral_floor);
+    }
+    {
+        PerfScope scope(perf_, CpuStage::kOnlineMvn);
+        if (cur_frame_ == 0) {
+            mu_ = feat;
+            sigma_square_ = nc::square(feat);
+        }
+        utils::onlineMVN_per_frame(feat, cur_frame_, mu_, sigma_square_);
+        mvn_frame_ = cur_frame_;
+    }
+
+    assert(feat.size() * sizeof(float) == sizes[0]);
+    std::copy_n(feat.data(), feat.size(), input);
+
+    if (cache_fill_) {
+        if (cur_frame_ <= cache_filled_) {
+            // Synthesis then uses the float32 values a hit reads back, so the pass filling the cache and the
+            // passes reading it enhance alike.
+            std::copy_n(input, feat.size(), cache_fill_->Features(frame));
+            std::copy_n(x_mag_.data(), x_mag_.size(), cache_fill_->Magnitudes(frame));
+            std::copy_n(x_phs_.data(), x_phs_.size(), cache_fill_->Phasors(frame));
+            std::copy_n(cache_fill_->Magnitudes(frame), x_mag_.size(), x_mag_.data());
+            std::copy_n(cache_fill_->Phasors(frame), x_phs_.size(), x_phs_.data());
+            cache_filled_ = std::max(cache_filled_, cur_frame_ + 1);
+        } else {
+            // Frames were skipped by a restored state, the entry would have a gap.
+            cache_fill_.reset();
+        }
+    }
+    return true;
+}
+
+void VoiceInputStream::SaveState(StreamState &state) const
+{
+    CatchUpMvn();
+    state.frame_index = cur_frame_;
+    state.mu.assign(mu_.begin(), mu_.end());
+    state.sigma_square.assign(sigma_square_.begin(), sigma_square_.end());
+}
+
+void VoiceInputStream::RestoreState(const StreamState &state)
+{
+    cur_frame_ = static_cast<int>(state.frame_index);
+    if (mu_.size() != state.mu.size()) {
+        mu_ = nc::NdArray<double>(1, static_cast<uint32_t>(state.mu.size()));
+        sigma_square_ = nc::NdArray<double>(1, static_cast<uint32_t>(state.sigma_square.size()));
+    }
+    std::copy(state.mu.begin(), state.mu.end(), mu_.begin());
+    std::copy(state.sigma_square.begin(), state.sigma_square.end(), sigma_square_.begin());
+    mvn_frame_ = cur_frame_;
+}
+
+void VoiceInputStream::CatchUpMvn() const
+{
+    const auto last = std::min(cur_frame_, frame_count_ - 1);
+    if (mvn_frame_ >= last) {
+        return;
+    }
+    // Only frames read from the feature cache are behind. Their features are computed again on a frontend of
+    // its own, with the double precision of the uncached path, so the state is the one an uncached run has.
+    audiofft::AudioFFT fft;
+    fft.init(config_.dft_size);
+    nc::NdArray<double> mag;
+    nc::NdArray<double> phs;
+    for (auto frame = mvn_frame_ + 1; frame <= last; ++frame) {
+        const auto frame_start = frame * hot_fraction_size_;
+        const auto frame_end = frame_start + static_cast<int>(wind_.size());
+        auto frame_sig_pad = sig_pad_(sig_pad_.rSlice(), nc::Slice(frame_start, frame_end)) * wind_;
+        utils::mag_phasor(utils::stft(frame_sig_pad, fft, config_.dft_size, false), mag, phs);
+        auto feat = utils::log_pow(mag, config_.spectral_floor);
+        if (frame == 0) {
+            mu_ = feat;
+            sigma_square_ = nc::square(feat);
+        }
+        utils::onlineMVN_per_frame(feat, frame, mu_, sigma_square_);
+    }
+    mvn_frame_ = last;
+}
+
+LocalFileInputStream::LocalFileInputStream(const VoiceFileInputConfig &config, const std::string &path,
+                                           TrtExecutor *executor)
+    : VoiceInputStream(config, executor),
+      snd_file_(path)
+{
+    if (!snd_file_) {
+        return;
+    }
+
+    const auto frames = snd_file_.frames();
+    std::cout << "[SndFile]: frames: " << frames << ", sample_rate: " << snd_file_.samplerate();
+    std::cout << ", channels: " << snd_file_.channels() << ", format: " << snd_file_.format() << std::endl;
+
+    const auto s_size = snd_file_.channels() * frames;
+    auto *sig_ptr = Prepare(s_size, snd_file_.samplerate(), snd_file_.channels(), snd_file_.format());
+    TRT_TIMELINE_SCOPE("io", "read_input");
+    const auto read_cnt = snd_file_.read(sig_ptr, s_size);
+    assert(read_cnt == s_size);
+}
+
+LocalFileOutputHandler::LocalFileOutputHandler(std::shared_ptr<VoiceInputStream> input, const std::string &path)
+    : input_(std::move(input)),
+      save_path_(path),
+      out_(nc::zeros<float>(1, input_->FrameCount() * input_->HotFractionSize())),
+      old_(nc::zeros<float>(1, input_->HotFractionSize()))
+{
+    //
+}
+
+LocalFileOutputHandler::~LocalFileOutputHandler() noexcept
+{
+    Finish();
+}
+
+bool LocalFileOutputHandler::Finish()
+{
+    if (save_path_.empty()) {
+        return true;
+    }
+    const auto path = std::move(save_path_);
+    save_path_.clear();
+    TRT_TIMELINE_SCOPE("io", "write_output");
+    SndfileHandle snd_file(path, SFM_WRITE, input_->Format(), input_->Channels(), input_->SampleRate());
+    if (!snd_file) {
+        std::cerr << "Error: Unable to open " << path << " for writing: " << snd_file.strError() << std::endl;
+        return false;
+    }
+
+    const auto written = snd_file.write(out_.data(), out_.size());
+    if (written != static_cast<sf_count_t>(out_.size())) {
+        std::cerr << "Error: only " << written << " of " << out_.size() << " samples written to " << path << ": "
+                  << snd_file.strError() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+std::vector<std::string> LocalFileOutputHandler::GetOutputTensorNames(const InferEngine &engine)
+{
+    return VoiceOutputTensorNames(engine);
+}
+
+void LocalFileOutputHandler::SetTensorDim(const char *output_name, const infer::Dims &dims)
+{
+    //
+}
+
+void LocalFileOutputHandler::SaveState(StreamState &state) const
+{
+    state.overlap.assign(old_.begin(), old_.end());
+}
+
+void LocalFileOutputHandler::RestoreState(const StreamState &state)
+{
+    if (state.overlap.size() == old_.size()) {
+        std::copy(state.overlap.begin(), state.overlap.end(), old_.begin());
+    } else {
+        old_.fill(0.f);
+    }
+}
+
+void LocalFileOutputHandler::Consume(const std::vector<void *> &host_buffer, const std::vector<size_t> &sizes)
+{
+    assert(host_buffer.size() == sizes.size());
+    TRT_TIMELINE_SCOPE("output", "synthesis");
+
+    auto *perf = input_->Perf();
+    nc::NdArray<float> x_enh;
+    {
+        PerfScope scope(perf, CpuStage::kIstft);
+        auto &x_mag = input_->XMag();
+        auto &x_phs = input_->XPhs();
+        auto *output = static_cast<float *>(host_buffer[0]);
+        auto len = sizes[0] / sizeof(float);
+        nc::NdArray<float> mask(1, len * 2);
+        for (unsigned i = 0; i < len; ++i) {
+            auto t = x_mag[i] * output[i];
+            mask[i] = t * x_phs[i];
+            mask[i + len] = t * x_phs[i + len];
+        }
+
+        x_enh = utils::istft(mask, input_->AudioFFT());
+    }
+
+    PerfScope scope(perf, CpuStage::kOverlapAdd);
+    int cur_frame = input_->CurFrame();
+    int h_size = input_->HotFractionSize();
+    int frame_start = cur_frame * h_size;
+    std::transform(x_enh.data(), x_enh.data() + h_size, old_.data(), x_enh.data(), std::plus<float>());
+    memcpy(out_.data() + frame_start, x_enh.data(), sizeof(float) * h_size);
+    memcpy(old_.data(), x_enh.data() + h_size, sizeof(float) * h_size);
+}
+
+StreamingFrontend::StreamingFrontend(const VoiceFileInputConfig &config, int sample_rate)
+    : config_(config),
+      bins_(audiofft::AudioFFT::ComplexSize(config.dft_size)),
+      scratch_(config.dft_size),
+      frame_(static_cast<size_t>(config.window_len * sample_rate)),
+      spec_(2 * bins_),
+      mag_(bins_),
+      unit_(2 * bins_),
+      feat_(bins_),
+      mu_(bins_),
+      sigma_square_(bins_)
+{
+    fft_.init(config_.dft_size);
+    const auto frame_size = static_cast<int>(frame_.size());
+    const auto wind = utils::hamming(frame_size, config_.hot_fraction);
+    wind_.assign(wind.begin(), wind.end());
+    hop_size_ = static_cast<int>(config_.hot_fraction * frame_size);
+}
+
+void StreamingFrontend::Analyze(float *feature)
+{
+    ++cur_frame_;
+    for (size_t i = 0; i < frame_.size(); ++i) {
+        frame_[i] *= wind_[i];
+    }
+    utils::stft(frame_.data(), static_cast<uint32_t>(frame_.size()), fft_, config_.dft_size, false, scratch_,
+                spec_.data());
+    utils::mag_phasor(spec_.data(), bins_, mag_.data(), unit_.data());
+    utils::log_pow(mag_.data(), bins_, feat_.data(), config_.spectral_floor);
+    if (cur_frame_ == 0) {
+        std::copy(feat_.begin(), feat_.end(), mu_.begin());
+        std::transform(feat_.begin(), feat_.end(), sigma_square_.begin(), [](double v) { return v * v; });
+    }
+    utils::onlineMVN_per_frame(feat_.data(), bins_, static_cast<int>(cur_frame_), mu_.data(), sigma_square_.data());
+    std::copy(feat_.begin(), feat_.end(), feature);
+}
+
+void StreamingFrontend::SaveState(StreamState &state) const
+{
+    state.frame_index = cur_frame_;
+    state.mu.assign(mu_.begin(), mu_.end());
+    state.sigma_square.assign(sigma_square_.begin(), sigma_square_.end());
+}
+
+void StreamingFrontend::RestoreState(const StreamState &state)
+{
+    cur_frame_ = state.frame_index;
+    if (state.mu.size() == mu_.size() && state.sigma_square.size() == sigma_square_.size()) {
+        std::copy(state.mu.begin(), state.mu.end(), mu_.begin());
+        std::copy(state.sigma_square.begin(), state.sigma_square.end(), sigma_square_.begin());
+    }
+}
+
+StreamingSynthesis::StreamingSynthesis(StreamingFrontend &frontend)
+    : frontend_(frontend),
+      mask_(2 * frontend.Bins()),
+      x_enh_(2 * (frontend.Bins() - 1)),
+      old_(frontend.HopSize())
+{
+}
+
+const float *StreamingSynthesis::Synthesize(const float *gain)
+{
+    const auto *x_mag = frontend_.XMag();
+    const auto *x_phs = frontend_.XPhs();
+    const auto len = frontend_.Bins();
+    for (unsigned i = 0; i < len; ++i) {
+        auto t = x_mag[i] * gain[i];
+        mask_[i] = static_cast<float>(t * x_phs[i]);
+        mask_[i + len] = static_cast<float>(t * x_phs[i + len]);
+    }
+    utils::istft(mask_.data(), len, frontend_.AudioFFT(), x_enh_.data());
+
+    const auto h_size = old_.size();
+    std::transform(x_enh_.begin(), x_enh_.begin() + h_size, old_.begin(), x_enh_.begin(), std::plus<float>());
+    std::copy_n(x_enh_.begin() + h_size, h_size, old_.begin());
+    return x_enh_.data();
+}
+
+void StreamingSynthesis::SaveState(StreamState &state) const
+{
+    state.overlap.assign(old_.begin(), old_.end());
+}
+
+void StreamingSynthesis::RestoreState(const StreamState &state)
+{
+    if (state.overlap.size() == old_.size()) {
+        std::copy(state.overlap.begin(), state.overlap.end(), old_.begin());
+    } else {
+        std::fill(old_.begin(), old_.end(), 0.f);
+    }
+}
@@ -0,0 +1,347 @@
+// VoiceStream.h: NSNet frontend and synthesis over a voice signal
+//
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <sndfile.hh>
+
+#include "AudioUtils.h"
+#include "FeatureCache.h"
+#include "PerfCounters.h"
+#include "TrtExecutor.h"
+
+
+struct VoiceFileInputConfig
+{
+    float window_len = 0.02f;
+    float hot_fraction = 0.5f;
+    int dft_size = 512;
+    float spectral_floor = -120.0f;
+    float time_signal_floor = 1e-12f;
+};
+
+//!
+//! \brief The feature tensor "input" followed by the other inputs of the engine, the recurrent states.
+//!
+std::vector<std::string> VoiceInputTensorNames(const InferEngine &engine);
+
+//!
+//! \brief The mask tensor "output" followed by the other outputs of the engine, the recurrent states.
+//!
+std::vector<std::string> VoiceOutputTensorNames(const InferEngine &engine);
+
+//!
+//! \brief Frontend of a voice signal held in memory: windowed STFT, log power and online MVN per frame.
+//!
+class VoiceInputStream : public TrtInputStream
+{
+public:
+    //!
+    //! \brief A stream over samples, interleaved if channels > 1. format is the libsndfile format the output
+    //!        handler writes the enhanced signal with.
+    //!
+    VoiceInputStream(const VoiceFileInputConfig &config, const std::vector<double> &samples, int sample_rate,
+                     int channels, int format, TrtExecutor *executor);
+
+    infer::Dims GetDynamicDim(const char *input_name) override;
+
+    std::vector<std::string> GetInputTensorNames(const InferEngine &engine) override;
+
+    bool TryTake(const std::vector<void *> &host_buffer, const std::vector<size_t> &sizes) override;
+
+    void SaveState(StreamState &state) const override;
+
+    void RestoreState(const StreamState &state) override;
+
+    const VoiceFileInputConfig &VoiceConfig() const
+    {
+        return config_;
+    }
+
+    //!
+    //! \brief Count the frontend stages, and the synthesis stages of the output handlers, into perf.
+    //!
+    void SetPerfCounters(PerfCounters *perf)
+    {
+        perf_ = perf;
+    }
+
+    PerfCounters *Perf() const
+    {
+        return perf_;
+    }
+
+    //!
+    //! \brief Take the frames from cache if it holds this signal under this config, bypassing the frontend;
+    //!        otherwise store them there once every frame was computed. Call before the first TryTake.
+    //!        Frames read from the cache skip the MVN too; SaveState computes the MVN state of those frames
+    //!        again first, so a snapshot of a cached stream is that of an uncached one, at the cost of their
+    //!        STFTs once.
+    //!
+    void SetFeatureCache(std::shared_ptr<FeatureCache> cache);
+
+    int SampleRate() const
+    {
+        return sampling_rate_;
+    }
+
+    int Channels() const
+    {
+        return channels_;
+    }
+
+    int Format() const
+    {
+        return format_;
+    }
+
+    audiofft::AudioFFT &AudioFFT()
+    {
+        return fft_;
+    }
+
+    const nc::NdArray<double> &Wind() const
+    {
+        return wind_;
+    }
+
+    int HotFractionSize() const
+    {
+        return hot_fraction_size_;
+    }
+
+    int FrameCount() const
+    {
+        return frame_count_;
+    }
+
+    int CurFrame() const
+    {
+        return cur_frame_;
+    }
+
+    const nc::NdArray<double> &XMag() const
+    {
+        return x_mag_;
+    }
+
+    const nc::NdArray<double> &XPhs() const
+    {
+        return x_phs_;
+    }
+
+protected:
+    VoiceInputStream(const VoiceFileInputConfig &config, TrtExecutor *executor);
+
+    //!
+    //! \brief Size the zero padded signal the frames are cut from for count samples, returns where the
+    //!        samples go in it.
+    //!
+    double *Prepare(size_t count, int sample_rate, int channels, int format);
+
+private:
+    //!
+    //! \brief Accumulate the MVN of the frames up to cur_frame_ read from the feature cache.
+    //!
+    void CatchUpMvn() const;
+    VoiceFileInputConfig config_;
+    TrtExecutor *executor_;
+
+    int sampling_rate_ = 0;
+    int channels_ = 0;
+    int format_ = 0;
+
+    audiofft::AudioFFT fft_;
+
+    int hot_fraction_size_ = 0;
+    int frame_count_ = 0;
+    nc::NdArray<double> wind_;
+    nc::NdArray<double> sig_pad_;
+
+    int cur_frame_ = -1;
+
+    nc::NdArray<double> x_mag_;
+    nc::NdArray<double> x_phs_;
+    // Brought up to date by SaveState, as frames read from the cache skip the MVN.
+    mutable nc::NdArray<double> mu_;
+    mutable nc::NdArray<double> sigma_square_;
+    mutable int mvn_frame_ = -1;    //!< Last frame accumulated into mu_ and sigma_square_.
+
+    std::shared_ptr<FeatureCache> cache_;
+    std::unique_ptr<FeatureCacheEntry> cached_;     //!< Found in the cache, the frames come from it.
+    std::unique_ptr<FeatureCacheEntry> cache_fill_; //!< Begun on a miss, the frames computed go into it.
+    int cache_filled_ = 0;
+
+    PerfCounters *perf_ = nullptr;
+};
+
+//!
+//! \brief Voice input decoded from an audio file by libsndfile.
+//!
+class LocalFileInputStream : public VoiceInputStream
+{
+public:
+    LocalFileInputStream(const VoiceFileInputConfig &config, const std::string &path, TrtExecutor *executor);
+
+    const SndfileHandle &SndFile() const
+    {
+        return snd_file_;
+    }
+
+private:
+    SndfileHandle snd_file_;
+};
+
+//!
+//! \brief Synthesis of a voice stream: masks its spectrum, inverse STFT and overlap-add into the enhanced
+//!        signal, which is written to a file when the handler is destroyed.
+//!
+class LocalFileOutputHandler : public TrtOutputHandler
+{
+public:
+    //!
+    //! \brief With an empty path the enhanced signal is only kept in memory.
+    //!
+    LocalFileOutputHandler(std::shared_ptr<VoiceInputStream> input, const std::string &path);
+
+    //!
+    //! \brief Calls Finish unless it was called, ignoring its result.
+    //!
+    ~LocalFileOutputHandler() noexcept;
+
+    //!
+    //! \brief Write the enhanced signal to the path, once. Returns false if the file cannot be opened or not all
+    //!        of the signal is written; true with an empty path or if written before.
+    //!
+    bool Finish();
+
+    std::vector<std::string> GetOutputTensorNames(const InferEngine &engine) override;
+
+    void SetTensorDim(const char *output_name, const infer::Dims &dims) override;
+
+    void SaveState(StreamState &state) const override;
+
+    void RestoreState(const StreamState &state) override;
+
+    void Consume(const std::vector<void *> &host_buffer, const std::vector<size_t> &sizes) override;
+
+    const nc::NdArray<float> &Enhanced() const
+    {
+        return out_;
+    }
+
+private:
+    std::shared_ptr<VoiceInputStream> input_;
+    std::string save_path_;
+
+    nc::NdArray<float> out_;
+    nc::NdArray<float> old_;
+};
+
+//!
+//! \brief Frontend of a live stream, frame by frame over preallocated buffers: the caller fills Frame() with
+//!        the raw samples of the window, Analyze windows them and computes the features like VoiceInputStream.
+//!
+class StreamingFrontend
+{
+public:
+    StreamingFrontend(const VoiceFileInputConfig &config, int sample_rate);
+
+    int FrameSize() const
+    {
+        return static_cast<int>(frame_.size());
+    }
+
+    int HopSize() const
+    {
+        return hop_size_;
+    }
+
+    uint32_t Bins() const
+    {
+        return bins_;
+    }
+
+    double *Frame()
+    {
+        return frame_.data();
+    }
+
+    //!
+    //! \brief Features of the next frame into feature, Bins() floats.
+    //!
+    void Analyze(float *feature);
+
+    //!
+    //! \brief Index of the frame last analyzed, -1 before the first.
+    //!
+    int64_t FrameIndex() const
+    {
+        return cur_frame_;
+    }
+
+    void SaveState(StreamState &state) const;
+
+    void RestoreState(const StreamState &state);
+
+    audiofft::AudioFFT &AudioFFT()
+    {
+        return fft_;
+    }
+
+    const double *XMag() const
+    {
+        return mag_.data();
+    }
+
+    const double *XPhs() const
+    {
+        return unit_.data();
+    }
+
+private:
+    VoiceFileInputConfig config_;
+    int hop_size_;
+    uint32_t bins_;
+
+    audiofft::AudioFFT fft_;
+    utils::StftScratch scratch_;
+    std::vector<double> wind_;
+    std::vector<double> frame_;
+    std::vector<double> spec_;
+    std::vector<double> mag_;
+    std::vector<double> unit_;
+    std::vector<double> feat_;
+    std::vector<double> mu_;
+    std::vector<double> sigma_square_;
+    int64_t cur_frame_ = -1;
+};
+
+//!
+//! \brief Synthesis matching a StreamingFrontend: masks the spectrum of the frame it analyzed last, inverse
+//!        STFT and overlap-add, one hop per frame without allocating.
+//!
+class StreamingSynthesis
+{
+public:
+    explicit StreamingSynthesis(StreamingFrontend &frontend);
+
+    //!
+    //! \brief Returns HopSize() enhanced samples, valid until the next call. gain holds Bins() floats.
+    //!
+    const float *Synthesize(const float *gain);
+
+    void SaveState(StreamState &state) const;
+
+    void RestoreState(const StreamState &state);
+
+private:
+    StreamingFrontend &frontend_;
+    std::vector<float> mask_;
+    std::vector<float> x_enh_;
+    std::vector<float> old_;
+};
@@ -1,293 +1,668 @@
 #include "TrtExecutor.h"
+#include "common/arena.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
 #include <iostream>
-#include <cmath>
-
-#include <sndfile.hh>
-
-#include "AudioUtils.h"
-
+#include <thread>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "BatchJob.h"
+#include "CorpusReader.h"
+#include "InferBackend.h"
+#include "MetricsExporter.h"
+#include "PacketReplay.h"
+#include "PcmStream.h"
+#include "PerfCounters.h"
+#include "ShmStream.h"
+#include "StreamServer.h"
+#include "Timeline.h"
+#include "TraceReplay.h"
+#include "VoiceStream.h"
+
+
+static void PrintUsage(const char *prog)
+{
+    std::cout << "Usage: " << prog << " TensorRT-model-file Src-voice-file Enhanced-save-file [options]" << std::endl;
+    std::cout << "       " << prog << " TensorRT-model-file --replay trace-file [replay options]" << std::endl;
+    std::cout << "       " << prog << " TensorRT-model-file --serve unix:path|[host:]port [server options]" << std::endl;
+    std::cout << "       " << prog << " TensorRT-model-file --shm input-ring output-ring" << std::endl;
+    std::cout << "       " << prog << " TensorRT-model-file --pipe [pipe options] < pcm > enhanced-pcm" << std::endl;
+    std::cout << "       " << prog << " TensorRT-model-file --batch list-file output-dir [batch options]" << std::endl;
+    std::cout << "       " << prog << " --merge batch-report..." << std::endl;
+    std::cout << "Options:" << std::endl;
+    std::cout << "  --fanout model-file save-file   Also run model-file on the same features, save its output separately." << std::endl;
+    std::cout << "  --ensemble model-file           Also run model-file on the same features, combine its mask." << std::endl;
+    std::cout << "  --combine avg|min|max           How ensemble masks are combined, default avg." << std::endl;
+    std::cout << "  --huge-pages none|thp|explicit  Back the host tensor arena with huge pages, default none." << std::endl;
+    std::cout << "  --record trace-file             Record the input tensors of every frame." << std::endl;
+    std::cout << "  --record-outputs                Also record the output tensors." << std::endl;
+    std::cout << "  --metrics unix:path|[host:]port Serve Prometheus metrics over HTTP on the endpoint." << std::endl;
+    std::cout << "  --metrics-file path             Rewrite Prometheus metrics to path every second." << std::endl;
+    std::cout << "  --perf-counters                 Count cycles, instructions and misses of the CPU stages." << std::endl;
+    std::cout << "  --timeline json-file            Record a Chrome trace of the pipeline, written at exit and on SIGUSR1." << std::endl;
+    std::cout << "  --feature-cache dir             Reuse the frontend features of inputs seen before, stored in dir." << std::endl;
+    std::cout << "  --feature-cache-size MiB        Evict the least recently used features past this size, default 8192." << std::endl;
+    std::cout << "  --overload ms                   Shed inference (reuse, then glide the mask to unity) past an ms frame deadline." << std::endl;
+    std::cout << "Replay options:" << std::endl;
+    std::cout << "  --realtime                      Feed frames at their recorded pace, default full speed." << std::endl;
+    std::cout << "  --feed-states                   Also feed the recorded recurrent states." << std::endl;
+    std::cout << "  --compare tolerance             Compare outputs to the recorded ones, fail over tolerance." << std::endl;
+    std::cout << "  --alloc-guard frames            Fail if the executor loop allocates after frames of warm-up." << std::endl;
+    std::cout << "Server options:" << std::endl;
+    std::cout << "  --serve unix:path|[host:]port   Listen on one more endpoint. SIGHUP reloads the model file." << std::endl;
+    std::cout << "  --workers n                     Executors sharing the engine, default 1." << std::endl;
+    std::cout << "  --io-threads n                  Threads running the socket event loops, default 1." << std::endl;
+    std::cout << "  --max-connections n             Refuse connections above n, default 256." << std::endl;
+    std::cout << "  --resident-states n             Serialize the states of idle streams above n, default 64." << std::endl;
+    std::cout << "  --format s16|f32                PCM sample format of the streams, default s16." << std::endl;
+    std::cout << "  --metrics unix:path|[host:]port Serve Prometheus metrics over HTTP on the endpoint." << std::endl;
+    std::cout << "  --alloc-guard frames            Report allocations of the workers after frames of warm-up." << std::endl;
+    std::cout << "  --overload ms                   As for a single file, per worker." << std::endl;
+    std::cout << "  --timeline json-file            As for a single file, threads and events tagged per stream." << std::endl;
+    std::cout << "Pipe options:" << std::endl;
+    std::cout << "  --format s16|f32                Raw PCM sample format of stdin and stdout, default s16." << std::endl;
+    std::cout << "  --rate hz                       Sample rate, default 16000." << std::endl;
+    std::cout << "  --channels n                    Interleaved channels, mixed down, the output has as many, default 1." << std::endl;
+    std::cout << "  --block hops                    Write the output every hops hops (10 ms each), default 1." << std::endl;
+    std::cout << "  --no-vmsplice                   Copy the output into the pipe, for readers that splice it on." << std::endl;
+    std::cout << "  --overload ms                   As for a single file." << std::endl;
+    std::cout << "  --packets trace-file            Deliver stdin as the packets of trace-file through the jitter buffer." << std::endl;
+    std::cout << "  --min-delay ms --max-delay ms   Bounds of the jitter buffer delay, default 20 and 300." << std::endl;
+    std::cout << "  --timeline json-file            As for a single file." << std::endl;
+    std::cout << "Batch options, list-file has one input path per line, optionally a tab and its length:" << std::endl;
+    std::cout << "  --workers n                     Executors sharing the engine, default 1." << std::endl;
+    std::cout << "  --prefetch n                    Files read and decoded ahead of the workers, default 8." << std::endl;
+    std::cout << "  --io-threads n                  Reader threads when io_uring is not available, default 4." << std::endl;
+    std::cout << "  --decode-threads n              Threads decoding the files read, default 2." << std::endl;
+    std::cout << "  --no-io-uring                   Read with the thread pool even where io_uring is available." << std::endl;
+    std::cout << "  --feature-cache dir             As for a single file, shared by the workers." << std::endl;
+    std::cout << "  --feature-cache-size MiB        As for a single file." << std::endl;
+    std::cout << "  --shard i/n                     Enhance only shard i (from 0) of n, balanced by length if every line gives one." << std::endl;
+    std::cout << "  --report path                   Append the results to path, default output-dir/batch-i-of-n.report." << std::endl;
+    std::cout << "  --timeline json-file            As for a single file, covering every worker and reader thread." << std::endl;
+}
 
-struct VoiceFileInputConfig
+//!
+//! \brief Record the timeline into path until exit, if path is given.
+//!
+static void EnableTimeline(const std::string &path)
 {
-    float window_len = 0.02f;
-    float hot_fraction = 0.5f;
-    int dft_size = 512;
-    float spectral_floor = -120.0f;
-    float time_signal_floor = 1e-12f;
-};
-
-class LocalFileInputStream : public TrtInputStream
+    if (!path.empty() && Timeline::Instance().Enable(path)) {
+        // After main returns, so what runs at the end (the output file write) is in the trace too.
+        std::atexit([]() { Timeline::Instance().Disable(); });
+    }
+}
+
+//!
+//! \brief Run the streaming server until SIGINT or SIGTERM, reloading the model file on SIGHUP.
+//!
+static int Serve(const std::string &model_path, int argc, char **argv)
 {
-public:
-    LocalFileInputStream(const VoiceFileInputConfig &config, const std::string &path, TrtExecutor *executor)
-        : config_(config),
-          executor_(executor),
-          snd_file_(path)
-    {
-        if (!snd_file_) {
-            return;
+    StreamServerConfig server_config;
+    server_config.model_path = model_path;
+    std::string metrics_endpoint;
+    std::string timeline_path;
+    for (int i = 2; i < argc; ++i) {
+        if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+            server_config.endpoints.emplace_back(argv[++i]);
+        } else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+            server_config.workers = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--io-threads") == 0 && i + 1 < argc) {
+            server_config.io_threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--max-connections") == 0 && i + 1 < argc) {
+            server_config.max_connections = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--resident-states") == 0 && i + 1 < argc) {
+            server_config.resident_states = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+            server_config.format = strcmp(argv[++i], "f32") == 0 ? PcmFormat::kF32 : PcmFormat::kS16;
+        } else if (strcmp(argv[i], "--metrics") == 0 && i + 1 < argc) {
+            metrics_endpoint = argv[++i];
+        } else if (strcmp(argv[i], "--alloc-guard") == 0 && i + 1 < argc) {
+            server_config.alloc_guard_frames = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--timeline") == 0 && i + 1 < argc) {
+            timeline_path = argv[++i];
+        } else if (strcmp(argv[i], "--overload") == 0 && i + 1 < argc) {
+            server_config.overload.enabled = true;
+            server_config.overload.frame_deadline_ms = atof(argv[++i]);
+        } else {
+            PrintUsage(argv[0]);
+            return -1;
         }
-
-        frames_ = snd_file_.frames();
-        sampling_rate_ = snd_file_.samplerate();
-        channels_ = snd_file_.channels();
-        format_ = snd_file_.format();
-        std::cout << "[SndFile]: frames: " << frames_ << ", sample_rate: " << sampling_rate_;
-        std::cout << ", channels: " << channels_ << ", format: " << format_ << std::endl;
-
-        fft_.init(config_.dft_size);
-
-        int frame_size = static_cast<int>(config_.window_len * sampling_rate_);
-        wind_ = utils::hamming(frame_size, config_.hot_fraction);
-
-        int s_size = channels_ * frames_;
-        int f_size = wind_.size();
-        int h_size = static_cast<int>(config_.hot_fraction * frame_size);
-        hot_fraction_size_ = h_size;
-
-        int s_start = h_size - f_size;
-        int s_end = s_size;
-        int n_frame = static_cast<int>(std::ceil(1.0 * (s_end - s_start) / h_size));
-        frame_count_ = n_frame;
-
-        int zp_left = -s_start;
-        int zp_right = (n_frame - 1) * h_size + f_size - zp_left - s_size;
-
-        sig_pad_ = nc::zeros<double>(1, s_size + zp_left + zp_right);
-        double *sig_ptr = sig_pad_.data() + zp_left;
-        const auto read_cnt = snd_file_.read(sig_ptr, s_size);
-        assert(static_cast<int>(read_cnt) == s_size);
     }
 
-    Dims GetDynamicDim(const char *input_name) override
-    {
-        std::cout << "Info: Get dim for " << input_name << std::endl;
-        return Dims3{1, 1, 257};
+    // Blocked before any thread starts so they all inherit the mask and only sigwait below sees them.
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+    EnableTimeline(timeline_path);
+
+    auto registry = metrics_endpoint.empty() ? nullptr : std::make_shared<MetricsRegistry>();
+    MetricsExporter exporter(registry);
+    StreamServer server(server_config);
+    if (!server.Start(registry)) {
+        return 1;
     }
-
-    std::vector<std::string> GetInputTensorNames(const nvinfer1::ICudaEngine &engine) override
-    {
-        std::vector<std::string> ret;
-        ret.emplace_back("input");
-        for (int i = 0; i < engine.getNbBindings(); ++i) {
-            if (engine.bindingIsInput(i) && strcmp(engine.getBindingName(i), "input") != 0) {
-                ret.emplace_back(engine.getBindingName(i));
-            }
-        }
-        return ret;
+    if (registry && !exporter.Listen(metrics_endpoint)) {
+        return 1;
     }
 
-    bool TryTake(const std::vector<void *> &host_buffer, const std::vector<size_t> &sizes) override
-    {
-        ++cur_frame_;
-        if (cur_frame_ >= frame_count_) {
-            executor_->Terminate();
-            return false;
-        }
-        assert(host_buffer.size() == sizes.size());
-        if (cur_frame_ == 0) {
-            for (unsigned i = 1; i < host_buffer.size(); ++i) {
-                memset(host_buffer[i], 0, sizes[i]);
-            }
-        }
+    int signal = 0;
+    while (sigwait(&signals, &signal) == 0 && signal == SIGHUP) {
+        server.Reload();
+    }
+    std::cout << "Info: signal " << signal << ", stopping the server." << std::endl;
+    exporter.Stop();
+    server.Stop();
+    return 0;
+}
 
-        input_buffer_ = host_buffer;
-        sizes_ = sizes;
+//!
+//! \brief Enhance the stream another process writes into the shared-memory ring input-ring, writing the
+//!        result into output-ring, until the producer closes the input. Both rings are created by the producer.
+//!
+static int ShmStream(TrtExecuteConfig config, const char *input_name, const char *output_name)
+{
+    auto input_ring = ShmRing::Open(input_name);
+    auto output_ring = ShmRing::Open(output_name);
+    if (!input_ring || !output_ring) {
+        return 1;
+    }
 
-        // cur frame data
-        int frame_start = cur_frame_ * hot_fraction_size_;
-        int frame_end = frame_start + wind_.size();
-        auto frame_sig_pad = sig_pad_(sig_pad_.rSlice(), nc::Slice(frame_start, frame_end)) * wind_;
+    VoiceFileInputConfig voice_config;
+    config.frame_hop_ms = 1000.0 * voice_config.window_len * voice_config.hot_fraction;
+    TrtExecutor executor(config);
+    auto input_stream = std::make_shared<ShmInputStream>(voice_config, input_ring, &executor);
+    executor.SetInputStream(input_stream);
+    executor.SetOutputHandler(std::make_shared<ShmOutputHandler>(input_stream, output_ring));
+    const auto processed = executor.Process();
+    output_ring->Close();
 
-        utils::mag_phasor(utils::stft(frame_sig_pad, fft_, config_.dft_size, false), x_mag_, x_phs_);
+    std::cout << "Info: shm input overruns " << input_ring->Overruns() << " samples, output overruns "
+              << output_ring->Overruns() << ", output underruns " << output_ring->Underruns() << "." << std::endl;
+    return processed ? 0 : 1;
+}
 
-        auto feat = utils::log_pow(x_mag_, config_.spectral_floor);
-        if (cur_frame_ == 0) {
-            mu_ = feat;
-            sigma_square_ = nc::square(feat);
+//!
+//! \brief Enhance raw PCM from stdin to stdout hop by hop, for shell pipelines. Logs go to stderr.
+//!        With a packet trace, stdin is the source the packets carry and goes through the jitter buffer.
+//!
+static int Pipe(TrtExecuteConfig config, int argc, char **argv)
+{
+    PcmPipeConfig pipe_config;
+    JitterBufferConfig jitter_config;
+    std::string packets_path;
+    std::string timeline_path;
+    for (int i = 3; i < argc; ++i) {
+        if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+            pipe_config.format = strcmp(argv[++i], "f32") == 0 ? PcmFormat::kF32 : PcmFormat::kS16;
+        } else if (strcmp(argv[i], "--rate") == 0 && i + 1 < argc) {
+            pipe_config.sample_rate = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--channels") == 0 && i + 1 < argc) {
+            pipe_config.channels = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--block") == 0 && i + 1 < argc) {
+            pipe_config.block_hops = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--no-vmsplice") == 0) {
+            pipe_config.vmsplice = false;
+        } else if (strcmp(argv[i], "--overload") == 0 && i + 1 < argc) {
+            config.overload.enabled = true;
+            config.overload.frame_deadline_ms = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--packets") == 0 && i + 1 < argc) {
+            packets_path = argv[++i];
+        } else if (strcmp(argv[i], "--min-delay") == 0 && i + 1 < argc) {
+            jitter_config.min_delay_ms = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--max-delay") == 0 && i + 1 < argc) {
+            jitter_config.max_delay_ms = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--timeline") == 0 && i + 1 < argc) {
+            timeline_path = argv[++i];
+        } else {
+            PrintUsage(argv[0]);
+            return -1;
         }
-        utils::onlineMVN_per_frame(feat, cur_frame_, mu_, sigma_square_);
+    }
+    // stdout carries the samples, everything the executor reports goes to stderr.
+    std::cout.rdbuf(std::cerr.rdbuf());
+    EnableTimeline(timeline_path);
 
-        assert(feat.size() * sizeof(float) == sizes[0]);
-        auto *input = static_cast<float *>(host_buffer[0]);
-        std::copy_n(feat.data(), feat.size(), input);
+    VoiceFileInputConfig voice_config;
+    config.frame_hop_ms = 1000.0 * voice_config.window_len * voice_config.hot_fraction;
+    std::vector<PacketRecord> packets;
+    if (!packets_path.empty()) {
+        packets = LoadPacketTrace(packets_path);
+        if (packets.empty()) {
+            return 1;
+        }
+    }
 
-        return true;
+    TrtExecutor executor(config);
+    if (!packets.empty()) {
+        jitter_config.sample_rate = pipe_config.sample_rate;
+        const auto frame_size = static_cast<int>(voice_config.window_len * jitter_config.sample_rate);
+        auto buffer = std::make_shared<JitterBuffer>(jitter_config,
+                                                     static_cast<int>(voice_config.hot_fraction * frame_size));
+        auto input_stream = std::make_shared<PacketReplayInputStream>(voice_config, buffer, std::move(packets),
+                                                                      ReadPcm(STDIN_FILENO, pipe_config), &executor);
+        auto output_handler = std::make_shared<PipeOutputHandler>(input_stream, input_stream->Frontend(), pipe_config,
+                                                                  STDOUT_FILENO);
+        executor.SetInputStream(input_stream);
+        executor.SetOutputHandler(output_handler);
+        const auto processed = executor.Process();
+
+        const auto stats = buffer->Stats();
+        std::cout << "Info: jitter buffer: " << stats.packets << " packets, " << stats.reordered_packets
+                  << " reordered, " << stats.late_packets << " late, " << stats.overflow_packets << " overflowed, "
+                  << stats.concealed_samples << " samples concealed, jitter " << stats.jitter_ms << " ms, delay "
+                  << stats.delay_ms << " ms (max " << stats.max_delay_ms << " ms)." << std::endl;
+        return output_handler->Flush() && processed ? 0 : 1;
     }
 
-    void MergeOutput(const std::vector<void *> &output, const std::vector<size_t> &sizes)
-    {
-        assert(input_buffer_.size() == output.size());
-        assert(sizes_ == sizes);
+    auto input_stream = std::make_shared<PipeInputStream>(voice_config, pipe_config, STDIN_FILENO, &executor);
+    auto output_handler = std::make_shared<PipeOutputHandler>(input_stream, input_stream->Frontend(), pipe_config,
+                                                              STDOUT_FILENO);
+    executor.SetInputStream(input_stream);
+    executor.SetOutputHandler(output_handler);
+    const auto processed = executor.Process();
+    return output_handler->Flush() && processed ? 0 : 1;
+}
 
-        for (int i = 1; i < input_buffer_.size(); ++i) {
-            memcpy(input_buffer_[i], output[i], sizes[i]);
+//!
+//! \brief Create the directories of path that do not exist yet.
+//!
+static bool MakeParentDirectories(const std::string &path)
+{
+    for (auto slash = path.find('/', 1); slash != std::string::npos; slash = path.find('/', slash + 1)) {
+        if (mkdir(path.substr(0, slash).c_str(), 0755) != 0 && errno != EEXIST) {
+            return false;
         }
     }
+    return true;
+}
 
-    const VoiceFileInputConfig &VoiceConfig() const
-    {
-        return config_;
+//!
+//! \brief Enhance every file of list-file, or of its shard, into output-dir under its path below the directory
+//!        all listed files share, see AssignOutputNames. The files are read and decoded ahead by a CorpusReader,
+//!        so the workers only run the executor. Outputs already in output-dir are skipped, so a killed run
+//!        resumes where it stopped; outputs are renamed into place once written, so a killed run leaves none
+//!        half written.
+//!
+static int Batch(TrtExecuteConfig config, int argc, char **argv)
+{
+    CorpusReaderConfig reader_config;
+    FeatureCacheConfig cache_config;
+    auto workers = 1;
+    auto shard = 0;
+    auto shards = 1;
+    std::string report_path;
+    std::string timeline_path;
+    for (int i = 5; i < argc; ++i) {
+        if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+            workers = std::max(1, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--prefetch") == 0 && i + 1 < argc) {
+            reader_config.prefetch_files = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--io-threads") == 0 && i + 1 < argc) {
+            reader_config.io_threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--decode-threads") == 0 && i + 1 < argc) {
+            reader_config.decode_threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--no-io-uring") == 0) {
+            reader_config.io_uring = false;
+        } else if (strcmp(argv[i], "--feature-cache") == 0 && i + 1 < argc) {
+            cache_config.directory = argv[++i];
+        } else if (strcmp(argv[i], "--feature-cache-size") == 0 && i + 1 < argc) {
+            cache_config.max_bytes = strtoull(argv[++i], nullptr, 10) << 20;
+        } else if (strcmp(argv[i], "--shard") == 0 && i + 1 < argc) {
+            if (sscanf(argv[++i], "%d/%d", &shard, &shards) != 2 || shards < 1 || shard < 0 || shard >= shards) {
+                std::cerr << "Error: --shard takes i/n with 0 <= i < n." << std::endl;
+                return -1;
+            }
+        } else if (strcmp(argv[i], "--report") == 0 && i + 1 < argc) {
+            report_path = argv[++i];
+        } else if (strcmp(argv[i], "--timeline") == 0 && i + 1 < argc) {
+            timeline_path = argv[++i];
+        } else {
+            PrintUsage(argv[0]);
+            return -1;
+        }
     }
 
-    const SndfileHandle &SndFile() const
-    {
-        return snd_file_;
+    std::vector<ManifestEntry> manifest;
+    if (!LoadManifest(argv[3], manifest)) {
+        return 1;
     }
-
-    audiofft::AudioFFT &AudioFFT()
-    {
-        return fft_;
+    const std::string output_dir = argv[4];
+    const auto weighed = [](const ManifestEntry &entry) { return entry.weighed; };
+    if (shards > 1 && !std::all_of(manifest.begin(), manifest.end(), weighed)) {
+        std::cout << "Warning: not every line of the manifest gives a weight, shards are split by path instead of by "
+                  << "weight." << std::endl;
     }
-
-    const nc::NdArray<double> &Wind() const
-    {
-        return wind_;
+    std::vector<std::string> paths;
+    std::vector<std::string> output_paths;
+    size_t skipped = 0;
+    for (const auto &entry : ShardManifest(manifest, shard, shards)) {
+        const auto path = output_dir + "/" + entry.output;
+        if (access(path.c_str(), F_OK) == 0) {
+            ++skipped;
+        } else {
+            paths.push_back(entry.path);
+            output_paths.push_back(path);
+        }
     }
+    std::cout << "Info: shard " << shard << "/" << shards << ": " << paths.size() + skipped << " of "
+              << manifest.size() << " files, " << skipped << " already done." << std::endl;
 
-    int HotFractionSize() const
-    {
-        return hot_fraction_size_;
+    if (report_path.empty()) {
+        report_path = output_dir + "/batch-" + std::to_string(shard) + "-of-" + std::to_string(shards) + ".report";
     }
-
-    int FrameCount() const
-    {
-        return frame_count_;
+    if (!MakeParentDirectories(output_dir + "/") || !MakeParentDirectories(report_path)) {
+        std::cerr << "Error: Unable to create the output directory " << output_dir << ": " << strerror(errno)
+                  << std::endl;
+        return 1;
     }
-
-    int CurFrame() const
-    {
-        return cur_frame_;
+    BatchReportWriter report;
+    if (!report.Open(report_path, shard, shards, paths.size(), skipped)) {
+        return 1;
     }
+    EnableTimeline(timeline_path);
+    const auto start = std::chrono::steady_clock::now();
 
-    const nc::NdArray<double> &XMag() const
-    {
-        return x_mag_;
+    auto engine = LoadInferEngine(config.model_path);
+    if (!engine) {
+        std::cerr << "Error: Unable to load model: " << config.model_path << std::endl;
+        return 1;
     }
-
-    const nc::NdArray<double> &XPhs() const
-    {
-        return x_phs_;
+    std::shared_ptr<FeatureCache> cache;
+    if (!cache_config.directory.empty() && !(cache = FeatureCache::Open(cache_config))) {
+        return 1;
     }
-
-private:
-    VoiceFileInputConfig config_;
-    TrtExecutor *executor_;
-
-    SndfileHandle snd_file_;
-    sf_count_t frames_ = 0;
-    int sampling_rate_ = 0;
-    int channels_ = 0;
-    int format_ = 0;
-
-    audiofft::AudioFFT fft_;
-
-    int hot_fraction_size_ = 0;
-    int frame_count_ = 0;
-    nc::NdArray<double> wind_;
-    nc::NdArray<double> sig_pad_;
-
-    int cur_frame_ = -1;
-    std::vector<void *> input_buffer_;
-    std::vector<size_t> sizes_;
-
-    nc::NdArray<double> x_mag_;
-    nc::NdArray<double> x_phs_;
-    nc::NdArray<double> mu_;
-    nc::NdArray<double> sigma_square_;
-};
-
-class LocalFileOutputHandler : public TrtOutputHandler
-{
-public:
-    LocalFileOutputHandler(std::shared_ptr<LocalFileInputStream> input, const std::string &path)
-        : input_(std::move(input)),
-          save_path_(path),
-          out_(nc::zeros<float>(1, input_->FrameCount() * input_->HotFractionSize())),
-          old_(nc::zeros<float>(1, input_->HotFractionSize()))
-    {
-        //
-    }
-
-    ~LocalFileOutputHandler() noexcept
-    {
-        auto &in_handle = input_->SndFile();
-        SndfileHandle snd_file(save_path_, SFM_WRITE, in_handle.format(), in_handle.channels(), in_handle.samplerate());
-        if (!snd_file) {
-            return;
-        }
-
-        snd_file.write(out_.data(), out_.size());
+    const auto max_contexts = engine->MaxContexts();
+    if (max_contexts > 0 && workers > max_contexts) {
+        std::cout << "Warning: the model runs " << max_contexts << " contexts at once, only " << max_contexts
+                  << " of " << workers << " workers start." << std::endl;
+        workers = max_contexts;
     }
-
-    std::vector<std::string> GetOutputTensorNames(const nvinfer1::ICudaEngine &engine) override
-    {
-        std::vector<std::string> ret;
-        ret.emplace_back("output");
-        for (int i = 0; i < engine.getNbBindings(); ++i) {
-            if (!engine.bindingIsInput(i) && strcmp(engine.getBindingName(i), "output") != 0) {
-                ret.emplace_back(engine.getBindingName(i));
+    VoiceFileInputConfig voice_config;
+    config.frame_hop_ms = 1000.0 * voice_config.window_len * voice_config.hot_fraction;
+    // Every worker keeps its executor and context for all its files, the stages are reported once at the end.
+    config.report_stages = false;
+    config.keep_context = true;
+    auto stages = std::make_shared<StageProfiler>();
+
+    CorpusReader reader(reader_config, paths);
+    std::atomic<size_t> failures{0};
+    const auto work = [&]() {
+        TrtExecutor executor(config, engine);
+        executor.SetStageProfiler(stages);
+        CorpusFile file;
+        while (reader.Next(file)) {
+            if (!file.error.empty()) {
+                std::cerr << "Error: " << file.path << ": " << file.error << std::endl;
+                report.File(file.path, false, 0.0, 0.0, file.error);
+                ++failures;
+                continue;
             }
+            const auto file_start = std::chrono::steady_clock::now();
+            const auto &path = output_paths[file.index];
+            const auto partial_path = path + ".partial";
+            if (!MakeParentDirectories(path)) {
+                const auto error = std::string("Unable to create the output directory: ") + strerror(errno);
+                std::cerr << "Error: " << file.path << ": " << error << std::endl;
+                report.File(file.path, false, 0.0, 0.0, error);
+                ++failures;
+                continue;
+            }
+            bool processed;
+            bool written;
+            {
+                // A run of the executor per file, done once its input ends. The output is written by Finish,
+                // checked before the rename; a handler not finished writes it when it goes.
+                auto input_stream = std::make_shared<VoiceInputStream>(voice_config, file.samples,
+                                                                       file.sample_rate, file.channels, file.format,
+                                                                       &executor);
+                auto output_handler = std::make_shared<LocalFileOutputHandler>(input_stream, partial_path);
+                input_stream->SetFeatureCache(cache);
+                executor.SetInputStream(input_stream);
+                executor.SetOutputHandler(output_handler);
+                processed = executor.Process();
+                executor.SetInputStream(nullptr);
+                executor.SetOutputHandler(nullptr);
+                written = processed && output_handler->Finish();
+            }
+            const auto audio_seconds = file.sample_rate > 0 && file.channels > 0 ?
+                1.0 * file.samples.size() / file.channels / file.sample_rate : 0.0;
+            const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - file_start).count();
+            if (!processed) {
+                // Not renamed into place, so a resumed run retries the file.
+                unlink(partial_path.c_str());
+                const std::string error = "Inference failed, no output written";
+                std::cerr << "Error: " << file.path << ": " << error << std::endl;
+                report.File(file.path, false, audio_seconds, seconds, error);
+                ++failures;
+                continue;
+            }
+            if (!written) {
+                // A short or failed write is not renamed into place either, or a resumed run would skip it.
+                unlink(partial_path.c_str());
+                const std::string error = "Unable to write the output";
+                std::cerr << "Error: " << file.path << ": " << error << std::endl;
+                report.File(file.path, false, audio_seconds, seconds, error);
+                ++failures;
+                continue;
+            }
+            if (rename(partial_path.c_str(), path.c_str()) != 0) {
+                const auto error = std::string("Unable to write the output: ") + strerror(errno);
+                std::cerr << "Error: " << file.path << ": " << error << std::endl;
+                report.File(file.path, false, audio_seconds, seconds, error);
+                ++failures;
+                continue;
+            }
+            report.File(file.path, true, audio_seconds, seconds);
         }
-        return ret;
+    };
+    std::vector<std::thread> threads;
+    for (int i = 1; i < workers; ++i) {
+        threads.emplace_back(work);
     }
-
-    void SetTensorDim(const char *output_name, const Dims &dims) override
-    {
-        //
+    work();
+    for (auto &thread : threads) {
+        thread.join();
     }
+    report.End(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+#ifdef TRT_EXECUTOR_STAGE_TIMING
+    stages->Report(std::cout);
+#endif
+
+    std::cout << "Info: enhanced " << paths.size() - failures << " of " << paths.size() << " files, read with "
+              << (reader.UsesIoUring() ? "io_uring" : "a thread pool") << ", report " << report_path << "."
+              << std::endl;
+    if (cache) {
+        std::cout << "Info: feature cache " << cache->Hits() << " hits, " << cache->Misses() << " misses." << std::endl;
+    }
+    return failures == 0 ? 0 : 1;
+}
 
-    void Consume(const std::vector<void *> &host_buffer, const std::vector<size_t> &sizes) override
-    {
-        assert(host_buffer.size() == sizes.size());
-        input_->MergeOutput(host_buffer, sizes);
-
-        auto &x_mag = input_->XMag();
-        auto &x_phs = input_->XPhs();
-        auto *output = static_cast<float *>(host_buffer[0]);
-        auto len = sizes[0] / sizeof(float);
-        nc::NdArray<float> mask(1, len * 2);
-        for (unsigned i = 0; i < len; ++i) {
-            auto t = x_mag[i] * output[i];
-            mask[i] = t * x_phs[i];
-            mask[i + len] = t * x_phs[i + len];
+static int Replay(TrtExecuteConfig config, int argc, char **argv)
+{
+    TraceReplayConfig replay_config;
+    auto compare = false;
+    auto tolerance = 0.0f;
+    for (int i = 4; i < argc; ++i) {
+        if (strcmp(argv[i], "--realtime") == 0) {
+            replay_config.realtime = true;
+        } else if (strcmp(argv[i], "--feed-states") == 0) {
+            replay_config.feed_states = true;
+        } else if (strcmp(argv[i], "--compare") == 0 && i + 1 < argc) {
+            compare = true;
+            tolerance = static_cast<float>(atof(argv[++i]));
+        } else if (strcmp(argv[i], "--alloc-guard") == 0 && i + 1 < argc) {
+            config.alloc_guard_frames = atoi(argv[++i]);
+        } else {
+            PrintUsage(argv[0]);
+            return -1;
         }
-
-        auto x_enh = utils::istft(mask, input_->AudioFFT());
-        int cur_frame = input_->CurFrame();
-        int h_size = input_->HotFractionSize();
-        int frame_start = cur_frame * h_size;
-        std::transform(x_enh.data(), x_enh.data() + h_size, old_.data(), x_enh.data(), std::plus<float>());
-        memcpy(out_.data() + frame_start, x_enh.data(), sizeof(float) * h_size);
-        memcpy(old_.data(), x_enh.data() + h_size, sizeof(float) * h_size);
     }
 
-private:
-    std::shared_ptr<LocalFileInputStream> input_;
-    std::string save_path_;
-
-    nc::NdArray<float> out_;
-    nc::NdArray<float> old_;
-};
+    auto reader = std::make_shared<TensorTraceReader>();
+    if (!reader->Open(argv[3])) {
+        return 1;
+    }
+    TrtExecutor executor(config);
+    auto input_stream = std::make_shared<TraceReplayInputStream>(reader, replay_config, &executor);
+    auto output_handler = std::make_shared<TraceReplayOutputHandler>(reader, input_stream, compare, tolerance);
+    executor.SetInputStream(input_stream);
+    executor.SetOutputHandler(output_handler);
+    if (!executor.Process()) {
+        return 1;
+    }
+    if (!output_handler->Report()) {
+        return 2;
+    }
+    return executor.GetAllocationViolations() == 0 ? 0 : 3;
+}
 
 int main(int argc, char **argv)
 {
+    TrtExecuteConfig config;
+    if (argc >= 3 && strcmp(argv[1], "--merge") == 0) {
+        return MergeBatchReports(std::vector<std::string>(argv + 2, argv + argc), std::cout);
+    }
+    if (argc >= 3 && strcmp(argv[2], "--pipe") == 0) {
+        config.model_path = argv[1];
+        return Pipe(config, argc, argv);
+    }
     if (argc < 4) {
-        std::cout << "Usage: " << argv[0] << " TensorRT-model-file Src-voice-file Enhanced-save-file" << std::endl;
+        PrintUsage(argv[0]);
         return -1;
     }
 
-    TrtExecuteConfig config;
     config.model_path = argv[1];
-    TrtExecutor executor(config);
+    if (strcmp(argv[2], "--serve") == 0) {
+        return Serve(config.model_path, argc, argv);
+    }
+    if (strcmp(argv[2], "--replay") == 0) {
+        return Replay(config, argc, argv);
+    }
+    if (strcmp(argv[2], "--batch") == 0 && argc >= 5) {
+        return Batch(config, argc, argv);
+    }
+    if (strcmp(argv[2], "--shm") == 0 && argc == 5) {
+        return ShmStream(config, argv[3], argv[4]);
+    }
+
+    std::string record_path;
+    auto record_outputs = false;
+    std::string metrics_endpoint;
+    std::string metrics_file;
+    auto perf_counters = false;
+    std::string timeline_path;
+    FeatureCacheConfig cache_config;
+    std::vector<std::pair<std::string, std::string>> fanout_models;
+    std::vector<std::string> ensemble_models;
+    for (int i = 4; i < argc; ++i) {
+        if (strcmp(argv[i], "--fanout") == 0 && i + 2 < argc) {
+            fanout_models.emplace_back(argv[i + 1], argv[i + 2]);
+            i += 2;
+        } else if (strcmp(argv[i], "--ensemble") == 0 && i + 1 < argc) {
+            ensemble_models.emplace_back(argv[++i]);
+        } else if (strcmp(argv[i], "--combine") == 0 && i + 1 < argc) {
+            const std::string mode = argv[++i];
+            if (mode == "min") {
+                config.mask_combine = MaskCombine::kMin;
+            } else if (mode == "max") {
+                config.mask_combine = MaskCombine::kMax;
+            } else {
+                config.mask_combine = MaskCombine::kAverage;
+            }
+        } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            record_path = argv[++i];
+        } else if (strcmp(argv[i], "--record-outputs") == 0) {
+            record_outputs = true;
+        } else if (strcmp(argv[i], "--metrics") == 0 && i + 1 < argc) {
+            metrics_endpoint = argv[++i];
+        } else if (strcmp(argv[i], "--metrics-file") == 0 && i + 1 < argc) {
+            metrics_file = argv[++i];
+        } else if (strcmp(argv[i], "--perf-counters") == 0) {
+            perf_counters = true;
+        } else if (strcmp(argv[i], "--timeline") == 0 && i + 1 < argc) {
+            timeline_path = argv[++i];
+        } else if (strcmp(argv[i], "--feature-cache") == 0 && i + 1 < argc) {
+            cache_config.directory = argv[++i];
+        } else if (strcmp(argv[i], "--feature-cache-size") == 0 && i + 1 < argc) {
+            cache_config.max_bytes = strtoull(argv[++i], nullptr, 10) << 20;
+        } else if (strcmp(argv[i], "--overload") == 0 && i + 1 < argc) {
+            config.overload.enabled = true;
+            config.overload.frame_deadline_ms = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--huge-pages") == 0 && i + 1 < argc) {
+            const std::string mode = argv[++i];
+            if (mode == "thp") {
+                samplesCommon::ArenaPool::instance().setHugePages(samplesCommon::HugePageMode::kTransparent);
+            } else if (mode == "explicit") {
+                samplesCommon::ArenaPool::instance().setHugePages(samplesCommon::HugePageMode::kExplicit);
+            } else {
+                samplesCommon::ArenaPool::instance().setHugePages(samplesCommon::HugePageMode::kNone);
+            }
+        } else {
+            PrintUsage(argv[0]);
+            return -1;
+        }
+    }
+
+    EnableTimeline(timeline_path);
 
     VoiceFileInputConfig voice_config;
+    config.frame_hop_ms = 1000.0 * voice_config.window_len * voice_config.hot_fraction;
+    TrtExecutor executor(config);
+
+    // Opened here, on the thread that runs Process() and thus the stages.
+    PerfCounters perf;
     auto input_stream = std::make_shared<LocalFileInputStream>(voice_config, argv[2], &executor);
+    if (perf_counters && perf.Open()) {
+        input_stream->SetPerfCounters(&perf);
+    }
+    if (!cache_config.directory.empty()) {
+        auto cache = FeatureCache::Open(cache_config);
+        if (!cache) {
+            return 1;
+        }
+        input_stream->SetFeatureCache(cache);
+    }
     auto output_handler = std::make_shared<LocalFileOutputHandler>(input_stream, argv[3]);
     executor.SetInputStream(input_stream);
     executor.SetOutputHandler(output_handler);
-    executor.Process();
+    if (!record_path.empty()) {
+        executor.SetTraceWriter(std::make_shared<TensorTraceWriter>(record_path, record_outputs));
+    }
+    for (const auto &model : fanout_models) {
+        if (!executor.AddModel(model.first, std::make_shared<LocalFileOutputHandler>(input_stream, model.second))) {
+            return 1;
+        }
+    }
+    for (const auto &model : ensemble_models) {
+        if (!executor.AddModel(model)) {
+            return 1;
+        }
+    }
 
-    return 0;
+    auto registry = std::make_shared<MetricsRegistry>();
+    MetricsExporter server(registry);
+    MetricsExporter file_writer(registry);
+    if (!metrics_endpoint.empty() || !metrics_file.empty()) {
+        executor.SetMetrics(registry);
+    }
+    if (!metrics_endpoint.empty() && !server.Listen(metrics_endpoint)) {
+        return 1;
+    }
+    if (!metrics_file.empty() && !file_writer.WriteFile(metrics_file, std::chrono::seconds(1))) {
+        return 1;
+    }
+    const auto processed = executor.Process();
+    perf.Report(std::cout);
+    const auto written = output_handler->Finish();
+
+    return processed && written ? 0 : 1;
 }
@@ -157,12 +157,16 @@ bool SampleOnnxBuilder::constructNetwork(SampleUniquePtr<nvinfer1::IBuilder> &bu
 
     samplesCommon::enableDLA(builder.get(), config.get(), mParams.dlaCore);
 
-    // add optimization config
-    auto profile = builder->createOptimizationProfile();
-    profile->setDimensions("input", OptProfileSelector::kMIN, Dims3{1, 1, 257});
-    profile->setDimensions("input", OptProfileSelector::kOPT, Dims3{1, 1, 257});
-    profile->setDimensions("input", OptProfileSelector::kMAX, Dims3{1, 1, 257});
-    config->addOptimizationProfile(profile);
+    // add optimization config, the same for every profile: TensorRT 7 runs each context on a profile of its own
+    for (int i = 0; i < mParams.nbProfiles; ++i) {
+        auto profile = builder->createOptimizationProfile();
+        profile->setDimensions("input", OptProfileSelector::kMIN, Dims3{1, 1, 257});
+        profile->setDimensions("input", OptProfileSelector::kOPT, Dims3{1, 1, 257});
+        profile->setDimensions("input", OptProfileSelector::kMAX, Dims3{1, 1, 257});
+        if (config->addOptimizationProfile(profile) < 0) {
+            return false;
+        }
+    }
 
     return true;
 }
@@ -44,6 +44,7 @@ struct CaffeSampleParams : public SampleParams
 struct OnnxSampleParams : public SampleParams
 {
     std::string onnxFileName; //!< Filename of ONNX file of a network
+    int nbProfiles{ 1 };      //!< Optimization profiles, one for each execution context alive at once
 };
 
 
@@ -1,17 +1,23 @@
 #include "TrtTransformer.h"
 
+#include <algorithm>
+#include <cstdlib>
 #include <iostream>
 
 
 int main(int argc, char **argv)
 {
     if (argc < 3) {
-        std::cout << "Usage: " << argv[0] << " onnx_model_file TensorRT-save-file" << std::endl;
+        std::cout << "Usage: " << argv[0] << " onnx_model_file TensorRT-save-file [workers]" << std::endl;
+        std::cout << "  workers: execution contexts TrtExecutor runs at once on the model, default 1." << std::endl;
         return -1;
     }
     OnnxSampleParams params;
     params.onnxFileName = argv[1];
     params.outputTrtFile = argv[2];
+    if (argc > 3) {
+        params.nbProfiles = std::max(1, atoi(argv[3]));
+    }
 
     SampleOnnxBuilder onnx_builder(params);
     auto succeed = onnx_builder.build();